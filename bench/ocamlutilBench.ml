@@ -0,0 +1,293 @@
+(* Microbenchmarks for the ocamlutil data structures that underpin the
+ * hot paths of CIL: Pretty, Inthash, Bitmap, GrowArray and Clist.
+ *
+ * Each benchmark runs its workload several times and records the best
+ * wall-clock time, normalized to nanoseconds per operation. The results
+ * can be saved as JSON with --json and compared against a previously
+ * saved run with --baseline, so changes to these modules can be
+ * validated on the machine at hand:
+ *
+ *    dune exec bench/ocamlutilBench.exe -- --json before.json
+ *    ... apply the change, rebuild ...
+ *    dune exec bench/ocamlutilBench.exe -- --baseline before.json
+ *
+ * The comparison exits with a nonzero status when a benchmark is slower
+ * than the baseline by more than --tolerance (a fraction, default 0.3).
+ * Baselines are machine-specific and are not meant to be checked in. *)
+
+module P = Pretty
+module IH = Inthash
+module GA = GrowArray
+module B = Bitmap
+
+let (++) = P.(++)
+
+type result = {
+    name: string;          (* benchmark identifier *)
+    ops: int;              (* operations per run, for normalization *)
+    seconds: float;        (* best wall-clock time of a run *)
+    nsPerOp: float;
+  }
+
+let results: result list ref = ref []
+
+(* How often each workload is re-run; the best time is kept *)
+let repetitions = ref 3
+
+(* Run only the benchmarks whose name contains this substring *)
+let filter = ref ""
+
+let contains (s: string) (sub: string) : bool =
+  let ls = String.length s and lsub = String.length sub in
+  let rec loop i =
+    if i + lsub > ls then false
+    else if String.sub s i lsub = sub then true
+    else loop (i + 1)
+  in
+  lsub = 0 || loop 0
+
+let time (name: string) (ops: int) (f: unit -> unit) : unit =
+  if contains name !filter then begin
+    f ();                                   (* warm up *)
+    let best = ref infinity in
+    for _i = 1 to !repetitions do
+      let t0 = Unix.gettimeofday () in
+      f ();
+      let t1 = Unix.gettimeofday () in
+      if t1 -. t0 < !best then best := t1 -. t0
+    done;
+    let r = { name = name; ops = ops; seconds = !best;
+              nsPerOp = !best *. 1e9 /. float_of_int ops } in
+    results := r :: !results;
+    Printf.printf "%-32s %9d ops  %9.4f s  %10.1f ns/op\n%!"
+      name ops r.seconds r.nsPerOp
+  end
+
+
+(** {1 Pretty} *)
+
+(* A document shaped like the printer output for a large function body:
+ * many short statement lines under nested alignment *)
+let makeDoc (n: int) : P.doc =
+  let rec loop i acc =
+    if i >= n then acc
+    else
+      loop (i + 1)
+        (acc ++ P.dprintf "tmp_%d = f_%d(a_%d, b_%d) + %d;" i i i i i
+             ++ P.line)
+  in
+  P.dprintf "@[{ %a}@]" P.insert (loop 0 P.nil)
+
+let benchPretty () =
+  let n = 2000 in
+  time "pretty/construct" n
+    (fun () -> ignore (makeDoc n));
+  let d = makeDoc n in
+  time "pretty/render-w20" n
+    (fun () -> ignore (P.sprint ~width:20 d));
+  time "pretty/render-w80" n
+    (fun () -> ignore (P.sprint ~width:80 d));
+  time "pretty/render-wide" n
+    (fun () -> ignore (P.sprint ~width:999999 d));
+  let saved = !P.fastMode in
+  P.fastMode := true;
+  time "pretty/render-fast" n
+    (fun () -> ignore (P.sprint ~width:80 d));
+  P.fastMode := saved
+
+
+(** {1 Inthash} *)
+
+let benchInthash () =
+  let n = 200000 in
+  let h = IH.create 16 in
+  (* keys are scattered so the benchmark sees bucket collisions, not
+   * just the sequential best case *)
+  time "inthash/add" n
+    (fun () ->
+      IH.clear h;
+      for i = 0 to n - 1 do IH.replace h (i * 7919) i done);
+  time "inthash/find-hit" n
+    (fun () ->
+      for i = 0 to n - 1 do ignore (IH.find h (i * 7919)) done);
+  time "inthash/mem-miss" n
+    (fun () ->
+      for i = 0 to n - 1 do ignore (IH.mem h (i * 7919 + 1)) done);
+  (* a 3:1 probe/insert mix, like the visited tables of the analyses *)
+  time "inthash/mixed" n
+    (fun () ->
+      for i = 0 to n - 1 do
+        if i land 3 = 0 then IH.replace h i i
+        else ignore (IH.mem h ((i * 7919) land 0xfffff))
+      done);
+  time "inthash/fold" n
+    (fun () -> ignore (IH.fold (fun _ _ acc -> acc + 1) h 0))
+
+
+(** {1 Bitmap} *)
+
+let benchBitmap () =
+  let n = 65536 in
+  let b1 = B.init n (fun i -> i land 3 = 0) in
+  let b2 = B.init n (fun i -> i land 7 = 0) in
+  time "bitmap/setTo" n
+    (fun () ->
+      let b = B.make n in
+      for i = 0 to n - 1 do B.setTo b i (i land 1 = 0) done);
+  let unions = 100 in
+  time "bitmap/union_into" unions
+    (fun () ->
+      for _i = 1 to unions do
+        let dst = B.clone b1 in
+        ignore (B.union_into dst b2)
+      done);
+  let members = B.card b1 in
+  time "bitmap/iter" members
+    (fun () -> B.iter (fun _ -> ()) b1);
+  time "bitmap/fold" members
+    (fun () -> ignore (B.fold (fun acc i -> acc + i) b1 0))
+
+
+(** {1 GrowArray} *)
+
+let benchGrowArray () =
+  let n = 100000 in
+  (* growth from a small initial size, one doubling at a time *)
+  time "growarray/setg-grow" n
+    (fun () ->
+      let ga = GA.make 16 (GA.Elem 0) in
+      for i = 0 to n - 1 do GA.setg ga i i done);
+  (* sparse writes with a large stride force a growth step per write
+   * early on, then none *)
+  let stride = 1024 in
+  time "growarray/setg-sparse" (n / stride)
+    (fun () ->
+      let ga = GA.make 16 (GA.Elem 0) in
+      let i = ref 0 in
+      while !i < n do GA.setg ga !i !i; i := !i + stride done);
+  let ga = GA.make 16 (GA.Elem 0) in
+  for i = 0 to n - 1 do GA.setg ga i i done;
+  time "growarray/getg" n
+    (fun () ->
+      let sum = ref 0 in
+      for i = 0 to n - 1 do sum := !sum + GA.getg ga i done;
+      ignore !sum);
+  time "growarray/fold_left" n
+    (fun () -> ignore (GA.fold_left (fun acc x -> acc + x) 0 ga))
+
+
+(** {1 Clist} *)
+
+let benchClist () =
+  (* a fresh chunk per append: Clist.append refuses to reuse the same
+   * physical list on both sides *)
+  let chunk () = Clist.fromList [ 1; 2; 3; 4; 5; 6; 7; 8 ] in
+  let chunks = 10000 in
+  let build () =
+    let rec loop i acc =
+      if i = 0 then acc else loop (i - 1) (Clist.append acc (chunk ()))
+    in
+    loop chunks Clist.empty
+  in
+  time "clist/append" chunks
+    (fun () -> ignore (build ()));
+  let big = build () in
+  let len = Clist.length big in
+  time "clist/toList" len
+    (fun () -> ignore (Clist.toList big));
+  time "clist/fold_left" len
+    (fun () -> ignore (Clist.fold_left (fun acc x -> acc + x) 0 big));
+  time "clist/length" len
+    (fun () -> ignore (Clist.length big))
+
+
+(** {1 JSON output and baseline comparison} *)
+
+let writeJson (file: string) : unit =
+  let chn = open_out file in
+  output_string chn "[\n";
+  let rec dump = function
+      [] -> ()
+    | r :: rest ->
+        Printf.fprintf chn
+          "  {\"name\":\"%s\",\"ops\":%d,\"seconds\":%.6f,\"nsPerOp\":%.1f}%s\n"
+          r.name r.ops r.seconds r.nsPerOp
+          (if rest = [] then "" else ",");
+        dump rest
+  in
+  dump (List.rev !results);
+  output_string chn "]\n";
+  close_out chn;
+  Printf.printf "Wrote %s\n" file
+
+(* Read back a file written by writeJson. This is not a general JSON
+ * parser; it only understands the fixed one-record-per-line format
+ * above, which is all we need *)
+let readBaseline (file: string) : (string * float) list =
+  let chn = open_in file in
+  let entries = ref [] in
+  (try
+    while true do
+      let line = String.trim (input_line chn) in
+      try
+        Scanf.sscanf line
+          "{\"name\":\"%s@\",\"ops\":%d,\"seconds\":%f,\"nsPerOp\":%f}"
+          (fun name _ _ ns -> entries := (name, ns) :: !entries)
+      with Scanf.Scan_failure _ | Failure _ | End_of_file -> ()
+    done
+  with End_of_file -> ());
+  close_in chn;
+  !entries
+
+let checkBaseline (file: string) (tolerance: float) : unit =
+  let base = readBaseline file in
+  let regressions = ref 0 in
+  List.iter
+    (fun r ->
+      try
+        let old = List.assoc r.name base in
+        let ratio = r.nsPerOp /. old in
+        if ratio > 1.0 +. tolerance then begin
+          incr regressions;
+          Printf.printf "REGRESSION %-32s %.1f -> %.1f ns/op (%+.0f%%)\n"
+            r.name old r.nsPerOp ((ratio -. 1.0) *. 100.0)
+        end else if ratio < 1.0 -. tolerance then
+          Printf.printf "improved   %-32s %.1f -> %.1f ns/op (%+.0f%%)\n"
+            r.name old r.nsPerOp ((ratio -. 1.0) *. 100.0)
+      with Not_found ->
+        Printf.printf "no baseline for %s\n" r.name)
+    (List.rev !results);
+  if !regressions > 0 then begin
+    Printf.printf "%d benchmark(s) regressed beyond %.0f%%\n"
+      !regressions (tolerance *. 100.0);
+    exit 1
+  end else
+    Printf.printf "No regressions beyond %.0f%%\n" (tolerance *. 100.0)
+
+
+let main () =
+  let jsonOut = ref "" in
+  let baseline = ref "" in
+  let tolerance = ref 0.3 in
+  Arg.parse
+    [ "--json", Arg.Set_string jsonOut,
+      "<file> write the results to <file> as JSON";
+      "--baseline", Arg.Set_string baseline,
+      "<file> compare against a previous --json run; exit 1 on regression";
+      "--tolerance", Arg.Set_float tolerance,
+      "<f> allowed slowdown fraction for --baseline (default 0.3)";
+      "--repeat", Arg.Set_int repetitions,
+      "<n> runs per benchmark, keeping the best time (default 3)";
+      "--filter", Arg.Set_string filter,
+      "<s> run only the benchmarks whose name contains <s>" ]
+    (fun s -> raise (Arg.Bad ("unexpected argument " ^ s)))
+    "Usage: ocamlutilBench [options]";
+  benchPretty ();
+  benchInthash ();
+  benchBitmap ();
+  benchGrowArray ();
+  benchClist ();
+  if !jsonOut <> "" then writeJson !jsonOut;
+  if !baseline <> "" then checkBaseline !baseline !tolerance
+
+let () = main ()
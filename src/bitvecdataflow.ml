@@ -0,0 +1,157 @@
+(* A solver for gen/kill ("bitvector") dataflow problems. Unlike the
+ * general framework in dataflow.ml, which invokes a client transfer
+ * function on every statement and instruction on every visit, this
+ * solver requires the transfer functions to be expressed up-front as
+ * per-statement gen and kill sets over a dense universe of bits. The
+ * fixpoint iteration then consists solely of word-wide bitmap
+ * operations (see ocamlutil/bitmap.ml), which is dramatically cheaper
+ * than manipulating tree-based sets on large functions.
+ *
+ * Only union ("may") problems are supported: the data for a statement
+ * can only grow during the iteration, so it can be updated in place.
+ * The facts computed are those at statement starts, as in dataflow.ml.
+ *)
+
+open Cil
+
+module B = Bitmap
+module IH = Inthash
+module E = Errormsg
+
+(** A gen/kill problem. The universe of facts is a range of bit
+ * positions; the client is responsible for mapping its facts
+ * (variable ids, definition ids, etc.) to dense bit indices. *)
+type problem = {
+    bvName: string;
+    (** For debugging purposes, the name of the analysis *)
+
+    bvGen: stmt -> B.t;
+    (** The facts generated by a statement. Called once per statement,
+     * before the iteration starts. The returned bitmap is not
+     * modified by the solver. *)
+
+    bvKill: stmt -> B.t;
+    (** The facts killed by a statement. Called once per statement. *)
+  }
+
+(* The worklist. We use a FIFO queue, like dataflow.ml, with a bitmap
+ * over statement ids to avoid enqueueing a statement twice. *)
+type worklist = { wlQueue: int Queue.t;
+                  wlMember: B.t;
+                  wlStmts: stmt IH.t }
+
+let newWorklist () =
+  { wlQueue = Queue.create ();
+    wlMember = B.make 32;
+    wlStmts = IH.create 32 }
+
+let wlPush (wl: worklist) (s: stmt) : unit =
+  if not (B.test wl.wlMember s.sid) then begin
+    B.setTo wl.wlMember s.sid true;
+    if not (IH.mem wl.wlStmts s.sid) then IH.add wl.wlStmts s.sid s;
+    Queue.add s.sid wl.wlQueue
+  end
+
+let wlPop (wl: worklist) : stmt =
+  let sid = Queue.take wl.wlQueue in
+  B.setTo wl.wlMember sid false;
+  IH.find wl.wlStmts sid
+
+(* Compute the gen and kill sets for the given statements, once *)
+let precompute (p: problem) (stmts: stmt list) : B.t IH.t * B.t IH.t =
+  let gen = IH.create 32 in
+  let kill = IH.create 32 in
+  List.iter
+    (fun s ->
+      if not (IH.mem gen s.sid) then begin
+        IH.add gen s.sid (p.bvGen s);
+        IH.add kill s.sid (p.bvKill s)
+      end)
+    stmts;
+  (gen, kill)
+
+(** Solve a forwards problem:
+ *    data(s)  superset  gen(p) union (data(p) - kill(p))
+ * for every CFG edge p -> s. [entries] gives the statements where the
+ * flow starts, along with their initial data (which the solver takes
+ * ownership of); [stmts] must contain every statement that may be
+ * reached from them. Returns the data at the start of each reached
+ * statement; a statement with no entry in the result was not reached. *)
+let solveForwards (p: problem)
+                  (entries: (stmt * B.t) list)
+                  (stmts: stmt list) : B.t IH.t =
+  let gen, kill = precompute p stmts in
+  let data : B.t IH.t = IH.create 32 in
+  let wl = newWorklist () in
+  List.iter
+    (fun (s, d) ->
+      (match IH.tryfind data s.sid with
+        None -> IH.add data s.sid d
+      | Some old -> ignore (B.union old d));
+      wlPush wl s)
+    entries;
+  (try
+    while true do
+      let s = wlPop wl in
+      let din =
+        try IH.find data s.sid
+        with Not_found ->
+          E.s (E.bug "Bitvecdataflow[%s]: statement %d has no data"
+                 p.bvName s.sid)
+      in
+      let sgen =
+        try IH.find gen s.sid
+        with Not_found ->
+          E.s (E.bug "Bitvecdataflow[%s]: reached statement %d was not \
+                      among those passed to the solver" p.bvName s.sid)
+      in
+      let skill = IH.find kill s.sid in
+      List.iter
+        (fun succ ->
+          match IH.tryfind data succ.sid with
+            None ->
+              (* First time we reach this successor *)
+              let d = B.clone sgen in
+              ignore (B.union_except d din skill);
+              IH.add data succ.sid d;
+              wlPush wl succ
+          | Some d ->
+              let changed = B.union d sgen in
+              let changed' = B.union_except d din skill in
+              if changed || changed' then wlPush wl succ)
+        s.succs
+    done
+  with Queue.Empty -> ());
+  data
+
+(** Solve a backwards problem:
+ *    data(p)  superset  gen(p) union (data(s) - kill(p))
+ * for every CFG edge p -> s. The data for every statement in [stmts]
+ * starts at its gen set (so sinks end up with exactly their gen set,
+ * i.e. the exit data is bottom). Returns the data at the start of each
+ * statement. *)
+let solveBackwards (p: problem) (stmts: stmt list) : B.t IH.t =
+  let gen, kill = precompute p stmts in
+  let data : B.t IH.t = IH.create 32 in
+  let wl = newWorklist () in
+  List.iter
+    (fun s ->
+      if not (IH.mem data s.sid) then
+        IH.add data s.sid (B.clone (IH.find gen s.sid));
+      wlPush wl s)
+    stmts;
+  (try
+    while true do
+      let s = wlPop wl in
+      let din = IH.find data s.sid in
+      List.iter
+        (fun pred ->
+          match IH.tryfind data pred.sid with
+            None -> () (* Not among the statements we were given *)
+          | Some d ->
+              let pkill = IH.find kill pred.sid in
+              if B.union_except d din pkill then wlPush wl pred)
+        s.preds
+    done
+  with Queue.Empty -> ());
+  data
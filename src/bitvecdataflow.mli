@@ -0,0 +1,41 @@
+(** A solver for gen/kill ("bitvector") dataflow problems. The transfer
+    functions are expressed up-front as per-statement gen and kill sets
+    over a dense universe of bits, and the fixpoint iteration consists
+    solely of word-wide {!Bitmap} operations. Only union ("may")
+    problems are supported. Before using this, you must initialize the
+    Control-flow Graph, e.g. using {!Cfg.computeFileCFG}. *)
+
+(** A gen/kill problem. The universe of facts is a range of bit
+ * positions; the client is responsible for mapping its facts (variable
+ * ids, definition ids, etc.) to dense bit indices. *)
+type problem = {
+    bvName: string;
+    (** For debugging purposes, the name of the analysis *)
+
+    bvGen: Cil.stmt -> Bitmap.t;
+    (** The facts generated by a statement. Called once per statement,
+     * before the iteration starts. The returned bitmap is not
+     * modified by the solver. *)
+
+    bvKill: Cil.stmt -> Bitmap.t;
+    (** The facts killed by a statement. Called once per statement. *)
+  }
+
+val solveForwards: problem -> (Cil.stmt * Bitmap.t) list ->
+                   Cil.stmt list -> Bitmap.t Inthash.t
+(** [solveForwards p entries stmts] solves
+ *     data(s)  superset  gen(p) union (data(p) - kill(p))
+ * for every CFG edge [p -> s]. [entries] gives the statements where
+ * the flow starts, along with their initial data (which the solver
+ * takes ownership of); [stmts] must contain every statement that may
+ * be reached from them. Returns the data at the start of each reached
+ * statement, keyed by statement id; a statement with no entry in the
+ * result was not reached. *)
+
+val solveBackwards: problem -> Cil.stmt list -> Bitmap.t Inthash.t
+(** [solveBackwards p stmts] solves
+ *     data(p)  superset  gen(p) union (data(s) - kill(p))
+ * for every CFG edge [p -> s] between statements of [stmts]. The exit
+ * data is bottom: the data for a statement with no successors is just
+ * its gen set. Returns the data at the start of each statement, keyed
+ * by statement id. *)
@@ -44,6 +44,7 @@
 open Pretty
 open Cil
 module E=Errormsg
+module IH=Inthash
 
 (* entry points: cfgFun, printCfgChannel, printCfgFilename *)
 
@@ -112,7 +113,20 @@ let findAddrOfLabelStmts (b : block) : stmt list =
     let slr = ref [] in
     let vis = new addrOfLabelFinder slr in
     ignore(visitCilBlock vis b);
-    !slr
+    (* The same label's address is commonly taken many times (computed-goto
+       dispatch tables do it once per use). Dedupe the statements through
+       their label names so that the successor lists built from this list
+       stay linear. *)
+    let seen : (string, unit) Hashtbl.t = Hashtbl.create 113 in
+    List.filter
+        (fun s ->
+            match List.filter (function Label _ -> true | _ -> false)
+                              s.labels with
+            | Label (ln, _, _) :: _ ->
+                if Hashtbl.mem seen ln then false
+                else begin Hashtbl.add seen ln (); true end
+            | _ -> true (* no named label; keep it *))
+        !slr
 
 (* entry point *)
 
@@ -128,6 +142,7 @@ let rec cfgFun (fd : fundec): int =
 
     fd.smaxstmtid <- Some(!start_id);
     fd.sallstmts <- List.rev !nodeList;
+    refreshStmtTable fd;
 
     !start_id - initial_id
   end
@@ -195,7 +210,13 @@ and cfgStmt (s: stmt) (next:stmt option) (break:stmt option) (cont:stmt option)
         ()
   | Return _  -> ()
   | Goto (p,_) -> addSucc !p
-  | ComputedGoto (e,_) -> List.iter addSucc rlabels
+  | ComputedGoto (e,_) ->
+      (* rlabels is duplicate-free (see findAddrOfLabelStmts) and this
+         statement gets its successors only here, so add them directly;
+         the memq checks of addSucc made this arm quadratic for the
+         thousands of targets of a generated dispatch table *)
+      List.iter (fun n -> n.preds <- s :: n.preds) rlabels;
+      s.succs <- List.rev_append rlabels s.succs
   | Break _ -> addOptionSucc break
   | Continue _ -> addOptionSucc cont
   | If (_, blk1, blk2, _) ->
@@ -209,7 +230,12 @@ and cfgStmt (s: stmt) (next:stmt option) (break:stmt option) (cont:stmt option)
       cfgBlock b next break cont nodeList rlabels
   | Switch(_,blk,l,_) ->
       let bl = findCaseLabeledStmts blk in
-      List.iter addSucc (List.rev bl(*l*)); (* Add successors in order *)
+      (* Add successors in order. bl is duplicate-free (the finder visits
+         each statement once) and this statement has no successors yet, so
+         skip the quadratic memq checks of addSucc; large generated
+         switches have thousands of cases *)
+      List.iter (fun n -> n.preds <- s :: n.preds) bl;
+      s.succs <- bl;
       (* sfg: if there's no default, need to connect s->next *)
       if not (List.exists
                 (fun stmt -> List.exists
@@ -309,6 +335,58 @@ let printCfgFilename (filename : string) (fd : fundec) =
       close_out chan;
     end
 
+(** Print only the region of the control flow graph within [depth] edges
+ * (following successors and predecessors) of the statement whose sid is
+ * [root]. Nodes are written to the channel as they are found and labels
+ * are rendered for the included nodes only, so dumping a small region
+ * of a huge function does not pay for the whole graph; edges leading
+ * out of the region are suppressed. *)
+let printCfgRegionChannel (chan : out_channel) (fd : fundec)
+    ~(root : int) ~(depth : int) =
+  let rootStmt : stmt option ref = ref None in
+  forallStmts
+    (fun s -> if s.sid = root then rootStmt := Some s) fd;
+  match !rootStmt with
+    None ->
+      E.s (E.error "printCfgRegion: no statement with sid %d in %s"
+             root fd.svar.vname)
+  | Some r ->
+      (* breadth-first out to the requested depth; the included sids
+       * double as the visited set *)
+      let included : unit IH.t = IH.create 113 in
+      let frontier = ref [r] in
+      IH.replace included r.sid ();
+      let d = ref 0 in
+      while !d < depth && !frontier <> [] do
+        let next = ref [] in
+        List.iter
+          (fun s ->
+            List.iter
+              (fun s' ->
+                if not (IH.mem included s'.sid) then begin
+                  IH.replace included s'.sid ();
+                  next := s' :: !next
+                end)
+              (s.succs @ s.preds))
+          !frontier;
+        frontier := !next;
+        incr d
+      done;
+      ignore (fprintf chan "digraph CFG_%s_%d {\n" fd.svar.vname root);
+      forallStmts
+        (fun s ->
+          if IH.mem included s.sid then begin
+            ignore (fprintf chan "%a [label=\"%a\"]\n"
+                      d_cfgnodename s d_cfgnodelabel s);
+            List.iter
+              (fun s' ->
+                if IH.mem included s'.sid then
+                  ignore (fprintf chan "\t%a\n" (d_cfgedge s) s'))
+              s.succs
+          end)
+        fd;
+      ignore (fprintf chan "}\n")
+
 
 ;;
 
@@ -325,21 +403,260 @@ let clearCFGinfo (fd : fundec) =
 
 let clearFileCFG (f : file) =
   start_id := 0;
-  iterGlobals f (fun g ->
-    match g with GFun(fd,_) ->
-      clearCFGinfo fd
-    | _ -> ())
+  iterFunctions f (fun fd _ -> clearCFGinfo fd)
 
 let computeFileCFG (f : file) =
-  iterGlobals f (fun g ->
-    match g with GFun(fd,_) ->
-      ignore(cfgFun fd)
-    | _ -> ())
+  iterFunctions f (fun fd _ -> ignore(cfgFun fd))
 
 let allStmts (f : file) : stmt list =
-  foldGlobals f
-    (fun accu g ->
-      match g with
-      | GFun (f,l) -> f.sallstmts @ accu
-      | _ -> accu
-    ) []
+  let accu = ref [] in
+  iterFunctions f (fun fd _ -> accu := fd.sallstmts @ !accu);
+  !accu
+
+(**********************************************************************)
+(* packed CFG *)
+
+(* A compressed-sparse-row view of the CFG of one function: the edges of
+   all statements live back to back in two int arrays, with a span per
+   statement. Dataflow fixpoints touch every edge of every statement many
+   times, and on large functions chasing the succs/preds list cells is
+   where the time goes; iterating a span of an int array is sequential
+   reads instead. The statement ids of a function form a contiguous range
+   (both cfgFun and Cil.computeCFGInfo number them consecutively), so we
+   index the arrays by [sid - pcBase]. *)
+
+type packedCfg = {
+    pcBase: int;          (* the smallest statement id in the function *)
+    pcStmts: stmt array;  (* the statement with id [pcBase + i] at index i *)
+    pcSuccIdx: int array; (* length n+1; successors of statement i are
+                           * pcSuccs.(pcSuccIdx.(i)) .. pcSuccs.(pcSuccIdx.(i+1)-1) *)
+    pcSuccs: int array;   (* successor indexes, packed back to back *)
+    pcPredIdx: int array; (* same layout for the predecessors *)
+    pcPreds: int array;
+  }
+
+(** Build the packed representation from the succs/preds lists. Call after
+  [cfgFun] or {!Cil.computeCFGInfo}; rebuild it whenever the CFG is
+  recomputed. *)
+let packCfg (fd: fundec) : packedCfg =
+  match fd.sallstmts with
+    [] -> { pcBase = 0; pcStmts = [||];
+            pcSuccIdx = [| 0 |]; pcSuccs = [||];
+            pcPredIdx = [| 0 |]; pcPreds = [||] }
+  | first :: rest ->
+      let base =
+        List.fold_left (fun m s -> min m s.sid) first.sid rest in
+      let maxid =
+        List.fold_left (fun m s -> max m s.sid) first.sid rest in
+      let n = maxid - base + 1 in
+      let stmts = Array.make n first in
+      List.iter (fun s -> stmts.(s.sid - base) <- s) fd.sallstmts;
+      (* The usual two passes of a CSR build: count the edges per
+         statement, turn the counts into prefix sums, then fill *)
+      let succIdx = Array.make (n + 1) 0 in
+      let predIdx = Array.make (n + 1) 0 in
+      List.iter
+        (fun s ->
+          succIdx.(s.sid - base + 1) <- List.length s.succs;
+          predIdx.(s.sid - base + 1) <- List.length s.preds)
+        fd.sallstmts;
+      for i = 1 to n do
+        succIdx.(i) <- succIdx.(i) + succIdx.(i - 1);
+        predIdx.(i) <- predIdx.(i) + predIdx.(i - 1)
+      done;
+      let succs = Array.make succIdx.(n) 0 in
+      let preds = Array.make predIdx.(n) 0 in
+      List.iter
+        (fun s ->
+          let i = s.sid - base in
+          let j = ref succIdx.(i) in
+          List.iter (fun s' -> succs.(!j) <- s'.sid - base; incr j) s.succs;
+          let j = ref predIdx.(i) in
+          List.iter (fun s' -> preds.(!j) <- s'.sid - base; incr j) s.preds)
+        fd.sallstmts;
+      { pcBase = base; pcStmts = stmts;
+        pcSuccIdx = succIdx; pcSuccs = succs;
+        pcPredIdx = predIdx; pcPreds = preds }
+
+(** Apply a function to the successors of a statement, in the same order
+  as the succs list *)
+let iterSuccs (f: stmt -> unit) (pc: packedCfg) (s: stmt) : unit =
+  let i = s.sid - pc.pcBase in
+  for k = pc.pcSuccIdx.(i) to pc.pcSuccIdx.(i + 1) - 1 do
+    f pc.pcStmts.(pc.pcSuccs.(k))
+  done
+
+(** Apply a function to the predecessors of a statement, in the same order
+  as the preds list *)
+let iterPreds (f: stmt -> unit) (pc: packedCfg) (s: stmt) : unit =
+  let i = s.sid - pc.pcBase in
+  for k = pc.pcPredIdx.(i) to pc.pcPredIdx.(i + 1) - 1 do
+    f pc.pcStmts.(pc.pcPreds.(k))
+  done
+
+(** Fold over the successors of a statement *)
+let foldSuccs (f: 'a -> stmt -> 'a) (acc: 'a) (pc: packedCfg) (s: stmt) : 'a =
+  let i = s.sid - pc.pcBase in
+  let r = ref acc in
+  for k = pc.pcSuccIdx.(i) to pc.pcSuccIdx.(i + 1) - 1 do
+    r := f !r pc.pcStmts.(pc.pcSuccs.(k))
+  done;
+  !r
+
+(** Fold over the predecessors of a statement *)
+let foldPreds (f: 'a -> stmt -> 'a) (acc: 'a) (pc: packedCfg) (s: stmt) : 'a =
+  let i = s.sid - pc.pcBase in
+  let r = ref acc in
+  for k = pc.pcPredIdx.(i) to pc.pcPredIdx.(i + 1) - 1 do
+    r := f !r pc.pcStmts.(pc.pcPreds.(k))
+  done;
+  !r
+
+(**********************************************************************)
+(* basic blocks *)
+
+(* A basic-block view on top of the statement CFG: maximal chains of
+   statements with straight-line control between them collapse into one
+   block, blocks get dense numbers from 0, and the block-level edges are
+   kept in the same CSR form as packedCfg. Worklist algorithms that
+   iterate blocks instead of statements do far fewer worklist operations,
+   since the statements inside a block never need separate scheduling.
+   Cross-block edges only ever target block heads: every non-head
+   statement has exactly one predecessor, which is in its block. *)
+
+type basicBlocks = {
+    bbBase: int;               (* the smallest statement id in the function *)
+    bbCount: int;              (* blocks are numbered 0 .. bbCount-1 *)
+    bbOfStmt: int array;       (* the block of the statement with id
+                                * [bbBase + i], at index i *)
+    bbStmts: stmt array array; (* the statements of each block, in
+                                * control-flow order; element 0 is the head *)
+    bbSuccIdx: int array;      (* block-level edges, in the CSR layout of
+                                * packedCfg *)
+    bbSuccs: int array;
+    bbPredIdx: int array;
+    bbPreds: int array;
+  }
+
+(* Whether the statement contains a function call. Note that this is at
+   statement granularity: an Instr statement with a call in the middle
+   still ends its block as a whole. Run a splitter such as
+   Partial.calls_end_basic_blocks first if calls must end blocks at
+   instruction granularity. *)
+let stmtHasCall (s: stmt) : bool =
+  match s.skind with
+    Instr il ->
+      List.exists (function Call _ -> true | _ -> false) il
+  | _ -> false
+
+(** Build the basic blocks of a function from its statement CFG. Call
+  after [cfgFun] or {!Cil.computeCFGInfo}. When [callsEndBlocks] is set,
+  a statement containing a call terminates its block, so block
+  boundaries are also call boundaries. *)
+let buildBasicBlocks ?(callsEndBlocks=false) (fd: fundec) : basicBlocks =
+  match fd.sallstmts with
+    [] -> { bbBase = 0; bbCount = 0; bbOfStmt = [||]; bbStmts = [||];
+            bbSuccIdx = [| 0 |]; bbSuccs = [||];
+            bbPredIdx = [| 0 |]; bbPreds = [||] }
+  | first :: rest ->
+      let base =
+        List.fold_left (fun m s -> min m s.sid) first.sid rest in
+      let maxid =
+        List.fold_left (fun m s -> max m s.sid) first.sid rest in
+      let n = maxid - base + 1 in
+      let stmts = Array.make n first in
+      List.iter (fun s -> stmts.(s.sid - base) <- s) fd.sallstmts;
+      (* A statement leads a block unless a unique predecessor falls
+         through to it alone, without a terminating call *)
+      let isLeader (s: stmt) : bool =
+        match s.preds with
+          [p] ->
+            (match p.succs with [_] -> false | _ -> true)
+            || (callsEndBlocks && stmtHasCall p)
+        | _ -> true
+      in
+      let blockOf = Array.make n (-1) in
+      let nblocks = ref 0 in
+      let blocks : stmt array list ref = ref [] in (* in reverse order *)
+      let startBlockAt (s: stmt) : unit =
+        let b = !nblocks in
+        incr nblocks;
+        let chain = ref [] in
+        let cur = ref s in
+        let continue = ref true in
+        while !continue do
+          chain := !cur :: !chain;
+          blockOf.(!cur.sid - base) <- b;
+          (match !cur.succs with
+            [s'] when not (isLeader s')
+                      && blockOf.(s'.sid - base) < 0 ->
+              cur := s'
+          | _ -> continue := false)
+        done;
+        blocks := Array.of_list (List.rev !chain) :: !blocks
+      in
+      for i = 0 to n - 1 do
+        if blockOf.(i) < 0 && isLeader stmts.(i) then
+          startBlockAt stmts.(i)
+      done;
+      (* cycles made only of non-leaders (unreachable self loops) have
+         no leader to start from; break them at the smallest id *)
+      for i = 0 to n - 1 do
+        if blockOf.(i) < 0 then
+          startBlockAt stmts.(i)
+      done;
+      let bstmts = Array.of_list (List.rev !blocks) in
+      let nb = !nblocks in
+      (* the successors of a block are those of its last statement, and
+         its predecessors those of its head; the usual two CSR passes *)
+      let succIdx = Array.make (nb + 1) 0 in
+      let predIdx = Array.make (nb + 1) 0 in
+      for b = 0 to nb - 1 do
+        let arr = bstmts.(b) in
+        succIdx.(b + 1) <- List.length arr.(Array.length arr - 1).succs;
+        predIdx.(b + 1) <- List.length arr.(0).preds
+      done;
+      for b = 1 to nb do
+        succIdx.(b) <- succIdx.(b) + succIdx.(b - 1);
+        predIdx.(b) <- predIdx.(b) + predIdx.(b - 1)
+      done;
+      let succs = Array.make succIdx.(nb) 0 in
+      let preds = Array.make predIdx.(nb) 0 in
+      for b = 0 to nb - 1 do
+        let arr = bstmts.(b) in
+        let j = ref succIdx.(b) in
+        List.iter
+          (fun s' -> succs.(!j) <- blockOf.(s'.sid - base); incr j)
+          arr.(Array.length arr - 1).succs;
+        let j = ref predIdx.(b) in
+        List.iter
+          (fun p -> preds.(!j) <- blockOf.(p.sid - base); incr j)
+          arr.(0).preds
+      done;
+      { bbBase = base; bbCount = nb; bbOfStmt = blockOf;
+        bbStmts = bstmts;
+        bbSuccIdx = succIdx; bbSuccs = succs;
+        bbPredIdx = predIdx; bbPreds = preds }
+
+(** The block of a statement *)
+let blockOfStmt (bb: basicBlocks) (s: stmt) : int =
+  bb.bbOfStmt.(s.sid - bb.bbBase)
+
+(** Apply a function to the successor blocks of a block *)
+let iterBlockSuccs (f: int -> unit) (bb: basicBlocks) (b: int) : unit =
+  for k = bb.bbSuccIdx.(b) to bb.bbSuccIdx.(b + 1) - 1 do
+    f bb.bbSuccs.(k)
+  done
+
+(** Apply a function to the predecessor blocks of a block *)
+let iterBlockPreds (f: int -> unit) (bb: basicBlocks) (b: int) : unit =
+  for k = bb.bbPredIdx.(b) to bb.bbPredIdx.(b + 1) - 1 do
+    f bb.bbPreds.(k)
+  done
+
+(** The number of blocks *)
+let blockCount (bb: basicBlocks) : int = bb.bbCount
+
+(** The statements of a block, in control-flow order; element 0 is the
+  head. Do not mutate the array *)
+let blockStmts (bb: basicBlocks) (b: int) : stmt array = bb.bbStmts.(b)
@@ -23,8 +23,74 @@ val printCfgChannel : out_channel -> Cil.fundec -> unit
 (** Print control flow graph (in dot form) for fundec to file *)
 val printCfgFilename : string -> Cil.fundec -> unit
 
+(** Print (in dot form) only the region of the control flow graph
+  within [depth] edges, following successors and predecessors, of the
+  statement whose sid is [root]. Node labels are rendered for the
+  included nodes only, so a small region of a huge function is cheap to
+  dump; edges leaving the region are suppressed. *)
+val printCfgRegionChannel : out_channel -> Cil.fundec ->
+                            root:int -> depth:int -> unit
+
 (** Next statement id that will be assigned. *)
 val start_id: int ref
 
 (** Return all statements in a file - valid after computeFileCfg only *)
 val allStmts : Cil.file -> Cil.stmt list
+
+(** A packed, array-based view of the CFG of one function: the successor
+  and predecessor edges of all statements live back to back in int arrays,
+  with one span per statement, indexed by statement id. Iterating the
+  edges this way is much kinder to the cache than chasing the succs/preds
+  lists, which matters during dataflow fixpoints on large functions. *)
+type packedCfg
+
+(** Build the packed representation from the succs/preds lists. Call after
+  {!Cfg.cfgFun} or {!Cil.computeCFGInfo}; rebuild it whenever the CFG is
+  recomputed. *)
+val packCfg : Cil.fundec -> packedCfg
+
+(** Apply a function to the successors of a statement, in the same order
+  as the succs list *)
+val iterSuccs : (Cil.stmt -> unit) -> packedCfg -> Cil.stmt -> unit
+
+(** Apply a function to the predecessors of a statement, in the same order
+  as the preds list *)
+val iterPreds : (Cil.stmt -> unit) -> packedCfg -> Cil.stmt -> unit
+
+(** Fold over the successors of a statement *)
+val foldSuccs : ('a -> Cil.stmt -> 'a) -> 'a -> packedCfg -> Cil.stmt -> 'a
+
+(** Fold over the predecessors of a statement *)
+val foldPreds : ('a -> Cil.stmt -> 'a) -> 'a -> packedCfg -> Cil.stmt -> 'a
+
+(** A basic-block view on top of the statement CFG: maximal chains of
+  statements with straight-line control between them collapse into one
+  block, blocks get dense numbers from 0, and the block-level edges are
+  kept in int arrays like those of {!packedCfg}. Cross-block edges only
+  ever target block heads: every non-head statement has exactly one
+  predecessor, which is inside its block. *)
+type basicBlocks
+
+(** Build the basic blocks of a function from its statement CFG. Call
+  after {!Cfg.cfgFun} or {!Cil.computeCFGInfo}; rebuild whenever the CFG
+  is recomputed. When [callsEndBlocks] is set, a statement containing a
+  call terminates its block, so block boundaries are also call
+  boundaries. This is at statement granularity: to end blocks at the
+  calls inside Instr statements, first run a splitter such as
+  [Partial.calls_end_basic_blocks]. *)
+val buildBasicBlocks : ?callsEndBlocks:bool -> Cil.fundec -> basicBlocks
+
+(** The number of blocks; block numbers are dense, 0 .. count-1 *)
+val blockCount : basicBlocks -> int
+
+(** The block of a statement *)
+val blockOfStmt : basicBlocks -> Cil.stmt -> int
+
+(** The statements of a block, in control-flow order; element 0 is the
+  head. Do not mutate the array *)
+val blockStmts : basicBlocks -> int -> Cil.stmt array
+
+(** Apply a function to the successor (resp. predecessor) blocks of a
+  block, one call per edge *)
+val iterBlockSuccs : (int -> unit) -> basicBlocks -> int -> unit
+val iterBlockPreds : (int -> unit) -> basicBlocks -> int -> unit
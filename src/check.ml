@@ -47,9 +47,35 @@ type checkFlags =
     NoCheckGlobalIds   (* Do not check that the global ids have the proper
                         * hash value *)
     | IgnoreInstructions of (instr -> bool) (* Ignore the specified instructions *)
+    | OnlyFunctions of (string -> bool) (* Check only the bodies of the
+                        * functions whose name the predicate accepts; the
+                        * declarations of all functions are still
+                        * processed *)
+    | OnlyModified     (* Check only the bodies of the functions that a
+                        * pass has reported as modified (see
+                        * reportModified) *)
 
 let checkGlobalIds = ref true
 let ignoreInstr = ref (fun i -> false)
+let checkBody : (string -> bool) ref = ref (fun _ -> true)
+
+(* The functions that a pass has reported as modified, for the OnlyModified
+ * flag. The set is cleared by the next check that uses the flag *)
+let modifiedFunctions : (string, unit) H.t = H.create 17
+let reportModified (name: string) : unit =
+  H.replace modifiedFunctions name ()
+let anyReportedModified () : bool =
+  H.length modifiedFunctions > 0
+
+(* The function-body predicate that a list of flags amounts to *)
+let bodyPredOfFlags (flags: checkFlags list) : string -> bool =
+  List.fold_left
+    (fun acc flag ->
+      match flag with
+        OnlyFunctions p -> (fun n -> acc n && p n)
+      | OnlyModified -> (fun n -> acc n && H.mem modifiedFunctions n)
+      | _ -> acc)
+    (fun _ -> true) flags
 
   (* Attributes must be sorted *)
 type ctxAttr =
@@ -107,9 +133,14 @@ let defineVariable vi =
   (* E.log "saw %s: %d\n" vi.vname vi.vid; *)
   defineName vi.vname;
   varNamesList := (vi.vname, vi.vid) :: !varNamesList;
-  (* Check the id *)
+  (* Check the id. Ids must be globally unique, and every id must have
+   * been drawn from the allocator: an id at or above the counter was
+   * made up by hand and a future newVID will collide with it *)
   if H.mem allVarIds vi.vid then
     ignore (warn "Id %d is already defined (%s)" vi.vid vi.vname);
+  if vi.vid >= !nextGlobalVID then
+    ignore (warn "Id %d (%s) was not obtained from newVID"
+              vi.vid vi.vname);
   H.add allVarIds vi.vid vi;
   (* And register it in the current scope also *)
   H.add varIdsEnv vi.vid vi
@@ -156,6 +187,23 @@ let labels: (string, unit) H.t = H.create 17
 (* A list of statements seen in the current function *)
 let statements: stmt list ref = ref []
 
+(* Statement sets with expected-constant-time membership by physical
+ * identity: bucket on the depth-bounded structural hash and compare
+ * physically inside the bucket. Sids cannot index such sets, because
+ * the checker also runs on files whose CFG (and hence sids) has not
+ * been computed. *)
+let memqH (tbl: (int, stmt list) H.t) (s: stmt) : bool =
+  try List.memq s (H.find tbl (Hashtbl.hash s))
+  with Not_found -> false
+
+let addH (tbl: (int, stmt list) H.t) (s: stmt) : unit =
+  let h = Hashtbl.hash s in
+  let old = try H.find tbl h with Not_found -> [] in
+  H.replace tbl h (s :: old)
+
+(* The statements seen in the current function, as a set *)
+let statementsSeen : (int, stmt list) H.t = H.create 1021
+
 (* A list of the targets of Gotos *)
 let gotoTargets: (string * stmt) list ref = ref []
 
@@ -627,6 +675,10 @@ and checkInit  (i: init) : typ =
     (fun _ ->
       match i with
         SingleInit e -> checkExp true e
+      | RepeatInit (i, n) ->
+          if n <= 0 then
+            ignore (warn "RepeatInit with non-positive count");
+          checkInit i
 (*
       | ArrayInit (bt, len, initl) -> begin
           checkType bt CTSizeof;
@@ -660,7 +712,13 @@ and checkInit  (i: init) : typ =
                       ignore (warn "Initializer for index %s when %s was expected"
                                 (Int64.format "%d" i') (Int64.format "%d" i));
                     checkInitType ei bt;
-                    loopIndex (Int64.succ i) rest
+                    (* A RepeatInit covers several consecutive indices *)
+                    let n =
+                      match ei with
+                        RepeatInit (_, n) -> Int64.of_int n
+                      | _ -> Int64.one
+                    in
+                    loopIndex (Int64.add i n) rest
                 | _ :: rest ->
                     ignore (warn "Malformed initializer for array element")
               in
@@ -745,9 +803,10 @@ and checkStmt (s: stmt) =
       in
       List.iter checkLabel s.labels;
       (* See if we have seen this statement before *)
-      if List.memq s !statements then
+      if memqH statementsSeen s then
         ignore (warn "Statement is shared");
       (* Remember that we have seen this one *)
+      addH statementsSeen s;
       statements := s :: !statements;
       match s.skind with
         Break _ | Continue _ -> ()
@@ -793,25 +852,29 @@ and checkStmt (s: stmt) =
           let prevStatements = !statements in
           checkBlock b;
           (* Now make sure that all the cases do occur in that block,
-             and that no case is listed twice. *)
-          let casesVisited : stmt list ref = ref [] in
+             and that no case is listed twice. The statements of the
+             block are the ones seen since prevStatements; index them
+             once, so that a switch with a huge case list is checked in
+             linear time. *)
+          let blockStmts : (int, stmt list) H.t = H.create 113 in
+          let rec fillBlockStmts = function
+            | l when l == prevStatements -> ()
+            | [] -> E.s (E.bug "Check: fillBlockStmts")
+            | c' :: rest -> addH blockStmts c'; fillBlockStmts rest
+          in
+          fillBlockStmts !statements;
+          let casesVisited : (int, stmt list) H.t = H.create 113 in
           List.iter
             (fun c ->
-               (if List.memq c !casesVisited then
+               (if memqH casesVisited c then
                   ignore (warnContext
                             "Duplicate stmt in \"cases\" list of Switch.")
                 else
-                  casesVisited := c::!casesVisited);
+                  addH casesVisited c);
               (* Make sure it is in there *)
-              let rec findCase = function
-                | l when l == prevStatements -> (* Not found *)
-                    ignore (warnContext
-                              "Cannot find target of switch statement")
-                | [] -> E.s (E.bug "Check: findCase")
-                | c' :: rest when c == c' -> () (* Found *)
-                | _ :: rest -> findCase rest
-              in
-              findCase !statements)
+              if not (memqH blockStmts c) then
+                ignore (warnContext
+                          "Cannot find target of switch statement"))
             cases;
       | TryFinally (b, h, l) ->
           currentLoc := l;
@@ -1007,8 +1070,9 @@ let rec checkGlobal = function
                         fname)
           end;
           ignore (fd.smaxid >= 0 || E.s (bug "smaxid < 0 for %s" fname));
-          (* Now start a new environment, in a finally clause *)
-          begin try
+          (* Now start a new environment, in a finally clause. When
+           * checking incrementally, unmodified bodies are skipped *)
+          if !checkBody fname then begin try
             startEnv ();
             (* Do the locals *)
             let doLocal tctx v =
@@ -1026,16 +1090,18 @@ let rec checkGlobal = function
             List.iter (doLocal CTFArg) fd.sformals;
             List.iter (doLocal CTDecl) fd.slocals;
             statements := [];
+            H.clear statementsSeen;
             gotoTargets := [];
             checkBlock fd.sbody;
             H.clear labels;
             (* Now verify that we have scanned all targets *)
             List.iter
-              (fun (lab, t) -> if not (List.memq t !statements) then
+              (fun (lab, t) -> if not (memqH statementsSeen t) then
                 ignore (warnContext
                           "Target of \"goto %s\" statement does not appear in function body" lab))
               !gotoTargets;
             statements := [];
+            H.clear statementsSeen;
             gotoTargets := [];
             (* Done *)
             endEnv ()
@@ -1051,10 +1117,12 @@ let rec checkGlobal = function
 let checkFile flags fl =
   if !E.verboseFlag then ignore (E.log "Checking file %s\n" fl.fileName);
   valid := true;
+  checkBody := bodyPredOfFlags flags;
   List.iter
     (function
         NoCheckGlobalIds -> checkGlobalIds := false
       | IgnoreInstructions f -> ignoreInstr := f
+      | OnlyFunctions _ | OnlyModified -> ()
     )
     flags;
   iterGlobals fl (fun g -> try checkGlobal g with _ -> ());
@@ -1088,6 +1156,85 @@ let checkFile flags fl =
   H.clear enumUsed;
   H.clear typUsed;
   varNamesList := [];
+  checkBody := (fun _ -> true);
+  if List.mem OnlyModified flags then H.clear modifiedFunctions;
   if !E.verboseFlag then
     ignore (E.log "Finished checking file %s\n" fl.fileName);
   !valid
+
+(* Check 'fl' with the function bodies -- the bulk of the work -- divided
+ * over up to 'jobs' forked worker processes. Every worker repeats the
+ * cheap global environment checks, but checks only its own round-robin
+ * slice of the bodies. A worker's report goes into a pipe and the parent
+ * forwards the reports worker by worker once each is done, so the output
+ * is not interleaved; the result is the conjunction of the workers'
+ * results, reported through the exit codes *)
+let checkFileParallel (jobs: int) flags (fl: file) : bool =
+  let pred = bodyPredOfFlags flags in
+  let fnames = ref [] in (* in reverse order *)
+  iterGlobals fl
+    (function
+        GFun (fd, _) when pred fd.svar.vname ->
+          fnames := fd.svar.vname :: !fnames
+      | _ -> ());
+  let nfuns = List.length !fnames in
+  let nw = min (max 1 jobs) (max 1 nfuns) in
+  if nw <= 1 then checkFile flags fl
+  else begin
+    if !E.verboseFlag then
+      ignore (E.log "Checking file %s, %d bodies over %d workers\n"
+                fl.fileName nfuns nw);
+    (* Deal the functions out round-robin, so that a stretch of large
+     * functions does not all land on the same worker *)
+    let slices = Array.make nw [] in
+    let k = ref 0 in
+    List.iter
+      (fun n -> slices.(!k) <- n :: slices.(!k); k := (!k + 1) mod nw)
+      (List.rev !fnames);
+    let forkWorker (mine: string list) : int * Unix.file_descr =
+      let (rd, wr) = Unix.pipe () in
+      match Unix.fork () with
+      | 0 -> begin (* child *)
+          Unix.close rd;
+          (* this worker's report goes to the parent through the pipe *)
+          Unix.dup2 wr Unix.stderr;
+          Unix.close wr;
+          let keep : (string, unit) H.t = H.create (List.length mine) in
+          List.iter (fun n -> H.replace keep n ()) mine;
+          let ok =
+            try checkFile (OnlyFunctions (fun n -> H.mem keep n) :: flags) fl
+            with _ -> false
+          in
+          flush stderr;
+          (* Do not run at_exit handlers of the parent in the child *)
+          exit (if ok then 0 else 1)
+        end
+      | pid ->
+          Unix.close wr;
+          (pid, rd)
+    in
+    let workers = Array.map forkWorker slices in
+    let allValid = ref true in
+    Array.iter
+      (fun (pid, rd) ->
+        let ic = Unix.in_channel_of_descr rd in
+        (try
+          while true do
+            let line = input_line ic in
+            output_string stderr line;
+            output_char stderr '\n'
+          done
+        with End_of_file -> ());
+        close_in ic; (* closes rd as well *)
+        let (_, status) = Unix.waitpid [] pid in
+        match status with
+          Unix.WEXITED 0 -> ()
+        | Unix.WEXITED _ -> allValid := false
+        | _ ->
+            allValid := false;
+            ignore (E.log "Warning: check worker exited abnormally\n"))
+      workers;
+    flush stderr;
+    if List.mem OnlyModified flags then H.clear modifiedFunctions;
+    !allValid
+  end
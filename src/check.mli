@@ -38,10 +38,28 @@
     (* Checks the well-formedness of the file. Prints warnings and
      * returns false if errors are found *)
 
-type checkFlags = 
-    NoCheckGlobalIds   (* Do not check that the global ids have the proper 
-                        * hash value *) 
-    | IgnoreInstructions of (Cil.instr -> bool) 
+type checkFlags =
+    NoCheckGlobalIds   (* Do not check that the global ids have the proper
+                        * hash value *)
+    | IgnoreInstructions of (Cil.instr -> bool)
                        (** Ignore the specified instructions *)
- 
+    | OnlyFunctions of (string -> bool)
+                       (** Check only the bodies of the functions whose
+                        * name the predicate accepts; the declarations of
+                        * all functions are still processed *)
+    | OnlyModified     (** Check only the bodies of the functions that a
+                        * pass has reported as modified with
+                        * {!reportModified} *)
+
 val checkFile: checkFlags list -> Cil.file -> bool
+
+    (* Like checkFile, but with the function bodies divided over up to
+     * the given number of forked worker processes. The workers' reports
+     * are forwarded one worker at a time, so they do not interleave *)
+val checkFileParallel: int -> checkFlags list -> Cil.file -> bool
+
+    (* Passes may record here the functions whose bodies they changed;
+     * a later check with the OnlyModified flag then re-checks just
+     * those bodies, and clears the record *)
+val reportModified: string -> unit
+val anyReportedModified: unit -> bool
@@ -80,6 +80,23 @@ val cilVersionRevision: int
  * global item CIL stores the source location where it appears (using the
  * type {!Cil.location}) *)
 
+(** A wide string literal, packed eight bytes per wide character in an
+ * immutable string rather than one cons cell and one boxed int64 per
+ * character, since localized programs carry very large wide literals.
+ * Build one with {!Cil.wstringOfList} and inspect it with
+ * {!Cil.wstringToList}, {!Cil.wstringLength}, {!Cil.wstringGet},
+ * {!Cil.wstringIter} and {!Cil.wstringFold}. *)
+type wstring
+
+(** A narrow string literal. Short literals are ordinary OCaml strings;
+ * literals of at least {!Cil.offHeapStringLimit} bytes are stored
+ * off-heap in a malloc'ed Bigarray buffer, so translation units that
+ * embed megabyte binary blobs do not keep those bytes in the traced
+ * heap. Build one with {!Cil.cstringOfString} and inspect it with
+ * {!Cil.cstringToString} and {!Cil.cstringLength}; the printers escape
+ * directly from the off-heap buffer. *)
+type cstring
+
 type file =
     { mutable fileName: string;   (** The complete file name *)
       mutable globals: global list; (** List of globals as they will appear
@@ -96,9 +113,24 @@ type file =
        * create a global initialization CIL will try to insert code in main
        * to call it. This will not happen if your file does not contain a
        * function called "main" *)
+
+      mutable gindex: globalIndex option;
+      (** A lazily built index of the globals that carry a varinfo ([GVar],
+       * [GVarDecl], [GFun]), by name and by variable id. Built on the
+       * first call to {!Cil.lookupGlobalsByName} or
+       * {!Cil.lookupGlobalsByVid}; code that assigns the globals list
+       * directly must call {!Cil.invalidateGlobalIndex}. *)
     }
 (** Top-level representation of a C source file *)
 
+(** The contents of the gindex field. Both tables use multiple bindings
+ * per key (a name or a variable id can have both a declaration and a
+ * definition), in file order. *)
+and globalIndex = {
+    giName: (string, global) Hashtbl.t;
+    giVid: (int, global) Hashtbl.t;
+}
+
 and comment = location * string
 
 (** {b Globals}. The main type for representing global declarations and
@@ -439,9 +471,18 @@ and typeinfo = {
      * or enumeration tag. If empty cannot be referred to from the file *)
     mutable ttype: typ;
     (** The actual type. This includes the attributes that were present in
-     * the typedef *)
+     * the typedef. Mutate this only through {!Cil.setTypeinfoType}:
+     * direct assignment leaves the unrollings that {!Cil.unrollType}
+     * has memoized pointing at the old definition *)
     mutable treferenced: bool;
     (** True if used. Initially set to false*)
+    mutable tunrolled: typ option;
+    (** Memoized [unrollType ttype], maintained by {!Cil.unrollType}.
+     * Initialize to [None] *)
+    mutable tunrolledGen: int;
+    (** The typedef generation in which [tunrolled] was computed; the
+     * memo is dead once any [ttype] in the program has been mutated
+     * since *)
 }
 
 (** {b Variables.}
@@ -591,7 +632,7 @@ and exp =
   | SizeOfE    of exp
     (** sizeof(<expression>) *)
 
-  | SizeOfStr  of string
+  | SizeOfStr  of cstring
     (** sizeof(string_literal). We separate this case out because this is the
       * only instance in which a string literal should not be treated as
       * having type pointer to character. *)
@@ -642,14 +683,16 @@ and constant =
      * constant as, for example, 0xF instead of 15.) Use {!Cil.integer} or
      * {!Cil.kinteger} to create these. Watch out for integers that cannot be
      * represented on 64 bits. OCAML does not give Overflow exceptions. *)
-  | CStr of string
-    (** String constant. The escape characters inside the string have been
+  | CStr of cstring
+    (** String constant, as a {!Cil.cstring} (large literals live outside
+     * the OCaml heap). The escape characters inside the string have been
      * already interpreted. This constant has pointer to character type! The
      * only case when you would like a string literal to have an array type
      * is when it is an argument to sizeof. In that case you should use
      * SizeOfStr. *)
-  | CWStr of int64 list
-    (** Wide character string constant. Note that the local interpretation
+  | CWStr of wstring
+    (** Wide character string constant, as a packed {!Cil.wstring}.
+     * Note that the local interpretation
      * of such a literal depends on {!Cil.wcharType} and {!Cil.wcharKind}.
      * Such a constant has type pointer to {!Cil.wcharType}. The
      * escape characters in the string have not been "interpreted" in
@@ -825,6 +868,15 @@ and init =
      * For arrays, however, we allow you to give only a prefix of the
      * initializers. You can scan an initializer list with
      * {!Cil.foldLeftCompound}. *)
+  | RepeatInit of init * int
+    (** The given initializer repeated the given number of times. Appears
+     * only as the initializer of an array [CompoundInit] entry: the
+     * entry's [Index] offset is the index of the first repeated element
+     * and the following elements are filled with the same initializer.
+     * {!Cil.makeZeroInit} and the front-end produce this for zero runs of
+     * at least {!Cil.repeatInitThreshold} elements, so that large
+     * partially-initialized arrays do not materialize one initializer node
+     * per element. {!Cil.foldLeftCompound} expands it transparently. *)
 
 
 (** We want to be able to update an initializer in a variable, so we define it
@@ -881,6 +933,21 @@ and fundec =
       mutable sallstmts: stmt list;  (** After you call {!Cil.computeCFGInfo}
                                       * this field is set to contain all
                                       * statements in the function *)
+      mutable scfgprepared: bool;    (** True if {!Cil.prepareCFG} has
+                                      * already lowered this function, in
+                                      * which case it exits early on the
+                                      * next call. Reset it if you
+                                      * introduce new [Switch], [Break] or
+                                      * [Continue] statements in the body *)
+      mutable smodgen: int;          (** Monotone modification counter,
+                                      * starting at 0. {!Cil.visitCilFunction}
+                                      * bumps it when it can see that a
+                                      * visitor changed the function; passes
+                                      * that mutate statements in place must
+                                      * call {!Cil.markFunctionModified}
+                                      * themselves. Compare against a
+                                      * {!Cil.passMemo} to skip functions a
+                                      * pass has already processed. *)
     }
 
 
@@ -1142,11 +1209,46 @@ val insertImplicitCasts: bool ref
  ** Compares first by filename, then line, then byte *)
 val compareLoc: location -> location -> int
 
+(** Return the canonical copy of a file name, registering it on first
+ * sight. All locations made by the frontend and the binary file loader
+ * carry interned names, so the same path is held once no matter how
+ * many locations mention it, and file-name equality is usually a
+ * pointer comparison. *)
+val internFileName: string -> string
+
+(** The small integer id of a file name, for use as a compact key in
+ * per-file tables. Ids are assigned in order of first interning. *)
+val fileNameId: string -> int
+
 (** {b Values for manipulating globals} *)
 
 (** Make an empty function *)
 val emptyFunction: string -> fundec
 
+(** Bump the [smodgen] modification counter of a function. Needed only
+ * by passes that change statements in place, which the visitor cannot
+ * detect; passes that rewrite through {!Cil.visitCilFunction} get the
+ * bump automatically. *)
+val markFunctionModified: fundec -> unit
+
+(** The [smodgen] values a pass has already processed, keyed by the
+ * [vid] of the function's varinfo. One memo belongs to one pass: check
+ * {!Cil.passMemoNeedsVisit} before processing a function and call
+ * {!Cil.passMemoNoteVisited} afterwards, and the pass will skip every
+ * function that has not been modified since it last ran. *)
+type passMemo
+
+(** Make an empty memo for one pass *)
+val newPassMemo: unit -> passMemo
+
+(** Has the function been modified since the pass owning this memo last
+ * noted it as visited (or has it never been seen)? *)
+val passMemoNeedsVisit: passMemo -> fundec -> bool
+
+(** Record that the pass owning this memo has processed the function in
+ * its current state *)
+val passMemoNoteVisited: passMemo -> fundec -> unit
+
 (** Update the formals of a [fundec] and make sure that the function type
     has the same information. Will copy the name as well into the type. *)
 val setFormals: fundec -> varinfo list -> unit
@@ -1175,7 +1277,9 @@ val dummyFile: file
 (** Write a {!Cil.file} in binary form to the filesystem. The file can be
  * read back in later using {!Cil.loadBinaryFile}, possibly saving parsing
  * time. The second argument is the name of the file that should be
- * created. *)
+ * created. The format is a compact versioned encoding (varints, an
+ * interned string table, shared-record tables and a per-global index)
+ * that is independent of the OCaml compiler version, unlike [Marshal]. *)
 val saveBinaryFile : file -> string -> unit
 
 (** Write a {!Cil.file} in binary form to the filesystem. The file can be
@@ -1183,12 +1287,58 @@ val saveBinaryFile : file -> string -> unit
  * time. Does not close the channel. *)
 val saveBinaryFileChannel : file -> out_channel -> unit
 
+(** Like {!Cil.saveBinaryFile}, but the globals are encoded by the given
+ * number of forked worker processes and the results are concatenated.
+ * {!Cil.loadBinaryFile} reads the result transparently and restores the
+ * sharing of varinfos, compinfos, enuminfos and typeinfos across the
+ * parts, so the loaded file is equivalent to a sequential save. With
+ * one worker (or one global) this is exactly {!Cil.saveBinaryFile}. *)
+val saveBinaryFilePar : int -> file -> string -> unit
+
+(** Like {!Cil.saveBinaryFilePar}, but writing to a channel. Does not
+ * close the channel. *)
+val saveBinaryFileParChannel : int -> file -> out_channel -> unit
+
 (** Read a {!Cil.file} in binary form from the filesystem. The first
  * argument is the name of a file previously created by
  * {!Cil.saveBinaryFile}. Because this also reads some global state,
  * this should be called before any other CIL code is parsed or generated. *)
 val loadBinaryFile : string -> file
 
+(** Like {!Cil.loadBinaryFile}, but the bodies of functions are not
+ * decoded. Each [GFun] carries its varinfo, formals and locals but an
+ * empty [sbody] until {!Cil.forceFunctionBody} is called on it. Use this
+ * when only a small fraction of the functions of a large merged file
+ * will actually be inspected. *)
+val loadBinaryFileLazy : string -> file
+
+(** Like {!Cil.loadBinaryFile}, but safe to call after other files have
+ * been parsed or loaded in this process: every varinfo and compinfo of
+ * the loaded file receives a fresh id, so the ids do not conflict with
+ * those already handed out. Use this to load several binary files for
+ * merging. *)
+val loadBinaryFileRenumber : string -> file
+
+(** {!Cil.loadBinaryFileLazy} combined with
+ * {!Cil.loadBinaryFileRenumber}: fresh ids, and function bodies that
+ * are only decoded when {!Cil.forceFunctionBody} touches them. This is
+ * the natural way to bring the output of a worker process back into a
+ * parent that already holds other files. *)
+val loadBinaryFileLazyRenumber : string -> file
+
+(** Renumber the variable ids and compinfo keys of a file densely,
+ * starting from 1. After merging and pruning, the surviving ids are
+ * sparse over the whole pre-merge range, and every vid-indexed array a
+ * later analysis allocates is sized for the dead ids too. Ids are
+ * unique per file only; do not use this while another file in the
+ * process shares varinfos or compinfos with this one. *)
+val compactFileIds : file -> unit
+
+(** Materialize the body of a function from a file that was loaded with
+ * {!Cil.loadBinaryFileLazy}. Does nothing if the body is already
+ * present. *)
+val forceFunctionBody : fundec -> unit
+
 (** Get the global initializer and create one if it does not already exist.
  * When it creates a global initializer it attempts to place a call to it in
  * the main function named by the optional argument (default "main")  *)
@@ -1197,6 +1347,14 @@ val getGlobInit: ?main_name:string -> file -> fundec
 (** Iterate over all globals, including the global initializer *)
 val iterGlobals: file -> (global -> unit) -> unit
 
+(** A pull-based cursor over the globals of a file, including the global
+ * initializer (presented last, as in {!Cil.iterGlobals}). Each call sets
+ * [currentLoc] and returns the next global, or [None] when exhausted.
+ * {!Cil.iterGlobals} and {!Cil.foldGlobals} are implemented on top of
+ * this; consumers that want bounded memory can pull from the cursor
+ * directly and drop their other references to the globals list. *)
+val globalCursor: file -> (unit -> global option)
+
 (** Fold over all globals, including the global initializer *)
 val foldGlobals: file -> ('a -> global -> 'a) -> 'a -> 'a
 
@@ -1204,6 +1362,43 @@ val foldGlobals: file -> ('a -> global -> 'a) -> 'a -> 'a
     in place *)
 val mapGlobals: file -> (global -> global) -> unit
 
+(** Return the globals that declare or define a variable or function with
+ * the given name ([GVar], [GVarDecl] or [GFun]), in file order. O(1)
+ * through an index that is built lazily on the first lookup, so prefer
+ * this to scanning the globals list inside a loop. *)
+val lookupGlobalsByName: file -> string -> global list
+
+(** Like {!Cil.lookupGlobalsByName}, but keyed by the variable id *)
+val lookupGlobalsByVid: file -> int -> global list
+
+(** The [GFun] globals of the file, in file order. This and the other
+ * kind-partitioned views below share the lazily built index of the
+ * lookup functions above, so a pass that only cares about one kind of
+ * global need not pattern-match its way through the whole globals list.
+ * The views are subsequences of the globals list: the interleaving
+ * needed for printing stays in the list itself, which remains the
+ * authoritative ordering. Like the lookups, the views cover the globals
+ * list only and do not include the global initializer. *)
+val fileFunctions: file -> global list
+
+(** The [GVar] and [GVarDecl] globals of the file, in file order *)
+val fileVariables: file -> global list
+
+(** The [GType], [GCompTag], [GCompTagDecl], [GEnumTag] and
+ * [GEnumTagDecl] globals of the file, in file order *)
+val fileTypes: file -> global list
+
+(** Iterate over the function definitions only, setting [currentLoc] as
+ * {!Cil.iterGlobals} would, with the global initializer (if any)
+ * presented last *)
+val iterFunctions: file -> (fundec -> location -> unit) -> unit
+
+(** Drop the index used by the lookup functions above; it will be rebuilt
+ * on the next lookup. {!Cil.mapGlobals}, {!Cil.visitCilFile} and the other
+ * functions in this interface that replace the globals list do this for
+ * you, but code that assigns the globals field directly must call it. *)
+val invalidateGlobalIndex: file -> unit
+
 (** Find a function or function prototype with the given name in the file.
   * If it does not exist, create a prototype with the given type, and return
   * the new varinfo.  This is useful when you need to call a libc function
@@ -1216,11 +1411,18 @@ val findOrCreateFunc: file -> string -> typ -> varinfo
 
 val new_sid : unit -> int
 
+(** Reserve a contiguous block of statement ids and return the first
+ * one; see {!Cil.reserveVIDBlock} *)
+val reserveSidBlock : int -> int
+
 (** Prepare a function for CFG information computation by
   * {!Cil.computeCFGInfo}. This function converts all [Break], [Switch],
   * [Default] and [Continue] {!Cil.stmtkind}s and {!Cil.label}s into [If]s
   * and [Goto]s, giving the function body a very CFG-like character. This
-  * function modifies its argument in place. *)
+  * function modifies its argument in place. It registers the labels and
+  * looks for constructs to lower in a single walk, and exits immediately
+  * when the function's [scfgprepared] flag says a previous call already
+  * lowered it; the flag is set on completion. *)
 val prepareCFG: fundec -> unit
 
 (** Compute the CFG information for all statements in a fundec and return a
@@ -1239,9 +1441,27 @@ val prepareCFG: fundec -> unit
   * continue correctly.*)
 val computeCFGInfo: fundec -> bool -> unit
 
-
-(** Create a deep copy of a function. There should be no sharing between the
- * copy and the original function *)
+(** The statement of a function with the given id, in O(1). The lookup
+ * goes through a dense per-function [stmt array] indexed by sid that is
+ * maintained by {!Cil.computeCFGInfo} and [Cfg.cfgFun] (and built on
+ * demand from [sallstmts] otherwise), so analyses need not each build
+ * their own sid table. Raises [Not_found] if no statement of the
+ * function has that id or if no CFG information has been computed. *)
+val stmtOfSid: fundec -> int -> stmt
+
+(** Rebuild the sid-indexed statement table of a function from its
+ * [sallstmts] field. Call this only if you renumber statements by hand;
+ * the CFG computations refresh the table themselves. *)
+val refreshStmtTable: fundec -> unit
+
+
+(** Create a copy of a function. All of the mutable structure of the
+ * function (varinfos, statements, blocks) is fresh, so the copy can be
+ * rewritten freely; immutable subtrees (expressions, instructions,
+ * types, attributes) that mention no local of the function are shared
+ * with the original, which makes cloning cheap for functions whose
+ * copies will only be lightly specialized. Rewrite shared subtrees only
+ * through the visitors, which copy on change. *)
 val copyFunction: fundec -> string -> fundec
 
 
@@ -1277,6 +1497,15 @@ val builtinLoc: location
 (** Make a initializer for zero-ing a data type *)
 val makeZeroInit: typ -> init
 
+(** Zero runs of at least this many array elements are represented as one
+ * [RepeatInit] instead of one initializer per element (default 64). Set it
+ * to [max_int] to always get the fully expanded form. *)
+val repeatInitThreshold: int ref
+
+(** The number of array cells covered by an initializer list, counting each
+ * [RepeatInit] entry as its repeat count *)
+val compoundInitLength: (offset * init) list -> int
+
 
 (** Fold over the list of initializers in a Compound (not also the nested
  * ones). [doinit] is called on every present initializer, even if it is of
@@ -1284,7 +1513,9 @@ val makeZeroInit: typ -> init
  * (this is [Field(f,NoOffset)] or [Index(i,NoOffset)]), the initializer
  * value, expected type of the initializer value, accumulator. In the case of
  * arrays there might be missing zero-initializers at the end of the list.
- * These are scanned only if [implicit] is true. This is much like
+ * These are scanned only if [implicit] is true. A [RepeatInit] entry is
+ * expanded: [doinit] is called once per repeated element, with the proper
+ * index. This is much like
  * [List.fold_left] except we also pass the type of the initializer.
 
  * This is a good way to use it to scan even nested initializers :
@@ -1419,9 +1650,17 @@ val compFullName: compinfo -> string
 val isCompleteType: typ -> bool
 
 (** Unroll a type until it exposes a non
- * [TNamed]. Will collect all attributes appearing in [TNamed]!!! *)
+ * [TNamed]. Will collect all attributes appearing in [TNamed]!!!
+ * The unrolling of each typedef is memoized on its {!Cil.typeinfo},
+ * so after the first use this is one load per call; see
+ * {!Cil.setTypeinfoType} for how the memo is kept honest. *)
 val unrollType: typ -> typ
 
+(** Change the type denoted by a typedef. This is the only safe way to
+ * mutate [ttype]: it also invalidates the unrollings memoized by
+ * {!Cil.unrollType}, which may embed the old definition *)
+val setTypeinfoType: typeinfo -> typ -> unit
+
 (** Unroll all the TNamed in a type (even under type constructors such as
  * [TPtr], [TFun] or [TArray]. Does not unroll the types of fields in [TComp]
  * types. Will collect all attributes *)
@@ -1522,6 +1761,20 @@ val setTypeSigAttrs: attributes -> typsig -> typsig
 (** Get the top-level attributes of a signature *)
 val typeSigAttrs: typsig -> attributes
 
+(** Whether to hash-cons the types constructed by the CABS to CIL
+ * conversion. Set this before parsing. Structurally identical types are
+ * then represented by the same heap value, which reduces the residency
+ * of large ASTs considerably and lets the pointer-equality fast paths
+ * in the type comparison functions fire instead of walking the
+ * structure. Off by default. *)
+val useTypeInterning: bool ref
+
+(** Return the canonical representative of a type, interning its
+ * component types bottom-up through a weak table. The identity when
+ * {!Cil.useTypeInterning} is off. Compinfos, enuminfos and typeinfos
+ * keep their identity; only the typ spine is shared. *)
+val internType: typ -> typ
+
 (*********************************************************)
 (**  {b Lvalues} *)
 
@@ -1568,10 +1821,36 @@ val makeGlobalVar: string -> typ -> varinfo
 val copyVarinfo: varinfo -> string -> varinfo
 
 
+(** The id that {!Cil.newVID} will hand out next. All variable ids in a
+ * well-formed file are below this counter. Read-only for clients; it is
+ * maintained by the id allocator and by the binary file loaders *)
+val nextGlobalVID: int ref
+
 (** Generate a new variable ID. This will be different than any variable ID
- * that is generated by {!Cil.makeLocalVar} and friends *)
+ * that is generated by {!Cil.makeLocalVar} and friends. Every varinfo
+ * constructor ({!Cil.makeVarinfo}, {!Cil.makeLocalVar},
+ * {!Cil.makeTempVar}, {!Cil.makeFormalVar}, {!Cil.makeGlobalVar},
+ * {!Cil.copyVarinfo}) and {!Cil.copyFunction} draw ids from here, so
+ * vids are globally unique across a file: passes may key file-wide
+ * tables by vid without a renumbering pre-pass. {!Check.checkFile}
+ * verifies the invariant *)
 val newVID: unit -> int
 
+(** Generate a new compinfo key, different from the key of any compinfo
+ * created by {!Cil.mkCompInfo} *)
+val newCompinfoKey: unit -> int
+
+(** Reserve a contiguous block of variable ids and return the first one.
+ * The ids of the block will never be handed out by {!Cil.newVID}. Use
+ * this to give forked worker processes disjoint id ranges before the
+ * fork, so that the variables they create do not collide when their
+ * results are brought back; size the block to what a worker actually
+ * allocates, since over-sized blocks leave holes in the id space. *)
+val reserveVIDBlock: int -> int
+
+(** Like {!Cil.reserveVIDBlock}, for compinfo keys *)
+val reserveCompinfoKeyBlock: int -> int
+
 (** Add an offset at the end of an lvalue. Make sure the type of the lvalue
  * and the offset are compatible. *)
 val addOffsetLval: offset -> lval -> lval
@@ -1665,8 +1944,48 @@ val isNullPtrConstant: exp -> bool
   Returns CInt64(sign-extended c, IInt, None) *)
 val charConstToInt: char -> constant
 
+(** Build a packed wide string from the list of its wide characters *)
+val wstringOfList: int64 list -> wstring
+
+(** The wide characters of a packed wide string, as a list *)
+val wstringToList: wstring -> int64 list
+
+(** The number of wide characters in a packed wide string *)
+val wstringLength: wstring -> int
+
+(** The i-th wide character of a packed wide string *)
+val wstringGet: wstring -> int -> int64
+
+(** Iterate over the wide characters of a packed wide string *)
+val wstringIter: (int64 -> unit) -> wstring -> unit
+
+(** Fold over the wide characters of a packed wide string *)
+val wstringFold: ('a -> int64 -> 'a) -> 'a -> wstring -> 'a
+
+(** String literals at least this many bytes long are stored outside the
+    OCaml heap (default: 65536) *)
+val offHeapStringLimit: int ref
+
+(** Build a {!Cil.cstring} literal: short strings are kept as they are,
+    long ones are copied into a malloc'ed off-heap buffer *)
+val cstringOfString: string -> cstring
+
+(** The contents of a literal as an OCaml string; copies an off-heap
+    literal back into the heap, so avoid it on hot paths *)
+val cstringToString: cstring -> string
+
+(** The number of bytes in a literal *)
+val cstringLength: cstring -> int
+
 (** Do constant folding on an expression. If the first argument is true then
     will also compute compiler-dependent expressions such as sizeof.
+    If nothing folds, the expression is returned physically unchanged.
+    Besides folding adjacent constants, this reassociates chains of +,
+    -, *, &, | and ^ performed in a single integer kind so constants
+    separated by a variable part combine (so [(a + 1) + 2] folds to
+    [a + 3]), and with machdep it drops intermediate integer casts that
+    cannot affect the result (so [(int)((long)x + 0)] folds to [x] on
+    ILP32 and to [(int)x] where [long] is wider).
     See also {!Cil.constFoldVisitor}, which will run constFold on all
     expressions in a given AST node.*)
 val constFold: bool -> exp -> exp
@@ -1715,9 +2034,23 @@ val mkCast: e:exp -> newt:typ -> exp
   "(A)(B)(x + (C)y)", but leave the (C) cast. *)
 val stripCasts: exp -> exp
 
-(** Compute the type of an expression *)
+(** Compute the type of an expression. With {!Cil.useTypeOfCache} set,
+ * the result is memoized per expression node so repeated queries on
+ * the same node are a table lookup *)
 val typeOf: exp -> typ
 
+(** When set, {!Cil.typeOf} memoizes its results in a table keyed by
+ * the physical identity of the expression node. Passes that ask for
+ * the type of the same node repeatedly can turn this on around their
+ * traversal. The cache retains the expressions it has seen and is not
+ * invalidated automatically: call {!Cil.clearTypeOfCache} whenever the
+ * pass mutates a [vtype], an [ftype] or a typedef, and once when done.
+ * (default: false) *)
+val useTypeOfCache: bool ref
+
+(** Drop everything {!Cil.typeOf} has memoized *)
+val clearTypeOfCache: unit -> unit
+
 (** Convert a string representing a C integer literal to an expression.
  * Handles the prefixes 0x and 0 and the suffixes L, U, UL, LL, ULL *)
 val parseInt: string -> exp
@@ -1792,8 +2125,15 @@ val partitionAttributes:  default:attributeClass ->
                                        attribute list * (* AttrFunType *)
                                            attribute list   (* AttrType *)
 
+(** Intern an attribute name. The name stored by {!Cil.addAttribute} and
+    the query arguments of {!Cil.hasAttribute}, {!Cil.filterAttributes}
+    and {!Cil.dropAttribute} are interned automatically, so that their
+    comparisons are resolved on physical equality; intern the names
+    yourself only when comparing attribute names by hand in a hot loop *)
+val internAttrName: string -> string
+
 (** Add an attribute. Maintains the attributes in sorted order of the second
-    argument *)
+    argument. The name of the attribute is interned *)
 val addAttribute: attribute -> attributes -> attributes
 
 (** Add a list of attributes. Maintains the attributes in sorted order. The
@@ -1863,6 +2203,24 @@ type 'a visitAction =
 
 
 
+(** Which kinds of subtrees a visitor wants to see. The traversal skips
+ * wholesale the subtrees a visitor declares uninteresting, instead of
+ * walking them only to discard the rebuilt copies. The default,
+ * inherited from {!Cil.nopCilVisitor}, is to see everything; a visitor
+ * that overrides none of the type- and attribute-related methods can
+ * redefine [vinterest] to avoid re-walking [TComp] and attribute
+ * structure it never touches. *)
+type visitorInterest = {
+    viTypes: bool;
+    (** Visit occurrences of types. A type subtree includes its
+     * attributes and array-length expressions, which are then not
+     * shown to [vattr]/[vexpr] either. *)
+
+    viAttrs: bool;
+    (** Visit occurrences of attributes, both in declarations and
+     * inside types *)
+}
+
 (** A visitor interface for traversing CIL trees. Create instantiations of
  * this type by specializing the class {!Cil.nopCilVisitor}. Each of the
  * specialized visiting functions can also call the [queueInstr] to specify
@@ -1955,11 +2313,30 @@ class type cilVisitor = object
      * automatically for you when you visit statements. *)
   method unqueueInstr: unit -> instr list
 
+    (** The kinds of subtrees this visitor wants to see; the default is
+     * everything. See {!Cil.visitorInterest}. *)
+  method vinterest: visitorInterest
+
 end
 
 (** Default Visitor. Traverses the CIL tree without modifying anything *)
 class nopCilVisitor: cilVisitor
 
+(** Fuse several visitors into one, so that a single traversal of the
+ * tree dispatches each node to all of them; much cheaper than one
+ * {!visitCilFile} per visitor when the traversal itself dominates.
+ * Components are consulted in the order given. A component that answers
+ * [SkipChildren] or [ChangeTo] is suspended for the children of the
+ * current node and resumed afterwards, so it sees exactly the nodes it
+ * would have seen on its own; a node rewritten by an earlier component
+ * is shown to the later ones in its rewritten form. For the methods
+ * whose action carries a node list ([vinst], [vglob], [vattr]) a
+ * rewrite cannot be replayed to the remaining components, so the first
+ * component that rewrites such a node wins and the rest are not
+ * consulted for it. Instructions queued by the components through their
+ * own [queueInstr] are emitted in component order. *)
+val fuseVisitors: cilVisitor list -> cilVisitor
+
 (* other cil constructs *)
 
 (** Visit a file. This will will re-cons all globals TWICE (so that it is
@@ -1973,6 +2350,11 @@ val visitCilFile: cilVisitor -> file -> unit
  * long files. *)
 val visitCilFileSameGlobals: cilVisitor -> file -> unit
 
+(** Streaming variant of {!Cil.visitCilFileSameGlobals}: the globals are
+ * pulled from a cursor (see {!Cil.globalCursor}), so the producer never
+ * needs the full globals list in memory. *)
+val visitCilCursorSameGlobals: cilVisitor -> (unit -> global option) -> unit
+
 (** Visit a global *)
 val visitCilGlobal: cilVisitor -> global -> global list
 
@@ -2017,6 +2399,65 @@ val visitCilAttributes: cilVisitor -> attribute list -> attribute list
 (* And some generic visitors. The above are built with these *)
 
 
+(** {b Read-only iteration} *)
+
+(** Callbacks for the read-only iterators below. The visitor rebuilds
+ * each node on the way out and relies on physical equality to discard
+ * the copies; for purely observational passes (counting, indexing,
+ * metrics) that is allocation for zero semantic effect. The iterators
+ * walk the same children as the visitor, in the same order, calling the
+ * callbacks at each node and allocating nothing on the traversal path.
+ * As in the visitor, uses of [TNamed], [TComp] and [TEnum] are not
+ * followed into the definitions, and attributes are not walked.
+ * {!Cil.currentLoc} is not maintained. Start from {!Cil.nopCilIterator}
+ * and use the record update syntax to supply only the callbacks you
+ * care about. *)
+type cilIterator = {
+    ivrbl: varinfo -> unit;   (** variable use *)
+    iexpr: exp -> unit;
+    ilval: lval -> unit;
+    ioffs: offset -> unit;
+    iinst: instr -> unit;
+    istmt: stmt -> unit;
+    itype: typ -> unit;
+    iinit: init -> unit;
+    iglob: global -> unit;
+}
+
+(** An iterator that does nothing at any node *)
+val nopCilIterator: cilIterator
+
+(** Iterate over an expression and its subtrees *)
+val iterExpr: cilIterator -> exp -> unit
+
+(** Iterate over an lvalue *)
+val iterLval: cilIterator -> lval -> unit
+
+(** Iterate over an lvalue or recursive offset *)
+val iterOffset: cilIterator -> offset -> unit
+
+(** Iterate over an instruction *)
+val iterInstr: cilIterator -> instr -> unit
+
+(** Iterate over a statement, including its blocks and instructions *)
+val iterStmt: cilIterator -> stmt -> unit
+
+(** Iterate over a block *)
+val iterBlock: cilIterator -> block -> unit
+
+(** Iterate over a type. Definitions of named and composite types are
+ * not followed *)
+val iterType: cilIterator -> typ -> unit
+
+(** Iterate over an initializer *)
+val iterInit: cilIterator -> init -> unit
+
+(** Iterate over one global, including, for [GFun], the types of the
+ * formals and locals and the function body. Use with {!Cil.iterGlobals}
+ * to cover a whole file. *)
+val iterGlobal: cilIterator -> global -> unit
+
+
 (** {b Utility functions} *)
 
 (** Whether the pretty printer should print output for the MS VC compiler.
@@ -2052,8 +2493,11 @@ val caseRangeFold: label list -> label list
    Note that CIL assumes that optimization is always enabled ;-) *)
 val oldstyleExternInline : bool ref
 
-(** A visitor that does constant folding. Pass as argument whether you want
- * machine specific simplifications to be done, or not. *)
+(** A visitor that does constant folding. This also lowers enumeration
+ * constants to integer constants, so a separate lowering pass is not
+ * needed; subtrees where nothing folds are kept physically unchanged.
+ * Pass as argument whether you want machine specific simplifications
+ * to be done, or not. *)
 val constFoldVisitor: bool -> cilVisitor
 
 (** Styles of printing line directives *)
@@ -2265,6 +2709,14 @@ end
 class defaultCilPrinterClass: cilPrinter
 val defaultCilPrinter: cilPrinter
 
+(** A printer that emits tokens straight into a buffer, with trivial
+ * indentation and no [Pretty.doc] intermediates on the common path. It
+ * prints the same C as {!Cil.defaultCilPrinter}, modulo line breaking, and
+ * is considerably faster when dumping whole files. Install it in
+ * {!Cil.printerForMaincil} when you only need compilable output. *)
+class fastCilPrinterClass: cilPrinter
+val fastCilPrinter: cilPrinter
+
 (** These are pretty-printers that will show you more details on the internal
  * CIL representation, without trying hard to make it look like C *)
 class plainCilPrinterClass: cilPrinter
@@ -2426,6 +2878,23 @@ val dumpGlobal: cilPrinter -> out_channel -> global -> unit
  * should be sent. *)
 val dumpFile: cilPrinter -> out_channel -> string -> file -> unit
 
+(** Like {!Cil.dumpFile}, but emit the globals grouped: the types,
+ * pragmas and declarations first (with a declaration synthesized for
+ * every definition), then all function and variable definitions.
+ * Downstream compilers parse the grouped form of a large merged file
+ * faster. The reorder streams over the globals twice during output;
+ * [file.globals] is not modified or copied. *)
+val dumpFileGrouped: cilPrinter -> out_channel -> string -> file -> unit
+
+(** Like {!Cil.dumpFile}, but render the globals with the given number
+ * of forked worker processes. Each worker prints a contiguous slice of
+ * the globals into a scratch file and the parent splices the scratch
+ * files into the output channel in the original order, so memory stays
+ * bounded however large the file is. Line directive tracking restarts
+ * at slice boundaries. A job count of 1 or less falls back to
+ * {!Cil.dumpFile}. *)
+val dumpFileParallel: cilPrinter -> out_channel -> string -> file -> int -> unit
+
 
 (** the following error message producing functions also print a location in
  * the code. use {!Errormsg.bug} and {!Errormsg.unimp} if you do not want
@@ -2562,6 +3031,18 @@ val bytesSizeOfInt: ikind -> int
  * call {!Cil.initCIL}. Remember that on GCC sizeof(void) is 1! *)
 val bitsSizeOf: typ -> int
 
+(** The layouts computed by {!Cil.bitsSizeOf} and {!Cil.alignOf_int} are
+ * memoized, keyed by the [ckey] of the composite types involved. A pass
+ * that mutates the [cfields] (or the types of the fields) of a compinfo
+ * that may already have been used in a layout computation must call this
+ * on it, so that stale layouts are not used afterwards. *)
+val invalidateCompLayout: compinfo -> unit
+
+(** Flush all of the layout caches (composite types and array sizes).
+ * Call this instead of {!Cil.invalidateCompLayout} after wholesale
+ * mutation of composite types, or if the machine model changes. *)
+val clearSizeOfCaches: unit -> unit
+
 (** Represents an integer as for a given kind.  Returns a truncation
  * flag saying that the value fit in the kind (NoTruncation), didn't
  * fit but no "interesting" bits (all-0 or all-1) were lost
@@ -56,9 +56,42 @@ let neg_cilint c =
 (* Apply big_int 'op' to two cilints, returning a cilint *)
 let b op c1 c2 = cilint_of_big_int (op (big_int_of_cilint c1) (big_int_of_cilint c2))
 
-let add_cilint = b add_big_int
-let sub_cilint = b sub_big_int
-let mul_cilint = b mult_big_int
+(* Add, subtract and multiply Small values directly on the native ints,
+   going through big_int only when the result actually overflows; these
+   are the hot operations of constant folding. For + and - the result's
+   sign is wrong exactly when the operation overflowed; for * we divide
+   the product back out (min_int * -1 is the one wrapped product that
+   passes that test, so it is excluded explicitly). *)
+let add_cilint c1 c2 =
+  match c1, c2 with
+  | Small i1, Small i2 ->
+      let s = i1 + i2 in
+      if (s lxor i1) land (s lxor i2) < 0 then
+	b add_big_int c1 c2
+      else
+	Small s
+  | _ -> b add_big_int c1 c2
+
+let sub_cilint c1 c2 =
+  match c1, c2 with
+  | Small i1, Small i2 ->
+      let d = i1 - i2 in
+      if (i1 lxor i2) land (d lxor i1) < 0 then
+	b sub_big_int c1 c2
+      else
+	Small d
+  | _ -> b sub_big_int c1 c2
+
+let mul_cilint c1 c2 =
+  match c1, c2 with
+  | Small i1, Small i2 ->
+      let p = i1 * i2 in
+      if i1 = 0 || ((i1 <> -1 || i2 <> min_int) && p / i1 = i2) then
+	Small p
+      else
+	b mult_big_int c1 c2
+  | _ -> b mult_big_int c1 c2
+
 let div_cilint = b div_big_int
 let mod_cilint = b mod_big_int
 
@@ -186,29 +219,28 @@ let lognot_cilint (c1:cilint) : cilint =
   | Small i -> Small (lnot i)
   | Big b -> Big (pred_big_int (minus_big_int b))
 
+(* The number of bits in a native int *)
+let small_bits = Nativeint.size - 1
+
 let truncate_signed_cilint (c:cilint) (n:int) : cilint * truncation =
   match c with
-  | Small i when n >= Nativeint.size - 1 -> Small i, NoTruncation
-  | Small i when n < Nativeint.size - 2 ->
-      let max = 1 lsl (n - 1) in
-      let truncmax = 1 lsl n in
-     let bits = i land (truncmax - 1) in
-      let tval =
-    (* check if the n-th bit is 1... *)
-	if bits < max then
-	  bits
-	else
-    (* and fill with 1 bits on the left if it is *)
-	  bits - truncmax
-      in
+  | Small i when n >= small_bits -> Small i, NoTruncation
+  | Small i ->
+      (* n < small_bits, so the mask-and-shift cannot overflow: align
+	 the low n bits at the top of the word, then shift them back to
+	 sign-extend *)
+      let shift = small_bits - n in
+      let tval = (i lsl shift) asr shift in
+      let hi = i asr (n - 1) in
       let trunc =
-	if i >= max || i < -max then
-	  if i >= truncmax then
-	    BitTruncation
-	  else
-	    ValueTruncation
-	else
+	if hi = 0 || hi = -1 then
+	  (* i fits in n signed bits *)
 	  NoTruncation
+	else if i asr n > 0 then
+	  (* i >= 2^n *)
+	  BitTruncation
+	else
+	  ValueTruncation
       in Small tval, trunc
   | _ ->
       let b = big_int_of_cilint c in
@@ -233,19 +265,20 @@ let truncate_signed_cilint (c:cilint) (n:int) : cilint * truncation =
 
 let truncate_unsigned_cilint (c:cilint) (n:int) : cilint * truncation =
   match c with
-  | Small i when i > 0 && n >= Nativeint.size - 2 -> Small i, NoTruncation
-  | Small i when n < Nativeint.size - 2 ->
-      let max = 1 lsl (n - 1) in
-      let truncmax = 1 lsl n in
-      let bits = i land (truncmax - 1) in
+  | Small i when i >= 0 && n >= small_bits -> Small i, NoTruncation
+  | Small i when n < small_bits ->
+      (* zero-extend the low n bits; the shifted mask cannot overflow *)
+      let shift = small_bits - n in
+      let bits = (i lsl shift) lsr shift in
       let trunc =
-	if i >= truncmax || i < 0 then
-	  if i < -max then
-	    BitTruncation
-	  else
-	    ValueTruncation
-	else
+	if i asr n = 0 then
+	  (* i fits in n unsigned bits *)
 	  NoTruncation
+	else if i asr (n - 1) < -1 then
+	  (* i < -2^(n-1) *)
+	  BitTruncation
+	else
+	  ValueTruncation
       in Small bits, trunc
   | _ ->
       let b = big_int_of_cilint c in
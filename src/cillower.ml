@@ -54,3 +54,10 @@ class lowerEnumVisitorClass : cilVisitor = object (self)
 end
 
 let lowerEnumVisitor = new lowerEnumVisitorClass
+
+(* Cil.constFold replaces CEnum constants with their values, so running
+ * Cil.constFoldVisitor already performs the lowering above. Use this when
+ * both rewrites are wanted, to get a single traversal of the file instead
+ * of two. *)
+let lowerEnumAndFoldVisitor (machdep: bool) : cilVisitor =
+  constFoldVisitor machdep
@@ -40,3 +40,12 @@
 
 (** Replace enumeration constants with integer constants *)
 val lowerEnumVisitor : Cil.cilVisitor
+
+(** Replace enumeration constants with integer constants and constant-fold
+    in a single traversal. {!Cil.constFold} already lowers enumeration
+    constants, so this is {!Cil.constFoldVisitor}; prefer it to running
+    [lowerEnumVisitor] and a folding pass back to back. The argument is
+    passed to {!Cil.constFold} and enables machine-dependent folding such
+    as [sizeof]. Subtrees that are left unchanged are returned physically
+    equal, so unmodified parts of the file are not reallocated. *)
+val lowerEnumAndFoldVisitor : bool -> Cil.cilVisitor
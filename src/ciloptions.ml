@@ -195,6 +195,18 @@ let options : (string * Arg.spec * string) list =
     (" Do not print statistics" ^
        is_default (not !Cilutil.printStats));
 
+    "--statsJson",
+    Arg.String (fun s -> Cilutil.statsJsonFile := Some s),
+    "<filename> Also write the timing and allocation statistics as JSON\n\t\t\t\tto this file";
+
+    "--statsFolded",
+    Arg.String (fun s -> Cilutil.statsFoldedFile := Some s),
+    "<filename> Also write the timing tree in folded-stack form to this\n\t\t\t\tfile, for flamegraph tooling";
+
+    "--statsFoldedMeasure",
+    Arg.String (fun s -> Cilutil.statsFoldedMeasure := s),
+    "<time|minor|major> What the folded-stack values measure: time\n\t\t\t\t(microseconds, the default) or words allocated";
+
     "--log",
     Arg.String (openFile "log" (fun oc -> E.logChannel := oc.fchan)),
     "<filename> Set the name of the log file; by default use stderr";
@@ -264,6 +276,18 @@ let options : (string * Arg.spec * string) list =
     (" Do not insert implicit casts" ^
        is_default (not !Cil.insertImplicitCasts));
 
+    "--analysisMode",
+    Arg.Unit Cabs2cil.setAnalysisMode,
+    (" Elaborate for analysis rather than source-to-source: no implicit" ^
+       " casts,\n\t\t\t\tlowered constants, no temporary at cast-only call" ^
+       " destinations.\n\t\t\t\tThe printed output relies on the compiler" ^
+       " to redo the implicit\n\t\t\t\tconversions");
+
+    "--internTypes",
+    Arg.Set Cil.useTypeInterning,
+    (" Hash-cons the types built during the conversion to CIL, sharing " ^
+       "structurally identical types" ^ is_default !Cil.useTypeInterning);
+
     "--forceRLArgEval",
     Arg.Set Cabs2cil.forceRLArgEval,
     (" Forces right to left evaluation of function arguments" ^
@@ -349,6 +373,10 @@ let options : (string * Arg.spec * string) list =
     (" Do not delete any unused inline functions" ^
        is_default (not !Rmtmps.rmUnusedInlines));
 
+    "--rmRootsFile",
+    Arg.String (fun s -> Rmtmps.linkerRootsFile := Some s),
+    "<filename> Use the symbols listed in this file (one per line; nm\n\t\t\t\toutput works) as the only roots when removing unused\n\t\t\t\tglobals, and reduce unlisted functions to prototypes";
+
     (* Output Options *)
     "", Arg.Unit (fun () -> ()), " \n\t\tOutput Options\n";
 
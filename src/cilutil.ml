@@ -41,6 +41,13 @@ let strictChecking= ref false   (* If doCheck is true and warnings are found,
                                 * treat them as errors. *)
 
 let printStats = ref false
+let statsJsonFile : string option ref = ref None  (* Also dump the stats as
+                                                   * JSON to this file *)
+let statsFoldedFile : string option ref = ref None (* Also dump the timing
+                                                    * tree in folded-stack
+                                                    * form to this file *)
+let statsFoldedMeasure = ref "time" (* what the folded values measure:
+                                     * "time", "minor" or "major" *)
 
 (* when 'sliceGlobal' is set, then when 'rmtmps' runs, only globals*)
 (* marked with #pragma cilnoremove(whatever) are kept; when used with *)
@@ -90,8 +90,30 @@ module type ForwardsTransfer = sig
 end
 
 
-module ForwardsDataFlow =
-  functor (T : ForwardsTransfer) ->
+(** The transfer functions of {!ForwardsTransfer} plus the storage
+ * primitives for the per-statement state. The engine below is written
+ * against this signature, so the hash-backed and the array-backed
+ * variants share one implementation and differ only in how a sid is
+ * mapped to its data. *)
+module type ForwardsStore = sig
+  val name: string
+  val debug: bool ref
+  type t
+  val copy: t -> t
+  val findData: int -> t     (** Raises [Not_found] if nothing is known *)
+  val memData: int -> bool
+  val setData: int -> t -> unit
+  val pretty: unit -> t -> Pretty.doc
+  val computeFirstPredecessor: Cil.stmt -> t -> t
+  val combinePredecessors: Cil.stmt -> old:t -> t -> t option
+  val doInstr: Cil.instr -> t -> t action
+  val doStmt: Cil.stmt -> t -> t stmtaction
+  val doGuard: Cil.exp -> t -> t guardaction
+  val filterStmt: Cil.stmt -> bool
+end
+
+module ForwardsEngine =
+  functor (T : ForwardsStore) ->
   struct
 
     (** Keep a worklist of statements to process. It is best to keep a queue,
@@ -99,6 +121,15 @@ module ForwardsDataFlow =
      * predecessors of a statement before the statement itself. *)
     let worklist: Cil.stmt Queue.t = Queue.create ()
 
+    (** When set, iterate the CFG edges from the packed representation of
+     * {!Cfg.packCfg} instead of chasing the succs lists *)
+    let packedCfg: Cfg.packedCfg option ref = ref None
+
+    let iterSuccs (f: stmt -> unit) (s: stmt) : unit =
+      match !packedCfg with
+        Some pc -> Cfg.iterSuccs f pc s
+      | None -> List.iter f s.succs
+
     (** We call this function when we have encountered a statement, with some
      * state. *)
     let reachedStatement (s: stmt) (d: T.t) : unit =
@@ -110,7 +141,7 @@ module ForwardsDataFlow =
           s.sid T.pretty d);
       let newdata: T.t option =
         try
-          let old = IH.find T.stmtStartData s.sid in
+          let old = T.findData s.sid in
           match T.combinePredecessors s ~old:old d with
             None -> (* We are done here *)
               if !T.debug then
@@ -135,7 +166,7 @@ module ForwardsDataFlow =
       match newdata with
         None -> ()
       | Some d' ->
-          IH.replace T.stmtStartData s.sid d';
+          T.setData s.sid d';
           if T.filterStmt s &&
             not (Queue.fold (fun exists s' -> exists || s'.sid = s.sid)
                             false
@@ -185,7 +216,7 @@ module ForwardsDataFlow =
 
       (* It must be the case that the block has some data *)
       let init: T.t =
-         try T.copy (IH.find T.stmtStartData s.sid)
+         try T.copy (T.findData s.sid)
          with Not_found ->
             E.s (E.bug "FF(%s): processing block without data" T.name)
       in
@@ -227,14 +258,14 @@ module ForwardsDataFlow =
           currentLoc := get_stmtLoc s.skind;
 
           (* Handle If guards *)
-          let succsToReach = match s.skind with
+          (match s.skind with
               If (e, _, _, _) -> begin
                 let not_e = UnOp(LNot, e, intType) in
                 let thenGuard = T.doGuard e after in
                 let elseGuard = T.doGuard not_e after in
                 if thenGuard = GDefault && elseGuard = GDefault then
                   (* this is the common case *)
-                  s.succs
+                  iterSuccs (fun s' -> reachedStatement s' after) s
                 else begin
                   let doBranch succ guard =
                     match guard with
@@ -249,14 +280,12 @@ module ForwardsDataFlow =
                   in
                   let thenSucc, elseSucc = ifSuccs s  in
                   doBranch thenSucc thenGuard;
-                  doBranch elseSucc elseGuard;
-                  []
+                  doBranch elseSucc elseGuard
                 end
               end
-            | _ -> s.succs
-          in
-          (* Reach the successors *)
-          List.iter (fun s' -> reachedStatement s' after) succsToReach;
+            | _ ->
+                (* Reach the successors *)
+                iterSuccs (fun s' -> reachedStatement s' after) s)
 
       end
 
@@ -270,7 +299,7 @@ module ForwardsDataFlow =
 
       (* All initial stmts must have non-bottom data *)
       List.iter (fun s ->
-         if not (IH.mem T.stmtStartData s.sid) then
+         if not (T.memData s.sid) then
            E.s (E.error "FF(%s): initial stmt %d does not have data"
                   T.name s.sid))
          sources;
@@ -299,9 +328,299 @@ module ForwardsDataFlow =
       in
       fixedpoint ()
 
+    (** Like {!compute}, but iterate the successors from the packed CFG
+     * representation of {!Cfg.packCfg} *)
+    let computePacked (pc: Cfg.packedCfg) (sources: stmt list) =
+      packedCfg := Some pc;
+      (try compute sources
+       with e -> packedCfg := None; raise e);
+      packedCfg := None
+
   end
 
 
+(* The classic hash-backed variant: a sid maps to its data through the
+ * Inthash supplied by the transfer module *)
+module ForwardsDataFlow =
+  functor (T : ForwardsTransfer) ->
+    ForwardsEngine (struct
+      include T
+      let findData (sid: int) : t = IH.find T.stmtStartData sid
+      let memData (sid: int) : bool = IH.mem T.stmtStartData sid
+      let setData (sid: int) (d: t) : unit = IH.replace T.stmtStartData sid d
+    end)
+
+
+(** Like {!ForwardsTransfer} but the per-statement state lives in a
+ * plain array indexed by sid, with None meaning bottom, so the
+ * innermost fixpoint loop does no hashing. Requires the compact sids of
+ * {!Cfg.cfgFun} (or {!Cil.computeCFGInfo}); size the array to
+ * [List.length fd.sallstmts] to avoid regrowth. *)
+module type ForwardsArrayTransfer = sig
+  val name: string
+  val debug: bool ref
+  type t
+  val copy: t -> t
+  val stmtStartData: t option array ref
+  (** Indexed by statement id; [None] means nothing is known about the
+   * state at this point (at the end of the analysis, that the statement
+   * is not reachable). The functor grows the array on demand. *)
+  val pretty: unit -> t -> Pretty.doc
+  val computeFirstPredecessor: Cil.stmt -> t -> t
+  val combinePredecessors: Cil.stmt -> old:t -> t -> t option
+  val doInstr: Cil.instr -> t -> t action
+  val doStmt: Cil.stmt -> t -> t stmtaction
+  val doGuard: Cil.exp -> t -> t guardaction
+  val filterStmt: Cil.stmt -> bool
+end
+
+module ForwardsArrayDataFlow =
+  functor (T : ForwardsArrayTransfer) ->
+    ForwardsEngine (struct
+      include T
+      let findData (sid: int) : t =
+        let a = !T.stmtStartData in
+        if sid >= 0 && sid < Array.length a then
+          match a.(sid) with Some d -> d | None -> raise Not_found
+        else
+          raise Not_found
+      let memData (sid: int) : bool =
+        let a = !T.stmtStartData in
+        sid >= 0 && sid < Array.length a &&
+        (match a.(sid) with Some _ -> true | None -> false)
+      let setData (sid: int) (d: t) : unit =
+        let a = !T.stmtStartData in
+        let n = Array.length a in
+        if sid >= n then begin
+          let a' = Array.make (max (sid + 1) (max 32 (2 * n))) None in
+          Array.blit a 0 a' 0 n;
+          T.stmtStartData := a'
+        end;
+        (!T.stmtStartData).(sid) <- Some d
+    end)
+
+
+(******************************************************************
+ **********
+ **********         FORWARDS, PRIORITY WORKLIST
+ **********
+ ********************************************************************)
+
+(** Like {!ForwardsDataFlow} but the worklist is a priority queue ordered
+ * by reverse postorder over the CFG, so that on reducible flow graphs
+ * each statement sees the final values of all its non-back-edge
+ * predecessors before it is processed. This can reduce the number of
+ * revisits dramatically on deep loop nests and large switches. *)
+module ForwardsPriorityDataFlow =
+  functor (T : ForwardsTransfer) ->
+  struct
+    module FF = ForwardsDataFlow (T)
+
+    (* Number the statements reachable from the sources in reverse
+     * postorder over the succs edges computed by Cfg.cfgFun *)
+    let computeRPO (sources: stmt list) : int IH.t =
+      let rank : int IH.t = IH.create 113 in
+      let seen : unit IH.t = IH.create 113 in
+      let post : stmt list ref = ref [] in (* postorder, reversed at end *)
+      let rec dfs (s: stmt) : unit =
+        if not (IH.mem seen s.sid) then begin
+          IH.add seen s.sid ();
+          List.iter dfs s.succs;
+          post := s :: !post
+        end
+      in
+      List.iter dfs sources;
+      (* !post is already the reverse of the postorder *)
+      let n = ref 0 in
+      List.iter (fun s -> IH.add rank s.sid !n; incr n) !post;
+      rank
+
+    (* A binary min-heap of statements keyed by their RPO rank. The
+     * membership table keeps each statement in the heap at most once. *)
+    let heap : (int * stmt) array ref = ref [||]
+    let heapSize = ref 0
+    let inHeap : unit IH.t = IH.create 113
+
+    let heapClear () =
+      heap := [||]; heapSize := 0; IH.clear inHeap
+
+    let heapPush (rk: int) (s: stmt) : unit =
+      if not (IH.mem inHeap s.sid) then begin
+        IH.add inHeap s.sid ();
+        if !heapSize >= Array.length !heap then begin
+          let nlen = max 32 (2 * Array.length !heap) in
+          let nh = Array.make nlen (rk, s) in
+          Array.blit !heap 0 nh 0 !heapSize;
+          heap := nh
+        end;
+        let h = !heap in
+        let i = ref !heapSize in
+        incr heapSize;
+        h.(!i) <- (rk, s);
+        let continue = ref true in
+        while !continue && !i > 0 do
+          let parent = (!i - 1) / 2 in
+          if fst h.(!i) < fst h.(parent) then begin
+            let tmp = h.(!i) in
+            h.(!i) <- h.(parent); h.(parent) <- tmp;
+            i := parent
+          end else
+            continue := false
+        done
+      end
+
+    let heapPop () : stmt =
+      if !heapSize = 0 then raise Queue.Empty;
+      let h = !heap in
+      let (_, s) = h.(0) in
+      decr heapSize;
+      h.(0) <- h.(!heapSize);
+      let i = ref 0 in
+      let continue = ref true in
+      while !continue do
+        let l = 2 * !i + 1 and r = 2 * !i + 2 in
+        let smallest = ref !i in
+        if l < !heapSize && fst h.(l) < fst h.(!smallest) then smallest := l;
+        if r < !heapSize && fst h.(r) < fst h.(!smallest) then smallest := r;
+        if !smallest <> !i then begin
+          let tmp = h.(!i) in
+          h.(!i) <- h.(!smallest); h.(!smallest) <- tmp;
+          i := !smallest
+        end else
+          continue := false
+      done;
+      IH.remove inHeap s.sid;
+      s
+
+    (** Compute the data flow. Must have the CFG initialized *)
+    let compute (sources: stmt list) =
+      (* All initial stmts must have non-bottom data *)
+      List.iter (fun s ->
+         if not (IH.mem T.stmtStartData s.sid) then
+           E.s (E.error "FF(%s): initial stmt %d does not have data"
+                  T.name s.sid))
+         sources;
+      let rank = computeRPO sources in
+      let rankOf (s: stmt) : int =
+        try IH.find rank s.sid
+        with Not_found -> max_int (* not reachable from the sources *)
+      in
+      heapClear ();
+      Queue.clear FF.worklist;
+      List.iter (fun s -> heapPush (rankOf s) s) sources;
+      if !T.debug then
+        ignore (E.log "\nFF(%s): processing with RPO priorities\n" T.name);
+      let rec fixedpoint () =
+        let keepgoing =
+          try
+            let s = heapPop () in
+            FF.processStmt s;
+            (* processStmt schedules the changed successors on the plain
+             * queue of ForwardsDataFlow; drain them into the heap *)
+            while not (Queue.is_empty FF.worklist) do
+              let s' = Queue.take FF.worklist in
+              heapPush (rankOf s') s'
+            done;
+            true
+          with Queue.Empty ->
+            if !T.debug then
+              ignore (E.log "FF(%s): done\n\n" T.name);
+            false
+        in
+        if keepgoing then
+          fixedpoint ()
+      in
+      fixedpoint ()
+
+    (** Like {!compute}, but iterate the successors from the packed CFG
+     * representation of {!Cfg.packCfg} *)
+    let computePacked (pc: Cfg.packedCfg) (sources: stmt list) =
+      FF.packedCfg := Some pc;
+      (try compute sources
+       with e -> FF.packedCfg := None; raise e);
+      FF.packedCfg := None
+  end
+
+
+(******************************************************************
+ **********
+ **********         FORWARDS, BLOCK WORKLIST
+ **********
+ ********************************************************************)
+
+(** Like {!ForwardsDataFlow} but the worklist holds basic blocks of
+ * {!Cfg.buildBasicBlocks} instead of statements: the statements inside
+ * a block are processed in order within one worklist step, with
+ * membership tested by a plain array of flags indexed by the dense
+ * block numbers. The per-statement transfer functions and the contents
+ * of stmtStartData are exactly those of {!ForwardsDataFlow}. *)
+module ForwardsBlockFlow =
+  functor (T : ForwardsTransfer) ->
+  struct
+    module FF = ForwardsDataFlow (T)
+
+    (** Compute the data flow over the given blocks. Must have the CFG
+     * initialized and the sources in stmtStartData *)
+    let compute (bb: Cfg.basicBlocks) (sources: stmt list) =
+      List.iter (fun s ->
+         if not (IH.mem T.stmtStartData s.sid) then
+           E.s (E.error "FF(%s): initial stmt %d does not have data"
+                  T.name s.sid))
+         sources;
+      let inlist = Array.make (max 1 (Cfg.blockCount bb)) false in
+      let q : int Queue.t = Queue.create () in
+      let enqueue (b: int) : unit =
+        if not inlist.(b) then begin
+          inlist.(b) <- true;
+          Queue.add b q
+        end
+      in
+      Queue.clear FF.worklist;
+      List.iter (fun s -> enqueue (Cfg.blockOfStmt bb s)) sources;
+      if !T.debug then
+        ignore (E.log "\nFF(%s): processing per block\n" T.name);
+      let rec fixedpoint () =
+        match (try Some (Queue.take q) with Queue.Empty -> None) with
+          None ->
+            if !T.debug then
+              ignore (E.log "FF(%s): done\n\n" T.name)
+        | Some b ->
+            inlist.(b) <- false;
+            let stmts = Cfg.blockStmts bb b in
+            (* Process the statements in control-flow order; a statement
+             * updated by its in-block predecessor is picked up later in
+             * this same pass. Statements without data are unreachable
+             * so far and contribute nothing *)
+            Array.iter
+              (fun s ->
+                if IH.mem T.stmtStartData s.sid then
+                  FF.processStmt s)
+              stmts;
+            (* processStmt scheduled the changed statements on the plain
+             * queue. Cross-block edges only target block heads, and the
+             * changed non-head statements of this block were already
+             * consumed by the in-order pass above *)
+            let head = stmts.(0) in
+            while not (Queue.is_empty FF.worklist) do
+              let s = Queue.take FF.worklist in
+              let b' = Cfg.blockOfStmt bb s in
+              if b' <> b || s == head then
+                enqueue b'
+            done;
+            fixedpoint ()
+      in
+      fixedpoint ()
+
+    (** Like {!compute}, but iterate the statement successors from the
+     * packed CFG representation of {!Cfg.packCfg} *)
+    let computePacked (pc: Cfg.packedCfg) (bb: Cfg.basicBlocks)
+                      (sources: stmt list) =
+      FF.packedCfg := Some pc;
+      (try compute bb sources
+       with e -> FF.packedCfg := None; raise e);
+      FF.packedCfg := None
+  end
+
 
 (******************************************************************
  **********
@@ -361,12 +680,38 @@ module type BackwardsTransfer = sig
 
 end
 
-module BackwardsDataFlow =
-  functor (T : BackwardsTransfer) ->
+(** The transfer functions of {!BackwardsTransfer} plus the storage
+ * primitives for the per-statement state, mirroring {!ForwardsStore} *)
+module type BackwardsStore = sig
+  val name: string
+  val debug: bool ref
+  type t
+  val pretty: unit -> t -> Pretty.doc
+  val findData: int -> t     (** Raises [Not_found] if not initialized *)
+  val setData: int -> t -> unit
+  val funcExitData: t
+  val combineStmtStartData: Cil.stmt -> old:t -> t -> t option
+  val combineSuccessors: t -> t -> t
+  val doStmt: Cil.stmt -> t action
+  val doInstr: Cil.instr -> t -> t action
+  val filterStmt: Cil.stmt -> Cil.stmt -> bool
+end
+
+module BackwardsEngine =
+  functor (T : BackwardsStore) ->
   struct
 
+    (** When set, iterate the CFG edges from the packed representation of
+     * {!Cfg.packCfg} instead of chasing the succs/preds lists *)
+    let packedCfg: Cfg.packedCfg option ref = ref None
+
+    let iterPreds (f: stmt -> unit) (s: stmt) : unit =
+      match !packedCfg with
+        Some pc -> Cfg.iterPreds f pc s
+      | None -> List.iter f s.preds
+
     let getStmtStartData (s: stmt) : T.t =
-      try IH.find T.stmtStartData s.sid
+      try T.findData s.sid
       with Not_found ->
         E.s (E.bug "BF(%s): stmtStartData is not initialized for %d: %a"
                T.name s.sid d_stmt s)
@@ -386,13 +731,30 @@ module BackwardsDataFlow =
          | (Default | Post _) as action -> begin
              (* Do the default one. Combine the successors *)
              let res =
-               match s.succs with
-                 [] -> T.funcExitData
-               | fst :: rest ->
-                   List.fold_left (fun acc succ ->
-                     T.combineSuccessors acc (getStmtStartData succ))
-                     (getStmtStartData fst)
-                     rest
+               match !packedCfg with
+                 None -> begin
+                   match s.succs with
+                     [] -> T.funcExitData
+                   | fst :: rest ->
+                       List.fold_left (fun acc succ ->
+                         T.combineSuccessors acc (getStmtStartData succ))
+                         (getStmtStartData fst)
+                         rest
+                 end
+               | Some pc -> begin
+                   match
+                     Cfg.foldSuccs
+                       (fun acc succ ->
+                         match acc with
+                           None -> Some (getStmtStartData succ)
+                         | Some d ->
+                             Some (T.combineSuccessors d
+                                     (getStmtStartData succ)))
+                       None pc s
+                   with
+                     None -> T.funcExitData
+                   | Some d -> d
+                 end
              in
              (* Now do the instructions *)
              let res' =
@@ -432,7 +794,7 @@ module BackwardsDataFlow =
           if !T.debug then
             ignore (E.log "BF(%s): set data for block %d: %a\n"
                       T.name s.sid T.pretty d');
-          IH.replace T.stmtStartData s.sid d';
+          T.setData s.sid d';
           true
 
 
@@ -457,13 +819,13 @@ module BackwardsDataFlow =
             if changes then begin
               (* We must add all predecessors of block b, only if not already
                * in and if the filter accepts them. *)
-              List.iter
+              iterPreds
                 (fun p ->
                    if not (Queue.fold (fun exists s' -> exists || p.sid = s'.sid)
                              false worklist) &&
                      T.filterStmt p s then
                        Queue.add p worklist)
-                s.preds;
+                s;
             end;
             true
 
@@ -477,6 +839,140 @@ module BackwardsDataFlow =
       in
       fixedpoint ();
 
+    (** Like {!compute}, but iterate the successors and predecessors from
+     * the packed CFG representation of {!Cfg.packCfg} *)
+    let computePacked (pc: Cfg.packedCfg) (sinks: stmt list) =
+      packedCfg := Some pc;
+      (try compute sinks
+       with e -> packedCfg := None; raise e);
+      packedCfg := None
+
+  end
+
+
+(* The classic hash-backed variant *)
+module BackwardsDataFlow =
+  functor (T : BackwardsTransfer) ->
+    BackwardsEngine (struct
+      include T
+      let findData (sid: int) : t = IH.find T.stmtStartData sid
+      let setData (sid: int) (d: t) : unit = IH.replace T.stmtStartData sid d
+    end)
+
+
+(** Like {!BackwardsTransfer} but the per-statement state lives in a
+ * plain array indexed by sid, with None meaning "not initialized";
+ * as with {!BackwardsTransfer}, every statement must be given data
+ * before the fixpoint starts. Requires the compact sids of
+ * {!Cfg.cfgFun} (or {!Cil.computeCFGInfo}). *)
+module type BackwardsArrayTransfer = sig
+  val name: string
+  val debug: bool ref
+  type t
+  val pretty: unit -> t -> Pretty.doc
+  val stmtStartData: t option array ref
+  (** Indexed by statement id. The functor grows the array on demand,
+   * but it is an error for a reachable statement to be [None]. *)
+  val funcExitData: t
+  val combineStmtStartData: Cil.stmt -> old:t -> t -> t option
+  val combineSuccessors: t -> t -> t
+  val doStmt: Cil.stmt -> t action
+  val doInstr: Cil.instr -> t -> t action
+  val filterStmt: Cil.stmt -> Cil.stmt -> bool
+end
+
+module BackwardsArrayDataFlow =
+  functor (T : BackwardsArrayTransfer) ->
+    BackwardsEngine (struct
+      include T
+      let findData (sid: int) : t =
+        let a = !T.stmtStartData in
+        if sid >= 0 && sid < Array.length a then
+          match a.(sid) with Some d -> d | None -> raise Not_found
+        else
+          raise Not_found
+      let setData (sid: int) (d: t) : unit =
+        let a = !T.stmtStartData in
+        let n = Array.length a in
+        if sid >= n then begin
+          let a' = Array.make (max (sid + 1) (max 32 (2 * n))) None in
+          Array.blit a 0 a' 0 n;
+          T.stmtStartData := a'
+        end;
+        (!T.stmtStartData).(sid) <- Some d
+    end)
+
+
+(******************************************************************
+ **********
+ **********         BACKWARDS, BLOCK WORKLIST
+ **********
+ ********************************************************************)
+
+(** Like {!BackwardsDataFlow} but the worklist holds basic blocks of
+ * {!Cfg.buildBasicBlocks}: the statements of a block are processed in
+ * reverse control-flow order within one worklist step, and only a
+ * change at the block head (the only statement with cross-block
+ * predecessors) schedules the predecessor blocks. The transfer
+ * functions and stmtStartData are exactly those of
+ * {!BackwardsDataFlow}, and stmtStartData must be initialized for
+ * every statement, as there. *)
+module BackwardsBlockFlow =
+  functor (T : BackwardsTransfer) ->
+  struct
+    module BF = BackwardsDataFlow (T)
+
+    (** Compute the data flow over the given blocks. Must have the CFG
+     * initialized *)
+    let compute (bb: Cfg.basicBlocks) (sinks: stmt list) =
+      let inlist = Array.make (max 1 (Cfg.blockCount bb)) false in
+      let q : int Queue.t = Queue.create () in
+      let enqueue (b: int) : unit =
+        if not inlist.(b) then begin
+          inlist.(b) <- true;
+          Queue.add b q
+        end
+      in
+      List.iter (fun s -> enqueue (Cfg.blockOfStmt bb s)) sinks;
+      if !T.debug then
+        ignore (E.log "\nBF(%s): processing per block\n" T.name);
+      let rec fixedpoint () =
+        match (try Some (Queue.take q) with Queue.Empty -> None) with
+          None ->
+            if !T.debug then
+              ignore (E.log "BF(%s): done\n\n" T.name)
+        | Some b ->
+            inlist.(b) <- false;
+            let stmts = Cfg.blockStmts bb b in
+            (* In reverse order, a statement's in-block successor was
+             * processed just before it, so one pass propagates through
+             * the whole block *)
+            let headChanged = ref false in
+            for i = Array.length stmts - 1 downto 0 do
+              let changed = BF.processStmt stmts.(i) in
+              if changed && i = 0 then headChanged := true
+            done;
+            if !headChanged then begin
+              let head = stmts.(0) in
+              List.iter
+                (fun p ->
+                  if T.filterStmt p head then
+                    enqueue (Cfg.blockOfStmt bb p))
+                head.preds
+            end;
+            fixedpoint ()
+      in
+      fixedpoint ()
+
+    (** Like {!compute}, but iterate the statement successors and
+     * predecessors from the packed CFG representation of
+     * {!Cfg.packCfg} *)
+    let computePacked (pc: Cfg.packedCfg) (bb: Cfg.basicBlocks)
+                      (sinks: stmt list) =
+      BF.packedCfg := Some pc;
+      (try compute bb sinks
+       with e -> BF.packedCfg := None; raise e);
+      BF.packedCfg := None
   end
 
 
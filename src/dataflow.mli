@@ -84,14 +84,119 @@ end
 
 module ForwardsDataFlow (T : ForwardsTransfer) : sig
   val compute: Cil.stmt list -> unit
-  (** Fill in the T.stmtStartData, given a number of initial statements to 
-   * start from. All of the initial statements must have some entry in 
+  (** Fill in the T.stmtStartData, given a number of initial statements to
+   * start from. All of the initial statements must have some entry in
+   * T.stmtStartData (i.e., the initial data should not be bottom) *)
+
+  val computePacked: Cfg.packedCfg -> Cil.stmt list -> unit
+  (** Like {!compute}, but iterate the successors from the packed CFG
+   * representation of {!Cfg.packCfg}, which is much kinder to the cache
+   * on large functions *)
+end
+
+(** Like {!ForwardsTransfer} but the per-statement state lives in a
+ * plain array indexed by sid instead of an [Inthash], so the innermost
+ * fixpoint loop does no hashing. Requires the compact statement ids of
+ * {!Cfg.cfgFun} (or {!Cil.computeCFGInfo}). *)
+module type ForwardsArrayTransfer = sig
+  val name: string (** For debugging purposes, the name of the analysis *)
+
+  val debug: bool ref (** Whether to turn on debugging *)
+
+  type t  (** The type of the data we compute for each block start. May be
+           * imperative.  *)
+
+  val copy: t -> t
+  (** Make a deep copy of the data *)
+
+  val stmtStartData: t option array ref
+  (** For each statement id, the data at the start; [None] means nothing
+   * is known about the state at this point. At the end of the analysis
+   * this means that the statement is not reachable. The functor grows
+   * the array on demand; size it to [List.length fd.sallstmts] to avoid
+   * regrowth. *)
+
+  val pretty: unit -> t -> Pretty.doc
+  (** Pretty-print the state *)
+
+  val computeFirstPredecessor: Cil.stmt -> t -> t
+  (** Give the first value for a predecessors, compute the value to be set
+   * for the block *)
+
+  val combinePredecessors: Cil.stmt -> old:t -> t -> t option
+  (** Take some old data for the start of a statement, and some new data for
+   * the same point. Return None if the combination is identical to the old
+   * data. Otherwise, compute the combination, and return it. *)
+
+  val doInstr: Cil.instr -> t -> t action
+  (** The (forwards) transfer function for an instruction. The
+   * {!Cil.currentLoc} is set before calling this. The default action is to
+   * continue with the state unchanged. *)
+
+  val doStmt: Cil.stmt -> t -> t stmtaction
+  (** The (forwards) transfer function for a statement. The {!Cil.currentLoc}
+   * is set before calling this. The default action is to do the instructions
+   * in this statement, if applicable, and continue with the successors. *)
+
+  val doGuard: Cil.exp -> t -> t guardaction
+  (** Generate the successor to an If statement assuming the given expression
+    * is nonzero; see {!ForwardsTransfer.doGuard} *)
+
+  val filterStmt: Cil.stmt -> bool
+  (** Whether to put this statement in the worklist. This is called when a
+   * block would normally be put in the worklist. *)
+
+end
+
+(** Like {!ForwardsDataFlow} but with the array-backed state of
+ * {!ForwardsArrayTransfer} *)
+module ForwardsArrayDataFlow (T : ForwardsArrayTransfer) : sig
+  val compute: Cil.stmt list -> unit
+  (** Fill in the T.stmtStartData, given a number of initial statements to
+   * start from. All of the initial statements must have some entry in
    * T.stmtStartData (i.e., the initial data should not be bottom) *)
+
+  val computePacked: Cfg.packedCfg -> Cil.stmt list -> unit
+  (** Like {!compute}, but iterate the successors from the packed CFG
+   * representation of {!Cfg.packCfg} *)
+end
+
+(** Like {!ForwardsDataFlow} but the worklist is ordered by reverse
+ * postorder over the CFG, so that statements are processed after their
+ * non-back-edge predecessors. Much faster to stabilize on deep loop
+ * nests and switch-heavy functions. *)
+module ForwardsPriorityDataFlow (T : ForwardsTransfer) : sig
+  val compute: Cil.stmt list -> unit
+  (** Fill in the T.stmtStartData, given a number of initial statements to
+   * start from. All of the initial statements must have some entry in
+   * T.stmtStartData (i.e., the initial data should not be bottom) *)
+
+  val computePacked: Cfg.packedCfg -> Cil.stmt list -> unit
+  (** Like {!compute}, but iterate the successors from the packed CFG
+   * representation of {!Cfg.packCfg} *)
+end
+
+(** Like {!ForwardsDataFlow} but the worklist holds the basic blocks of
+ * {!Cfg.buildBasicBlocks} instead of statements: the statements of a
+ * block are processed in order within one worklist step, and worklist
+ * membership is a flag in an array indexed by the dense block numbers.
+ * The transfer functions and the contents of stmtStartData are exactly
+ * those of {!ForwardsDataFlow}. *)
+module ForwardsBlockFlow (T : ForwardsTransfer) : sig
+  val compute: Cfg.basicBlocks -> Cil.stmt list -> unit
+  (** Fill in the T.stmtStartData, given the blocks of the function and
+   * a number of initial statements to start from. All of the initial
+   * statements must have some entry in T.stmtStartData *)
+
+  val computePacked: Cfg.packedCfg -> Cfg.basicBlocks ->
+                     Cil.stmt list -> unit
+  (** Like {!compute}, but iterate the statement successors from the
+   * packed CFG representation of {!Cfg.packCfg} *)
 end
 
 (******************************************************************
  **********
- **********         BACKWARDS 
+ **********         BACKWARDS
  **********
  ********************************************************************)
 module type BackwardsTransfer = sig
@@ -155,10 +260,92 @@ module BackwardsDataFlow (T : BackwardsTransfer) : sig
    * If you want to use bottom for the initial data, you should pass the
    * complete list of statements to {!compute}, so that everything is visited.
    * {!find_stmts} may be useful here. *)
+
+  val computePacked: Cfg.packedCfg -> Cil.stmt list -> unit
+  (** Like {!compute}, but iterate the successors and predecessors from
+   * the packed CFG representation of {!Cfg.packCfg} *)
+end
+
+(** Like {!BackwardsTransfer} but the per-statement state lives in a
+ * plain array indexed by sid instead of an [Inthash]. Requires the
+ * compact statement ids of {!Cfg.cfgFun} (or {!Cil.computeCFGInfo}). *)
+module type BackwardsArrayTransfer = sig
+  val name: string (** For debugging purposes, the name of the analysis *)
+
+  val debug: bool ref (** Whether to turn on debugging *)
+
+  type t  (** The type of the data we compute for each block start; see
+           * {!BackwardsTransfer.t} *)
+
+  val pretty: unit -> t -> Pretty.doc (** Pretty-print the state *)
+
+  val stmtStartData: t option array ref
+  (** For each statement id, the data at the start. As with
+   * {!BackwardsTransfer.stmtStartData}, this must be initialized with
+   * the initial data for each statement before the fixpoint starts;
+   * a reachable [None] entry is an error. *)
+
+  val funcExitData: t
+  (** The data at function exit.  Used for statements with no successors. *)
+
+  val combineStmtStartData: Cil.stmt -> old:t -> t -> t option
+  (** When the analysis reaches the start of a block, combine the old data
+   * with the one we have just computed; see
+   * {!BackwardsTransfer.combineStmtStartData} *)
+
+  val combineSuccessors: t -> t -> t
+  (** Take the data from two successors and combine it *)
+
+  val doStmt: Cil.stmt -> t action
+  (** The (backwards) transfer function for a branch; see
+   * {!BackwardsTransfer.doStmt} *)
+
+  val doInstr: Cil.instr -> t -> t action
+  (** The (backwards) transfer function for an instruction; see
+   * {!BackwardsTransfer.doInstr} *)
+
+  val filterStmt: Cil.stmt -> Cil.stmt -> bool
+  (** Whether to put this predecessor block in the worklist. We give the
+   * predecessor and the block whose predecessor we are (and whose data has
+   * changed)  *)
+
+end
+
+(** Like {!BackwardsDataFlow} but with the array-backed state of
+ * {!BackwardsArrayTransfer} *)
+module BackwardsArrayDataFlow (T : BackwardsArrayTransfer) : sig
+  val compute: Cil.stmt list -> unit
+  (** Fill in the T.stmtStartData, given the sinks to start from. As
+   * with {!BackwardsDataFlow.compute}, every statement must have an
+   * entry in T.stmtStartData *)
+
+  val computePacked: Cfg.packedCfg -> Cil.stmt list -> unit
+  (** Like {!compute}, but iterate the successors and predecessors from
+   * the packed CFG representation of {!Cfg.packCfg} *)
+end
+
+(** Like {!BackwardsDataFlow} but the worklist holds the basic blocks
+ * of {!Cfg.buildBasicBlocks}: the statements of a block are processed
+ * in reverse control-flow order within one worklist step, and only a
+ * change at the block head (the only statement with cross-block
+ * predecessors) schedules the predecessor blocks. The transfer
+ * functions and stmtStartData are exactly those of
+ * {!BackwardsDataFlow}. *)
+module BackwardsBlockFlow (T : BackwardsTransfer) : sig
+  val compute: Cfg.basicBlocks -> Cil.stmt list -> unit
+  (** Fill in the T.stmtStartData, given the blocks of the function and
+   * the sinks to start from. As with {!BackwardsDataFlow.compute},
+   * every statement must have an entry in T.stmtStartData *)
+
+  val computePacked: Cfg.packedCfg -> Cfg.basicBlocks ->
+                     Cil.stmt list -> unit
+  (** Like {!compute}, but iterate the statement successors and
+   * predecessors from the packed CFG representation of
+   * {!Cfg.packCfg} *)
 end
 
 
-(** Returns (all_stmts, sink_stmts), where all_stmts is a list of the 
+(** Returns (all_stmts, sink_stmts), where all_stmts is a list of the
   statements in a function, and sink_stmts is a list of the return statments
   (including statements that fall through the end of a void function).  
   Useful when you need an initial set of statements for
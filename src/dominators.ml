@@ -35,77 +35,24 @@
  *
  *)
 
-(** Compute dominator information for the statements in a function *)
+(** Compute dominator information for the statements in a function, using
+ * the semi-NCA variant of the Lengauer-Tarjan algorithm. This runs in
+ * near-linear time in the size of the CFG, unlike the earlier iterative
+ * dataflow formulation which kept a dominator set per statement. *)
 open Cil
 open Pretty
 module E = Errormsg
-module H = Hashtbl
-module U = Util
 module IH = Inthash
 
-module DF = Dataflow
-
 let debug = false
 
-(* For each statement we maintain a set of statements that dominate it *)
+(* For the dominator tree we keep the set of statements dominated by each
+ * statement *)
 module BS = Set.Make(struct
                         type t = Cil.stmt
                         let compare v1 v2 = Stdlib.compare v1.sid v2.sid
                      end)
 
-
-
-
-(** Customization module for dominators *)
-module DT = struct
-  let name = "dom"
-
-  let debug = ref debug
-
-  type t = BS.t
-
-   (** For each statement in a function we keep the set of dominator blocks.
-    * Indexed by statement id *)
-  let stmtStartData: t IH.t = IH.create 17
-
-  let copy (d: t) = d
-
-  let pretty () (d: t) =
-    dprintf "{%a}"
-      (docList (fun s -> dprintf "%d" s.sid))
-      (BS.elements d)
-
-  let computeFirstPredecessor (s: stmt) (d: BS.t) : BS.t =
-    (* Make sure we add this block to the set *)
-    BS.add s d
-
-  let combinePredecessors (s: stmt) ~(old: BS.t) (d: BS.t) : BS.t option =
-    (* First, add this block to the data from the predecessor *)
-    let d' = BS.add s d in
-    if BS.subset old d' then
-      None
-    else
-      Some (BS.inter old d')
-
-  let doInstr (i: instr) (d: t) = DF.Default
-
-  let doStmt (s: stmt) (d: t) = DF.SDefault
-
-  let doGuard condition _ = DF.GDefault
-
-
-  let filterStmt _ = true
-end
-
-
-
-module Dom = DF.ForwardsDataFlow(DT)
-
-let getStmtDominators (data: BS.t IH.t) (s: stmt) : BS.t =
-  try IH.find data s.sid
-  with Not_found -> BS.empty (* Not reachable *)
-
-
 let getIdom (idomInfo: stmt option IH.t) (s: stmt) =
   try IH.find idomInfo s.sid
   with Not_found ->
@@ -122,6 +69,113 @@ let rec dominates (idomInfo: stmt option IH.t) (s1: stmt) (s2: stmt) =
   | Some s2idom -> dominates idomInfo s1 s2idom)
 
 
+(* Fill [idomData] with the immediate dominator of every statement in
+ * [f.sallstmts]: [None] for the start statement and for the unreachable
+ * statements, [Some] of the immediate dominator otherwise. We use the
+ * semi-NCA algorithm of Georgiadis and Tarjan: first a depth-first
+ * numbering of the reachable statements, then the semidominators in
+ * reverse preorder using path compression, and finally the immediate
+ * dominators in preorder by walking the partially-built dominator tree
+ * up to the semidominator. *)
+let fillIDoms (f: fundec) (start: stmt) (idomData: stmt option IH.t) : unit =
+  (* Phase 1: depth-first numbering of the reachable statements. We use an
+   * explicit stack because functions with tens of thousands of statements
+   * can produce very deep depth-first trees. *)
+  let dfnum: int IH.t = IH.create 64 in
+  let order = ref [] in (* (statement, parent number), in reverse preorder *)
+  let count = ref 0 in
+  let stack = ref [ (0, start) ] in
+  while !stack <> [] do
+    match !stack with
+      [] -> ()
+    | (p, s) :: rest ->
+        stack := rest;
+        if not (IH.mem dfnum s.sid) then begin
+          let n = !count in
+          incr count;
+          IH.add dfnum s.sid n;
+          order := (s, p) :: !order;
+          List.iter (fun s' -> stack := (n, s') :: !stack) s.succs
+        end
+  done;
+  let n = !count in
+  let vertex: stmt array = Array.make n start in
+  let parent: int array = Array.make n 0 in
+  let i = ref n in
+  List.iter
+    (fun (s, p) -> decr i; vertex.(!i) <- s; parent.(!i) <- p)
+    !order;
+
+  (* Phase 2: semidominators, in reverse preorder. [eval w] returns the
+   * vertex with the minimal semidominator on the forest path from [w] to
+   * the root of its tree; the forest contains the already-processed
+   * vertices, linked to their depth-first parents. *)
+  let semi = Array.init n (fun i -> i) in
+  let ancestor = Array.make n (-1) in
+  let label = Array.init n (fun i -> i) in
+  let compress (v: int) =
+    (* Collect the path from v towards the root of its tree, then rewrite
+     * it top-down. Iterative, again because of very deep paths. *)
+    let path = ref [] in
+    let u = ref v in
+    while ancestor.(ancestor.(!u)) >= 0 do
+      path := !u :: !path;
+      u := ancestor.(!u)
+    done;
+    (* The head of the path is nearest to the root; process it first *)
+    List.iter
+      (fun w ->
+        if semi.(label.(ancestor.(w))) < semi.(label.(w)) then
+          label.(w) <- label.(ancestor.(w));
+        ancestor.(w) <- ancestor.(ancestor.(w)))
+      !path
+  in
+  let eval (v: int) : int =
+    if ancestor.(v) < 0 then v
+    else begin compress v; label.(v) end
+  in
+  for w = n - 1 downto 1 do
+    List.iter
+      (fun (p: stmt) ->
+        match IH.tryfind dfnum p.sid with
+          None -> () (* The predecessor is itself unreachable *)
+        | Some v ->
+            let u = eval v in
+            if semi.(u) < semi.(w) then semi.(w) <- semi.(u))
+      vertex.(w).preds;
+    ancestor.(w) <- parent.(w)
+  done;
+
+  (* Phase 3: the immediate dominator of w is the nearest common ancestor,
+   * in the depth-first tree, of the parent and the semidominator of w. We
+   * find it by walking the dominator tree built so far, which is correct
+   * because the vertices are processed in preorder. *)
+  let idom = Array.make n 0 in
+  for w = 1 to n - 1 do
+    let v = ref parent.(w) in
+    while !v > semi.(w) do v := idom.(!v) done;
+    idom.(w) <- !v
+  done;
+
+  IH.replace idomData start.sid None;
+  for w = 1 to n - 1 do
+    IH.replace idomData vertex.(w).sid (Some vertex.(idom.(w)))
+  done;
+  (* The unreachable statements have no dominators *)
+  List.iter
+    (fun s ->
+      if not (IH.mem dfnum s.sid) then IH.replace idomData s.sid None)
+    f.sallstmts;
+
+  if debug then
+    List.iter
+      (fun s ->
+        ignore (E.log "Immediate dominator for %d: %a\n" s.sid
+                  insert
+                  (match IH.tryfind idomData s.sid with
+                    Some (Some d) -> num d.sid
+                  | _ -> text "none")))
+      f.sallstmts
 
 
 let computeIDom ?(doCFG:bool=true) (f: fundec) : stmt option IH.t =
@@ -130,71 +184,10 @@ let computeIDom ?(doCFG:bool=true) (f: fundec) : stmt option IH.t =
     prepareCFG f;
     computeCFGInfo f false
   end;
-  IH.clear DT.stmtStartData;
-  let idomData: stmt option IH.t = IH.create 13 in
-
-  let _ =
-    match f.sbody.bstmts with
-      [] -> () (* function has no body *)
-    | start :: _ -> begin
-        (* We start with only the start block *)
-        IH.add DT.stmtStartData start.sid (BS.singleton start);
-
-        Dom.compute [start];
-
-        (* Dump the dominators information *)
-         if debug then
-           List.iter
-             (fun s ->
-               let sdoms = getStmtDominators DT.stmtStartData s in
-               if not (BS.mem s sdoms) then begin
-                 (* It can be that the block is not reachable *)
-                 if s.preds <> [] then
-                   E.s (E.bug "Statement %d is not in its list of dominators"
-                          s.sid);
-               end;
-               ignore (E.log "Dominators for %d: %a\n" s.sid
-                         DT.pretty (BS.remove s sdoms)))
-             f.sallstmts;
-
-        (* Now fill the immediate dominators for all nodes *)
-        let rec fillOneIdom (s: stmt) =
-          try
-            ignore (IH.find idomData s.sid)
-              (* Already set *)
-          with Not_found -> begin
-            (* Get the dominators *)
-            let sdoms = getStmtDominators DT.stmtStartData s in
-            (* Fill the idom for the dominators first *)
-            let idom =
-              BS.fold
-                (fun d (sofar: stmt option) ->
-                  if d.sid = s.sid then
-                    sofar (* Ignore the block itself *)
-                  else begin
-                    (* fill the idom information recursively *)
-                    fillOneIdom d;
-                    match sofar with
-                      None -> Some d
-                    | Some sofar' ->
-                        (* See if d is dominated by sofar. We know that the
-                         * idom information has been computed for both sofar
-                         * and for d*)
-                        if dominates idomData sofar' d then
-                          Some d
-                        else
-                          sofar
-                  end)
-                sdoms
-                None
-            in
-            IH.replace idomData s.sid idom
-          end
-        in
-        (* Scan all blocks and compute the idom *)
-        List.iter fillOneIdom f.sallstmts
-    end
-  in
+  let idomData: stmt option IH.t = IH.create 64 in
+  (match f.sbody.bstmts with
+    [] -> () (* function has no body *)
+  | start :: _ -> fillIDoms f start idomData);
   idomData
 
 type tree = stmt option * BS.t IH.t
@@ -203,84 +196,18 @@ type tree = stmt option * BS.t IH.t
    the set of statements that are dominated *)
 let computeDomTree ?(doCFG:bool=true) (f: fundec)
     : stmt option IH.t * tree =
-  (* We must prepare the CFG info first *)
-  if doCFG then begin
-    prepareCFG f;
-    computeCFGInfo f false
-  end;
-  IH.clear DT.stmtStartData;
+  let idomData = computeIDom ~doCFG f in
   let treeData: BS.t IH.t = IH.create 64 in
-  let idomData: stmt option IH.t = IH.create 64 in
-
-  let _ =
-    match f.sbody.bstmts with
-      [] -> () (* function has no body *)
-    | start :: _ -> begin
-        (* We start with only the start block *)
-        IH.add DT.stmtStartData start.sid (BS.singleton start);
-
-        Dom.compute [start];
-
-        (* Dump the dominators information *)
-         if debug then
-           List.iter
-             (fun s ->
-               let sdoms = getStmtDominators DT.stmtStartData s in
-               if not (BS.mem s sdoms) then begin
-                 (* It can be that the block is not reachable *)
-                 if s.preds <> [] then
-                   E.s (E.bug "Statement %d is not in its list of dominators"
-                          s.sid);
-               end;
-               ignore (E.log "Dominators for %d: %a\n" s.sid
-                         DT.pretty (BS.remove s sdoms)))
-             f.sallstmts;
-
-        (* Now fill the immediate dominators for all nodes *)
-        let rec fillOneIdom (s: stmt) =
-          try
-            ignore (IH.find idomData s.sid)
-              (* Already set *)
-          with Not_found -> begin
-            (* Get the dominators *)
-            let sdoms = getStmtDominators DT.stmtStartData s in
-            (* Fill the idom for the dominators first *)
-            let idom =
-              BS.fold
-                (fun d (sofar: stmt option) ->
-                  if d.sid = s.sid then
-                    sofar (* Ignore the block itself *)
-                  else begin
-                    (* fill the idom information recursively *)
-                    fillOneIdom d;
-                    match sofar with
-                      None -> Some d
-                    | Some sofar' ->
-                        (* See if d is dominated by sofar. We know that the
-                         * idom information has been computed for both sofar
-                         * and for d*)
-                        if dominates idomData sofar' d then
-                          Some d
-                        else
-                          sofar
-                  end)
-                sdoms
-                None
-            in
-            IH.replace idomData s.sid idom;
-	    match idom with
-	    | None -> ()
-	    | Some d -> begin
-		match IH.tryfind treeData d.sid with
-		| None -> IH.add treeData d.sid (BS.singleton s)
-		| Some bs -> IH.replace treeData d.sid (BS.add s bs)
-	    end
-          end
-        in
-        (* Scan all blocks and compute the idom *)
-        List.iter fillOneIdom f.sallstmts
-    end
-  in
+  List.iter
+    (fun s ->
+      match IH.tryfind idomData s.sid with
+        Some (Some d) -> begin
+          match IH.tryfind treeData d.sid with
+          | None -> IH.add treeData d.sid (BS.singleton s)
+          | Some bs -> IH.replace treeData d.sid (BS.add s bs)
+        end
+      | _ -> ())
+    f.sallstmts;
   try idomData, (Some(List.hd f.sbody.bstmts), treeData)
   with Failure _ -> idomData, (None, treeData)
 
@@ -317,6 +244,88 @@ let children (t: tree) (s: stmt) : stmt list =
   | None -> []
   | Some bs -> BS.elements bs
 
+(* Maps the id of every statement in the dominator tree to its pre and
+ * postorder visit numbers in a depth-first traversal of the tree *)
+type intervals = (int * int) IH.t
+
+(** Number the dominator tree in depth-first order. A statement dominates
+ * another exactly when its [(pre, post)] interval contains the other's,
+ * so after this a dominance query is two integer comparisons (see
+ * {!intervalDominates}) instead of a walk up the idom chain. *)
+let computeDomIntervals (t: tree) : intervals =
+  let data: intervals = IH.create 64 in
+  let count = ref 0 in
+  (match fst t with
+    None -> ()
+  | Some root ->
+      (* Explicit stack of (statement, entered) pairs, because the
+       * dominator tree can be very deep. Pushing a statement with
+       * [entered = false] assigns its preorder number and schedules its
+       * children; popping it again with [entered = true] assigns the
+       * postorder number. *)
+      let stack = ref [ (root, false) ] in
+      while !stack <> [] do
+        match !stack with
+          [] -> ()
+        | (s, true) :: rest ->
+            stack := rest;
+            let pre, _ = IH.find data s.sid in
+            IH.replace data s.sid (pre, !count);
+            incr count
+        | (s, false) :: rest ->
+            let n = !count in
+            incr count;
+            IH.add data s.sid (n, -1);
+            stack := (s, true) :: rest;
+            List.iter (fun c -> stack := (c, false) :: !stack) (children t s)
+      done);
+  data
+
+(** Check whether one statement dominates another, in constant time. Both
+ * statements must belong to the function whose dominator tree was
+ * numbered; a statement that does not appear in the numbering (i.e. is
+ * unreachable) dominates only itself, as with {!dominates}. *)
+let intervalDominates (data: intervals) (s1: stmt) (s2: stmt) : bool =
+  s1 == s2 ||
+  (match IH.tryfind data s1.sid, IH.tryfind data s2.sid with
+    Some (pre1, post1), Some (pre2, post2) ->
+      pre1 <= pre2 && post2 <= post1
+  | _, _ -> false)
+
+(** Compute the dominance frontier of every reachable statement: the
+ * statements Y such that X dominates a predecessor of Y but does not
+ * strictly dominate Y itself. We use the bottom-up formulation of Cytron
+ * et al. over the dominator tree, so the whole computation is linear in
+ * the size of the frontiers. Statements with an empty frontier do not
+ * appear in the table. *)
+let computeDomFrontier (idomData: stmt option IH.t)
+                       (t: tree) : stmt list IH.t =
+  let df: stmt list IH.t = IH.create 64 in
+  let getDF (s: stmt) =
+    match IH.tryfind df s.sid with None -> [] | Some l -> l in
+  let isIdomOf (x: stmt) (y: stmt) =
+    match IH.tryfind idomData y.sid with
+      Some (Some d) -> d.sid = x.sid
+    | _ -> false
+  in
+  domTreeIter
+    (fun x ->
+      let frontier = ref [] in
+      let seen: unit IH.t = IH.create 8 in
+      let add (y: stmt) =
+        if not (isIdomOf x y) && not (IH.mem seen y.sid) then begin
+          IH.add seen y.sid ();
+          frontier := y :: !frontier
+        end
+      in
+      (* The local part: successors not immediately dominated by x *)
+      List.iter add x.succs;
+      (* The part passed up from the children in the dominator tree *)
+      List.iter (fun z -> List.iter add (getDF z)) (children t x);
+      if !frontier <> [] then IH.replace df x.sid !frontier)
+    PostOrder t;
+  df
+
 (** Compute the start of the natural loops. For each start, keep a list of
  * origin of a back edge. The loop consists of the loop start and all
  * predecessors of the origins of back edges, up to and including the loop
@@ -358,3 +367,144 @@ let findNaturalLoops (f: fundec)
               loops);
 
   loops
+
+(** {b Loop forests.} The natural loops of a function arranged by
+ * nesting, with per-statement membership precomputed, so that "is this
+ * statement in a loop, and how deep" is an array read rather than a
+ * scan of the lists findNaturalLoops returns. *)
+type loopForest = {
+    lfBase: int;
+    (** Subtract from a sid to index lfLoopOf and lfDepth *)
+    lfLoopOf: int array;
+    (** Maps sid - lfBase to the number of the innermost loop
+     * containing the statement, or -1 if it is in no loop *)
+    lfDepth: int array;
+    (** Maps sid - lfBase to the loop nesting depth of the statement;
+     * 0 outside all loops *)
+    lfHeaders: stmt array;
+    (** Maps a loop number to its header statement *)
+    lfParent: int array;
+    (** Maps a loop number to the number of the enclosing loop, or -1
+     * for an outermost loop. Loops are numbered in preorder over the
+     * forest, so a parent's number is always smaller than its
+     * children's *)
+  }
+
+let computeLoopForest (f: fundec)
+                      (idomData: stmt option IH.t) : loopForest =
+  match f.sallstmts with
+    [] -> { lfBase = 0; lfLoopOf = [||]; lfDepth = [||];
+            lfHeaders = [||]; lfParent = [||] }
+  | first :: _ ->
+      let base, maxid =
+        List.fold_left
+          (fun (lo, hi) s -> ((min lo s.sid), (max hi s.sid)))
+          (first.sid, first.sid) f.sallstmts in
+      let n = maxid - base + 1 in
+      let natural = findNaturalLoops f idomData in
+      let nl = List.length natural in
+      let headers = Array.make nl dummyStmt in
+      let bodies = Array.make nl [] in
+      let bsize = Array.make nl 0 in
+      (* mark.(i) holds the index of the last loop whose body walk
+       * reached statement i, so one scratch array serves all loops *)
+      let mark = Array.make n (-1) in
+      List.iteri
+        (fun l (h, backs) ->
+          headers.(l) <- h;
+          mark.(h.sid - base) <- l;
+          let body = ref [h] in
+          let size = ref 1 in
+          (* The loop body: the header plus everything that reaches a
+           * back-edge origin without passing through the header *)
+          let work = ref backs in
+          let rec drain () =
+            match !work with
+              [] -> ()
+            | s :: rest ->
+                work := rest;
+                let i = s.sid - base in
+                if mark.(i) <> l then begin
+                  mark.(i) <- l;
+                  body := s :: !body;
+                  incr size;
+                  work := s.preds @ !work
+                end;
+                drain ()
+          in
+          drain ();
+          bodies.(l) <- !body;
+          bsize.(l) <- !size)
+        natural;
+      (* Distinct-header natural loops are either disjoint or strictly
+       * nested, so processing them from largest body to smallest means
+       * that when loop l comes up, loopOf still maps l's header to the
+       * innermost strictly larger loop containing it: l's parent *)
+      let order = Array.init nl (fun i -> i) in
+      Array.sort (fun a b -> compare bsize.(b) bsize.(a)) order;
+      let loopOf = Array.make n (-1) in
+      let depth = Array.make n 0 in
+      let parent = Array.make nl (-1) in
+      Array.iter
+        (fun l ->
+          parent.(l) <- loopOf.(headers.(l).sid - base);
+          List.iter
+            (fun s ->
+              let i = s.sid - base in
+              loopOf.(i) <- l;
+              depth.(i) <- depth.(i) + 1)
+            bodies.(l))
+        order;
+      (* Renumber the loops in preorder over the forest, visiting
+       * siblings in program order of their headers *)
+      let children = Array.make nl [] in
+      let roots = ref [] in
+      for l = nl - 1 downto 0 do
+        if parent.(l) < 0 then roots := l :: !roots
+        else children.(parent.(l)) <- l :: children.(parent.(l))
+      done;
+      let bySid =
+        List.sort (fun a b -> compare headers.(a).sid headers.(b).sid) in
+      let perm = Array.make nl (-1) in
+      let next = ref 0 in
+      let rec assign l =
+        perm.(l) <- !next;
+        incr next;
+        List.iter assign (bySid children.(l))
+      in
+      List.iter assign (bySid !roots);
+      let headers' = Array.make nl dummyStmt in
+      let parent' = Array.make nl (-1) in
+      for l = 0 to nl - 1 do
+        headers'.(perm.(l)) <- headers.(l);
+        parent'.(perm.(l)) <-
+          (if parent.(l) < 0 then -1 else perm.(parent.(l)))
+      done;
+      for i = 0 to n - 1 do
+        if loopOf.(i) >= 0 then loopOf.(i) <- perm.(loopOf.(i))
+      done;
+      { lfBase = base; lfLoopOf = loopOf; lfDepth = depth;
+        lfHeaders = headers'; lfParent = parent' }
+
+let loopDepth (lf: loopForest) (s: stmt) : int =
+  let i = s.sid - lf.lfBase in
+  if i >= 0 && i < Array.length lf.lfDepth then lf.lfDepth.(i) else 0
+
+let loopOf (lf: loopForest) (s: stmt) : int =
+  let i = s.sid - lf.lfBase in
+  if i >= 0 && i < Array.length lf.lfLoopOf then lf.lfLoopOf.(i) else -1
+
+let loopCount (lf: loopForest) : int = Array.length lf.lfHeaders
+
+(* One-entry memo so the many clients inside one pass share a forest.
+ * Keyed by the fundec and its sallstmts list: computeCFGInfo rebuilds
+ * sallstmts, so recomputing the CFG invalidates the entry naturally *)
+let lastForest : (fundec * stmt list * loopForest) option ref = ref None
+
+let getLoopForest (f: fundec) (idomData: stmt option IH.t) : loopForest =
+  match !lastForest with
+    Some (f', stmts', lf) when f' == f && stmts' == f.sallstmts -> lf
+  | _ ->
+      let lf = computeLoopForest f idomData in
+      lastForest := Some (f, f.sallstmts, lf);
+      lf
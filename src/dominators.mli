@@ -29,6 +29,30 @@ val dominates: Cil.stmt option Inthash.t -> Cil.stmt -> Cil.stmt -> bool
 (** Return a list of statements dominated by the argument *)
 val children: tree -> Cil.stmt -> Cil.stmt list
 
+(** Maps the id of every statement in a dominator tree to its pre and
+ * postorder visit numbers in a depth-first traversal of the tree *)
+type intervals = (int * int) Inthash.t
+
+(** Number a dominator tree in depth-first order. A statement dominates
+ * another exactly when its interval contains the other's, so
+ * {!Dominators.intervalDominates} answers each query with two integer
+ * comparisons. Use this instead of {!Dominators.dominates} when making
+ * many queries over the same function. *)
+val computeDomIntervals: tree -> intervals
+
+(** Check whether one statement dominates another, in constant time.
+ * Statements absent from the numbering (the unreachable ones) dominate
+ * only themselves, as with {!Dominators.dominates}. *)
+val intervalDominates: intervals -> Cil.stmt -> Cil.stmt -> bool
+
+(** Compute the dominance frontier of every reachable statement: the
+ * statements Y such that the given statement dominates a predecessor of Y
+ * but does not strictly dominate Y. Takes the results of
+ * {!Dominators.computeDomTree}. Statements with an empty frontier do not
+ * appear in the table. *)
+val computeDomFrontier: Cil.stmt option Inthash.t -> tree ->
+                        Cil.stmt list Inthash.t
+
 type order = PreOrder | PostOrder
 
 (** Iterate over a dominator tree *)
@@ -41,3 +65,44 @@ val domTreeIter: (Cil.stmt -> unit) -> order -> tree -> unit
 val findNaturalLoops: Cil.fundec -> 
                       Cil.stmt option Inthash.t -> 
                       (Cil.stmt * Cil.stmt list) list
+
+(** The natural loops of a function arranged by nesting, with
+ * per-statement membership precomputed: loop-depth and
+ * innermost-loop queries are array reads rather than scans of the
+ * lists {!Dominators.findNaturalLoops} returns. Loops are numbered in
+ * preorder over the forest (parents before children, siblings in
+ * program order of their headers). *)
+type loopForest = {
+    lfBase: int;
+    (** Subtract from a sid to index lfLoopOf and lfDepth *)
+    lfLoopOf: int array;
+    (** Maps sid - lfBase to the number of the innermost loop
+     * containing the statement, or -1 if it is in no loop *)
+    lfDepth: int array;
+    (** Maps sid - lfBase to the loop nesting depth of the statement;
+     * 0 outside all loops *)
+    lfHeaders: Cil.stmt array;
+    (** Maps a loop number to its header statement *)
+    lfParent: int array;
+    (** Maps a loop number to the enclosing loop, or -1 for an
+     * outermost loop; always smaller than the loop's own number *)
+  }
+
+(** Build the loop forest of a function from its natural loops. Takes
+ * the immediate dominator information of {!Dominators.computeIDom}. *)
+val computeLoopForest: Cil.fundec -> Cil.stmt option Inthash.t ->
+                       loopForest
+
+(** Like {!Dominators.computeLoopForest} but memoizes the most recent
+ * function, so the clients inside one pass share a single forest. The
+ * memo is dropped when the CFG of the function is recomputed. *)
+val getLoopForest: Cil.fundec -> Cil.stmt option Inthash.t -> loopForest
+
+(** The loop nesting depth of a statement; 0 outside all loops *)
+val loopDepth: loopForest -> Cil.stmt -> int
+
+(** The innermost loop containing a statement, or -1 if none *)
+val loopOf: loopForest -> Cil.stmt -> int
+
+(** The number of loops in the forest *)
+val loopCount: loopForest -> int
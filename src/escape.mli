@@ -41,8 +41,21 @@
 type wchar = int64
 type wstring = wchar list
 
+(** A Bigarray of bytes, as used by Cil for string literals stored
+    outside the OCaml heap *)
+type bigstring =
+    (char, Bigarray.int8_unsigned_elt, Bigarray.c_layout) Bigarray.Array1.t
+
 (** escape various constructs in accordance with C lexical rules *)
 val escape_char : char -> string
 val escape_string : string -> string
+
+(** like [escape_string], reading directly from an off-heap buffer *)
+val escape_bigstring : bigstring -> string
+
+(** like [escape_bigstring], appending to the given buffer instead of
+    building a string *)
+val escape_bigstring_buf : Buffer.t -> bigstring -> unit
+
 val escape_wchar : wchar -> string
 val escape_wstring : wstring -> string
@@ -181,9 +181,10 @@ let compareTypes ?(ignoreSign=true)
     in
     typeSigWithAttrs ~ignoreSign (List.filter attrFilter) t
   in
-  (typeSigNC t1) = (typeSigNC t2)
+  t1 == t2 || (typeSigNC t1) = (typeSigNC t2)
 
 let compareTypesNoAttributes ?(ignoreSign=true) (t1 : typ) (t2 : typ) : bool =
+  t1 == t2 ||
   let typSig = typeSigWithAttrs ~ignoreSign:ignoreSign (fun _ -> []) in
   Util.equals (typSig t1) (typSig t2)
 
@@ -270,6 +271,75 @@ let compareExpDeepStripCasts (e1 : exp) (e2 : exp) : bool =
   compareExp (stripCastsDeepForPtrArith e1) (stripCastsDeepForPtrArith e2)
 
 
+(**************************************************************************)
+(* Expression hashing *)
+
+(* Hash functions consistent with the comparisons above: expressions (or
+ * lvals) that compare equal get equal hashes, so they can key a hashtable
+ * directly instead of going through an association list or structural
+ * Hashtbl.hash (which hashes the attributes and types along with the
+ * expression).
+ *
+ * compareExp falls back to comparing constant-folded integer values, so
+ * every expression that folds to an integer is hashed by that value
+ * alone.  The physical equality tests in the comparisons (e.g. on the
+ * types of casts) need no counterpart here; leaving those components out
+ * only makes the hash coarser, never inconsistent. *)
+
+let hashCombine (h1: int) (h2: int) : int =
+  197 * h1 + h2
+
+let rec hashExp (e: exp) : int =
+  match e with
+  | Lval lv -> hashCombine 2 (hashLval lv)
+  | StartOf lv -> hashCombine 3 (hashLval lv)
+  | AddrOf lv -> hashCombine 4 (hashLval lv)
+  | _ -> begin
+      (* can the whole expression be compared as an integer? *)
+      match getInteger (constFold true e) with
+      | Some i -> hashCombine 1 (Hashtbl.hash (string_of_cilint i))
+      | None -> begin
+          match e with
+          | BinOp (bop, l, r, _) ->
+              hashCombine (hashCombine (Hashtbl.hash bop) (hashExp l))
+                (hashExp r)
+          | CastE (_, e') -> hashCombine 5 (hashExp e')
+          | _ ->
+              (* only physically (hence structurally) equal expressions
+               * compare equal here *)
+              Hashtbl.hash e
+        end
+    end
+
+and hashLval (lv: lval) : int =
+  let rec hashOffset (off: offset) : int =
+    match off with
+    | NoOffset -> 7
+    | Field (fld, off') ->
+        hashCombine (hashCombine fld.fcomp.ckey (Hashtbl.hash fld.fname))
+          (hashOffset off')
+    | Index (e, off') -> hashCombine (hashExp e) (hashOffset off')
+  in
+  match lv with
+  | Var vi, off -> hashCombine vi.vid (hashOffset off)
+  | Mem e, off -> hashCombine 8 (hashCombine (hashExp e) (hashOffset off))
+
+(* companions of compareExpStripCasts and compareExpDeepStripCasts *)
+let hashExpStripCasts (e: exp) : int =
+  hashExp (stripNopCasts e)
+
+let hashExpDeepStripCasts (e: exp) : int =
+  hashExp (stripCastsDeepForPtrArith e)
+
+(* Hashtable keyed by expressions, modulo value-preserving casts -- the
+ * equivalence that expression-availability passes use *)
+module ExpHash = Hashtbl.Make
+    (struct
+      type t = exp
+      let equal = compareExpStripCasts
+      let hash = hashExpStripCasts
+    end)
+
 let rec compareAttrParam (ap1 : attrparam) (ap2 : attrparam) : bool =
     ap1 == ap2 ||
     match ap1, ap2 with
@@ -37,6 +37,7 @@
 open Cil
 open Feature
 module E = Errormsg
+module IH = Inthash
 
 let debug = false
 
@@ -64,6 +65,9 @@ type node =
   mutable preds: node list;
   mutable succs: node list;
   mutable predstmts: (stmt * node) list;
+  (* the node ids of succs, so that addCall does not have to scan the
+   * successor list on every call site *)
+  succset: unit IH.t;
 }
 
 type blockpt =
@@ -90,7 +94,7 @@ let newNode (name: string) (fptr: bool) (mangle: bool) : node =
     scanned = false; expand = false;
     fptr = fptr; stacksize = 0; fds = None;
     bkind = NoBlock; origkind = NoBlock;
-    preds = []; succs = []; predstmts = []; }
+    preds = []; succs = []; predstmts = []; succset = IH.create 5; }
 
 
 (* My type signature ignores attributes and function pointers. *)
@@ -193,17 +197,19 @@ let dumpFunctionCallGraphToFile () =
 
 
 let addCall (callerNode: node) (calleeNode: node) (sopt: stmt option) =
-  if not (List.exists (fun n -> n.name = calleeNode.name)
-                      callerNode.succs) then begin
+  if not (IH.mem callerNode.succset calleeNode.nodeid) then begin
     if debug then
       ignore (E.log "found call from %s to %s\n"
                     callerNode.name calleeNode.name);
+    IH.replace callerNode.succset calleeNode.nodeid ();
     callerNode.succs <- calleeNode :: callerNode.succs;
     calleeNode.preds <- callerNode :: calleeNode.preds;
   end;
   match sopt with
     Some s ->
-      if not (List.exists (fun (s', _) -> s' = s) calleeNode.predstmts) then
+      (* a duplicate can only come from another call in the same
+       * statement, so physical equality suffices here *)
+      if not (List.exists (fun (s', _) -> s' == s) calleeNode.predstmts) then
         calleeNode.predstmts <- (s, callerNode) :: calleeNode.predstmts
   | None -> ()
 
@@ -287,7 +293,9 @@ let getStmtNode (s: stmt) : node option =
   | _ -> None
 
 let addBlockingPointEdge (bptFrom: blockpt) (bptTo: blockpt) : unit =
-  if not (List.exists (fun bpt -> bpt = bptTo) bptFrom.leadsto) then
+  (* blocking points are interned by id, so comparing the ids avoids a
+   * structural comparison of the (cyclic) leadsto lists *)
+  if not (List.exists (fun bpt -> bpt.id = bptTo.id) bptFrom.leadsto) then
     bptFrom.leadsto <- bptTo :: bptFrom.leadsto
 
 let findBlockingPointEdges (bpt: blockpt) : unit =
@@ -359,22 +367,30 @@ let findBlockingPointEdges (bpt: blockpt) : unit =
   done
 
 let markYieldPoints (n: node) : unit =
-  let rec markNode (n: node) : unit =
+  (* Forward propagation from the start node, with the same explicit
+   * worklist scheme as markBlockingFunctions *)
+  let worklist : node Heap.t = Heap.create 113 in
+  let schedule (n: node) : unit =
+    if n.bkind = NoBlock then
+      Heap.insert worklist n.nodeid 0 n
+  in
+  Hashtbl.iter (fun _ n -> n.bkind <- NoBlock) functionNodes;
+  Hashtbl.iter (fun _ n -> n.bkind <- NoBlock) functionPtrNodes;
+  schedule n;
+  while not (Heap.is_empty worklist) do
+    let _, n = Heap.extract_max worklist in
     if n.bkind = NoBlock then
       match n.origkind with
         BlockTrans ->
           if n.expand || n.fptr then begin
             n.bkind <- BlockTrans;
-            List.iter markNode n.succs
+            List.iter schedule n.succs
           end else begin
             n.bkind <- BlockPoint
           end
       | _ ->
           n.bkind <- n.origkind
-  in
-  Hashtbl.iter (fun _ n -> n.bkind <- NoBlock) functionNodes;
-  Hashtbl.iter (fun _ n -> n.bkind <- NoBlock) functionPtrNodes;
-  markNode n
+  done
 
 let makeBlockingGraph (start: node) =
   let startStmt =
@@ -494,15 +510,26 @@ let gatherPragmas (f: file) : unit =
 let blockingNodes : node list ref = ref []
 
 let markBlockingFunctions () : unit =
-  let rec markFunction (n: node) : unit =
+  (* Backward propagation: whatever can reach a blocking function
+   * blocks transitively. An explicit worklist keyed by the dense node
+   * ids replaces the earlier recursion; a node scheduled twice is
+   * coalesced by the heap, and the origkind test makes requeued nodes
+   * that were marked in the meantime a no-op. *)
+  let worklist : node Heap.t = Heap.create 113 in
+  let schedule (n: node) : unit =
+    if n.origkind = NoBlock then
+      Heap.insert worklist n.nodeid 0 n
+  in
+  List.iter (fun n -> List.iter schedule n.preds) !blockingNodes;
+  while not (Heap.is_empty worklist) do
+    let _, n = Heap.extract_max worklist in
     if debug then
       ignore (E.log "marking %s\n" n.name);
     if n.origkind = NoBlock then begin
       n.origkind <- BlockTrans;
-      List.iter markFunction n.preds;
+      List.iter schedule n.preds
     end
-  in
-  List.iter (fun n -> List.iter markFunction n.preds) !blockingNodes
+  done
 
 let hasFunctionTypeAttribute (n: string) (t: typ) : bool =
   let _, _, _, a = splitFunctionType t in
@@ -705,7 +732,8 @@ let makeStartNodeTable (globs: global list) : global list =
     stackInitInfo.init <-
       Some (CompoundInit (TArray (intType, None, []), stackInit));
     let file = { fileName = "startnode.h"; globals = newGlobs;
-                 globinit = None; globinitcalled = false; } in
+                 globinit = None; globinitcalled = false;
+                 gindex = None; } in
     let channel = open_out file.fileName in
     dumpFile defaultCilPrinter channel file.fileName file;
     close_out channel;
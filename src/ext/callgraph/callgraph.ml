@@ -170,6 +170,198 @@ let computeGraph (f:file) : callgraph = begin
   graph
 end
 
+(* ------------------- incremental maintenance ------------------- *)
+(* Re-derive the edges of a single function after a pass has changed
+ * its body, instead of re-visiting the whole file: the node's old
+ * callee edges (and the matching caller backlinks) are dropped and
+ * the fundec alone is re-visited. Note that the alias lists of
+ * indirect nodes only grow; an address-of that a transformation
+ * removed is forgotten only by a full computeGraph *)
+let updateFundec (graph: callgraph) (f: fundec) : unit = begin
+  (trace "callgraph" (P.dprintf "updating function %s\n" f.svar.vname));
+  let node = getNodeForVar graph f.svar in
+  IH.iter
+    (fun _ (callee: callnode) -> IH.remove callee.cnCallers node.cnid)
+    node.cnCallees;
+  IH.clear node.cnCallees;
+  let obj: cgComputer = new cgComputer graph in
+  ignore (visitCilFunction (obj :> cilVisitor) f)
+end
+
+(* Drop the node of a deleted function altogether. Callers that still
+ * mention it will re-create the node when they are updated *)
+let removeFundec (graph: callgraph) (v: varinfo) : unit =
+  try
+    let node = H.find graph v.vname in
+    IH.iter
+      (fun _ (callee: callnode) -> IH.remove callee.cnCallers node.cnid)
+      node.cnCallees;
+    IH.iter
+      (fun _ (caller: callnode) -> IH.remove caller.cnCallees node.cnid)
+      node.cnCallers;
+    H.remove graph v.vname
+  with Not_found -> ()
+
+
+(* ------------------- dense view ------------------- *)
+(* A dense, int-indexed view of a callgraph: nodes are numbered
+ * 0 .. dgCount-1 and the adjacency lists are kept in plain arrays, so
+ * traversals can use array-indexed worklists and distance tables
+ * instead of chasing hashtable entries *)
+type denseGraph = {
+  (* number of nodes; dense numbers are 0 .. dgCount-1 *)
+  dgCount: int;
+
+  (* the node carrying each dense number *)
+  dgNodes: callnode array;
+
+  (* map from a node id (cnid) to its dense number *)
+  dgIndexOfNode: int IH.t;
+
+  (* adjacency, indexed by dense number *)
+  dgCallees: int list array;
+  dgCallers: int list array;
+}
+
+let computeDenseGraph (cg: callgraph) : denseGraph = begin
+  let count = H.length cg in
+  let indexOfNode : int IH.t = IH.create count in
+  let nodes : callnode list ref = ref [] in (* newest first *)
+  let next = ref 0 in
+  H.iter (fun _ (n: callnode) ->
+    IH.replace indexOfNode n.cnid !next;
+    nodes := n :: !nodes;
+    incr next) cg;
+  let dgNodes = Array.of_list (List.rev !nodes) in
+
+  (* every neighbor is itself a member of the graph table, so the
+   * lookups below cannot fail *)
+  let dgCallees = Array.make count [] in
+  let dgCallers = Array.make count [] in
+  Array.iteri
+    (fun i (n: callnode) ->
+      IH.iter (fun id _ ->
+        dgCallees.(i) <- IH.find indexOfNode id :: dgCallees.(i)) n.cnCallees;
+      IH.iter (fun id _ ->
+        dgCallers.(i) <- IH.find indexOfNode id :: dgCallers.(i)) n.cnCallers)
+    dgNodes;
+
+  { dgCount = count;
+    dgNodes = dgNodes;
+    dgIndexOfNode = indexOfNode;
+    dgCallees = dgCallees;
+    dgCallers = dgCallers; }
+end
+
+(* ------------------- strongly connected components ------------------- *)
+(* The condensation of a callgraph: components are numbered densely
+ * from 0, in bottom-up order (every callee's component has a smaller
+ * number than its callers'), so clients can keep per-component state
+ * in plain arrays and propagate summaries with a single array scan *)
+type sccGraph = {
+  (* number of components; component numbers are 0 .. sccCount-1 *)
+  sccCount: int;
+
+  (* map from a node id (cnid) to the number of its component *)
+  sccOfNode: int IH.t;
+
+  (* the members of each component, indexed by component number *)
+  sccNodes: callnode list array;
+
+  (* edges of the condensed DAG, indexed by component number; no
+   * duplicates and no self edges *)
+  sccCallees: int list array;
+  sccCallers: int list array;
+}
+
+(* Tarjan's algorithm. Components are emitted in reverse topological
+ * order of the condensation, which for call edges means callees
+ * before callers; numbering them in emission order gives the
+ * bottom-up property above *)
+let computeSCCs (cg: callgraph) : sccGraph = begin
+  let index = ref 0 in        (* next DFS discovery index *)
+  let count = ref 0 in        (* next component number *)
+  let indices  : int IH.t = IH.create 37 in
+  let lowlinks : int IH.t = IH.create 37 in
+  let onstack  : unit IH.t = IH.create 37 in
+  let stack : callnode list ref = ref [] in
+  let sccOfNode : int IH.t = IH.create 37 in
+  let members : callnode list list ref = ref [] in (* newest first *)
+
+  let rec strongconnect (n: callnode) : unit =
+    IH.replace indices n.cnid !index;
+    IH.replace lowlinks n.cnid !index;
+    incr index;
+    stack := n :: !stack;
+    IH.replace onstack n.cnid ();
+    IH.iter
+      (fun id (callee: callnode) ->
+        if not (IH.mem indices id) then begin
+          strongconnect callee;
+          IH.replace lowlinks n.cnid
+            (min (IH.find lowlinks n.cnid) (IH.find lowlinks id))
+        end else if IH.mem onstack id then
+          IH.replace lowlinks n.cnid
+            (min (IH.find lowlinks n.cnid) (IH.find indices id)))
+      n.cnCallees;
+    if IH.find lowlinks n.cnid = IH.find indices n.cnid then begin
+      (* n is the root of a component; pop the members off the stack *)
+      let rec pop (acc: callnode list) : callnode list =
+        match !stack with
+          [] -> assert false
+        | m :: rest ->
+            stack := rest;
+            IH.remove onstack m.cnid;
+            IH.replace sccOfNode m.cnid !count;
+            if m.cnid = n.cnid then m :: acc else pop (m :: acc)
+      in
+      members := pop [] :: !members;
+      incr count
+    end
+  in
+  H.iter (fun _ (n: callnode) ->
+    if not (IH.mem indices n.cnid) then strongconnect n) cg;
+
+  let sccNodes = Array.make !count [] in
+  let fill (c: int) (ms: callnode list) : int =
+    sccNodes.(c) <- ms;
+    c - 1
+  in
+  ignore (List.fold_left fill (!count - 1) !members);
+
+  (* build the condensed DAG, dropping duplicate and self edges *)
+  let sccCallees = Array.make !count [] in
+  let sccCallers = Array.make !count [] in
+  let edgeSeen : (int * int, unit) H.t = H.create 37 in
+  let addEdge (c1: int) (c2: int) : unit =
+    if c1 <> c2 && not (H.mem edgeSeen (c1, c2)) then begin
+      H.add edgeSeen (c1, c2) ();
+      sccCallees.(c1) <- c2 :: sccCallees.(c1);
+      sccCallers.(c2) <- c1 :: sccCallers.(c2)
+    end
+  in
+  H.iter (fun _ (n: callnode) ->
+    let c1 = IH.find sccOfNode n.cnid in
+    IH.iter (fun id _ -> addEdge c1 (IH.find sccOfNode id)) n.cnCallees)
+    cg;
+
+  { sccCount = !count;
+    sccOfNode = sccOfNode;
+    sccNodes = sccNodes;
+    sccCallees = sccCallees;
+    sccCallers = sccCallers; }
+end
+
+(* Since component numbers increase from callees to callers, a
+ * bottom-up pass is just a scan in increasing order *)
+let iterSccBottomUp (scc: sccGraph) (f: int -> callnode list -> unit) : unit =
+  Array.iteri f scc.sccNodes
+
+let iterSccTopDown (scc: sccGraph) (f: int -> callnode list -> unit) : unit =
+  for c = scc.sccCount - 1 downto 0 do
+    f c scc.sccNodes.(c)
+  done
+
 let printGraph (out:out_channel) (g:callgraph) : unit = begin
   let printEntry _ (n:callnode) : unit =
     let name = nodeName n.cnInfo in
@@ -202,15 +394,270 @@ let printGraph (out:out_channel) (g:callgraph) : unit = begin
     g
   end
 
+(* ------------------- binary save/load ------------------- *)
+(* A computed callgraph can be saved to disk and shared by the tools
+ * that analyze the same merged file, since it takes minutes to build
+ * and milliseconds to read back. The format is compact and name-based:
+ * dense node numbers, the adjacency as integer lists, and the digest
+ * of the source file, so a cache left over from a different input is
+ * rejected. Nodes are resolved against the AST by function name when
+ * the graph is loaded *)
+
+let cgFormatVersion = 1
+
+(* Save a graph computed from the file named [srcFile]. An unwritable
+ * or undigestable destination only costs time, as with the AST caches
+ * in the driver, so failures are silent *)
+let saveGraphFile (fname: string) (srcFile: string) (g: callgraph) : unit =
+  try
+    let digest = Digest.file srcFile in
+    let dg = computeDenseGraph g in
+    let oc = open_out_bin fname in
+    output_string oc "CILCG";
+    output_binary_int oc cgFormatVersion;
+    output_string oc digest;
+    output_binary_int oc dg.dgCount;
+    let writeString (s: string) : unit =
+      output_binary_int oc (String.length s);
+      output_string oc s
+    in
+    Array.iter
+      (fun (n: callnode) ->
+        match n.cnInfo with
+          NIVar (v, def) ->
+            output_binary_int oc (if !def then 0 else 1);
+            writeString v.vname
+        | NIIndirect (name, funcs) ->
+            output_binary_int oc 2;
+            writeString name;
+            output_binary_int oc (List.length !funcs);
+            List.iter (fun (v: varinfo) -> writeString v.vname) !funcs)
+      dg.dgNodes;
+    Array.iter
+      (fun (callees: int list) ->
+        output_binary_int oc (List.length callees);
+        List.iter (output_binary_int oc) callees)
+      dg.dgCallees;
+    close_out oc
+  with Sys_error _ -> ()
+
+(* Load a graph saved by saveGraphFile, resolving the node names
+ * against the globals of [forFile]. Returns None when the cache is
+ * missing, malformed, or was computed from a source that does not
+ * digest like [srcFile] *)
+let loadGraphFile (fname: string) (srcFile: string) (forFile: file)
+    : callgraph option =
+  try
+    let digest = Digest.file srcFile in
+    let ic = open_in_bin fname in
+    let give_up () = close_in ic; None in
+    if really_input_string ic 5 <> "CILCG"
+       || input_binary_int ic <> cgFormatVersion
+       || really_input_string ic 16 <> digest then
+      give_up ()
+    else begin
+      (* function definitions win over mere prototypes *)
+      let varOfName : (string, varinfo) H.t = H.create 113 in
+      List.iter
+        (function
+            GFun (fd, _) -> H.replace varOfName fd.svar.vname fd.svar
+          | GVarDecl (vi, _) when isFunctionType vi.vtype ->
+              if not (H.mem varOfName vi.vname) then H.add varOfName vi.vname vi
+          | _ -> ())
+        forFile.globals;
+      let lookupVar (name: string) : varinfo =
+        try H.find varOfName name
+        (* the function is gone from the AST; give the node a varinfo
+         * of its own so the graph is still well formed *)
+        with Not_found -> makeGlobalVar name (TFun (voidType, None, false, []))
+      in
+      let readString () : string =
+        really_input_string ic (input_binary_int ic) in
+      let count = input_binary_int ic in
+      let infos = ref [] in
+      for _i = 1 to count do
+        let info =
+          match input_binary_int ic with
+            (0 | 1) as kind -> NIVar (lookupVar (readString ()), ref (kind = 0))
+          | 2 ->
+              let name = readString () in
+              let naliases = input_binary_int ic in
+              let aliases = ref [] in
+              for _j = 1 to naliases do
+                aliases := lookupVar (readString ()) :: !aliases
+              done;
+              NIIndirect (name, ref (List.rev !aliases))
+          | _ -> raise Exit
+        in
+        infos := info :: !infos
+      done;
+      let nodes =
+        Array.mapi
+          (fun i info -> { cnid = i; cnInfo = info;
+                           cnCallees = IH.create 5;
+                           cnCallers = IH.create 5 })
+          (Array.of_list (List.rev !infos)) in
+      Array.iter
+        (fun (n: callnode) ->
+          let ncallees = input_binary_int ic in
+          for _j = 1 to ncallees do
+            let callee = nodes.(input_binary_int ic) in
+            IH.replace n.cnCallees callee.cnid callee;
+            IH.replace callee.cnCallers n.cnid n
+          done)
+        nodes;
+      close_in ic;
+      (* nodes made later must not reuse the dense ids *)
+      if !nodeId < count then nodeId := count;
+      let g : callgraph = H.create 37 in
+      Array.iter (fun (n: callnode) -> H.replace g (nodeName n.cnInfo) n) nodes;
+      Some g
+    end
+  with Sys_error _ | End_of_file | Exit -> None
+
+(* ------------------- DOT output ------------------- *)
+(* Streaming DOT output of a subgraph. [select] decides which nodes
+ * are in; each included node and its surviving callee edges are
+ * written as they are visited and labels are rendered for included
+ * nodes only, so extracting a small region of interest costs the
+ * region, not the whole graph. Edges leaving the subgraph are
+ * suppressed *)
+let printDotFiltered (out: out_channel) (g: callgraph)
+                     (select: callnode -> bool) : unit = begin
+  fprintf out "digraph callgraph {\n";
+  H.iter
+    (fun _ (n: callnode) ->
+      if select n then begin
+        (match n.cnInfo with
+          NIVar (v, def) ->
+            fprintf out "  n%d [label=\"%s\"%s];\n" n.cnid v.vname
+              (if !def then "" else " style=dashed")
+        | NIIndirect (name, _) ->
+            fprintf out "  n%d [label=\"%s\" shape=box];\n" n.cnid name);
+        IH.iter
+          (fun _ (callee: callnode) ->
+            if select callee then
+              fprintf out "  n%d -> n%d;\n" n.cnid callee.cnid)
+          n.cnCallees
+      end)
+    g;
+  fprintf out "}\n"
+end
+
+(* the selectors for printDotFiltered *)
+let selectAll (_: callnode) : bool = true
+
+(* the nodes whose name contains the given substring *)
+let selectNameContains (pat: string) : callnode -> bool =
+  let np = String.length pat in
+  let contains (s: string) : bool =
+    let ns = String.length s in
+    let rec tryAt (i: int) : bool =
+      if i + np > ns then false
+      else if String.sub s i np = pat then true
+      else tryAt (i + 1)
+    in
+    np = 0 || tryAt 0
+  in
+  fun n -> contains (nodeName n.cnInfo)
+
+(* the nodes within [depth] call edges, in either direction, of the
+ * function with the given name *)
+let selectWithinDepth (g: callgraph) (rootName: string) (depth: int)
+    : callnode -> bool =
+  let included : unit IH.t = IH.create 113 in
+  (try
+    let root = H.find g rootName in
+    IH.replace included root.cnid ();
+    let frontier = ref [root] in
+    let d = ref 0 in
+    while !d < depth && !frontier <> [] do
+      let next = ref [] in
+      let note _ (m: callnode) : unit =
+        if not (IH.mem included m.cnid) then begin
+          IH.replace included m.cnid ();
+          next := m :: !next
+        end
+      in
+      List.iter
+        (fun (n: callnode) ->
+          IH.iter note n.cnCallees; IH.iter note n.cnCallers)
+        !frontier;
+      frontier := !next;
+      incr d
+    done
+  with Not_found ->
+    ignore (E.warn "callgraph: no function named %s to root the dump at"
+              rootName));
+  fun n -> IH.mem included n.cnid
+
+(* the strongly connected component of the function with the given
+ * name *)
+let selectScc (g: callgraph) (rootName: string) : callnode -> bool =
+  try
+    let scc = computeSCCs g in
+    let c = IH.find scc.sccOfNode (H.find g rootName).cnid in
+    fun n -> IH.find scc.sccOfNode n.cnid = c
+  with Not_found ->
+    ignore (E.warn "callgraph: no function named %s to root the dump at"
+              rootName);
+    fun _ -> false
+
+(* feature options: where to write the DOT dump and which subgraph *)
+let dumpDot : string ref = ref ""
+let dotRoot : string ref = ref ""
+let dotDepth : int ref = ref max_int
+let dotScc : bool ref = ref false
+let dotPattern : string ref = ref ""
+
+(* where to cache the computed graph between tool invocations *)
+let cacheFile : string ref = ref ""
+
 let feature =
   { fd_name = "callgraph";
     fd_enabled = false;
     fd_description = "generation of a static call graph";
-    fd_extraopt = [];
+    fd_extraopt = [
+      "--cgDot", Arg.String (fun s -> dumpDot := s),
+        "<file> write the call graph in DOT form to <file> instead of dumping text to stdout";
+      "--cgRoot", Arg.String (fun s -> dotRoot := s),
+        "<name> restrict the DOT dump to the neighborhood (see --cgDepth) or the SCC (see --cgScc) of function <name>";
+      "--cgDepth", Arg.Int (fun n -> dotDepth := n),
+        "<n> with --cgRoot, include only the nodes within n call edges of the root (default: all reachable)";
+      "--cgScc", Arg.Set dotScc,
+        " with --cgRoot, include only the strongly connected component of the root";
+      "--cgPattern", Arg.String (fun s -> dotPattern := s),
+        "<substring> restrict the DOT dump to the functions whose name contains <substring>";
+      "--cgCache", Arg.String (fun s -> cacheFile := s),
+        "<file> reuse the call graph saved in <file> when its digest matches the input,\n\t\t\t\totherwise compute the graph and save it there";
+    ];
     fd_doit =
     (function (f: file) ->
-      let graph:callgraph = computeGraph f in
-      printGraph stdout graph);
+      let graph:callgraph =
+        if !cacheFile <> "" then
+          match loadGraphFile !cacheFile f.fileName f with
+            Some g ->
+              (trace "callgraph" (P.dprintf "loaded cached graph from %s\n"
+                                    !cacheFile));
+              g
+          | None ->
+              let g = computeGraph f in
+              saveGraphFile !cacheFile f.fileName g;
+              g
+        else computeGraph f in
+      if !dumpDot <> "" then begin
+        let select =
+          if !dotRoot <> "" then
+            if !dotScc then selectScc graph !dotRoot
+            else selectWithinDepth graph !dotRoot !dotDepth
+          else if !dotPattern <> "" then selectNameContains !dotPattern
+          else selectAll
+        in
+        let out = open_out !dumpDot in
+        printDotFiltered out graph select;
+        close_out out
+      end else
+        printGraph stdout graph);
     fd_post_check = false;
   }
 
@@ -80,13 +80,103 @@ type callgraph =
   (string, callnode) Hashtbl.t
 
 
-(* ----------------- functions ------------------- *)  
+(* ------------------- dense view ------------------- *)
+(* a dense, int-indexed view of a callgraph: nodes are numbered
+ * 0 .. dgCount-1 and the adjacency lists are kept in plain arrays, so
+ * traversals can use array-indexed worklists and distance tables *)
+type denseGraph = {
+  (* number of nodes; dense numbers are 0 .. dgCount-1 *)
+  dgCount: int;
+
+  (* the node carrying each dense number *)
+  dgNodes: callnode array;
+
+  (* map from a node id (cnid) to its dense number *)
+  dgIndexOfNode: int Inthash.t;
+
+  (* adjacency, indexed by dense number *)
+  dgCallees: int list array;
+  dgCallers: int list array;
+}
+
+
+(* ------------- strongly connected components ------------- *)
+(* the condensation of a callgraph: components are numbered densely
+ * from 0, in bottom-up order (every callee's component has a smaller
+ * number than its callers'), so clients can keep per-component state
+ * in plain arrays *)
+type sccGraph = {
+  (* number of components; component numbers are 0 .. sccCount-1 *)
+  sccCount: int;
+
+  (* map from a node id (cnid) to the number of its component *)
+  sccOfNode: int Inthash.t;
+
+  (* the members of each component, indexed by component number *)
+  sccNodes: callnode list array;
+
+  (* edges of the condensed DAG, indexed by component number; no
+   * duplicates and no self edges *)
+  sccCallees: int list array;
+  sccCallers: int list array;
+}
+
+
+(* ----------------- functions ------------------- *)
 (* given a CIL file, compute its static call graph *)
 val computeGraph : Cil.file -> callgraph
 
+(* re-derive the edges of a single function after a pass has changed
+ * its body, instead of recomputing the whole graph. The alias lists
+ * of indirect nodes only grow; an address-of that a transformation
+ * removed is forgotten only by a full computeGraph *)
+val updateFundec : callgraph -> Cil.fundec -> unit
+
+(* drop the node of a deleted function; callers that still mention it
+ * will re-create it when they are updated *)
+val removeFundec : callgraph -> Cil.varinfo -> unit
+
+(* compute the dense view of a callgraph *)
+val computeDenseGraph : callgraph -> denseGraph
+
+(* compute the strongly connected components of a callgraph, using
+ * Tarjan's algorithm *)
+val computeSCCs : callgraph -> sccGraph
+
+(* visit every component with its members, callees before callers
+ * (resp. callers before callees) *)
+val iterSccBottomUp : sccGraph -> (int -> callnode list -> unit) -> unit
+val iterSccTopDown : sccGraph -> (int -> callnode list -> unit) -> unit
+
+(* save a computed callgraph in a compact binary form: dense node
+ * numbers, adjacency as integers, and the digest of the source file
+ * named by the second argument. Failures are silent, as with the AST
+ * caches *)
+val saveGraphFile : string -> string -> callgraph -> unit
+
+(* load a graph saved by saveGraphFile, resolving node names against
+ * the globals of the given file. None when the cache is missing,
+ * malformed, or was computed from a source whose digest differs *)
+val loadGraphFile : string -> string -> Cil.file -> callgraph option
+
 (* print the callgraph in a human-readable format to a channel *)
 val printGraph : out_channel -> callgraph -> unit
 
+(* print a subgraph in DOT form, streaming: the selector decides which
+ * nodes are in, labels are rendered for included nodes only, and edges
+ * leaving the subgraph are suppressed *)
+val printDotFiltered : out_channel -> callgraph ->
+                       (callnode -> bool) -> unit
+
+(* selectors for printDotFiltered *)
+val selectAll : callnode -> bool
+val selectNameContains : string -> callnode -> bool
+(* the nodes within the given number of call edges, in either
+ * direction, of the named function *)
+val selectWithinDepth : callgraph -> string -> int -> callnode -> bool
+(* the strongly connected component of the named function *)
+val selectScc : callgraph -> string -> callnode -> bool
+
 
 val feature: Feature.t
 (*
@@ -163,8 +163,11 @@ class canonicalizeVisitor = object(self)
 	let typeOfDest = typeOfLval dest in
 	match unrollType typeOfDest with
 	  TEnum _ -> (* add an explicit cast *)
-	    let newI = Set(dest, mkCast ~e:exp ~newt:typeOfDest, l) in
-	    ChangeTo [newI]
+	    let newE = mkCast ~e:exp ~newt:typeOfDest in
+	    if newE == exp then (* already the right type; leave it alone *)
+	      SkipChildren
+	    else
+	      ChangeTo [Set(dest, newE, l)]
 	| _ -> SkipChildren
       end
     | Call (dest, f, args, l) -> begin
@@ -174,13 +177,17 @@ class canonicalizeVisitor = object(self)
 	else
 	  match formals with
 	    Some formals' -> begin
+	      let changed: bool ref = ref false in
 	      let newArgs = try
 		(*Iterate over the arguments, looking for formals that
 		   expect enum types, and insert casts where necessary. *)
 		List.map2
 		  (fun (actual: exp) (formalName, formalType, _) ->
 		    match unrollType formalType with
-		      TEnum _ -> mkCast ~e:actual ~newt:formalType
+		      TEnum _ ->
+			let actual' = mkCast ~e:actual ~newt:formalType in
+			if actual' != actual then changed := true;
+			actual'
 		    | _ ->  actual)
 		  args
 		  formals'
@@ -188,8 +195,10 @@ class canonicalizeVisitor = object(self)
 		E.s (error "Number of arguments to %a doesn't match type."
 		       d_exp f)
 	      in
-	      let newI = Call(dest, f, newArgs, l) in
-	      ChangeTo [newI]
+	      if !changed then
+		ChangeTo [Call(dest, f, newArgs, l)]
+	      else (* no cast was needed; keep the original instruction *)
+		SkipChildren
 	    end
 	  | None -> begin
   (* #4. No arguments were specified for this type.  To fix this, infer the
@@ -222,6 +231,7 @@ class canonicalizeVisitor = object(self)
       SingleInit e -> DoChildren (* we don't handle simple initializers here,
 				  because we don't know what type is expected.
 				  This should be done in vglob if needed. *)
+    | RepeatInit _ -> DoChildren
     | CompoundInit(t, initList) ->
 	let changed: bool ref = ref false in
 	let initList' = Util.list_map
@@ -259,7 +269,8 @@ class canonicalizeVisitor = object(self)
 	  splitFunctionType currentFunction.svar.vtype in
 	match unrollType typeOfDest with
 	  TEnum _ ->
-	    stmt.skind <- Return (Some (mkCast ~e:exp ~newt:typeOfDest), l)
+	    let newE = mkCast ~e:exp ~newt:typeOfDest in
+	    if newE != exp then stmt.skind <- Return (Some newE, l)
 	| _ -> ()
       end
     | _ -> ());
@@ -461,13 +461,46 @@ let getMaxANTI (name1 : string) (name2 : string) (facts : FactSet.t) : int =
        | _ -> -1)
     facts
 
+(* One-pass tables of the maximum counts in a fact set, so that
+ * trimFacts and joinFacts can look maxima up instead of rescanning the
+ * whole set for every element. The keys mirror the getMax* functions
+ * above. *)
+type factMaxima = {
+  maxACC : (string, int) Hashtbl.t;
+  maxANT : (string, int) Hashtbl.t;
+  maxANTI : (string * string, int) Hashtbl.t;
+}
+
+let computeFactMaxima (facts : FactSet.t) : factMaxima =
+  let m = { maxACC = Hashtbl.create 7;
+            maxANT = Hashtbl.create 7;
+            maxANTI = Hashtbl.create 7; } in
+  let bump tbl key n =
+    let cur = try Hashtbl.find tbl key with Not_found -> -1 in
+    if n > cur then Hashtbl.replace tbl key n
+  in
+  FactSet.iter
+    (fun fact ->
+       match fact with
+       | name, ACC n -> bump m.maxACC name n
+       | name, ANT n -> bump m.maxANT name n
+       | name1, ANTI (name2, n) -> bump m.maxANTI (name1, name2) n
+       | _ -> ())
+    facts;
+  m
+
+let findMax (tbl : ('a, int) Hashtbl.t) (key : 'a) : int =
+  try Hashtbl.find tbl key with Not_found -> -1
+
 let trimFacts (facts : FactSet.t) : FactSet.t =
+  let m = computeFactMaxima facts in
   FactSet.fold
     (fun fact rest ->
        match fact with
-       | name, ACC n when n < getMaxACC name facts -> rest
-       | name, ANT n when n < getMaxANT name facts -> rest
-       | name1, ANTI (name2, n) when n < getMaxANTI name1 name2 facts -> rest
+       | name, ACC n when n < findMax m.maxACC name -> rest
+       | name, ANT n when n < findMax m.maxANT name -> rest
+       | name1, ANTI (name2, n) when n < findMax m.maxANTI (name1, name2) ->
+           rest
        | _ -> FactSet.add fact rest)
     facts
     FactSet.empty
@@ -475,6 +508,7 @@ let trimFacts (facts : FactSet.t) : FactSet.t =
 let joinFacts (facts1 : FactSet.t) (facts2 : FactSet.t) : FactSet.t =
   let facts1' = trimFacts facts1 in
   let facts2' = trimFacts facts2 in
+  let m2 = computeFactMaxima facts2' in
   let join = FactSet.inter facts1' facts2' in
   FactSet.fold
     (fun fact rest ->
@@ -483,19 +517,19 @@ let joinFacts (facts1 : FactSet.t) (facts2 : FactSet.t) : FactSet.t =
        in
        match fact with
        | name, ACC n when name = "*" ->
-           let m = getMaxACC name facts2' in
+           let m = findMax m2.maxACC name in
            if m >= 0 then
              add (name, ACC (min n m))
            else
              rest
        | name, ANT n ->
-           let m = getMaxANT name facts2' in
+           let m = findMax m2.maxANT name in
            if m >= 0 then
              add (name, ANT (min n m))
            else
              rest
        | name1, ANTI (name2, n) ->
-           let m = getMaxANTI name1 name2 facts2' in
+           let m = findMax m2.maxANTI (name1, name2) in
            if m >= 0 then
              add (name1, ANTI (name2, min n m))
            else
@@ -0,0 +1,215 @@
+(* A memory census of the CIL AST.
+
+   Walks the file with a counting visitor and reports node counts by
+   constructor, how much of the tree each global accounts for, how much
+   duplication there is among locations and types, and the largest
+   functions. This is the measurement surface for work that attacks AST
+   bloat (sharing, interning): run it before and after to see whether a
+   change pays off. *)
+
+open Cil
+open Feature
+
+module E = Errormsg
+module H = Hashtbl
+
+(* how many of the largest globals and functions to list *)
+let topN = ref 10
+
+(* counts by constructor name *)
+let expCounts : (string, int) H.t = H.create 17
+let instrCounts : (string, int) H.t = H.create 17
+let stmtCounts : (string, int) H.t = H.create 17
+let typCounts : (string, int) H.t = H.create 17
+
+let lvalCount = ref 0
+let attrCount = ref 0
+
+(* duplication: how many occurrences there are versus how many distinct
+ * values, for locations and for type signatures *)
+let locTotal = ref 0
+let locDistinct : (location, unit) H.t = H.create 1021
+let typTotal = ref 0
+let typDistinct : (typsig, unit) H.t = H.create 1021
+
+(* nodes seen so far; sampled around each global to size it *)
+let nodeCount = ref 0
+
+let bump (tbl: (string, int) H.t) (key: string) : unit =
+  try H.replace tbl key (H.find tbl key + 1)
+  with Not_found -> H.add tbl key 1
+
+let seeLoc (l: location) : unit =
+  incr locTotal;
+  if not (H.mem locDistinct l) then H.add locDistinct l ()
+
+let expKind (e: exp) : string =
+  match e with
+    Const _ -> "Const"
+  | Lval _ -> "Lval"
+  | SizeOf _ -> "SizeOf"
+  | Real _ -> "Real"
+  | Imag _ -> "Imag"
+  | SizeOfE _ -> "SizeOfE"
+  | SizeOfStr _ -> "SizeOfStr"
+  | AlignOf _ -> "AlignOf"
+  | AlignOfE _ -> "AlignOfE"
+  | UnOp _ -> "UnOp"
+  | BinOp _ -> "BinOp"
+  | Question _ -> "Question"
+  | CastE _ -> "CastE"
+  | AddrOf _ -> "AddrOf"
+  | AddrOfLabel _ -> "AddrOfLabel"
+  | StartOf _ -> "StartOf"
+
+let instrKind (i: instr) : string =
+  match i with
+    Set _ -> "Set"
+  | VarDecl _ -> "VarDecl"
+  | Call _ -> "Call"
+  | Asm _ -> "Asm"
+
+let stmtKind (sk: stmtkind) : string =
+  match sk with
+    Instr _ -> "Instr"
+  | Return _ -> "Return"
+  | Goto _ -> "Goto"
+  | ComputedGoto _ -> "ComputedGoto"
+  | Break _ -> "Break"
+  | Continue _ -> "Continue"
+  | If _ -> "If"
+  | Switch _ -> "Switch"
+  | Loop _ -> "Loop"
+  | Block _ -> "Block"
+  | TryFinally _ -> "TryFinally"
+  | TryExcept _ -> "TryExcept"
+
+let typKind (t: typ) : string =
+  match t with
+    TVoid _ -> "TVoid"
+  | TInt _ -> "TInt"
+  | TFloat _ -> "TFloat"
+  | TPtr _ -> "TPtr"
+  | TArray _ -> "TArray"
+  | TFun _ -> "TFun"
+  | TNamed _ -> "TNamed"
+  | TComp _ -> "TComp"
+  | TEnum _ -> "TEnum"
+  | TBuiltin_va_list _ -> "TBuiltin_va_list"
+
+class censusVisitorClass : cilVisitor = object
+  inherit nopCilVisitor
+
+  method! vexpr (e: exp) =
+    incr nodeCount;
+    bump expCounts (expKind e);
+    DoChildren
+
+  method! vlval (_: lval) =
+    incr nodeCount;
+    incr lvalCount;
+    DoChildren
+
+  method! vinst (i: instr) =
+    incr nodeCount;
+    bump instrCounts (instrKind i);
+    seeLoc (get_instrLoc i);
+    DoChildren
+
+  method! vstmt (s: stmt) =
+    incr nodeCount;
+    bump stmtCounts (stmtKind s.skind);
+    seeLoc (get_stmtLoc s.skind);
+    DoChildren
+
+  method! vtype (t: typ) =
+    incr nodeCount;
+    incr typTotal;
+    bump typCounts (typKind t);
+    let ts = typeSig t in
+    if not (H.mem typDistinct ts) then H.add typDistinct ts ();
+    DoChildren
+
+  method! vattr (_: attribute) =
+    incr attrCount;
+    DoChildren
+end
+
+let globalName (g: global) : string =
+  match g with
+    GType (ti, _) -> "typedef " ^ ti.tname
+  | GCompTag (ci, _) -> compFullName ci
+  | GCompTagDecl (ci, _) -> compFullName ci ^ " (decl)"
+  | GEnumTag (ei, _) -> "enum " ^ ei.ename
+  | GEnumTagDecl (ei, _) -> "enum " ^ ei.ename ^ " (decl)"
+  | GVarDecl (vi, _) -> vi.vname ^ " (decl)"
+  | GVar (vi, _, _) -> vi.vname
+  | GFun (fd, _) -> fd.svar.vname
+  | GAsm _ -> "<asm>"
+  | GPragma _ -> "<pragma>"
+  | GText _ -> "<text>"
+
+let reportCounts (what: string) (tbl: (string, int) H.t) : unit =
+  let entries = H.fold (fun k n acc -> (k, n) :: acc) tbl [] in
+  let entries =
+    List.sort (fun (_, n1) (_, n2) -> compare n2 n1) entries in
+  let total = List.fold_left (fun acc (_, n) -> acc + n) 0 entries in
+  ignore (E.log "  %s nodes: %d\n" what total);
+  List.iter
+    (fun (k, n) -> ignore (E.log "    %-16s %9d\n" k n))
+    entries
+
+let reportTop (what: string) (sizes: (string * int) list) : unit =
+  let sorted =
+    List.sort (fun (_, n1) (_, n2) -> compare n2 n1) sizes in
+  ignore (E.log "  largest %s:\n" what);
+  let rec loop n l =
+    match l with
+      (name, sz) :: rest when n < !topN ->
+        ignore (E.log "    %-32s %9d nodes\n" name sz);
+        loop (n + 1) rest
+    | _ -> ()
+  in
+  loop 0 sorted
+
+let doit (f: file) : unit =
+  let vis = new censusVisitorClass in
+  let globalSizes = ref [] in
+  let funSizes = ref [] in
+  iterGlobals f
+    (fun g ->
+      seeLoc (get_globalLoc g);
+      let before = !nodeCount in
+      ignore (visitCilGlobal vis g);
+      let size = !nodeCount - before in
+      globalSizes := (globalName g, size) :: !globalSizes;
+      match g with
+        GFun (fd, _) -> funSizes := (fd.svar.vname, size) :: !funSizes
+      | _ -> ());
+  ignore (E.log "AST census for %s:\n" f.fileName);
+  ignore (E.log "  total nodes: %d (plus %d lvals, %d attributes)\n"
+            !nodeCount !lvalCount !attrCount);
+  reportCounts "exp" expCounts;
+  reportCounts "instr" instrCounts;
+  reportCounts "stmt" stmtCounts;
+  reportCounts "typ" typCounts;
+  ignore (E.log "  locations: %d occurrences, %d distinct\n"
+            !locTotal (H.length locDistinct));
+  ignore (E.log "  types: %d occurrences, %d distinct signatures\n"
+            !typTotal (H.length typDistinct));
+  reportTop "globals" !globalSizes;
+  reportTop "functions" !funSizes
+
+let feature =
+  { fd_name = "cilstats";
+    fd_enabled = false;
+    fd_description = "report a memory census of the CIL AST";
+    fd_extraopt = [
+      "--cilstats-top", Arg.Int (fun n -> topN := n),
+      "<n> how many of the largest globals and functions to list (default 10)";
+    ];
+    fd_doit = doit;
+    fd_post_check = false;
+  }
+
+let () = Feature.register feature
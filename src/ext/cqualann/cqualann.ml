@@ -116,89 +116,138 @@ let rec getSize t: int * typ =
 
 (* exception Unimp *)
 let uniqueUnimplLabel = ref 0
+
+(* set while the current encoding contains an "unimplemented" label;
+ * such encodings carry a unique number and must not be interned *)
+let encodeImpure = ref false
+
 let unimplementedT t =
   ignore (warn "Can't annotate unimplemented type: %a  (Attrs: %a)"
             d_type t d_attrlist (typeAttrs t));
 (*   raise Unimp *)
   incr uniqueUnimplLabel;
-  text "unimplemented" ++ num !uniqueUnimplLabel
+  encodeImpure := true;
+  "unimplemented" ^ string_of_int !uniqueUnimplLabel
+
+(* Encoded types are interned per type signature: a merged file repeats
+ * the same handful of types across thousands of declarations, and
+ * re-encoding them through Pretty dominated annotation time. The
+ * encoders build into a buffer and return plain strings. *)
+let encodedTypes : (typsig, string) Hashtbl.t = Hashtbl.create 117
 
-let rec encodeType (t:typ): doc =
-  let unimplemented () = unimplementedT t in
-  let makeType str ty: doc =
-    chr '(' ++ text str ++ chr ' ' ++ ty ++ chr ')'
+let rec encodeType (t:typ): string =
+  let ts = typeSig t in
+  try
+    Hashtbl.find encodedTypes ts
+  with Not_found ->
+    let wasImpure = !encodeImpure in
+    encodeImpure := false;
+    let b = Buffer.create 32 in
+    encodeTypeBuf b t;
+    let s = Buffer.contents b in
+    if not !encodeImpure then begin
+      Hashtbl.add encodedTypes ts s;
+      encodeImpure := wasImpure
+    end;
+    (* if the encoding was impure, leave the flag set so that enclosing
+     * encodings are not interned either *)
+    s
+
+and encodeTypeBuf (b: Buffer.t) (t:typ) : unit =
+  let makeType str inner : unit =
+    Buffer.add_char b '(';
+    Buffer.add_string b str;
+    Buffer.add_char b ' ';
+    inner ();
+    Buffer.add_char b ')'
   in
   let a = typeAttrs t in
-  let addTaint t' =
+  let addTaint inner =
     if hasAttribute tainted_attribute a then
-      makeType "tainted" t'
+      makeType "tainted" inner
     else begin
       match filterAttributes poly_taint_attribute a with
-        [] -> makeType "untainted" t'
+        [] -> makeType "untainted" inner
       | [Attr(s, [AStr varname])] ->
-          text "(poly " ++ text varname ++ chr ' ' ++ t' ++ chr ')'
+          Buffer.add_string b "(poly ";
+          Buffer.add_string b varname;
+          Buffer.add_char b ' ';
+          inner ();
+          Buffer.add_char b ')'
       | _ ->
           E.s (error "bad attributes in %a." d_plaintype t)
     end
   in
+  let addText (s: string) () = Buffer.add_string b s in
   match unrollType t with
     TInt _ as t' when bitsSizeOf t' = 32 -> (*int, uint, long, ulong*)
-      addTaint (text "int")
-  | TInt _ as t' when bitsSizeOf t' = 8 ->  addTaint (text "char")
-  | TInt _ as t' when bitsSizeOf t' = 16 -> addTaint (text "short")
+      addTaint (addText "int")
+  | TInt _ as t' when bitsSizeOf t' = 8 ->  addTaint (addText "char")
+  | TInt _ as t' when bitsSizeOf t' = 16 -> addTaint (addText "short")
   | TInt _ as t' when bitsSizeOf t' = 64 ->  (* long long *)
       if hasAttribute tainted_attribute a then
-        text builtinTLongLong
+        Buffer.add_string b builtinTLongLong
       else
-        text builtinULongLong
+        Buffer.add_string b builtinULongLong
   | TComp(ci, _) when ci.cstruct ->
-      text ci.cname
-  | TFun _ -> encodeFuncType t
-  | TVoid _ -> text "void"
+      Buffer.add_string b ci.cname
+  | TFun _ -> encodeFuncTypeBuf b t
+  | TVoid _ -> Buffer.add_string b "void"
   | TPtr(bt, _) -> begin
+      (* the base type goes through the interning cache *)
       let bt' = encodeType bt in
-      addTaint (makeType "ptr" bt')
+      addTaint (fun () -> makeType "ptr" (addText bt'))
     end
   | _ ->
-      unimplemented ()
+      Buffer.add_string b (unimplementedT t)
 
 and encodeFuncType = function
+    TFun _ as t -> encodeType t
+  | _ ->
+      E.s (bug "nonfunc in encodeFuncType")
+
+and encodeFuncTypeBuf (b: Buffer.t) = function
     TFun(rt, args, va, a) ->
       (* FIXME: varargs *)
       if va then
         ignore (warn "vararg functions unimplemented.");
       if a <> [] then
         ignore (warn "function attributes unimplemented.");
-      let params: doc =
-        docList ~sep:(chr ' ') (fun (_, t, _) ->
-                                  encodeType t)
-          () (argsToList args)
-      in
-      let rt' =
-        if bitsSizeOf rt > 32 then begin
-          E.log "The Cqual verifier doesn't currently support multi-word return values.";
-          unimplementedT rt
-        end
-        else encodeType rt
-      in
-      text "(func " ++ rt' ++ chr ' ' ++ params ++ chr ')'
+      Buffer.add_string b "(func ";
+      if bitsSizeOf rt > 32 then begin
+        E.log "The Cqual verifier doesn't currently support multi-word return values.";
+        Buffer.add_string b (unimplementedT rt)
+      end
+      else
+        Buffer.add_string b (encodeType rt);
+      Buffer.add_char b ' ';
+      let first = ref true in
+      List.iter
+        (fun (_, t, _) ->
+          if !first then first := false else Buffer.add_char b ' ';
+          Buffer.add_string b (encodeType t))
+        (argsToList args);
+      Buffer.add_char b ')'
   | _ ->
       E.s (bug "nonfunc in encodeFuncType")
 
 
 (* For arrays inside structs, unroll them into "len" different fields *)
 (* FIXME: this doesn't work well for variable access *)
-let encodeArrayType (fieldName:string) (t:typ) =
+let encodeArrayType (fieldName:string) (t:typ) : string =
   if not (isArrayType t) then
     E.s (bug " non-array passed to encodeArrayType");
   let len, bt = getSize t in
-  let acc: doc list ref = ref [] in
   let typestr = encodeType bt in
-  for i = len - 1 downto 0 do
-    let d = dprintf ", \"%s%d\", %a" fieldName i insert typestr in
-    acc := d::!acc
+  let b = Buffer.create (len * (16 + String.length typestr)) in
+  for i = 0 to len - 1 do
+    Buffer.add_string b ", \"";
+    Buffer.add_string b fieldName;
+    Buffer.add_string b (string_of_int i);
+    Buffer.add_string b "\", ";
+    Buffer.add_string b typestr
   done;
-  (docList ~sep:nil (fun x -> x) () !acc)
+  Buffer.contents b
 
 
 (*******  Annotation macros  *****************************************)
@@ -207,18 +256,15 @@ let quoted s: string =
   "\"" ^ s ^ "\""
 
 (* Like quoted, but prepends _ to identifiers if Cil.underscore_name is true.*)
-let quotedLabel s: doc =
+let quotedLabel s: string =
   if !Cil.underscore_name then
-    text ("\"_" ^ s ^ "\"")
+    "\"_" ^ s ^ "\""
   else
-     text ("\"" ^ s ^ "\"")
-
-let strOf (d:doc):string =
-  sprint ~width:1024 d
+    "\"" ^ s ^ "\""
 
 
 let globalAnn label args:  global =
-  let annstr = "#ANN(" ^ label ^", " ^ (strOf args) ^")" in
+  let annstr = "#ANN(" ^ label ^", " ^ args ^")" in
   GAsm(annstr, !currentLoc)
 
 let volatile = [Attr("volatile", [])]
@@ -231,15 +277,15 @@ let localVarAnn label func v typ sz: instr =
   (*combine the function name and the var name *)
   let vname = quotedLabel (func.svar.vname ^ ":" ^ v.vname) in
   (* FIXME: are the input/outputs right? *)
-  let annstr = dprintf "#ANN(%s, %a, %a, %d, %%0)"
-                 label  insert vname insert typ  sz
+  let annstr = "#ANN(" ^ label ^ ", " ^ vname ^ ", " ^ typ ^ ", "
+               ^ string_of_int sz ^ ", %0)"
   in
   let lv = if isArrayType v.vtype then
     (Var v, Index(Cil.zero, NoOffset))
   else
     (Var v, NoOffset)
   in
-  Asm([], [strOf annstr], [None, "=m", lv],
+  Asm([], [annstr], [None, "=m", lv],
       (* ["0", Lval(lv)] *)
       [], [], !currentLoc)
 
@@ -257,8 +303,8 @@ let localANN = "ANN_LOCAL"
 (* let localarrayANN = "ANN_LOCALARRAY" *)
 
 let allocAnn typeStr: instr =
-  let annstr = dprintf "#ANN(%s, %a)" allocANN insert typeStr in
-  Asm(volatile, [strOf annstr], [], [], [], !currentLoc)
+  let annstr = "#ANN(" ^ allocANN ^ ", " ^ typeStr ^ ")" in
+  Asm(volatile, [annstr], [], [], [], !currentLoc)
 
 (*******   Strings  *******)
 
@@ -302,12 +348,12 @@ class stringVisitor
     match e with
         Const(CStr s) ->
 (*           ignore (E.log "String without cast: %a\n" d_plainexp e); *)
-          ChangeTo(global4String s false)
+          ChangeTo(global4String (cstringToString s) false)
       | CastE(t, Const(CStr s)) ->
           let taint =  baseTypeContainsSmallocAttribute t in
 (*           ignore (E.log "%stainted String: %a\n"  *)
 (*                     (if taint then "" else "Un") d_plainexp e); *)
-          ChangeTo(CastE(t, global4String s taint))
+          ChangeTo(CastE(t, global4String (cstringToString s) taint))
       | _ -> DoChildren
   end
 end
@@ -326,7 +372,7 @@ let annotateFundec fv =
     H.add annotatedFunctions fv ();
     let fname = fv.vname in
     let ftype = encodeFuncType fv.vtype in
-    let typestr = quotedLabel fname ++ text ", " ++ ftype in
+    let typestr = quotedLabel fname ^ ", " ^ ftype in
     let ann = globalAnn funcANN typestr in
     Some ann
   end
@@ -418,20 +464,23 @@ class annotationVisitor
             end
             else if ci.cstruct then begin
               (* ignore (E.log "printing struct \"%s\"\n" ci.cname ); *)
-              let annstr = ref (text (quoted ci.cname)) in
+              let annstr = Buffer.create 128 in
+              Buffer.add_string annstr (quoted ci.cname);
               List.iter
                 (fun fi ->
                    if fi.fname = Cil.missingFieldName then
                      E.s (unimp "not a real field? in %a" d_global g);
                    if isArrayType fi.ftype then
-                     annstr := !annstr ++ encodeArrayType fi.fname fi.ftype
+                     Buffer.add_string annstr
+                       (encodeArrayType fi.fname fi.ftype)
                    else begin
-                     let typestr = encodeType fi.ftype in
-                     annstr := !annstr ++ text ", " ++ text (quoted fi.fname)
-                                       ++ text ", " ++ typestr
+                     Buffer.add_string annstr ", ";
+                     Buffer.add_string annstr (quoted fi.fname);
+                     Buffer.add_string annstr ", ";
+                     Buffer.add_string annstr (encodeType fi.ftype)
                    end)
                 ci.cfields;
-              let ann = globalAnn structANN !annstr in
+              let ann = globalAnn structANN (Buffer.contents annstr) in
               ChangeDoChildrenPost(
                 [ann; g],
                 (fun g -> g)
@@ -457,14 +506,12 @@ class annotationVisitor
                   TArray _ ->
                     let size, bt = getSize vi.vtype in
                     globalAnn globalarrayANN
-                      (dprintf "%a, %a, %d"
-                         insert (quotedLabel vi.vname)
-                         insert (encodeType bt)
-                         size)
+                      (quotedLabel vi.vname ^ ", " ^ encodeType bt
+                       ^ ", " ^ string_of_int size)
                 | TFun _ -> E.s (bug "Use GVarDecl for function prototypes.")
                 | _ -> globalAnn globalANN (quotedLabel vi.vname
-                                            ++ text ", "
-                                            ++ encodeType vi.vtype)
+                                            ^ ", "
+                                            ^ encodeType vi.vtype)
             in
             ChangeDoChildrenPost(
               [ann; g],
@@ -486,10 +533,10 @@ let entry_point (f : file) =
   ignore (E.log "Annotating function parameters.\n");
   let longlongU =
     globalAnn structANN
-      (text "\"builtinUntaintedLongLong\", \"q1\", (untainted int), \"q2\", (untainted int)") in
+      "\"builtinUntaintedLongLong\", \"q1\", (untainted int), \"q2\", (untainted int)" in
   let longlongT =
     globalAnn structANN
-      (text "\"builtinTaintedLongLong\", \"q1\", (tainted int), \"q2\", (tainted int)") in
+      "\"builtinTaintedLongLong\", \"q1\", (tainted int), \"q2\", (tainted int)" in
   newGlobals := [longlongU; longlongT];
   visitCilFileSameGlobals (new stringVisitor :>cilVisitor) f;
   f.globals <- Util.list_append !newGlobals f.globals;
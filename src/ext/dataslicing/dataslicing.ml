@@ -129,7 +129,9 @@ and sliceTypeInfo (i : int) (tinfo : typeinfo) : typeinfo =
   with Not_found ->
     let result =
       { tinfo with tname = regionStruct i tinfo.tname;
-                   ttype = sliceType i tinfo.ttype; }
+                   ttype = sliceType i tinfo.ttype;
+                   (* do not inherit the unrolling memo of the original *)
+                   tunrolled = None; }
     in
     Hashtbl.add typeInfos (i, tinfo.tname) result;
     result
@@ -0,0 +1,269 @@
+(* pdgslice.ml *)
+(* code for pdgslice.mli *)
+
+(* Program slicing over an explicit program dependence graph. The graph
+ * is built once per function -- data dependences from the reaching
+ * definitions of Reachingdefs, control dependences from postdominators --
+ * and slices are then mere graph reachability over int-indexed arrays,
+ * instead of repeated traversals of the function body. *)
+
+open Cil
+open Feature
+module E = Errormsg
+module IH = Inthash
+module RD = Reachingdefs
+module UD = Usedef
+
+(* The dependence graph of one function. Statements are numbered densely
+ * from 0 so that per-node state lives in plain arrays *)
+type pdg = {
+  (* the statement carrying each node number *)
+  pdgStmts: stmt array;
+
+  (* map from a statement id (sid) to its node number *)
+  pdgIndexOfSid: int IH.t;
+
+  (* the nodes whose values a node uses, and the nodes whose branches
+   * decide whether it executes; indexed by node number, no duplicates *)
+  pdgDataDeps: int list array;
+  pdgCtrlDeps: int list array;
+}
+
+(* Collect every statement of a function, in visiting order *)
+class stmtCollectorClass (acc: stmt list ref) = object
+  inherit nopCilVisitor
+
+  method! vstmt (s: stmt) =
+    acc := s :: !acc;
+    DoChildren
+end
+
+let collectStmts (fdec: fundec) : stmt array =
+  let acc = ref [] in
+  ignore (visitCilFunction (new stmtCollectorClass acc) fdec);
+  Array.of_list (List.rev !acc)
+
+(* Compute the immediate postdominator of every node, by iteration over
+ * the reversed CFG in the style of Cooper, Harvey and Kennedy. The
+ * virtual exit, which postdominates the return statements, is
+ * represented by the node number 'n'; -1 means the node cannot reach an
+ * exit (e.g. it sits in an infinite loop) and has no postdominators *)
+let computePostIdom (stmts: stmt array) (indexOfSid: int IH.t) : int array =
+  let n = Array.length stmts in
+  let succs : int list array = Array.make n [] in
+  let preds : int list array = Array.make n [] in
+  Array.iteri
+    (fun i (s: stmt) ->
+      succs.(i) <- List.map (fun s' -> IH.find indexOfSid s'.sid) s.succs;
+      preds.(i) <- List.map (fun s' -> IH.find indexOfSid s'.sid) s.preds)
+    stmts;
+
+  (* a reverse postorder of the reversed CFG, rooted at the exits *)
+  let rponum = Array.make (n + 1) max_int in
+  rponum.(n) <- (-1);
+  let order : int list ref = ref [] in (* reverse postorder, head first *)
+  let seen = Array.make n false in
+  let rec dfs (i: int) : unit =
+    if not seen.(i) then begin
+      seen.(i) <- true;
+      List.iter dfs preds.(i);
+      order := i :: !order
+    end
+  in
+  Array.iteri (fun i (_: stmt) -> if succs.(i) = [] then dfs i) stmts;
+  let next = ref 0 in
+  List.iter (fun i -> rponum.(i) <- !next; incr next) !order;
+
+  let ipdom = Array.make (n + 1) (-1) in
+  ipdom.(n) <- n;
+  let rec intersect (b1: int) (b2: int) : int =
+    if b1 = b2 then b1
+    else if rponum.(b1) > rponum.(b2) then intersect ipdom.(b1) b2
+    else intersect b1 ipdom.(b2)
+  in
+  let changed = ref true in
+  while !changed do
+    changed := false;
+    List.iter
+      (fun i ->
+        (* fold the node's CFG successors -- its predecessors in the
+         * reversed graph -- that already have a postdominator *)
+        let newIpdom =
+          if succs.(i) = [] then n
+          else
+            List.fold_left
+              (fun acc j ->
+                if ipdom.(j) = -1 then acc
+                else if acc = -1 then j
+                else intersect acc j)
+              (-1) succs.(i)
+        in
+        if newIpdom <> -1 && newIpdom <> ipdom.(i) then begin
+          ipdom.(i) <- newIpdom;
+          changed := true
+        end)
+      !order
+  done;
+  ipdom
+
+(* The control dependences, from the postdominator tree: for every CFG
+ * edge (a,b) where b does not postdominate a, the nodes from b up the
+ * tree to a's own postdominator are control dependent on a *)
+let computeCtrlDeps (stmts: stmt array) (indexOfSid: int IH.t)
+                    (ipdom: int array) : int list array =
+  let n = Array.length stmts in
+  let deps : int list array = Array.make n [] in
+  let addDep (t: int) (a: int) : unit =
+    if not (List.mem a deps.(t)) then
+      deps.(t) <- a :: deps.(t)
+  in
+  Array.iteri
+    (fun a (s: stmt) ->
+      if List.length s.succs > 1 then
+        List.iter
+          (fun s' ->
+            let b = IH.find indexOfSid s'.sid in
+            let stop = ipdom.(a) in
+            let rec walk (t: int) : unit =
+              if t <> stop && t <> n && t <> -1 && t <> a then begin
+                addDep t a;
+                walk ipdom.(t)
+              end
+            in
+            walk b)
+          s.succs)
+    stmts;
+  deps
+
+(* The data dependences, from the reaching definitions: a node depends
+ * on the statements of the definitions that reach it for the variables
+ * it uses. Uses are taken per statement, so a use that a definition in
+ * the same instruction list already covers may also pull in an older
+ * definition; that errs toward larger slices *)
+let computeDataDeps (stmts: stmt array)
+                    (indexOfSid: int IH.t) : int list array =
+  let n = Array.length stmts in
+  let deps : int list array = Array.make n [] in
+  Array.iteri
+    (fun i (s: stmt) ->
+      let u, _ = UD.computeUseDefStmtKind s.skind in
+      match RD.getRDs s.sid with
+        Some (_, _, iosh) ->
+          let seen : unit IH.t = IH.create 8 in
+          UD.VS.iter
+            (fun vi ->
+              match RD.iosh_lookup iosh vi with
+                Some ios ->
+                  RD.IOS.iter
+                    (function
+                        Some defId -> begin
+                          match RD.getDefIdStmt defId with
+                            Some d when IH.mem indexOfSid d.sid ->
+                              let j = IH.find indexOfSid d.sid in
+                              if not (IH.mem seen j) then begin
+                                IH.add seen j ();
+                                deps.(i) <- j :: deps.(i)
+                              end
+                          | _ -> ()
+                        end
+                      | None -> ())
+                    ios
+              | None -> ())
+            u
+      | None -> ())
+    stmts;
+  deps
+
+(* Build the dependence graph of a function. The CFG and the reaching
+ * definitions must be current (see computeRDs) *)
+let computePdg (fdec: fundec) : pdg =
+  let stmts = collectStmts fdec in
+  let indexOfSid : int IH.t = IH.create (Array.length stmts) in
+  Array.iteri (fun i (s: stmt) -> IH.replace indexOfSid s.sid i) stmts;
+  let ipdom = computePostIdom stmts indexOfSid in
+  { pdgStmts = stmts;
+    pdgIndexOfSid = indexOfSid;
+    pdgDataDeps = computeDataDeps stmts indexOfSid;
+    pdgCtrlDeps = computeCtrlDeps stmts indexOfSid ipdom; }
+
+(* The backward slice from the given statements: everything the
+ * criterion transitively depends on, by a worklist walk over the
+ * dependence arrays *)
+let sliceFromStmts (g: pdg) (criterion: stmt list) : bool array =
+  let inSlice = Array.make (Array.length g.pdgStmts) false in
+  let worklist : int Queue.t = Queue.create () in
+  let mark (i: int) : unit =
+    if not inSlice.(i) then begin
+      inSlice.(i) <- true;
+      Queue.add i worklist
+    end
+  in
+  List.iter
+    (fun s ->
+      match IH.tryfind g.pdgIndexOfSid s.sid with
+        Some i -> mark i
+      | None -> ())
+    criterion;
+  while not (Queue.is_empty worklist) do
+    let i = Queue.take worklist in
+    List.iter mark g.pdgDataDeps.(i);
+    List.iter mark g.pdgCtrlDeps.(i)
+  done;
+  inSlice
+
+(* ------------------------- the feature ------------------------- *)
+(* Slice each function backward from the statements at a given source
+ * line and report the lines in the slice, for fault localization *)
+
+let sliceLine = ref (-1)
+let sliceSrcFile = ref ""
+
+let atCriterion (s: stmt) : bool =
+  let l = get_stmtLoc s.skind in
+  l.line = !sliceLine &&
+  (!sliceSrcFile = "" || l.file = !sliceSrcFile)
+
+let doFundec (fdec: fundec) : unit =
+  Cfg.clearCFGinfo fdec;
+  ignore (Cfg.cfgFun fdec);
+  RD.computeRDs fdec;
+  let criterion =
+    List.filter atCriterion (Array.to_list (collectStmts fdec)) in
+  if criterion <> [] then begin
+    let g = computePdg fdec in
+    let inSlice = sliceFromStmts g criterion in
+    ignore (E.log "pdgslice: slice in %s:\n" fdec.svar.vname);
+    Array.iteri
+      (fun i (s: stmt) ->
+        if inSlice.(i) then
+          let l = get_stmtLoc s.skind in
+          ignore (E.log "  %s:%d\n" l.file l.line))
+      g.pdgStmts
+  end
+
+let doit (f: file) : unit =
+  if !sliceLine < 0 then
+    E.warn "pdgslice: no slicing criterion; use --pdgslice-line"
+  else
+    iterGlobals f
+      (function
+          GFun (fdec, _) -> doFundec fdec
+        | _ -> ())
+
+let feature =
+  { fd_name = "pdgslice";
+    fd_enabled = false;
+    fd_description = "program slicing by reachability over an explicit" ^
+                "\n\t\t\t\tprogram dependence graph";
+    fd_extraopt =
+    [
+    ("--pdgslice-line", Arg.Int (fun n -> sliceLine := n),
+     "<n> slice backward from the statements at source line <n>");
+    ("--pdgslice-file", Arg.String (fun s -> sliceSrcFile := s),
+     "<name> restrict the slicing criterion to the given source file");
+    ];
+    fd_doit = doit;
+    fd_post_check = false;
+  }
+
+let () = Feature.register feature
@@ -0,0 +1,29 @@
+(* This feature computes program slices by reachability over an explicit
+ * program dependence graph, built per function from the reaching
+ * definitions (data dependences) and the postdominator tree (control
+ * dependences).  All per-node state lives in int-indexed arrays. *)
+
+(* the dependence graph of one function; statements are numbered
+ * densely from 0 *)
+type pdg = {
+  (* the statement carrying each node number *)
+  pdgStmts: Cil.stmt array;
+
+  (* map from a statement id (sid) to its node number *)
+  pdgIndexOfSid: int Inthash.t;
+
+  (* the nodes whose values a node uses, and the nodes whose branches
+   * decide whether it executes; indexed by node number, no duplicates *)
+  pdgDataDeps: int list array;
+  pdgCtrlDeps: int list array;
+}
+
+(* build the dependence graph of a function; the CFG and the reaching
+ * definitions must be current (Cfg.cfgFun, Reachingdefs.computeRDs) *)
+val computePdg : Cil.fundec -> pdg
+
+(* the backward slice from the given statements, as a membership array
+ * indexed by node number *)
+val sliceFromStmts : pdg -> Cil.stmt list -> bool array
+
+val feature : Feature.t
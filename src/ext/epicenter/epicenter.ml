@@ -12,12 +12,50 @@ open Pretty
 module H = Hashtbl
 module IH = Inthash
 
-let sliceFile (f:file) (epicenter:string) (maxHops:int) : unit =
-  (* compute the static call graph *)
+let sliceFile (f:file) (epicenter:string) (maxHops:int)
+    (amputate:bool) : unit =
+  (* compute the static call graph, and its dense int-indexed view *)
   let graph:callgraph = (computeGraph f) in
+  let dense:denseGraph = (computeDenseGraph graph) in
 
-  (* will accumulate here the set of names of functions already seen *)
+  (* breadth-first search over the dense graph, computing the distance
+   * in hops from the epicenter to every node; -1 means farther than
+   * 'maxHops' away *)
+  let dist: int array = (Array.make dense.dgCount (-1)) in
+  let worklist: int Queue.t = (Queue.create ()) in
+  let start: int =
+    IH.find dense.dgIndexOfNode (Hashtbl.find graph epicenter).cnid in
+  dist.(start) <- 0;
+  Queue.add start worklist;
+  while not (Queue.is_empty worklist) do
+    let i = (Queue.take worklist) in
+    if dist.(i) < maxHops then begin
+      (* expand to the node's callers and callees *)
+      let expand (j:int) : unit =
+	if dist.(j) < 0 then begin
+	  dist.(j) <- dist.(i) + 1;
+	  Queue.add j worklist
+	end
+      in
+      List.iter expand dense.dgCallees.(i);
+      List.iter expand dense.dgCallers.(i)
+    end
+  done;
+
+  (* the names of the functions we will retain at all, and of those we
+   * will retain with their bodies; when amputating, functions exactly
+   * 'maxHops' away (the slice boundary) keep only their prototype *)
   let seen: (string, unit) H.t = (H.create 117) in
+  let whole: (string, unit) H.t = (H.create 117) in
+  Array.iteri
+    (fun (i:int) (node:callnode) ->
+      if dist.(i) >= 0 then begin
+	H.add seen (nodeName node.cnInfo) ();
+	trace "epicenter" (dprintf "will keep %s\n" (nodeName node.cnInfo));
+	if not (amputate && dist.(i) = maxHops) then
+	  H.add whole (nodeName node.cnInfo) ()
+      end)
+    dense.dgNodes;
 
   (* when removing "unused" symbols, keep all seen functions *)
   let isRoot : global -> bool = function
@@ -27,29 +65,9 @@ let sliceFile (f:file) (epicenter:string) (maxHops:int) : unit =
 	false
   in
 
-  (* recursive depth-first search through the call graph, finding
-   * all nodes within 'hops' hops of 'node' and marking them to
-   * to be retained *)
-  let rec dfs (node:callnode) (hops:int) : unit =
-    (* only recurse if we haven't already marked this node *)
-    if not (H.mem seen (nodeName node.cnInfo)) then
-      begin
-        (* add this node *)
-	H.add seen (nodeName node.cnInfo) ();
-	trace "epicenter" (dprintf "will keep %s\n" (nodeName node.cnInfo));
-
-        (* if we cannot do any more hops, stop *)
-	if (hops > 0) then
-
-          (* recurse on all the node's callers and callees *)
-	  let recurse _ (adjacent:callnode) : unit =
-	    (dfs adjacent (hops - 1))
-          in
-	  IH.iter recurse node.cnCallees;
-	  IH.iter recurse node.cnCallers
-      end
-  in
-  dfs (Hashtbl.find graph epicenter) maxHops;
+  (* reduce the boundary functions to mere prototypes *)
+  if amputate then
+    Rmtmps.amputateFunctionBodies whole f;
 
   (* finally, throw away anything we haven't decided to keep *)
   Cilutil.sliceGlobal := true;
@@ -57,6 +75,7 @@ let sliceFile (f:file) (epicenter:string) (maxHops:int) : unit =
 
 let epicenterName = ref ""
 let epicenterHops = ref 0
+let epicenterAmputate = ref false
 
 let feature =
   { fd_name = "epicenter";
@@ -70,11 +89,14 @@ let feature =
                "<name> do an epicenter slice starting from function <name>");
     ("--epicenter-hops", Arg.Int (fun n -> epicenterHops := n),
      "<n> specify max # of hops for epicenter slice");
+    ("--epicenter-amputate", Arg.Set epicenterAmputate,
+     " reduce the functions at the boundary of the slice to prototypes" ^
+     "\n\t\t\t\tinstead of keeping them whole");
     ];
 
     fd_doit =
     (fun f ->
-      sliceFile f !epicenterName !epicenterHops);
+      sliceFile f !epicenterName !epicenterHops !epicenterAmputate);
 
     fd_post_check = true;
   }
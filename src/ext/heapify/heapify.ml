@@ -56,6 +56,10 @@ let mkSimpleField ci fn ft fl =
 
 let heapifyNonArrays = ref false
 
+(* Only heapify locals that the escape analysis below says can escape or
+ * whose array accesses may overflow *)
+let heapifyOnlyEscaping = ref false
+
 (* Does this local var contain an array? *)
 let rec containsArray (t:typ) : bool =  (* does this type contain an array? *)
   match unrollType t with
@@ -69,6 +73,119 @@ let rec containsArray (t:typ) : bool =  (* does this type contain an array? *)
    false
 
 
+(* Escape analysis for the gated mode: a candidate local may escape if its
+ * address can leave the function -- passed as a call argument, stored
+ * through a pointer or into a global, or returned. The address is tracked
+ * through chains of local assignments: a local assigned an expression
+ * mentioning a candidate's address becomes a holder of that candidate, and
+ * anything that leaks a holder leaks the candidate. The analysis errs on
+ * the side of escaping, so the gated mode never heapifies less than it
+ * should. *)
+let computeEscaping (fundec: fundec) (candidates: varinfo list)
+    : varinfo list =
+  (* vid -> the candidates whose address the local may hold *)
+  let holds : (int, varinfo list) Hashtbl.t = Hashtbl.create 16 in
+  let escaped : (int, unit) Hashtbl.t = Hashtbl.create 16 in
+  let changed = ref true in
+  (* the candidates whose address this expression may evaluate to *)
+  let rec addrsOf (e: exp) : varinfo list =
+    match e with
+      AddrOf(Var vi, _) | StartOf(Var vi, _) ->
+	if List.memq vi candidates then [vi] else []
+    | AddrOf(Mem e1, _) | StartOf(Mem e1, _) -> addrsOf e1
+    | Lval(Var vi, _) ->
+	(try Hashtbl.find holds vi.vid with Not_found -> [])
+    | Lval(Mem _, _) -> [] (* storing an address already escapes it *)
+    | CastE(_, e1) | UnOp(_, e1, _) | Real e1 | Imag e1 -> addrsOf e1
+    | BinOp(_, e1, e2, _) -> addrsOf e1 @ addrsOf e2
+    | Question(_, e2, e3, _) -> addrsOf e2 @ addrsOf e3
+    | _ -> []
+  in
+  let markEscaped vis =
+    List.iter (fun vi ->
+      if not (Hashtbl.mem escaped vi.vid) then begin
+	Hashtbl.replace escaped vi.vid () ; changed := true end) vis in
+  let addHolds (t: varinfo) vis =
+    let old = try Hashtbl.find holds t.vid with Not_found -> [] in
+    let added = List.filter (fun vi -> not (List.memq vi old)) vis in
+    if added <> [] then begin
+      Hashtbl.replace holds t.vid (added @ old) ; changed := true end in
+  let doInstr i = match i with
+      Set((Var t, _), e, _) ->
+	if t.vglob then markEscaped (addrsOf e)
+	else addHolds t (addrsOf e)
+    | Set((Mem _, _), e, _) -> markEscaped (addrsOf e)
+    | Call(_, _, args, _) -> List.iter (fun a -> markEscaped (addrsOf a)) args
+    | Asm(_, _, _, ins, _, _) ->
+	List.iter (fun (_, _, e) -> markEscaped (addrsOf e)) ins
+    | _ -> ()
+  in
+  let rec doStmt s =
+    match s.skind with
+      Instr il -> List.iter doInstr il
+    | Return(Some e, _) -> markEscaped (addrsOf e)
+    | If(_, b1, b2, _) -> doBlock b1 ; doBlock b2
+    | Switch(_, b, _, _) | Loop(b, _, _, _) | Block b -> doBlock b
+    | TryFinally(b1, b2, _) -> doBlock b1 ; doBlock b2
+    | TryExcept(b1, (il, _), b2, _) ->
+	doBlock b1 ; List.iter doInstr il ; doBlock b2
+    | _ -> ()
+  and doBlock b = List.iter doStmt b.bstmts
+  in
+  while !changed do
+    changed := false ;
+    doBlock fundec.sbody
+  done ;
+  List.filter (fun vi -> Hashtbl.mem escaped vi.vid) candidates
+
+(* Can an access overflow the candidate array? Only accesses through a
+ * constant, in-bounds index are known not to; everything else counts as a
+ * potential overflow. *)
+class overflowVisitor candidates mark = object
+  inherit nopCilVisitor
+  method! vlval lv = match lv with
+    Var(vi), off when List.memq vi candidates ->
+      let rec check t off = match off with
+	  NoOffset -> ()
+	| Field(fi, o) -> check fi.ftype o
+	| Index(ei, o) ->
+	    (match unrollType t with
+	      TArray(et, leno, _) ->
+		let bounded = match leno with
+		    None -> false
+		  | Some lene ->
+		      (match getInteger (constFold true lene),
+			     getInteger (constFold true ei) with
+			Some l, Some i ->
+			  Cilint.compare_cilint i Cilint.zero_cilint >= 0 &&
+			  Cilint.compare_cilint i l < 0
+		      | _ -> false)
+		in
+		if not bounded then mark vi ;
+		check et o
+	    | _ -> mark vi) (* lost track of the type: play it safe *)
+      in
+      check vi.vtype off ;
+      DoChildren
+  | _ -> DoChildren
+end
+
+let computeOverflowing (fundec: fundec) (candidates: varinfo list)
+    : varinfo list =
+  let marked = ref [] in
+  let mark vi = if not (List.memq vi !marked) then marked := vi :: !marked in
+  ignore (visitCilBlock (new overflowVisitor candidates mark) fundec.sbody) ;
+  !marked
+
+(* The gated mode: of the candidates, keep only those whose address may
+ * leave the function or whose accesses may overflow *)
+let needsHeapify (fundec: fundec) (candidates: varinfo list) : varinfo list =
+  let escaping = computeEscaping fundec candidates in
+  let overflowing = computeOverflowing fundec candidates in
+  List.filter (fun vi ->
+    List.memq vi escaping || List.memq vi overflowing) candidates
+
+
 class heapifyModifyVisitor big_struct big_struct_fields varlist free
     (currentFunction: fundec) = object(self)
   inherit nopCilVisitor  (* visit lvalues and statements *)
@@ -103,17 +220,22 @@ class heapifyAnalyzeVisitor f alloc free = object
   inherit nopCilVisitor (* only look at function bodies *)
   method! vglob gl = match gl with
     GFun(fundec,funloc) ->
-      let counter = ref 0 in (* the number of local vars containing arrays *)
+      (* find all local vars with arrays.  If the user requests it,
+         we also look for non-array vars whose address is taken. *)
+      let candidates = List.filter (fun vi ->
+        (containsArray vi.vtype) || (vi.vaddrof && !heapifyNonArrays))
+        fundec.slocals in
+      (* in the gated mode, leave alone whatever provably cannot
+         escape or overflow *)
+      let candidates =
+        if !heapifyOnlyEscaping then needsHeapify fundec candidates
+        else candidates in
+      let counter = ref 0 in (* the number of local vars to be moved *)
       let varlist = ref [] in  (* a list of (var,id) pairs, in reverse order *)
       List.iter (fun vi ->
-         (* find all local vars with arrays.  If the user requests it,
-            we also look for non-array vars whose address is taken. *)
-        if (containsArray vi.vtype) || (vi.vaddrof && !heapifyNonArrays)
-        then begin
-          varlist := (vi,!counter) :: !varlist ; (* add it to the list *)
-          incr counter (* put the next such var in the next slot *)
-        end
-        ) fundec.slocals ;
+        varlist := (vi,!counter) :: !varlist ; (* add it to the list *)
+        incr counter (* put the next such var in the next slot *)
+        ) candidates ;
       if (!varlist <> []) then begin (* some local vars contain arrays *)
         let name = (fundec.svar.vname ^ "_heapify") in
         let ci = mkCompInfo true name (* make a big structure *)
@@ -239,6 +361,8 @@ let feature2 =
     fd_extraopt = [
       "--heapifyAll", Arg.Set heapifyNonArrays,
       " When using heapify, move all local vars whose address is taken,\n\t\t\t\tnot just arrays.";
+      "--heapifyOnlyEscaping", Arg.Set heapifyOnlyEscaping,
+      " When using heapify, move only locals whose address may leave the\n\t\t\t\tfunction or whose array accesses may overflow.";
     ];
     fd_doit = (function (f: file) -> default_heapify f);
     fd_post_check = true;
@@ -56,145 +56,226 @@ module A = Alpha
 
 let debug = true
 
-exception Recursion (* Used to signal recursion *)
-
-(* A visitor that makes a deep copy of a function body for use inside a host
- * function, replacing duplicate labels, returns, etc. *)
-class copyBodyVisitor     (host: fundec)                (* The host of the
-                                                         * inlining *)
-                          (inlining: varinfo)           (* Function being
-                                                         * inlined *)
-                          (replVar: varinfo -> varinfo) (* Maps locals of the
-                                                         * inlined function
-                                                         * to locals of the
-                                                         * host *)
-                          (retlval: varinfo option)     (* The destination
-                                                         * for the "return" *)
-                          (replLabel: string -> string)
-                                                        (* A renamer for
-                                                         * labels *)
-                          (retlab: stmt)                (* The label for the
-                                                         * return *)
-                          = object (self)
-  inherit nopCilVisitor
-
-      (* Keep here a maping from statements to their copies, indexed by their
-       * original ID *)
-  val stmtmap : stmt IH.t = IH.create 113
-
-      (* Keep here a list of statements to be patched *)
-  val patches : stmt list ref = ref []
-
-  val argid = ref 0
-
-      (* This is the entry point *)
-  method! vfunc (f: fundec) : fundec visitAction =
-    let patchfunction (f' : fundec) =
-      let findStmt (i: int) =
-        try IH.find stmtmap i
-        with Not_found -> E.s (bug "Cannot find the copy of stmt#%d" i)
-      in
-      E.log "Patching gotos\n";
-      let patchstmt (s: stmt) =
-        match s.skind with
-          Goto (sr, l) ->
-            if debug then
-              E.log "patching goto\n";
-            (* Make a copy of the reference *)
-            let sr' = ref (findStmt !sr.sid) in
-            s.skind <- Goto (sr',l)
-        | Switch (e, body, cases, l) ->
-            s.skind <- Switch (e, body,
-                               Util.list_map (fun cs -> findStmt cs.sid) cases, l)
-        | _ -> ()
-      in
-      List.iter patchstmt !patches;
-      f'
-    in
-    patches := [];
-    IH.clear stmtmap;
-    ChangeDoChildrenPost (f, patchfunction)
-
-      (* We must replace references to local variables *)
-  method! vvrbl (v: varinfo) =
-    if v.vglob then
-      SkipChildren
+(* ------------------- inlining templates ------------------- *)
+
+(* A preprocessed inlining template for a callee. The formals and
+ * locals are numbered densely into slots and the statements are
+ * renumbered 0 .. tSize-1, so that instantiating the template is a
+ * direct structural copy driven by arrays, rather than a full
+ * visitor pass over the callee *)
+type template = {
+  tFundec: fundec;
+  tVars: varinfo array;      (* formals, then locals, indexed by slot *)
+  tSlotOfVid: int IH.t;      (* vid of a formal or local -> its slot *)
+  tNumFormals: int;
+  tSize: int;                (* number of statements in the body *)
+  tRecursive: bool;          (* the body calls the function itself *)
+  tRetType: typ;
+}
+
+(* Cached templates, indexed by the vid of the callee. An entry must
+ * be dropped whenever we inline into the callee itself *)
+let templates : template IH.t = IH.create 13
+
+let makeTemplate (repl: fundec) : template =
+  let vars = Array.of_list (repl.sformals @ repl.slocals) in
+  let slotOfVid : int IH.t = IH.create (Array.length vars + 1) in
+  Array.iteri (fun slot v -> IH.replace slotOfVid v.vid slot) vars;
+  (* Renumber the statements densely and look for self-calls *)
+  let size = ref 0 in
+  let recursive = ref false in
+  let rec numStmt (s: stmt) : unit =
+    s.sid <- !size;
+    incr size;
+    match s.skind with
+      Instr il ->
+        List.iter
+          (function
+              Call (_, Lval (Var vi, _), _, _)
+                when vi.vid = repl.svar.vid -> recursive := true
+            | _ -> ())
+          il
+    | If (_, b1, b2, _) -> numBlock b1; numBlock b2
+    | Switch (_, b, _, _) -> numBlock b
+    | Loop (b, _, _, _) -> numBlock b
+    | Block b -> numBlock b
+    | TryFinally (b, h, _) -> numBlock b; numBlock h
+    | TryExcept (b, _, h, _) -> numBlock b; numBlock h
+    | _ -> ()
+  and numBlock (b: block) : unit =
+    List.iter numStmt b.bstmts
+  in
+  numBlock repl.sbody;
+  let rt, _, _, _ = splitFunctionType repl.svar.vtype in
+  { tFundec = repl;
+    tVars = vars;
+    tSlotOfVid = slotOfVid;
+    tNumFormals = List.length repl.sformals;
+    tSize = !size;
+    tRecursive = !recursive;
+    tRetType = rt; }
+
+let getTemplate (repl: fundec) : template =
+  IH.memoize templates repl.svar.vid (fun _ -> makeTemplate repl)
+
+(* Instantiate a template into [host]: copy the body substituting the
+ * slot variables, renaming labels, turning returns into an
+ * assignment plus a goto to [retlab], and patching gotos and switch
+ * cases through the dense statement numbering. Expressions that
+ * mention no substituted variable are shared with the template *)
+let instantiateTemplate (t: template)
+                        (host: fundec)
+                        (slots: varinfo array)  (* a host var per slot *)
+                        (retlval: varinfo option) (* The destination
+                                                   * for the "return" *)
+                        (replLabel: string -> string)
+                                                (* A renamer for labels *)
+                        (retlab: stmt)          (* The label for the
+                                                 * return *)
+    : block =
+  let subst (v: varinfo) : varinfo =
+    if v.vglob then v
     else
-      let v' = replVar v in
-      if v == v' then
-        SkipChildren
-      else
-        ChangeTo v'
-
-
-  method! vinst (i: instr) =
+      try slots.(IH.find t.tSlotOfVid v.vid)
+      with Not_found ->
+        E.s (bug "Cannot find the new copy of local variable %s" v.vname)
+  in
+  let rec cExp (e: exp) : exp =
+    match e with
+      Const _ | SizeOf _ | SizeOfStr _ | AlignOf _ | AddrOfLabel _ -> e
+    | Lval lv -> let lv' = cLval lv in if lv' == lv then e else Lval lv'
+    | SizeOfE e1 -> let e1' = cExp e1 in if e1' == e1 then e else SizeOfE e1'
+    | AlignOfE e1 ->
+        let e1' = cExp e1 in if e1' == e1 then e else AlignOfE e1'
+    | UnOp (op, e1, ty) ->
+        let e1' = cExp e1 in if e1' == e1 then e else UnOp (op, e1', ty)
+    | BinOp (op, e1, e2, ty) ->
+        let e1' = cExp e1 and e2' = cExp e2 in
+        if e1' == e1 && e2' == e2 then e else BinOp (op, e1', e2', ty)
+    | Question (e1, e2, e3, ty) ->
+        let e1' = cExp e1 and e2' = cExp e2 and e3' = cExp e3 in
+        if e1' == e1 && e2' == e2 && e3' == e3 then e
+        else Question (e1', e2', e3', ty)
+    | CastE (ty, e1) ->
+        let e1' = cExp e1 in if e1' == e1 then e else CastE (ty, e1')
+    | AddrOf lv -> let lv' = cLval lv in if lv' == lv then e else AddrOf lv'
+    | StartOf lv ->
+        let lv' = cLval lv in if lv' == lv then e else StartOf lv'
+    | Imag e1 -> let e1' = cExp e1 in if e1' == e1 then e else Imag e1'
+    | Real e1 -> let e1' = cExp e1 in if e1' == e1 then e else Real e1'
+  and cLval (lv: lval) : lval =
+    match lv with
+      (Var v, off) ->
+        let v' = subst v and off' = cOffset off in
+        if v' == v && off' == off then lv else (Var v', off')
+    | (Mem e, off) ->
+        let e' = cExp e and off' = cOffset off in
+        if e' == e && off' == off then lv else (Mem e', off')
+  and cOffset (off: offset) : offset =
+    match off with
+      NoOffset -> off
+    | Field (fi, off1) ->
+        let off1' = cOffset off1 in
+        if off1' == off1 then off else Field (fi, off1')
+    | Index (e, off1) ->
+        let e' = cExp e and off1' = cOffset off1 in
+        if e' == e && off1' == off1 then off else Index (e', off1')
+  in
+  let cInstr (i: instr) : instr =
     match i with
-      Call (_, Lval (Var vi, _), _, _) when vi.vid == inlining.vid ->
-        raise Recursion
-
-    | _ -> DoChildren
-
-        (* Replace statements. *)
-  method! vstmt (s: stmt) : stmt visitAction =
-    (* There is a possibility that we did not have the statements IDed
-     * propertly. So, we change the ID even on the replaced copy so that we
-     * can index on them ! *)
-    (match host.smaxstmtid with
-      Some id ->
-        s.sid <- 1 + id
-    | None ->
-        s.sid <- 1);
-    (* Copy and change ID *)
-    let s' = {s with sid = s.sid} in
-    host.smaxstmtid <- Some s'.sid;
-
-    IH.add stmtmap s.sid s'; (* Remember where we copied this statement *)
-    (* if we have a Goto or a Switch remember them to fixup at end *)
-    (match s'.skind with
-      (Goto _ | Switch _) ->
-        E.log "Found goto\n";
-        patches := s' :: !patches
-    | _ -> ());
-
-    (* Change the returns *)
-    let postProc (s': stmt) : stmt =
-      (* Rename the labels if necessary *)
-      s'.labels <-
-        Util.list_map (fun lb ->
+      Set (lv, e, l) -> Set (cLval lv, cExp e, l)
+    | Call (lvo, f, args, l) ->
+        Call ((match lvo with
+                 Some lv -> Some (cLval lv)
+               | None -> None),
+              cExp f, Util.list_map cExp args, l)
+    | Asm (attrs, tmpls, outs, ins, clobs, l) ->
+        Asm (attrs, tmpls,
+             Util.list_map (fun (so, c, lv) -> (so, c, cLval lv)) outs,
+             Util.list_map (fun (so, c, e) -> (so, c, cExp e)) ins,
+             clobs, l)
+    | VarDecl (v, l) -> VarDecl (subst v, l)
+  in
+  (* The copies of the template statements, indexed by template sid.
+   * [retlab] doubles as the "not copied yet" marker *)
+  let stmtmap : stmt array = Array.make (max t.tSize 1) retlab in
+  let patches : stmt list ref = ref [] in
+  let findStmt (i: int) : stmt =
+    let s = stmtmap.(i) in
+    if s == retlab then E.s (bug "Cannot find the copy of stmt#%d" i);
+    s
+  in
+  let rec cStmt (s: stmt) : stmt =
+    (* Give the copy a fresh ID in the host *)
+    let sid' =
+      match host.smaxstmtid with
+        Some id -> 1 + id
+      | None -> 1
+    in
+    host.smaxstmtid <- Some sid';
+    let s' = {s with sid = sid'} in
+    stmtmap.(s.sid) <- s';  (* Remember where we copied this statement *)
+    (* Rename the labels if necessary *)
+    s'.labels <-
+      Util.list_map
+        (fun lb ->
           match lb with
-            Label (n, l, fromsrc) -> Label(replLabel n, l, fromsrc)
-          | _ -> lb) s'.labels;
-
-      (* Now deal with the returns *)
-      (match s'.skind with
-      | Return (ro, l) -> begin
-          (* Change this into an assignment followed by a Goto *)
-          match ro, retlval with
-            _, None -> (* Function called with no return lval *)
-              s'.skind <- Goto (ref retlab, l)
-
-          | None, _ ->
-              ignore (warn "Found return without value in inlined function");
-              s'.skind <- Goto (ref retlab, l)
-
-          | Some rv, Some retvar->
-              s'.skind <-
-                Block (mkBlock [ mkStmt (Instr [(Set (var retvar, rv, l))]);
-                                 mkStmt (Goto (ref retlab, l)) ])
+            Label (n, l, fromsrc) -> Label (replLabel n, l, fromsrc)
+          | _ -> lb)
+        s.labels;
+    (match s.skind with
+      Instr il -> s'.skind <- Instr (Util.list_map cInstr il)
+    | Return (ro, l) -> begin
+        (* Change this into an assignment followed by a Goto *)
+        match ro, retlval with
+          _, None -> (* Function called with no return lval *)
+            s'.skind <- Goto (ref retlab, l)
+
+        | None, _ ->
+            ignore (warn "Found return without value in inlined function");
+            s'.skind <- Goto (ref retlab, l)
+
+        | Some rv, Some retvar ->
+            s'.skind <-
+              Block (mkBlock [ mkStmt (Instr [(Set (var retvar,
+                                                    cExp rv, l))]);
+                               mkStmt (Goto (ref retlab, l)) ])
       end
-      | _ -> ());
-      s'
-    in
-            (* Do the children then postprocess *)
-    ChangeDoChildrenPost (s', postProc)
-
-      (* Copy blocks since they are mutable *)
-  method! vblock (b: block) =
-    ChangeDoChildrenPost ({b with bstmts = b.bstmts}, fun x -> x)
-
-
-  method! vglob _ = E.s (bug "copyFunction should not be used on globals")
-end
+    | Goto (sr, l) ->
+        (* The target is patched once the whole body is copied *)
+        s'.skind <- Goto (sr, l);
+        patches := s' :: !patches
+    | ComputedGoto (e, l) -> s'.skind <- ComputedGoto (cExp e, l)
+    | Break _ | Continue _ -> s'.skind <- s.skind
+    | If (e, b1, b2, l) -> s'.skind <- If (cExp e, cBlock b1, cBlock b2, l)
+    | Switch (e, b, cases, l) ->
+        (* The case list is patched once the whole body is copied *)
+        s'.skind <- Switch (cExp e, cBlock b, cases, l);
+        patches := s' :: !patches
+    | Loop (b, l, s1, s2) -> s'.skind <- Loop (cBlock b, l, s1, s2)
+    | Block b -> s'.skind <- Block (cBlock b)
+    | TryFinally (b, h, l) -> s'.skind <- TryFinally (cBlock b, cBlock h, l)
+    | TryExcept (b, (il, e), h, l) ->
+        s'.skind <- TryExcept (cBlock b,
+                               (Util.list_map cInstr il, cExp e),
+                               cBlock h, l));
+    s'
+  and cBlock (b: block) : block =
+    { b with bstmts = Util.list_map cStmt b.bstmts }
+  in
+  let body = cBlock t.tFundec.sbody in
+  let patchstmt (s: stmt) =
+    match s.skind with
+      Goto (sr, l) ->
+        (* Make a copy of the reference *)
+        s.skind <- Goto (ref (findStmt !sr.sid), l)
+    | Switch (e, b, cases, l) ->
+        s.skind <-
+          Switch (e, b, Util.list_map (fun cs -> findStmt cs.sid) cases, l)
+    | _ -> ()
+  in
+  List.iter patchstmt !patches;
+  body
 
 (** Replace a statement with the result of inlining *)
 let replaceStatement (host: fundec)                         (* The host *)
@@ -244,80 +325,65 @@ let replaceStatement (host: fundec)                         (* The host *)
                loop resti
 
            | Some repl -> begin
-               anyInlining := true;
-               E.log "Done inlining\n";
-
-               (* We must inline *)
-               (* Prepare the mapping of local variables *)
-               let vmap : varinfo IH.t = IH.create 13 in
-               let replVar (vi: varinfo) =
-                 if vi.vglob then vi
-                 else
-                   try IH.find vmap vi.vid
-                   with Not_found -> begin
-                     E.s (bug "Cannot find the new copy of local variable %s"
-                            vi.vname)
+               let t = getTemplate repl in
+               if t.tRecursive then begin
+                 ignore (warn "Encountered recursion in function %s"
+                           repl.svar.vname);
+                 prevrinstr := i :: !prevrinstr
+               end else if List.length args <> t.tNumFormals then begin
+                 E.bug "Invalid number of arguments";
+                 prevrinstr := i :: !prevrinstr
+               end else begin
+                 anyInlining := true;
+                 (* The host changed, so a cached template for it is
+                  * now stale *)
+                 IH.remove templates host.svar.vid;
+                 if debug then
+                   E.log "Done inlining\n";
+
+                 (* Make a host variable for every slot of the
+                  * template *)
+                 let slots: varinfo array =
+                   Array.map
+                     (fun v -> makeTempVar host ~name:v.vname v.vtype)
+                     t.tVars
+                 in
+                 (* Do the actual arguments, and keep extending
+                  * prevrinstr. We must copy the argument even if it is
+                  * already a variable, to obey call by value *)
+                 let rec loopArgs (slot: int) (args: exp list) =
+                   match args with
+                     [] -> ()
+                   | a :: args' ->
+                       prevrinstr := (Set (var slots.(slot), a, l))
+                                     :: !prevrinstr;
+                       loopArgs (slot + 1) args'
+                 in
+                 loopArgs 0 args;
+
+                 (* Make the return statement *)
+                 let (ret : stmt), (retvar: varinfo option) =
+                   match t.tRetType with
+                     TVoid _  -> mkStmt (Instr []), None
+                   | rt -> begin
+                       match lvo with
+                         None -> mkStmt (Instr []), None
+                       | Some lv ->
+                           (* Make a return variable *)
+                           let rv = makeTempVar
+                               host ~name:("ret_" ^ repl.svar.vname) rt in
+                           mkStmtOneInstr (Set (lv, Lval (var rv), l)),
+                           Some rv
                    end
-               in
-               (* Do the actual arguments, and keep extending prevrinstr *)
-               let rec loopArgs (args: exp list) (formals: varinfo list) =
-                 match args, formals with
-                   [], [] -> ()
-                 | (a :: args'), (f :: formals') -> begin
-                     (* We must copy the argument even if it is already a
-                      * variable, to obey call by value *)
-                     (* Make a local and a copy *)
-                     let f' = makeTempVar host ~name:f.vname f.vtype in
-                     prevrinstr := (Set (var f', a, l)) :: !prevrinstr;
-                     IH.add vmap f.vid f';
-
-                     loopArgs args' formals'
-                 end
-                 | _, _ -> E.bug "Invalid number of arguments"
-               in
-               loopArgs args repl.sformals;
-
-               (* Copy the locals *)
-               List.iter (fun loc ->
-                 let loc' = makeTempVar host ~name:loc.vname loc.vtype in
-                 IH.add vmap loc.vid loc') repl.slocals;
-
-
-               (* Make the return statement *)
-               let (ret : stmt), (retvar: varinfo option) =
-                 let rt, _, isva, _ = splitFunctionType repl.svar.vtype in
-                 match rt with
-                   TVoid _  -> mkStmt (Instr []), None
-                 | _ -> begin
-                     match lvo with
-                       None -> mkStmt (Instr []), None
-                     | Some lv ->
-                         (* Make a return variable *)
-                         let rv = makeTempVar
-                             host ~name:("ret_" ^ repl.svar.vname) rt in
-                         mkStmtOneInstr (Set (lv, Lval (var rv), l)), Some rv
-                 end
-               in
-               ret.labels <- [Label (replLabel ("Lret_" ^ repl.svar.vname),
-                                     l, false)];
-               let oldBody = repl.sbody in
-               (* Now replace the body *)
-               (try
-                 ignore (visitCilFunction
-                           (new copyBodyVisitor host repl.svar replVar
-                              retvar replLabel ret)
-                           repl);
+                 in
+                 ret.labels <- [Label (replLabel ("Lret_" ^ repl.svar.vname),
+                                       l, false)];
+                 let body' =
+                   instantiateTemplate t host slots retvar replLabel ret in
                  currentLoc := l;
-                 let body' = repl.sbody in
-                 (* Replace the old body in the function to inline *)
-                 repl.sbody <- oldBody;
-
                  emptyPrevrinstr ();
                  prevrstmts := ret :: (mkStmt (Block body')) :: !prevrstmts
-               with Recursion ->
-                 ignore (warn "Encountered recursion in function %s"
-                           repl.svar.vname);
-                 prevrinstr := i :: !prevrinstr);
+               end;
 
                loop resti
            end
@@ -406,6 +472,61 @@ let doFile (inlineWhat: varinfo -> fundec option) (* What to inline. See
     | _ -> ())
 
 
+(* ------------------- bottom-up driver ------------------- *)
+
+(** Budget for automatic inlining: calls to non-recursive defined
+ * functions whose bodies have at most this many statements are
+ * inlined. 0 disables the bottom-up driver *)
+let inlineBudget: int ref = ref 0
+
+(** Apply inlining bottom-up over the strongly connected components
+ * of the callgraph. Because callees are processed before their
+ * callers, a callee's statement count includes whatever was already
+ * inlined into it, so the budget bounds the size of what actually
+ * gets copied. Calls within a component (recursion cycles) are
+ * never inlined *)
+let doFileBottomUp (fl: file) : unit =
+  let cg = Callgraph.computeGraph fl in
+  let scc = Callgraph.computeSCCs cg in
+  let fundecs : (string, fundec) H.t = H.create 37 in
+  iterGlobals fl
+    (function
+        GFun (fd, _) -> H.replace fundecs fd.svar.vname fd
+      | _ -> ());
+  let compOfName (n: string) : int =
+    IH.find scc.Callgraph.sccOfNode (H.find cg n).Callgraph.cnid
+  in
+  let doHost (host: fundec) : unit =
+    let hostComp = compOfName host.svar.vname in
+    let inlineWhat (vi: varinfo) : fundec option =
+      try
+        let fd = H.find fundecs vi.vname in
+        if compOfName vi.vname = hostComp then None
+        else
+          let t = getTemplate fd in
+          if t.tRecursive || t.tSize > !inlineBudget then None
+          else Some fd
+      with Not_found -> None
+    in
+    let anyInlining = ref true in
+    while !anyInlining do
+      anyInlining := false;
+      doFunction host inlineWhat anyInlining
+    done
+  in
+  Callgraph.iterSccBottomUp scc
+    (fun _ members ->
+      List.iter
+        (fun (n: Callgraph.callnode) ->
+          match n.Callgraph.cnInfo with
+            Callgraph.NIVar (v, def) when !def -> begin
+              try doHost (H.find fundecs v.vname)
+              with Not_found -> ()
+            end
+          | _ -> ())
+        members)
+
+
 (* Function names to inline *)
 let toinline: string list ref = ref []
 let doit (fl: file) =
@@ -428,7 +549,10 @@ let doit (fl: file) =
       ignore (warn "Cannot inline function %s because we cannot find its definition" fn))
     !toinline;
 
-  doFile inlineWhat fl
+  if !toinline <> [] then
+    doFile inlineWhat fl;
+  if !inlineBudget > 0 then
+    doFileBottomUp fl
 
 let rec feature =
   { fd_name = "inliner";
@@ -438,6 +562,9 @@ let rec feature =
     "--inline", Arg.String (fun s -> feature.fd_enabled <- true;
                                      toinline := s :: !toinline),
                 "<func> inline this function";
+    "--inline-budget", Arg.Int (fun n -> feature.fd_enabled <- true;
+                                         inlineBudget := n),
+                "<n> inline all calls to non-recursive functions of at most n statements, bottom-up over the callgraph";
     ];
     fd_doit = doit;
     fd_post_check = true;
@@ -11,6 +11,8 @@ open Feature
 open Pretty
 
 module DF = Dataflow
+module BV = Bitvecdataflow
+module B = Bitmap
 module UD = Usedef
 module IH = Inthash
 module E = Errormsg
@@ -117,18 +119,186 @@ let null_adder fdec =
   ignore(visitCilFunction (new nullAdderClass) fdec);
   !all_stmts
 
+(* The statement-level transfer function as gen/kill sets: the
+ * variables that become live, and the variables whose incoming
+ * liveness is cut off. For instruction lists this composes the
+ * per-instruction transfers from the last instruction to the first,
+ * so the sets are exact even when a variable is both defined and
+ * used inside the same statement. *)
+let stmtGenKill (stm: stmt) : VS.t * VS.t =
+  match stm.skind with
+    Instr il ->
+      let uds = UD.cachedUseDefInstrList stm il in
+      List.fold_left2 (fun (gen, kill) i (u, d) ->
+	if (!ignore_inst) i then (gen, kill) else
+	(VS.union u (VS.diff gen d), VS.union kill d))
+	(VS.empty, VS.empty) (List.rev il) (List.rev uds)
+  | _ -> UD.cachedUseDefStmtKind stm
+
+(* The per-function tables are recycled through pools, so running the
+ * analysis over every function of a file reuses two sets of arrays
+ * instead of allocating fresh tables per function *)
+let bitOfVidPool : int IH.pool = IH.mkPool 64
+let genKillPool : (B.t * B.t) IH.pool = IH.mkPool 64
+
+(* Solve the fixpoint over bitmaps rather than over VS.t: each
+ * variable that appears in some gen or kill set gets a dense bit
+ * index, and the iteration is word-parallel. The results are
+ * converted back to VS.t in stmtStartData, so clients are
+ * unaffected. *)
 let computeLiveness fdec =
   IH.clear LiveFlow.stmtStartData;
   UD.onlyNoOffsetsAreDefs := false;
   all_stmts := [];
   let a = null_adder fdec in
+  UD.computeUseDefCache fdec;
+  let bitOfVid : int IH.t = IH.getTable bitOfVidPool in
+  let numBits = ref 0 in
+  let varsRev = ref [] in
+  let bitOf (vi: varinfo) : int =
+    match IH.tryfind bitOfVid vi.vid with
+      Some b -> b
+    | None ->
+	let b = !numBits in
+	incr numBits;
+	IH.add bitOfVid vi.vid b;
+	varsRev := vi :: !varsRev;
+	b
+  in
   try
-    L.compute a
+    let genKill : (B.t * B.t) IH.t = IH.getTable genKillPool in
+    List.iter (fun stm ->
+      let gen, kill = stmtGenKill stm in
+      let toBitmap vs =
+	let b = B.make 32 in
+	VS.iter (fun vi -> B.setTo b (bitOf vi) true) vs;
+	b
+      in
+      IH.add genKill stm.sid (toBitmap gen, toBitmap kill)) a;
+    let problem = { BV.bvName = LiveFlow.name;
+		    bvGen = (fun s -> fst (IH.find genKill s.sid));
+		    bvKill = (fun s -> snd (IH.find genKill s.sid)) } in
+    let sol = BV.solveBackwards problem a in
+    let varOfBit = Array.of_list (List.rev !varsRev) in
+    IH.iter (fun sid b ->
+      let vs = B.fold (fun vs bit -> VS.add varOfBit.(bit) vs) b VS.empty in
+      IH.replace LiveFlow.stmtStartData sid vs) sol;
+    IH.putTable genKillPool genKill;
+    IH.putTable bitOfVidPool bitOfVid
   with E.Error -> begin
     ignore(E.log "Liveness failed on function:\n %a\n" d_global (GFun(fdec,locUnknown)));
     E.s "Bug in Liveness compute"
   end
 
+(* COMPACT WHOLE-FILE STORAGE. A full VS.t per statement is quadratic
+ * in memory on long straight-line runs where consecutive sets differ
+ * by a couple of variables. The compact form keeps a full set only at
+ * the anchors -- statements with zero or several successors, or whose
+ * successor joins several predecessors -- and stores the statements
+ * inside a run as gen/kill deltas, from which their sets are replayed
+ * on demand from the anchor below. This is what to hold on to when
+ * liveness for every function of a file must stay resident at once. *)
+
+type delta = { dGen: varinfo list; dKill: varinfo list }
+
+type compactLiveness = {
+    clStmts: stmt list;        (* every statement of the function *)
+    clAnchors: VS.t IH.t;      (* full sets at run boundaries, by sid *)
+    clDeltas: delta IH.t;      (* the in-run statements, by sid *)
+    clNext: stmt IH.t;         (* unique successor of in-run statements *)
+  }
+
+(* A statement can be stored as a delta when its live set can be
+ * replayed from the set of its unique successor, i.e. when that
+ * successor joins no other predecessor *)
+let storedAsDelta (s: stmt) : stmt option =
+  match s.succs with
+    [s'] -> (match s'.preds with [_] -> Some s' | _ -> None)
+  | _ -> None
+
+(* Run the analysis on a function and pack the solution. The packed
+ * form is self-contained: the global stmtStartData table is free to
+ * be overwritten by the next function *)
+let computeCompactLiveness (fdec: fundec) : compactLiveness =
+  computeLiveness fdec;
+  let stmts = !all_stmts in
+  let anchors : VS.t IH.t = IH.create 113 in
+  let deltas : delta IH.t = IH.create 113 in
+  let next : stmt IH.t = IH.create 113 in
+  List.iter
+    (fun s ->
+      match storedAsDelta s with
+        Some s' when IH.mem LiveFlow.stmtStartData s'.sid ->
+          let gen, kill = stmtGenKill s in
+          IH.replace deltas s.sid
+            { dGen = VS.elements gen; dKill = VS.elements kill };
+          IH.replace next s.sid s'
+      | _ ->
+          (try IH.replace anchors s.sid (IH.find LiveFlow.stmtStartData s.sid)
+          with Not_found -> ()))
+    stmts;
+  { clStmts = stmts; clAnchors = anchors; clDeltas = deltas; clNext = next }
+
+(* liveIn(s) = gen(s) u (liveIn(next) \ kill(s)) *)
+let applyDelta (d: delta) (below: VS.t) : VS.t =
+  let vs = List.fold_left (fun a vi -> VS.remove vi a) below d.dKill in
+  List.fold_left (fun a vi -> VS.add vi a) vs d.dGen
+
+(* The live set of one statement, replayed from the anchor below it.
+ * Costs the length of the run for an in-run statement; use
+ * iterCompactLiveness to visit many statements *)
+let rec getCompactLiveSet (cl: compactLiveness) (s: stmt) : VS.t =
+  match IH.tryfind cl.clAnchors s.sid with
+    Some vs -> vs
+  | None ->
+      match IH.tryfind cl.clDeltas s.sid, IH.tryfind cl.clNext s.sid with
+        Some d, Some s' -> applyDelta d (getCompactLiveSet cl s')
+      | _, _ -> VS.empty
+
+(* Visit every statement with its reconstructed live set. Each
+ * straight-line run is replayed once from its anchor upwards, so the
+ * whole walk applies each delta exactly once *)
+let iterCompactLiveness (cl: compactLiveness) (f: stmt -> VS.t -> unit)
+    : unit =
+  (* a run starts at a statement that no other in-run statement
+   * derives its set from *)
+  let derived : unit IH.t = IH.create 113 in
+  List.iter
+    (fun s ->
+      if IH.mem cl.clDeltas s.sid then
+        match IH.tryfind cl.clNext s.sid with
+          Some s' -> IH.replace derived s'.sid ()
+        | None -> ())
+    cl.clStmts;
+  List.iter
+    (fun top ->
+      if not (IH.mem derived top.sid) then begin
+        (* collect the run, anchor first *)
+        let rec collect (s: stmt) (acc: stmt list) : stmt list =
+          if IH.mem cl.clAnchors s.sid then s :: acc
+          else match IH.tryfind cl.clNext s.sid with
+            Some s' -> collect s' (s :: acc)
+          | None -> s :: acc
+        in
+        ignore
+          (List.fold_left
+             (fun (below: VS.t option) (s: stmt) ->
+               let vs =
+                 match below with
+                   None ->
+                     (try IH.find cl.clAnchors s.sid
+                     with Not_found -> VS.empty)
+                 | Some b ->
+                     (match IH.tryfind cl.clDeltas s.sid with
+                       Some d -> applyDelta d b
+                     | None -> b)
+               in
+               f s vs;
+               Some vs)
+             None (collect top []))
+      end)
+    cl.clStmts
+
 let getLiveSet sid =
   try Some(IH.find LiveFlow.stmtStartData sid)
   with Not_found -> None
@@ -140,19 +310,19 @@ let getPostLiveness (s:stmt) : LiveFlow.t =
   List.fold_left foldLiveness VS.empty s.succs
 
 let instrLiveness (il : instr list) (stm : stmt) (vs : VS.t) (out: bool) : VS.t list =
-    let proc_one vsl i =
+    let proc_one vsl (i, (u, d)) =
         match vsl with
         | [] ->
             if (!ignore_inst) i then vs::vsl else
-            let u,d = UD.computeUseDefInstr i in
             (VS.union u (VS.diff vs d))::vsl
         | vs'::rst ->
             if (!ignore_inst) i then vs'::vsl else
-            let u,d = UD.computeUseDefInstr i in
             (VS.union u (VS.diff vs' d))::vsl
     in
+    let uds = UD.cachedUseDefInstrList stm il in
     let liveout = getPostLiveness stm in
-    let folded = List.fold_left proc_one [liveout] (List.rev il) in
+    let folded =
+        List.fold_left proc_one [liveout] (List.rev (List.combine il uds)) in
     if out then List.tl folded else folded
 
 (* Inherit from this to visit with liveness info at instructions.
@@ -214,6 +384,8 @@ class deadnessVisitorClass = object(self)
 
     val mutable liv_dat_lst = []
 
+    val mutable ud_dat_lst = []
+
     val mutable cur_liv_dat = None
 
     val mutable post_dead_vars = VS.empty
@@ -225,6 +397,7 @@ class deadnessVisitorClass = object(self)
         | None -> begin
             if !debug then E.log "deadVis: stm %d has no data\n" sid;
             cur_liv_dat <- None;
+            ud_dat_lst <- [];
             post_dead_vars <- VS.empty;
             post_live_vars <- VS.empty;
             DoChildren
@@ -251,10 +424,12 @@ class deadnessVisitorClass = object(self)
             match stm.skind with
             | Instr il -> begin
                 liv_dat_lst <- instrLiveness il stm vs true;
+                ud_dat_lst <- UD.cachedUseDefInstrList stm il;
                 DoChildren
             end
             | _ -> begin
                 cur_liv_dat <- None;
+                ud_dat_lst <- [];
                 DoChildren
             end
         end
@@ -264,7 +439,10 @@ class deadnessVisitorClass = object(self)
             let data = List.hd liv_dat_lst in
             cur_liv_dat <- Some(data);
             liv_dat_lst <- List.tl liv_dat_lst;
-            let u,d = UD.computeUseDefInstr i in
+            let u,d = match ud_dat_lst with
+            | ud::rst -> ud_dat_lst <- rst; ud
+            | [] -> UD.computeUseDefInstr i
+            in
             let inlive = VS.union u (VS.diff data d) in
             (* if both defined and used, then both dies and comes to life *)
             let ud = VS.inter u d in
@@ -347,3 +525,6 @@ let feature =
  }
 
 let () = Feature.register feature
+(* liveness is computed one function at a time, so the feature may run
+ * on a partition of the file's functions *)
+let () = Feature.markFunctionParallel "Liveness"
@@ -2,6 +2,7 @@
 open Cil
 
 module E = Errormsg
+module IH = Inthash
 
 (** compute use/def information *)
 
@@ -252,3 +253,194 @@ let computeUseLocalTypes ?(acc_used=VS.empty)
   List.fold_left (fun u vi ->
     ignore(visitCilType useDefVisitor vi.vtype);
     VS.union u (!varUsed)) acc_used fd.slocals
+
+(** Per-function cache of use/def information, indexed by statement
+ * id. A backwards liveness fixpoint consults the use/def sets of a
+ * statement every time a transfer function touches it, so the visitor
+ * walks above dominate its cost; computing the sets once per function
+ * turns the inner loop into table reads. The cache reflects the
+ * configuration flags in effect when it was built, and a statement
+ * whose instructions have changed since then falls back to a fresh
+ * computation. *)
+
+(* sid -> (use, def) for statement kinds other than Instr *)
+let stmtUseDefHash : (VS.t * VS.t) IH.t = IH.create 64
+
+(* sid -> (use, def) per instruction, in order, for Instr statements *)
+let instrUseDefHash : (VS.t * VS.t) list IH.t = IH.create 64
+
+class useDefCacherClass = object(self)
+  inherit nopCilVisitor
+
+  method! vstmt (s: stmt) =
+    (match s.skind with
+      Instr il ->
+	IH.replace instrUseDefHash s.sid
+	  (List.map (fun i -> computeUseDefInstr i) il)
+    | sk ->
+	IH.replace stmtUseDefHash s.sid (computeUseDefStmtKind sk));
+    DoChildren
+
+end
+
+(** Fill the cache for a function. Statement ids must have been
+ * assigned, as they are after a CFG computation. *)
+let computeUseDefCache (fd: fundec) : unit =
+  IH.clear stmtUseDefHash;
+  IH.clear instrUseDefHash;
+  ignore (visitCilFunction (new useDefCacherClass) fd)
+
+(** The use/def sets of a statement kind other than Instr, from the
+ * cache when possible *)
+let cachedUseDefStmtKind (s: stmt) : VS.t * VS.t =
+  try IH.find stmtUseDefHash s.sid
+  with Not_found -> computeUseDefStmtKind s.skind
+
+(** The per-instruction use/def sets of an Instr statement, from the
+ * cache when it still matches the instruction list *)
+let cachedUseDefInstrList (s: stmt) (il: instr list) : (VS.t * VS.t) list =
+  match (try Some (IH.find instrUseDefHash s.sid) with Not_found -> None) with
+    Some uds when List.length uds = List.length il -> uds
+  | _ -> List.map (fun i -> computeUseDefInstr i) il
+
+(** CALLEE EFFECT SUMMARIES. The only information about a [Call] comes
+ * from the {!getUseDefFunctionRef} hook, so a client that needs
+ * soundness makes every call read and write every global, and the
+ * dataflow then pushes those worst-case sets around. A summary gives,
+ * per function, the globals it may transitively read or write and the
+ * globals whose address it takes (through which a pointer access may
+ * go); a call to a summarized function then contributes exactly that.
+ * Summaries are computed bottom-up over the strongly connected
+ * components of the callgraph, so recursion costs one union per
+ * component. *)
+
+type funcEffects = {
+    feReads: VS.t;    (** globals possibly read, transitively *)
+    feWrites: VS.t;   (** globals possibly written, transitively *)
+    feEscapes: VS.t;  (** globals whose address is taken; a pointer
+                       * access in the callee may read or write them *)
+    feUnknown: bool;  (** the function, or a transitive callee, is
+                       * external, called through a pointer, or uses
+                       * asm: it has no closed summary *)
+  }
+
+(** The summaries, by function name, after computeEffectSummaries *)
+let effectSummaries : (string, funcEffects) Hashtbl.t = Hashtbl.create 113
+
+(* the intraprocedural part of the effects *)
+let deReads = ref VS.empty
+let deWrites = ref VS.empty
+let deEscapes = ref VS.empty
+let deUnknown = ref false
+
+class directEffectsClass = object(self)
+  inherit nopCilVisitor
+
+  method! vexpr (e: exp) =
+    match e with
+      Lval (Var v, off) ->
+        if v.vglob then deReads := VS.add v !deReads;
+        ignore (visitCilOffset (self :> cilVisitor) off);
+        SkipChildren
+    | AddrOf (Var v, off) | StartOf (Var v, off) ->
+        if v.vglob then deEscapes := VS.add v !deEscapes;
+        ignore (visitCilOffset (self :> cilVisitor) off);
+        SkipChildren
+    | _ -> DoChildren
+
+  method! vinst (i: instr) =
+    (match i with
+      Set ((Var v, _), _, _) when v.vglob ->
+        deWrites := VS.add v !deWrites
+    | Call (Some (Var v, _), _, _, _) when v.vglob ->
+        deWrites := VS.add v !deWrites
+    | Asm _ -> deUnknown := true
+    | _ -> ());
+    DoChildren
+end
+
+(** Compute the effect summaries for all the functions of a file *)
+let computeEffectSummaries (fl: file) : unit =
+  Hashtbl.clear effectSummaries;
+  let direct : (string, funcEffects) Hashtbl.t = Hashtbl.create 113 in
+  iterGlobals fl
+    (function
+        GFun (fd, _) ->
+          deReads := VS.empty; deWrites := VS.empty;
+          deEscapes := VS.empty; deUnknown := false;
+          ignore (visitCilFunction (new directEffectsClass) fd);
+          Hashtbl.replace direct fd.svar.vname
+            { feReads = !deReads; feWrites = !deWrites;
+              feEscapes = !deEscapes; feUnknown = !deUnknown }
+      | _ -> ());
+  let cg = Callgraph.computeGraph fl in
+  let scc = Callgraph.computeSCCs cg in
+  Callgraph.iterSccBottomUp scc
+    (fun c members ->
+      (* the members of a component share one summary: the union of
+       * their direct effects and of the summaries of their callees in
+       * lower components, which are already done *)
+      let reads = ref VS.empty in
+      let writes = ref VS.empty in
+      let escapes = ref VS.empty in
+      let unknown = ref false in
+      let addSummary (fe: funcEffects) : unit =
+        reads := VS.union !reads fe.feReads;
+        writes := VS.union !writes fe.feWrites;
+        escapes := VS.union !escapes fe.feEscapes;
+        if fe.feUnknown then unknown := true
+      in
+      List.iter
+        (fun (n: Callgraph.callnode) ->
+          match n.Callgraph.cnInfo with
+            Callgraph.NIVar (v, def) when !def -> begin
+              (try addSummary (Hashtbl.find direct v.vname)
+              with Not_found -> unknown := true);
+              IH.iter
+                (fun _ (callee: Callgraph.callnode) ->
+                  if IH.find scc.Callgraph.sccOfNode callee.Callgraph.cnid
+                     <> c then
+                    try
+                      addSummary
+                        (Hashtbl.find effectSummaries
+                           (Callgraph.nodeName callee.Callgraph.cnInfo))
+                    with Not_found ->
+                      (* external or indirect callee *)
+                      unknown := true)
+                n.Callgraph.cnCallees
+            end
+          | _ -> (* an external function or an indirect node *)
+              unknown := true)
+        members;
+      let fe = { feReads = !reads; feWrites = !writes;
+                 feEscapes = !escapes; feUnknown = !unknown } in
+      List.iter
+        (fun (n: Callgraph.callnode) ->
+          match n.Callgraph.cnInfo with
+            Callgraph.NIVar (v, def) when !def ->
+              Hashtbl.replace effectSummaries v.vname fe
+          | _ -> ())
+        members)
+
+(** Compute the summaries for a file and plug them into
+ * {!getUseDefFunctionRef}: a direct call to a function with a closed
+ * summary contributes its globals (the escaped ones both as use and
+ * def), every other call falls through to whatever the hook did
+ * before. Note that, as before, effects on the caller's locals whose
+ * address was passed away are not seen. *)
+let installEffectSummaries (fl: file) : unit =
+  computeEffectSummaries fl;
+  let previous = !getUseDefFunctionRef in
+  getUseDefFunctionRef :=
+    (fun func args ->
+      match func with
+        Lval (Var vi, NoOffset) -> begin
+          match (try Some (Hashtbl.find effectSummaries vi.vname)
+                 with Not_found -> None) with
+            Some fe when not fe.feUnknown ->
+              (VS.union fe.feReads fe.feEscapes,
+               VS.union fe.feWrites fe.feEscapes,
+               args)
+          | _ -> previous func args
+        end
+      | _ -> previous func args)
@@ -61,11 +61,12 @@ open Llvmutils
 open Llvmgen
 open Llvmssa
 
-(* Generate LLVM code (as a doc string) for file 'f'. Currently x86+gcc specific,
-   and missing bitfield support (plus a few minor gcc-specific features, see above) *)
-let generate (f:file) : doc =
+(* Generate LLVM code (as a doc string) for a single global, shared by the
+   batch and streaming paths below. 'globals' accumulates the string
+   constants encountered while compiling function bodies; the caller must
+   print them (globals#printGlobals) as top-level LLVM constants.
 
-  (* Implementation overview:
+   Implementation overview:
      - For all top-level declarations except function definitions, we directly
        generate a doc string representing the LLVM equivalent.
      - For functions, we use the llvmGeneratorClass to "compile" (but the
@@ -73,12 +74,8 @@ let generate (f:file) : doc =
        (see the llvm* types in llvmgen.ml) in non-SSA form. We then use
        llvmssa.ml to transform this code into SSA form, and finally print
        the results as a doc string.
-     - We also use  llvmGeneratorClass to keep track of the string constants
-       used in file 'f'. We need to print these as top-level LLVM constants
-       (outside function bodies).
-  *)
-
-  let globals = new llvmGeneratorClass in
+*)
+let gGlobalGen (globals:llvmGenerator) : global -> doc =
 
   (* LLVM linkage for global 'vi' *)
   let rec gLinkage (vi:varinfo) (default:string) : string =
@@ -125,13 +122,22 @@ let generate (f:file) : doc =
 	     missing initializers for the tail of the array,
 	     but the default frontend doesn't generate any it seems... *)
 	  let ct' = typeArrayOf ct in
-	  dprintf "[ %a ]" (docList (fun (o, i) -> giInit ct' i)) inits
+	  (* expand run-length encoded entries; the element doc is shared *)
+	  let expand (o, i) = match i with
+	  | RepeatInit (i', n) ->
+	      let d = giInit ct' i' in
+	      Array.to_list (Array.make n d)
+	  | _ -> [giInit ct' i]
+	  in
+	  let elems = List.concat (Util.list_map expand inits) in
+	  dprintf "[ %a ]" (docList (fun d -> d)) elems
 	else (* a structure initializer *)
 	  let pfield (o, fieldinit) = match o with
 	  | Field(f, NoOffset) -> giInit f.ftype fieldinit
 	  | _ -> raise Bug
 	  in
 	  dprintf "{ %a }" (docList pfield) inits
+    | RepeatInit _ -> raise Bug (* occurs only inside an array CompoundInit *)
     in tdoc ++ (text " ") ++ idoc
 
   and gInit (t,ii) : doc = match ii.init with
@@ -159,10 +165,30 @@ let generate (f:file) : doc =
   | GPragma _ -> nil
   | GText s -> text s
   in
+  gGlobal
 
+(* Generate LLVM code (as a doc string) for file 'f'. Currently x86+gcc specific,
+   and missing bitfield support (plus a few minor gcc-specific features, see above) *)
+let generate (f:file) : doc =
+  let globals = new llvmGeneratorClass in
+  let gGlobal = gGlobalGen globals in
   let body = fold_left (++) nil (map gGlobal f.globals) in
   (globals#printGlobals ()) ++ body
 
+(* Stream LLVM code for file 'f' to channel 'out', one global at a time, so
+   that each global's doc (and, for functions, the code and SSA state built
+   while compiling it) becomes garbage as soon as it has been printed,
+   instead of accumulating a doc for the whole file. The string constants
+   are only known once every function has been compiled, so they are
+   emitted last; LLVM accepts globals in any order, so the module is
+   equivalent to the one 'generate' produces. 'out' is buffered by the
+   runtime, hence printing global-by-global costs no extra system calls *)
+let generateStreamed (f:file) (out:out_channel) : unit =
+  let globals = new llvmGeneratorClass in
+  let gGlobal = gGlobalGen globals in
+  iter (fun g -> fprint out ~width:80 (gGlobal g)) f.globals;
+  fprint out ~width:80 (globals#printGlobals ())
+
 (* CIL feature setup *)
 let feature =
   { fd_name = "llvm";
@@ -171,6 +197,6 @@ let feature =
     fd_extraopt = [];
     fd_doit =
     (function (f: file) ->
-      fprint stdout ~width:80 (generate f));
+      generateStreamed f stdout);
     fd_post_check = false
   }
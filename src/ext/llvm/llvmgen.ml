@@ -422,7 +422,7 @@ let llvmCastOp (tfrom:typ) (tto:typ) : llvmCast =
 (* comments in actual definition *)
 class type llvmGenerator = object
   method addString : string -> llvmGlobal
-  method addWString : int64 list -> llvmGlobal
+  method addWString : wstring -> llvmGlobal
   method mkFunction : fundec -> llvmBlock list
   method mkConstant : constant -> llvmValue
   method mkConstantExp : exp -> llvmValue
@@ -487,8 +487,8 @@ class llvmGeneratorClass : llvmGenerator = object (self)
     g
 
   (* Record a new wide string and return the global value that references it *)
-  method addWString (ws:int64 list) : llvmGlobal =
-    let realws = ws @ [ Int64.zero ] in (* CIL strings are missing the trailing nul *)
+  method addWString (ws:wstring) : llvmGlobal =
+    let realws = wstringToList ws @ [ Int64.zero ] in (* CIL strings are missing the trailing nul *)
     let wstrt = TArray(!wcharType, Some (kinteger IInt (length realws)), []) in
     let g = (self#newGLabel (), wstrt) in
     wstrings <- (g, realws) :: wstrings;
@@ -589,7 +589,7 @@ class llvmGeneratorClass : llvmGenerator = object (self)
   method mkConstant (c:constant) : llvmValue =
     match c with
     | CInt64 (i, ik, _) -> LInt (i, ik)
-    | CStr s -> LGetelementptr [ LGlobal (self#addString s); lzerop; lzerop ]
+    | CStr s -> LGetelementptr [ LGlobal (self#addString (cstringToString s)); lzerop; lzerop ]
     | CWStr ws -> LGetelementptr [ LGlobal (self#addWString ws); lzerop; lzerop ]
     | CChr c -> LInt (Int64.of_int (Char.code c), IInt)
     | CReal (f, fk, _) -> LFloat (f, fk)
@@ -991,7 +991,7 @@ class llvmGeneratorClass : llvmGenerator = object (self)
     | Const c -> ([], self#mkConstant c)
     | SizeOf t -> iExp (sizeOf t)
     | SizeOfE e -> iExp (sizeOf (typeOf e))
-    | SizeOfStr s -> ([], LInt (Int64.of_int ((String.length s) + 1), !kindOfSizeOf))
+    | SizeOfStr s -> ([], LInt (Int64.of_int ((cstringLength s) + 1), !kindOfSizeOf))
     | AlignOf t -> ([], LInt (Int64.of_int (alignOf_int t), !kindOfSizeOf))
     | AlignOfE e -> ([], LInt (Int64.of_int (alignOf_int (typeOf e)), !kindOfSizeOf))
     | Lval lv -> iRLval lv
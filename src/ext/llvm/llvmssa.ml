@@ -55,14 +55,27 @@ let z = 3
 let z = 3
 
 let llvmSsa (globals:llvmGenerator) (bl:llvmBlock list) (formals:varinfo list) (ssavars:varinfo list) : llvmBlock list = 
-  (* map from (b:string, v:string) -> llvmLocal
-       giving the ssa variable to use for 'v' at entry to block labeled 'b' *)
-  let entryName = H.create 32
+  (* Dense numberings of the blocks and of the 'ssavars', so that the
+     renaming state lives in arrays indexed by block and variable number
+     instead of hashtables keyed by (label, name) string pairs *)
+  let nblocks = length bl in
+  let nvars = length ssavars in
+  let bidOfLabel : (string, int) H.t = H.create nblocks in
+  iteri (fun i b -> H.add bidOfLabel b.lblabel i) bl;
+  let bid (b:llvmBlock) : int = H.find bidOfLabel b.lblabel in
+  let varIdx : (string, int) H.t = H.create nvars in
+  iteri (fun i vi -> H.add varIdx vi.vname i) ssavars;
 
-  (* map from (b:string, v:string) -> llvmValue
-       giving the value to use for 'v' at exit from block labeled 'b' 
-     note that the result is a value as 'v' may have been assigned a constant in 'b' *)
-  and exitValue = H.create 32 in
+  (* entryName.(b).(v): the ssa variable to use for 'v' at entry to block
+     number 'b'; None for the function entry point, which gets no phis *)
+  let entryName : llvmLocal option array array =
+    Array.init nblocks (fun _ -> Array.make nvars None) in
+
+  (* exitValue.(b).(v): the value to use for 'v' at exit from block number
+     'b'; note that the result is a value as 'v' may have been assigned a
+     constant in the block *)
+  let exitValue : llvmValue option array array =
+    Array.init nblocks (fun _ -> Array.make nvars None) in
 
   let id = ref 0 in
   (* create a new unique LLVM local for local variable 'vi' *)
@@ -71,22 +84,24 @@ let llvmSsa (globals:llvmGenerator) (bl:llvmBlock list) (formals:varinfo list) (
     (sprintf "%s.%d" s !id, t)
   in
 
-  (* Rename variables 'vl' in block 'b': pick new variables for 'b' at
-     entry to 'b' (except if 'b' is the function entry point), and
+  (* Rename the converted variables in block 'b': pick new variables for
+     'b' at entry to 'b' (except if 'b' is the function entry point), and
      rename all uses and subsequent assignments. Record the variable's
      new names at entry to 'b' and new values at exit from 'b' in
      entryName and exitValue *)
-  let renameVariables (vl:varinfo list) (b:llvmBlock) : unit = 
-    let blabel = b.lblabel in
+  let renameVariables (b:llvmBlock) : unit = 
+    let b_id = bid b in
+    let entry = entryName.(b_id)
+    and exitv = exitValue.(b_id) in
 
     (* The entry value is a new variable for all blocks except the function entry
        point. At entry, formals keep their name in the argument list, while 
        non-formals get C's 0 value for their type (maybe LUndef would be a better
        choice?) *)
-    let name1 vi = 
+    let name1 i vi = 
       if b.lbpreds <> [] then begin
 	let phiname = nextname vi.vname vi.vtype in
-	H.add entryName (b.lblabel, vi.vname) phiname;
+	entry.(i) <- Some phiname;
 	LLocal phiname
       end else if memq vi formals then 
 	LLocal (vi.vname, vi.vtype)
@@ -95,26 +110,34 @@ let llvmSsa (globals:llvmGenerator) (bl:llvmBlock list) (formals:varinfo list) (
     in
 
     (* Set initial variable values *) 
-    iter (fun vi -> H.add exitValue (blabel, vi.vname) (name1 vi)) vl;
+    iteri (fun i vi -> exitv.(i) <- Some (name1 i vi)) ssavars;
+
+    (* The current value of the variable named 'av', if it is one of the
+       variables being converted *)
+    let current (av:string) : llvmValue option =
+      if H.mem varIdx av then exitv.(H.find varIdx av) else None
+    in
 
     (* Rename LLVM value 'lv' *)
     let rec renameValue (lv:llvmValue) = match lv with
-    | LLocal (av, t) when H.mem exitValue (blabel, av) -> H.find exitValue (blabel, av)
+    | LLocal (av, t) -> (match current av with Some v -> v | None -> lv)
     | _ -> lv
 
-    (* Rename 'i's arguments, and remap the assigned variable if it's in vl *)
+    (* Rename 'i's arguments, and remap the assigned variable if it's being
+       converted *)
     and renameIns (i:llvmInstruction) : unit =
       i.liargs <- map renameValue i.liargs;
       match i.liresult with
-      | Some (rv, t) when H.mem exitValue (blabel, rv) -> (* rv assigned, pick new name *)
+      | Some (rv, t) when H.mem varIdx rv -> (* rv assigned, pick new name *)
+	  let k = H.find varIdx rv in
 	  if i.liop = LIassign then (* special assignment instruction *)
 	    (* from here on, substitute rv with the value assigned *)
-	    H.replace exitValue (blabel, rv) (hd i.liargs)
+	    exitv.(k) <- Some (hd i.liargs)
 	  else begin
 	    (* give rv a new name *)
 	    let newname = nextname rv t in
 	    i.liresult <- Some newname;
-	    H.replace exitValue (blabel, rv) (LLocal newname)
+	    exitv.(k) <- Some (LLocal newname)
 	  end
       | _ -> ()
 	    
@@ -131,12 +154,12 @@ let llvmSsa (globals:llvmGenerator) (bl:llvmBlock list) (formals:varinfo list) (
     b.lbterminator <- renameTerminator b.lbterminator;
   in
 
-  (* Add the phi statement for 'vi' to the start of block 'b' *)
-  let addPhi (b:llvmBlock) (vi:varinfo) : unit= 
+  (* Add the phi statement for variable number 'k' to the start of block 'b' *)
+  let addPhi (b:llvmBlock) (k:int) (_:varinfo) : unit= 
     if b.lbpreds <> [] then
-      let v = vi.vname in
-      let args = map (fun pb -> LPhi (H.find exitValue (pb.lblabel, v), pb)) b.lbpreds in
-      let phiIns = mkIns LIphi (H.find entryName (b.lblabel, v)) args in
+      let getOpt = function Some x -> x | None -> raise Bug in
+      let args = map (fun pb -> LPhi (getOpt exitValue.(bid pb).(k), pb)) b.lbpreds in
+      let phiIns = mkIns LIphi (getOpt entryName.(bid b).(k)) args in
       b.lbbody <- phiIns :: b.lbbody
   in
 
@@ -225,8 +248,8 @@ let llvmSsa (globals:llvmGenerator) (bl:llvmBlock list) (formals:varinfo list) (
     b.lbbody <- filter liveins b.lbbody
   in
 
-  iter (renameVariables ssavars) bl;
-  iter (fun b -> iter (addPhi b) ssavars) bl;
+  iter renameVariables bl;
+  iter (fun b -> iteri (addPhi b) ssavars) bl;
   (*fprint ~width:80 stderr (dprintf "%s\n%a" "pre-opt" globals#printBlocks bl);*)
   optimizeSsa bl;
   iter removeAssignAndDeadPhi bl;
@@ -34,6 +34,74 @@ let mkPrint (format: string) (args: exp list) : instr =
   Call(None, Lval(var p), (mkString format) :: args, !currentLoc)
 
 
+(* Whether to log into a per-thread ring buffer instead of calling printf
+ * per event *)
+let useBuffer = ref false
+
+(* The buffered mode appends a small binary record per event to a per-thread
+ * ring buffer and calls into the runtime only when the buffer fills up. The
+ * runtime contract is the same as for the logwrites feature:
+ *   struct cil_log_entry { void *addr; unsigned int site; unsigned int kind; };
+ *   extern __thread struct cil_log_entry *cil_log_cur, *cil_log_end;
+ *   void cil_log_flush(void);
+ * "addr" is the address of the function involved, "site" the source line,
+ * and "kind" one of the event codes below. *)
+let logEntryComp : compinfo =
+  mkCompInfo true "cil_log_entry"
+    (fun _ -> [ ("addr", voidPtrType, None, [], locUnknown);
+                ("site", uintType, None, [], locUnknown);
+                ("kind", uintType, None, [], locUnknown) ])
+    []
+let logEntryPtrType = TPtr(TComp(logEntryComp, []), [])
+
+let logCur =
+  let v = makeGlobalVar "cil_log_cur" logEntryPtrType in
+  v.vstorage <- Extern;
+  v.vattr <- [Attr("thread", [])];
+  v
+let logEnd =
+  let v = makeGlobalVar "cil_log_end" logEntryPtrType in
+  v.vstorage <- Extern;
+  v.vattr <- [Attr("thread", [])];
+  v
+let logFlush =
+  let fdec = emptyFunction "cil_log_flush" in
+  fdec.svar.vtype <- TFun(voidType, Some [], false, []);
+  fdec
+
+(* The event codes. 0 is a memory write, emitted by logwrites *)
+let evEnter = 1    (* function entry *)
+let evExit = 2     (* function exit *)
+let evCall = 3     (* before a call *)
+let evReturn = 4   (* after a call returns *)
+
+(* The address of the function that an event concerns *)
+let funcAddr (e: exp) : exp =
+  match e with
+    Lval lv -> mkCast ~e:(mkAddrOf lv) ~newt:voidPtrType
+  | _ -> mkCast ~e ~newt:voidPtrType
+
+(* The inline buffer append: fill in the next slot and bump cil_log_cur *)
+let mkAppend (addr: exp) (site: int) (kind: int) : instr list =
+  let cur = Lval (var logCur) in
+  let setField (fname: string) (what: exp) =
+    Set((Mem cur, Field(getCompField logEntryComp fname, NoOffset)),
+        what, !currentLoc)
+  in
+  [ setField "addr" addr;
+    setField "site" (integer site);
+    setField "kind" (integer kind);
+    Set(var logCur, BinOp(PlusPI, cur, one, logEntryPtrType), !currentLoc) ]
+
+(* if (cil_log_cur == cil_log_end) cil_log_flush (); *)
+let mkFlushCheck () : stmt =
+  mkStmt
+    (If(BinOp(Eq, Lval (var logCur), Lval (var logEnd), intType),
+        mkBlock [ mkStmtOneInstr
+                    (Call(None, Lval (var logFlush.svar), [],
+                          !currentLoc)) ],
+        mkBlock [], !currentLoc))
+
 let d_string (fmt : ('a,unit,doc,string) format4) : 'a =
   let f (d: doc) : string =
     Pretty.sprint ~width:200 d
@@ -41,6 +109,13 @@ let d_string (fmt : ('a,unit,doc,string) format4) : 'a =
   Pretty.gprintf f fmt
 
 let currentFunc: string ref = ref ""
+let currentFuncVar: varinfo option ref = ref None
+
+(* The address of the function being instrumented, for entry/exit records *)
+let currentFuncAddr () : exp =
+  match !currentFuncVar with
+    Some v -> mkCast ~e:(mkAddrOf (var v)) ~newt:voidPtrType
+  | None -> mkCast ~e:zero ~newt:voidPtrType
 
 class logCallsVisitorClass = object
   inherit nopCilVisitor
@@ -113,6 +188,44 @@ end
 
 let logCallsVisitor = new logCallsVisitorClass
 
+(* The buffered variant. Works on whole instruction lists so that the
+ * overflow check around each record can be a statement *)
+class logCallsBufferVisitorClass = object
+  inherit nopCilVisitor
+
+  method! vstmt (s: stmt) = begin
+    match s.skind with
+      Instr il when List.exists (function Call _ -> true | _ -> false) il ->
+        let doInstr (acc: stmt list) (i: instr) : stmt list =
+          match i with
+            Call(_, e, _, l) ->
+              currentLoc := l;
+              let addr = funcAddr e in
+              mkFlushCheck ()
+              :: mkStmt (Instr (mkAppend addr l.line evReturn))
+              :: mkStmtOneInstr i
+              :: mkFlushCheck ()
+              :: mkStmt (Instr (mkAppend addr l.line evCall))
+              :: acc
+          | _ -> mkStmtOneInstr i :: acc
+        in
+        s.skind <- Block (mkBlock (List.rev (List.fold_left doInstr [] il)));
+        SkipChildren
+
+    | Return (_, l) ->
+        currentLoc := l;
+        ChangeTo
+          (mkStmt (Block (mkBlock
+            [ mkStmt (Instr (mkAppend (currentFuncAddr ()) l.line evExit));
+              mkFlushCheck ();
+              s ])))
+
+    | _ -> DoChildren
+  end
+end
+
+let logCallsBufferVisitor = new logCallsBufferVisitorClass
+
 
 let logCalls (f: file) : unit =
 
@@ -123,13 +236,26 @@ let logCalls (f: file) : unit =
 
     | GFun (fdec, loc) ->
         currentFunc := fdec.svar.vname;
-        (* do the body *)
-        ignore (visitCilFunction logCallsVisitor fdec);
-        (* Now add the entry instruction *)
-        let pre = mkPrint (d_string "enter %s\n" !currentFunc) [] in
-        fdec.sbody <-
-          mkBlock [ mkStmtOneInstr pre;
-                    mkStmt (Block fdec.sbody) ]
+        currentFuncVar := Some fdec.svar;
+        if !useBuffer then begin
+          (* do the body *)
+          ignore (visitCilFunction logCallsBufferVisitor fdec);
+          (* Now add the entry record *)
+          currentLoc := loc;
+          fdec.sbody <-
+            mkBlock [ mkStmt (Instr (mkAppend (currentFuncAddr ())
+                                       loc.line evEnter));
+                      mkFlushCheck ();
+                      mkStmt (Block fdec.sbody) ]
+        end else begin
+          (* do the body *)
+          ignore (visitCilFunction logCallsVisitor fdec);
+          (* Now add the entry instruction *)
+          let pre = mkPrint (d_string "enter %s\n" !currentFunc) [] in
+          fdec.sbody <-
+            mkBlock [ mkStmtOneInstr pre;
+                      mkStmt (Block fdec.sbody) ]
+        end
 (*
 	(* debugging 'anagram', it's really nice to be able to see the strings *)
 	(* inside fat pointers, even if it's a bit of a hassle and a hack here *)
@@ -210,7 +336,14 @@ let logCalls (f: file) : unit =
     | _ -> ()
   in
   Stats.time "logCalls" (iterGlobals f) doGlobal;
-  if !addProto then begin
+  if !useBuffer then
+    (* Declare the runtime support *)
+    f.globals <-
+      GCompTag (logEntryComp, locUnknown) ::
+      GVarDecl (logCur, locUnknown) ::
+      GVarDecl (logEnd, locUnknown) ::
+      GVarDecl (logFlush.svar, locUnknown) :: f.globals
+  else if !addProto then begin
      let p = makePrintfFunction () in
      E.log "Adding prototype for call logging function %s\n" p.vname;
      f.globals <- GVarDecl (p, locUnknown) :: f.globals
@@ -224,7 +357,9 @@ let feature =
       ("--logcallprintf", Arg.String (fun s -> printFunctionName := s),
        " the name of the printf function to use");
       ("--logcalladdproto", Arg.Unit (fun s -> addProto := true),
-       " whether to add the prototype for the printf function")
+       " whether to add the prototype for the printf function");
+      ("--logcallsbuffer", Arg.Set useBuffer,
+       " log binary records into a per-thread ring buffer flushed in batches")
     ];
     fd_doit = logCalls;
     fd_post_check = true
@@ -77,6 +77,66 @@ let addr_of_lv (lh,lo) =
     (BinOp(PlusPI, lvPtr, (integer bytes_offset), ulongType))
   end else (AddrOf (lh,lo))
 
+(* Whether to log into a per-thread ring buffer instead of calling syslog
+ * per write *)
+let useBuffer = ref false
+
+(* The buffered mode appends a small binary record per write to a per-thread
+ * ring buffer and calls into the runtime only when the buffer fills up. The
+ * runtime provides the buffer and the batched flush:
+ *   struct cil_log_entry { void *addr; unsigned int site; unsigned int kind; };
+ *   extern __thread struct cil_log_entry *cil_log_cur, *cil_log_end;
+ *   void cil_log_flush(void);
+ * cil_log_cur points at the next free slot, cil_log_end one past the buffer,
+ * and cil_log_flush drains the records in one batch and resets cil_log_cur.
+ * "site" is the source line of the event; "kind" is 0 for a write (logcalls
+ * uses the same buffer with other kinds). *)
+let logEntryComp : compinfo =
+  mkCompInfo true "cil_log_entry"
+    (fun _ -> [ ("addr", voidPtrType, None, [], locUnknown);
+                ("site", uintType, None, [], locUnknown);
+                ("kind", uintType, None, [], locUnknown) ])
+    []
+let logEntryPtrType = TPtr(TComp(logEntryComp, []), [])
+
+let logCur =
+  let v = makeGlobalVar "cil_log_cur" logEntryPtrType in
+  v.vstorage <- Extern;
+  v.vattr <- [Attr("thread", [])];
+  v
+let logEnd =
+  let v = makeGlobalVar "cil_log_end" logEntryPtrType in
+  v.vstorage <- Extern;
+  v.vattr <- [Attr("thread", [])];
+  v
+let logFlush =
+  let fdec = emptyFunction "cil_log_flush" in
+  fdec.svar.vtype <- TFun(voidType, Some [], false, []);
+  fdec
+
+(* The inline buffer append:
+ * cil_log_cur->addr = addr; cil_log_cur->site = site; cil_log_cur->kind = 0;
+ * cil_log_cur ++; *)
+let mkAppend (addr: exp) (site: int) (kind: int) : instr list =
+  let cur = Lval (var logCur) in
+  let setField (fname: string) (what: exp) =
+    Set((Mem cur, Field(getCompField logEntryComp fname, NoOffset)),
+        what, !currentLoc)
+  in
+  [ setField "addr" addr;
+    setField "site" (integer site);
+    setField "kind" (integer kind);
+    Set(var logCur, BinOp(PlusPI, cur, one, logEntryPtrType), !currentLoc) ]
+
+(* if (cil_log_cur == cil_log_end) cil_log_flush (); *)
+let mkFlushCheck () : stmt =
+  mkStmt
+    (If(BinOp(Eq, Lval (var logCur), Lval (var logEnd), intType),
+        mkBlock [ mkStmtOneInstr
+                    (Call(None, Lval (var logFlush.svar), [],
+                          !currentLoc)) ],
+        mkBlock [], !currentLoc))
+
 class logWriteVisitor = object
   inherit nopCilVisitor
   (* Create a prototype for the logging function, but don't put it in the
@@ -125,15 +185,84 @@ class logWriteVisitor = object
 
 end
 
+(* The buffered variant. Works on whole instruction lists so that the
+ * overflow check can be a statement, and so that consecutive writes to the
+ * same lvalue can share one record *)
+class logWriteBufferVisitor = object
+  inherit nopCilVisitor
+
+  method! vstmt (s: stmt) : stmt visitAction =
+    match s.skind with
+      Instr il ->
+        let changed = ref false in
+        (* The address the last record covers; while consecutive writes hit
+         * the same lvalue we emit only the first record *)
+        let lastAddr : exp option ref = ref None in
+        let mustLog (lv: lval) =
+          match lv with
+            Var v, _ -> v.vglob
+          | Mem _, _ -> true
+        in
+        let record (acc: stmt list) (addr: exp) (l: location) : stmt list =
+          changed := true;
+          currentLoc := l;
+          mkFlushCheck () :: mkStmt (Instr (mkAppend addr l.line 0)) :: acc
+        in
+        let doInstr (acc: stmt list) (i: instr) : stmt list =
+          match i with
+            Set(lv, _, l) when mustLog lv ->
+              let addr = addr_of_lv lv in
+              let repeat =
+                match !lastAddr with
+                  Some a -> Expcompare.compareExpStripCasts a addr
+                | None -> false
+              in
+              lastAddr := Some addr;
+              if repeat then
+                mkStmtOneInstr i :: acc
+              else
+                mkStmtOneInstr i :: record acc addr l
+          | Call(Some lv, _, _, l) when mustLog lv ->
+              (* The callee may write anything, so do not coalesce across
+               * the call *)
+              lastAddr := None;
+              mkStmtOneInstr i :: record acc (addr_of_lv lv) l
+          | _ ->
+              lastAddr := None;
+              mkStmtOneInstr i :: acc
+        in
+        let stmts = List.rev (List.fold_left doInstr [] il) in
+        if !changed then
+          s.skind <- Block (mkBlock stmts);
+        SkipChildren
+
+    | _ -> DoChildren
+
+end
+
 let feature =
   { fd_name = "logwrites";
     fd_enabled = false;
     fd_description = "generation of code to log memory writes";
-    fd_extraopt = [];
+    fd_extraopt = [
+      ("--logwritesbuffer", Arg.Set useBuffer,
+       " log binary records into a per-thread ring buffer flushed in batches");
+    ];
     fd_doit =
     (function (f: file) ->
-      let lwVisitor = new logWriteVisitor in
-      visitCilFileSameGlobals lwVisitor f);
+      if !useBuffer then begin
+        let lwVisitor = new logWriteBufferVisitor in
+        visitCilFileSameGlobals lwVisitor f;
+        (* Declare the runtime support *)
+        f.globals <-
+          GCompTag (logEntryComp, locUnknown) ::
+          GVarDecl (logCur, locUnknown) ::
+          GVarDecl (logEnd, locUnknown) ::
+          GVarDecl (logFlush.svar, locUnknown) :: f.globals
+      end else begin
+        let lwVisitor = new logWriteVisitor in
+        visitCilFileSameGlobals lwVisitor f
+      end);
     fd_post_check = true;
   }
 
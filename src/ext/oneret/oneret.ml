@@ -46,6 +46,38 @@ module E = Errormsg
 
 let dummyVisitor = new nopCilVisitor
 
+(* Does the statement return anywhere inside? Used by the prescan below.
+ * TryFinally and TryExcept are opaque to the rewrite, so they are
+ * opaque here too. *)
+let rec stmtHasReturn (s: stmt) : bool =
+  match s.skind with
+    Return _ -> true
+  | If (_, t, e, _) -> blockHasReturn t || blockHasReturn e
+  | Loop (b, _, _, _) | Block b | Switch (_, b, _, _) -> blockHasReturn b
+  | Goto _ | ComputedGoto _ | Instr _ | Continue _ | Break _
+  | TryExcept _ | TryFinally _ -> false
+
+and blockHasReturn (b: block) : bool =
+  List.exists stmtHasReturn b.bstmts
+
+(* A function is already in one-return form when nothing in the body
+ * returns except the very last top-level statement, and that return
+ * needs no rewriting: [return;] for a subroutine, [return v;] for a
+ * plain variable otherwise. The scan is cheap -- it stops at the first
+ * return it sees -- and lets the common case skip the rewrite. *)
+let isOneretForm (b: block) (hasRet: bool) : bool =
+  let rec check = function
+      [] -> false  (* a return must still be appended at the end *)
+    | [s] -> begin
+        match s.skind with
+          Return (None, _) -> not hasRet
+        | Return (Some (Lval (Var _, NoOffset)), _) -> hasRet
+        | _ -> false
+      end
+    | s :: rests -> not (stmtHasReturn s) && check rests
+  in
+  check b.bstmts
+
 let oneret (f: Cil.fundec) : unit =
   let fname = f.svar.vname in
   (* Get the return type *)
@@ -57,108 +89,113 @@ let oneret (f: Cil.fundec) : unit =
   in
   (* Does it return anything ? *)
   let hasRet = match unrollType retTyp with TVoid _ -> false | _ -> true in
+  if isOneretForm f.sbody hasRet then () else begin
 
-  (* Memoize the return result variable. Use only if hasRet *)
-  let lastloc = ref locUnknown in
-  let retVar : varinfo option ref = ref None in
-  let getRetVar (x: unit) : varinfo =
-    match !retVar with
-      Some rv -> rv
-    | None -> begin
-        let rv = makeTempVar f ~name:"__retres" retTyp in (* don't collide *)
-        retVar := Some rv;
-        rv
-    end
-  in
-  (* Remember if we have introduced goto's *)
-  let haveGoto = ref false in
-  (* Memoize the return statement *)
-  let retStmt : stmt ref = ref dummyStmt in
-  let getRetStmt (x: unit) : stmt =
-    if !retStmt == dummyStmt then begin
-      (* Must create a statement *)
-      let rv =
-        if hasRet then Some (Lval(Var (getRetVar ()), NoOffset)) else None
-      in
-      let sr = mkStmt (Return (rv, !lastloc)) in
-      retStmt := sr;
-      sr
-    end else
-      !retStmt
-  in
-  (* Now scan all the statements. Know if you are the main body of the
-   * function and be prepared to add new statements at the end *)
-  let rec scanStmts (mainbody: bool) = function
-    | [] when mainbody -> (* We are at the end of the function. Now it is
-                           * time to add the return statement *)
-        let rs = getRetStmt () in
-        if !haveGoto then
-          rs.labels <- (Label("return_label", !lastloc, false)) :: rs.labels;
-        [rs]
-
-    | [] -> []
-
-    | [{skind=Return (Some (Lval(Var _,NoOffset)), _); _} as s]
-         when mainbody && not !haveGoto
-           -> [s]
-
-    | ({skind=Return (retval, l); _} as s) :: rests ->
-        currentLoc := l;
-(*
-        ignore (E.log "Fixing return(%a) at %a\n"
-                  insert
-                  (match retval with None -> text "None"
-                  | Some e -> d_exp () e)
-                  d_loc l);
-*)
-        if hasRet && retval = None then
-          E.s (error "Found return without value in function %s" fname);
-        if not hasRet && retval <> None then
-          E.s (error "Found return in subroutine %s" fname);
-        (* Keep this statement because it might have labels. But change it to
-         * an instruction that sets the return value (if any). *)
-        s.skind <- begin
-           match retval with
-             Some rval -> Instr [Set((Var (getRetVar ()), NoOffset), rval, l)]
-           | None -> Instr []
-        end;
-        (* See if this is the last statement in function *)
-        if mainbody && rests == [] then
+    (* Memoize the return result variable. Use only if hasRet *)
+    let lastloc = ref locUnknown in
+    let retVar : varinfo option ref = ref None in
+    let getRetVar (x: unit) : varinfo =
+      match !retVar with
+        Some rv -> rv
+      | None -> begin
+          let rv = makeTempVar f ~name:"__retres" retTyp in (* don't collide *)
+          retVar := Some rv;
+          rv
+      end
+    in
+    (* Remember if we have introduced goto's *)
+    let haveGoto = ref false in
+    (* Memoize the return statement *)
+    let retStmt : stmt ref = ref dummyStmt in
+    let getRetStmt (x: unit) : stmt =
+      if !retStmt == dummyStmt then begin
+        (* Must create a statement *)
+        let rv =
+          if hasRet then Some (Lval(Var (getRetVar ()), NoOffset)) else None
+        in
+        let sr = mkStmt (Return (rv, !lastloc)) in
+        retStmt := sr;
+        sr
+      end else
+        !retStmt
+    in
+    (* Now scan all the statements. Know if you are the main body of the
+     * function and be prepared to add new statements at the end *)
+    let rec scanStmts (mainbody: bool) = function
+      | [] when mainbody -> (* We are at the end of the function. Now it is
+                             * time to add the return statement *)
+          let rs = getRetStmt () in
+          if !haveGoto then
+            rs.labels <- (Label("return_label", !lastloc, false)) :: rs.labels;
+          [rs]
+
+      | [] -> []
+
+      | [{skind=Return (Some (Lval(Var _,NoOffset)), _); _} as s]
+           when mainbody && not !haveGoto
+             -> [s]
+
+      | ({skind=Return (retval, l); _} as s) :: rests ->
+          currentLoc := l;
+  (*
+          ignore (E.log "Fixing return(%a) at %a\n"
+                    insert
+                    (match retval with None -> text "None"
+                    | Some e -> d_exp () e)
+                    d_loc l);
+  *)
+          if hasRet && retval = None then
+            E.s (error "Found return without value in function %s" fname);
+          if not hasRet && retval <> None then
+            E.s (error "Found return in subroutine %s" fname);
+          (* Keep this statement because it might have labels. But change it to
+           * an instruction that sets the return value (if any). *)
+          s.skind <- begin
+             match retval with
+               Some rval -> Instr [Set((Var (getRetVar ()), NoOffset), rval, l)]
+             | None -> Instr []
+          end;
+          (* See if this is the last statement in function *)
+          if mainbody && rests == [] then
+            s :: scanStmts mainbody rests
+          else begin
+            (* Add a Goto *)
+            let sgref = ref (getRetStmt ()) in
+            let sg = mkStmt (Goto (sgref, l)) in
+            haveGoto := true;
+            s :: sg :: (scanStmts mainbody rests)
+          end
+
+      (* Compound statements keep their skind; their sub-blocks are
+       * rewritten in place *)
+      | ({skind=If(_,t,e,l); _} as s) :: rests ->
+          currentLoc := l;
+          scanBlock false t;
+          scanBlock false e;
+          s :: scanStmts mainbody rests
+      | ({skind=Loop(b,l,_,_); _} as s) :: rests ->
+          currentLoc := l;
+          scanBlock false b;
           s :: scanStmts mainbody rests
-        else begin
-          (* Add a Goto *)
-          let sgref = ref (getRetStmt ()) in
-          let sg = mkStmt (Goto (sgref, l)) in
-          haveGoto := true;
-          s :: sg :: (scanStmts mainbody rests)
-        end
-
-    | ({skind=If(eb,t,e,l); _} as s) :: rests ->
-        currentLoc := l;
-        s.skind <- If(eb, scanBlock false t, scanBlock false e, l);
-        s :: scanStmts mainbody rests
-    | ({skind=Loop(b,l,lb1,lb2); _} as s) :: rests ->
-        currentLoc := l;
-        s.skind <- Loop(scanBlock false b, l,lb1,lb2);
-        s :: scanStmts mainbody rests
-    | ({skind=Switch(e, b, cases, l); _} as s) :: rests ->
-        currentLoc := l;
-        s.skind <- Switch(e, scanBlock false b, cases, l);
-        s :: scanStmts mainbody rests
-    | ({skind=Block b; _} as s) :: rests ->
-        s.skind <- Block (scanBlock false b);
-        s :: scanStmts mainbody rests
-    | ({skind=(Goto _ | ComputedGoto _ | Instr _ | Continue _ | Break _
-               | TryExcept _ | TryFinally _); _} as s)
-      :: rests -> s :: scanStmts mainbody rests
-
-  and scanBlock (mainbody: bool) (b: block) =
-    { bstmts = scanStmts mainbody b.bstmts; battrs = b.battrs; }
+      | ({skind=Switch(_, b, _, l); _} as s) :: rests ->
+          currentLoc := l;
+          scanBlock false b;
+          s :: scanStmts mainbody rests
+      | ({skind=Block b; _} as s) :: rests ->
+          scanBlock false b;
+          s :: scanStmts mainbody rests
+      | ({skind=(Goto _ | ComputedGoto _ | Instr _ | Continue _ | Break _
+                 | TryExcept _ | TryFinally _); _} as s)
+        :: rests -> s :: scanStmts mainbody rests
 
-  in
-  ignore (visitCilBlock dummyVisitor f.sbody) ; (* sets CurrentLoc *)
-  lastloc := !currentLoc ;  (* last location in the function *)
-  f.sbody <- scanBlock true f.sbody
+    and scanBlock (mainbody: bool) (b: block) : unit =
+      b.bstmts <- scanStmts mainbody b.bstmts
+
+    in
+    ignore (visitCilBlock dummyVisitor f.sbody) ; (* sets CurrentLoc *)
+    lastloc := !currentLoc ;  (* last location in the function *)
+    scanBlock true f.sbody
+  end
 
 
 let feature =
@@ -174,3 +211,5 @@ let feature =
   }
 
 let () = Feature.register feature
+(* oneret rewrites each function body in isolation *)
+let () = Feature.markFunctionParallel "oneRet"
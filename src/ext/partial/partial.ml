@@ -261,11 +261,19 @@ struct
   end
 
   (* Rewrite an expression and return the new expression along with an
-   * indication of whether it depends on memory *)
+   * indication of whether it depends on memory. Rewritten expressions
+   * are stored back into the statements and re-evaluated on every
+   * fixpoint iteration, so an expression that has already been folded
+   * to a literal is the common case here: classify it with a
+   * constructor check instead of running the substitution visitor and
+   * the constant folder over it again. *)
   let rewriteExp r (e : exp) : exp * bool =
-    dependsOnMem := false;
-    let e' = constFold true (visitCilExpr (new rewriteExpClass r) e) in
-      e', !dependsOnMem
+    match e with
+        Const _ -> e, false
+      | _ ->
+          dependsOnMem := false;
+          let e' = constFold true (visitCilExpr (new rewriteExpClass r) e) in
+            e', !dependsOnMem
 
   let eval r e =
     let new_e, _depends = rewriteExp r e in
@@ -439,6 +447,10 @@ let calls_end_basic_blocks f =
 
 (*****************************************************************************
  * A transformation that gives each variable a unique identifier.
+ * Note that vids are globally unique by construction now (newVID backs
+ * every varinfo constructor, and Check verifies it), so this renumber
+ * is no longer run defensively by makeCFG. It remains useful when
+ * dense ids starting from 0 are wanted, e.g. to index arrays.
  ****************************************************************************)
 class vidVisitor = object
   inherit nopCilVisitor
@@ -474,8 +486,8 @@ let globally_unique_vids f =
  *       Use "calls_end_basic_blocks" to get this. cil/src/main.ml does
  *       this when you pass --makeCFG.
  * (2) All variables have globally unique identifiers.
- *       Use "globally_unique_vids" to get this. cil/src/main.ml does
- *       this when you pass --makeCFG.
+ *       This holds by construction: newVID backs every varinfo
+ *       constructor, and Check verifies it.
  * (3) This may not be a strict soundness requirement, but I wrote this
  *       assuming that the input file has all switch/break/continue
  *       statements removed.
@@ -862,7 +874,7 @@ struct
           let enqueue caller callee state =
             let si = get_sinfo callee in
               Hashtbl.replace si.incoming_state caller.sid state;
-              Heap.insert worklist si.priority callee
+              Heap.insert worklist callee.sid si.priority callee
           in
             (* we will be finished when we complete a round of
              * data-flow that does not change the ICFG *)
@@ -878,7 +890,8 @@ struct
               toposort c initial_stmt;
 
               let initial_si = get_sinfo initial_stmt in
-                Heap.insert worklist initial_si.priority initial_stmt;
+                Heap.insert worklist initial_stmt.sid initial_si.priority
+                  initial_stmt;
 
                 while not (Heap.is_empty worklist) do
                   let p, s = Heap.extract_max worklist in
@@ -1032,6 +1045,316 @@ struct
     else BasicPartial.simplify f c fd a
 end
 
+(*****************************************************************************
+ * Sparse conditional constant propagation.  An alternative to the
+ * data-flow engine above: instead of sweeping whole functions with
+ * joined register files until nothing changes, every local whose
+ * address is not taken gets a single flat lattice cell (top /
+ * constant / varying), a per-variable use list tells us which
+ * statements to re-examine when a cell drops, and the successors of a
+ * branch become executable only once its predicate allows it.
+ * Constants and unreachable-branch facts thus reinforce each other in
+ * one fixpoint per function: assignments sitting in branches that are
+ * never executable contribute nothing, which is what lets constants
+ * survive config-flag-style specialization.
+ *
+ * Soundness Assumptions:
+ * (1) The CFG is prepared: run --domakeCFG first, as for the partial
+ *     evaluator above.
+ * (2) Intraprocedural.  Formals, address-taken locals and globals are
+ *     treated as unknown, except for the const-qualified globals
+ *     handed in as assumptions, which cannot legally change.
+ ****************************************************************************)
+module SCCP =
+struct
+  module IH = Inthash
+
+  type value =
+      VTop                (* no evidence about this variable yet *)
+    | VConst of constant  (* on every executable path, this constant *)
+    | VVarying            (* conflicting or unknowable values *)
+
+  (* structural equality is not reliable on the big integers inside
+   * CInt64, so compare those explicitly *)
+  let equalConst (c1 : constant) (c2 : constant) : bool =
+    match c1, c2 with
+        CInt64 (i1, k1, _), CInt64 (i2, k2, _) ->
+          k1 = k2 && compare_cilint i1 i2 = 0
+      | _ -> Util.equals c1 c2
+
+  let meet (a : value) (b : value) : value =
+    match a, b with
+        VTop, x | x, VTop -> x
+      | VVarying, _ | _, VVarying -> VVarying
+      | VConst c1, VConst c2 -> if equalConst c1 c2 then a else VVarying
+
+  let equalValue (a : value) (b : value) : bool =
+    match a, b with
+        VTop, VTop | VVarying, VVarying -> true
+      | VConst c1, VConst c2 -> equalConst c1 c2
+      | _ -> false
+
+  (* evaluate [e] under [lookup]: substitute the variables whose cells
+   * are constant, fold, and classify the result.  Returns the folded
+   * expression together with its lattice value; the expression is
+   * only as good as the cells it was built from, so the caller must
+   * not keep it across further lowering unless the value was VConst *)
+  let evalExp (lookup : varinfo -> value) (e : exp) : exp * value =
+    let sawTop = ref false in
+    let sawVarying = ref false in
+    let vis = object
+      inherit nopCilVisitor
+      method! vexpr e =
+        match e with
+            Lval (Var v, NoOffset) ->
+              begin
+                match lookup v with
+                    VConst c -> ChangeTo (Const c)
+                  | VTop -> sawTop := true; SkipChildren
+                  | VVarying -> sawVarying := true; SkipChildren
+              end
+          | Lval (Mem _, _) | Lval (Var _, _) ->
+              (* a memory or aggregate read; index expressions inside
+               * may still fold *)
+              sawVarying := true;
+              DoChildren
+          | _ -> DoChildren
+    end in
+    let e' = constFold true (visitCilExpr vis e) in
+      match e' with
+          Const c -> e', VConst c
+        | _ ->
+            if !sawTop && not !sawVarying then e', VTop
+            else e', VVarying
+
+  let constTruth (v : value) : bool option =
+    match v with
+        VConst c ->
+          begin
+            match getInteger (Const c) with
+                Some x -> Some (not (is_zero_cilint x))
+              | None -> None
+          end
+      | _ -> None
+
+  (* a label anywhere inside the block means somebody may jump into
+   * it; cruder than the live-label analysis of the data-flow engine,
+   * but cheap and safe *)
+  let rec block_has_labels (b : block) : bool =
+    List.exists stmt_has_labels b.bstmts
+  and stmt_has_labels (s : stmt) : bool =
+    s.labels <> [] ||
+    match s.skind with
+        If (_, b1, b2, _) -> block_has_labels b1 || block_has_labels b2
+      | Switch (_, b, _, _) -> block_has_labels b
+      | Loop (b, _, _, _) -> block_has_labels b
+      | Block b -> block_has_labels b
+      | TryFinally (b1, b2, _) | TryExcept (b1, _, b2, _) ->
+          block_has_labels b1 || block_has_labels b2
+      | _ -> false
+
+  let simplify_function (fd : fundec) (assumptions : (lval * exp) list) : unit =
+    if fd.sbody.bstmts <> [] then begin
+      (* the assumptions are initialized const globals: their values
+       * hold everywhere, so they live in a separate, immutable table *)
+      let assumed : constant IH.t = IH.create 8 in
+        List.iter
+          (fun (l, e) ->
+             match l, constFold true e with
+                 (Var v, NoOffset), Const c -> IH.replace assumed v.vid c
+               | _ -> ())
+          assumptions;
+      let eligible v = not v.vglob && not v.vaddrof in
+      let cells : value IH.t = IH.create 64 in
+      let lookup (v : varinfo) : value =
+        if eligible v then
+          (try IH.find cells v.vid with Not_found -> VTop)
+        else
+          (try VConst (IH.find assumed v.vid) with Not_found -> VVarying)
+      in
+        (* formals arrive with values we know nothing about *)
+        List.iter (fun v -> IH.replace cells v.vid VVarying) fd.sformals;
+      (* use lists: the statements whose own expressions mention each
+       * eligible variable.  Nested statements record themselves; we
+       * only look at the expressions evaluated by the statement head *)
+      let uses : stmt list IH.t = IH.create 64 in
+      let addUses (s : stmt) : unit =
+        let seen : unit IH.t = IH.create 8 in
+        let vis = object
+          inherit nopCilVisitor
+          method! vvrbl (v : varinfo) =
+            if eligible v && not (IH.mem seen v.vid) then begin
+              IH.replace seen v.vid ();
+              let old = try IH.find uses v.vid with Not_found -> [] in
+                IH.replace uses v.vid (s :: old)
+            end;
+            SkipChildren
+        end in
+        let ve e = ignore (visitCilExpr vis e) in
+          match s.skind with
+              Instr il ->
+                List.iter (fun i -> ignore (visitCilInstr vis i)) il
+            | If (e, _, _, _) | Switch (e, _, _, _)
+            | Return (Some e, _) | ComputedGoto (e, _) -> ve e
+            | _ -> ()
+      in
+        List.iter addUses fd.sallstmts;
+      let exec : unit IH.t = IH.create 64 in
+      (* the keyed heap collapses duplicate entries, so a statement is
+       * queued at most once; -sid approximates program order *)
+      let work : stmt Heap.t = Heap.create (List.length fd.sallstmts) in
+      let enqueue (s : stmt) : unit = Heap.insert work s.sid (- s.sid) s in
+      let markExec (s : stmt) : unit =
+        if not (IH.mem exec s.sid) then begin
+          IH.replace exec s.sid ();
+          enqueue s
+        end
+      in
+      (* lower the cell of [v] towards [nv]; on a change, re-examine
+       * the executable statements that use [v] *)
+      let lower (v : varinfo) (nv : value) : unit =
+        if eligible v then begin
+          let old = try IH.find cells v.vid with Not_found -> VTop in
+          let nv' = meet old nv in
+            if not (equalValue old nv') then begin
+              IH.replace cells v.vid nv';
+              List.iter
+                (fun s -> if IH.mem exec s.sid then enqueue s)
+                (try IH.find uses v.vid with Not_found -> [])
+            end
+        end
+      in
+      let transfer_instr (i : instr) : unit =
+        match i with
+            Set ((Var v, NoOffset), e, _loc) ->
+              let _, value = evalExp lookup e in
+                lower v value
+          | Set ((Var v, _), _, _loc) ->
+              (* writing part of an aggregate *)
+              lower v VVarying
+          | Set ((Mem _, _), _, _loc) ->
+              (* eligible variables have no aliases *)
+              ()
+          | Call (Some (Var v, _), _, _, _loc) -> lower v VVarying
+          | Call _ -> ()
+          | Asm (_, _, outputs, _, _, _loc) ->
+              List.iter
+                (fun (_, _, (lh, _)) ->
+                   match lh with
+                       Var v -> lower v VVarying
+                     | Mem _ -> ())
+                outputs
+          | VarDecl _ -> ()
+      in
+      let transfer (s : stmt) : unit =
+        match s.skind with
+            Instr il ->
+              List.iter transfer_instr il;
+              List.iter markExec s.succs
+          | If (e, b1, b2, _loc) ->
+              let _, value = evalExp lookup e in
+              begin
+                match value, constTruth value with
+                    _, Some truth ->
+                      let live, dead = if truth then b1, b2 else b2, b1 in
+                      begin
+                        match live.bstmts with
+                            hd :: _tl -> markExec hd
+                          | [] ->
+                              (* the live branch falls through; every
+                               * successor but the dead branch's head
+                               * may execute *)
+                              List.iter
+                                (fun succ ->
+                                   match dead.bstmts with
+                                       dh :: _ when dh.sid = succ.sid -> ()
+                                     | _ -> markExec succ)
+                                s.succs
+                      end
+                  | VTop, _ ->
+                      (* no evidence yet; wait for the predicate *)
+                      ()
+                  | _, _ -> List.iter markExec s.succs
+              end
+          | Switch (e, _, _, _loc) ->
+              (* prepareCFG has normally rewritten these away; be
+               * conservative if one survives *)
+              let _, value = evalExp lookup e in
+                if not (equalValue value VTop) then
+                  List.iter markExec s.succs
+          | Return _ -> ()
+          | _ -> List.iter markExec s.succs
+      in
+        markExec (List.hd fd.sbody.bstmts);
+        while not (Heap.is_empty work) do
+          let _, s = Heap.extract_max work in
+            transfer s
+        done;
+      (* rewrite phase: fold the executable statements with the final
+       * cells; cells still at VTop were never assigned on any
+       * executable path and are left alone.  Statements that never
+       * became executable are only removed as the dead arm of a
+       * decided branch, and only when nobody can jump into them *)
+      let fold_exp e = fst (evalExp lookup e) in
+      let rewrite (s : stmt) : unit =
+        if IH.mem exec s.sid then
+          match s.skind with
+              Instr il ->
+                s.skind <-
+                  Instr
+                    (Util.list_map
+                       (fun i ->
+                          match i with
+                              Set (l, e, loc) -> Set (l, fold_exp e, loc)
+                            | Call (lo, f, args, loc) ->
+                                Call (lo, f, Util.list_map fold_exp args, loc)
+                            | _ -> i)
+                       il)
+            | If (e, b1, b2, loc) ->
+                let e', value = evalExp lookup e in
+                let collapse live dead =
+                  (match dead.bstmts with
+                       [] -> ()
+                     | dh :: _tl ->
+                         s.succs <-
+                           List.filter (fun succ -> succ.sid <> dh.sid)
+                             s.succs);
+                  if dead.bstmts = [] && dead.battrs = [] then begin
+                    s.skind <- Block live;
+                    match live.bstmts with
+                        [] -> ()
+                      | hd :: _tl -> s.succs <- [hd]
+                  end
+                  else begin
+                    let stmt' = mkStmt (Block live) in
+                      stmt'.sid <- new_sid ();
+                      s.skind <- Block {bstmts = [stmt']; battrs = []}
+                  end
+                in
+                begin
+                  match constTruth value with
+                      Some true when not (block_has_labels b2) ->
+                        collapse b1 b2
+                    | Some false when not (block_has_labels b1) ->
+                        collapse b2 b1
+                    | _ -> s.skind <- If (e', b1, b2, loc)
+                end
+            | Return (Some e, loc) ->
+                s.skind <- Return (Some (fold_exp e), loc)
+            | _ -> ()
+      in
+        List.iter rewrite fd.sallstmts
+    end
+
+  (* simplify every defined function; the assumptions play the same
+   * role as for [partial] below *)
+  let simplify (f : Cil.file) (assumptions : (lval * exp) list) : unit =
+    iterGlobals f
+      (function
+           GFun (fd, _loc) -> simplify_function fd assumptions
+         | _ -> ())
+end
+
 (* A very easy entry-point to partial evaluation/symbolic execution.
  * You pass the Cil file and a list of assumptions (lvalue, exp pairs
  * that should be treated as assignments that occur before the program
@@ -1092,6 +1415,7 @@ object
                                               loc)]
                             end
                         | CompoundInit (_typ, _ini_list) -> SkipChildren
+                        | RepeatInit _ -> SkipChildren
                     end
                 | None -> SkipChildren (* uninitialized constant *)
             else SkipChildren
@@ -1109,6 +1433,9 @@ let initialized_constants = ref false
 (* Name of function where we start to simplify *)
 let root_fun = ref "main"
 
+(* Use the sparse engine instead of the interprocedural data-flow one *)
+let use_sccp = ref false
+
 let do_feature_partial f =
   if not (Feature.enabled "makeCFG") then
     Errormsg.s (Errormsg.error
@@ -1117,16 +1444,17 @@ let do_feature_partial f =
     !PartialAlgorithm.use_ptranal_alias then
     Errormsg.s (Errormsg.error
                   "--dopartial: you must also specify --doptranal\n");
-  partial
-    f
-    !root_fun
-    (if !initialized_constants then
-       begin
-         let gcv = new globalConstVisitor in
-           visitCilFile (gcv :> Cil.cilVisitor) f;
-           gcv#get_initialized_constants
-       end
-     else [])
+  let assumptions =
+    if !initialized_constants then
+      begin
+        let gcv = new globalConstVisitor in
+          visitCilFile (gcv :> Cil.cilVisitor) f;
+          gcv#get_initialized_constants
+      end
+    else []
+  in
+    if !use_sccp then SCCP.simplify f assumptions
+    else partial f !root_fun assumptions
 
 let feature = {
   fd_name = "partial";
@@ -1147,7 +1475,10 @@ let feature = {
      " to analyze pointers");
     ("--partial_use_ptranal_alias",
      Arg.Set PartialAlgorithm.use_ptranal_alias,
-     " to analyze pointers (also see options of ptranal feature)")
+     " to analyze pointers (also see options of ptranal feature)");
+    ("--partial_use_sccp",
+     Arg.Set use_sccp,
+     " use sparse conditional constant propagation on every function")
   ];
   fd_doit = do_feature_partial;
   fd_post_check = false
@@ -1160,7 +1491,7 @@ let makeCFGFeature =
     fd_extraopt = [];
     fd_doit = (fun f ->
       ignore (calls_end_basic_blocks f) ;
-      ignore (globally_unique_vids f) ;
+      (* vids are globally unique by construction; no renumber needed *)
       iterGlobals f (fun glob -> match glob with
         GFun(fd,_) -> prepareCFG fd ;
                       (* jc: blockinggraph depends on this "true" arg *)
@@ -74,16 +74,92 @@ type context =
    of stamps representing a state in the cartesian product DFA. *)
 type configuration = context * int * int
 
-module ConfigHash =
+(* Configurations are encoded into one immediate int for the alias
+   simulation: bit 0 is the context and the two stamps take half of the
+   remaining bits each (30 bits on 64-bit hosts). Stamps beyond the
+   packable range -- not reachable in practice -- spill to a table that
+   hands out fresh negative codes, so the encoding stays injective. *)
+let config_stamp_bits = (Sys.word_size - 4) / 2
+let config_stamp_limit = 1 lsl config_stamp_bits
+let config_spill : (configuration, int) Hashtbl.t = Hashtbl.create 1
+let config_next_spill = ref (-1)
+
+let encode_configuration (c : context) (i : int) (i' : int) : int =
+  if i < config_stamp_limit && i' < config_stamp_limit then
+    (((i lsl config_stamp_bits) lor i') lsl 1)
+    lor (match c with Open -> 0 | Closed -> 1)
+  else
+    let config = (c, i, i') in
+    try Hashtbl.find config_spill config
+    with Not_found ->
+      let code = !config_next_spill in
+      decr config_next_spill;
+      Hashtbl.add config_spill config code;
+      code
+
+(* A set of encoded configurations: open addressing with linear probing
+   over a plain int array, since the solver probes it hundreds of
+   millions of times and the generic hash table would allocate a boxed
+   key and run the polymorphic hash on every probe. *)
+module ConfigSet =
 struct
-  type t = configuration
-  let equal t t' = t = t'
-  let hash t = Hashtbl.hash t
+  type t = { mutable keys : int array; (* empty_key marks a free slot *)
+             mutable mask : int;
+             mutable population : int }
+
+  let empty_key = min_int
+
+  let create (n : int) : t =
+    let cap = ref 16 in
+    while !cap < 2 * n do cap := !cap * 2 done;
+    { keys = Array.make !cap empty_key; mask = !cap - 1; population = 0 }
+
+  (* Multiplicative mixing; the low bits of a packed configuration are
+     heavily biased. The constant fits 32-bit hosts. *)
+  let index (s : t) (k : int) : int =
+    ((k lxor (k lsr 16)) * 0x27220A95) land s.mask
+
+  let mem (s : t) (k : int) : bool =
+    let keys = s.keys in
+    let i = ref (index s k) in
+    let res = ref false in
+    let probing = ref true in
+    while !probing do
+      let cur = keys.(!i) in
+      if cur = empty_key then probing := false
+      else if cur = k then begin res := true; probing := false end
+      else i := (!i + 1) land s.mask
+    done;
+    !res
+
+  let rec add (s : t) (k : int) : unit =
+    if 2 * (s.population + 1) > Array.length s.keys then grow s;
+    let keys = s.keys in
+    let i = ref (index s k) in
+    let probing = ref true in
+    while !probing do
+      let cur = keys.(!i) in
+      if cur = empty_key then begin
+        keys.(!i) <- k;
+        s.population <- s.population + 1;
+        probing := false
+      end
+      else if cur = k then probing := false
+      else i := (!i + 1) land s.mask
+    done
+
+  and grow (s : t) : unit =
+    let old = s.keys in
+    s.keys <- Array.make (2 * Array.length old) empty_key;
+    s.mask <- Array.length s.keys - 1;
+    s.population <- 0;
+    Array.iter (fun k -> if k <> empty_key then add s k) old
+
+  let iter (f : int -> unit) (s : t) : unit =
+    Array.iter (fun k -> if k <> empty_key then f k) s.keys
 end
 
-module CH = H.Make (ConfigHash)
-
-type config_map = unit CH.t
+type config_map = ConfigSet.t
 
 (** Generic bounds *)
 type 'a bound = {index : int; info : 'a U.uref}
@@ -137,9 +213,13 @@ type constant = int * string * Cil.varinfo
 module Constant =
 struct
   type t = constant
-  let compare (xid, _, _) (yid, _, _) = xid - yid
+  let index ((xid, _, _) : t) = xid
 end
-module C = Set.Make (Constant)
+(* Constants are identified by their fresh_index stamp, which is densely
+   assigned, so the points-to sets can use the dense bitmap-word
+   representation; unioning alias sets is the hot operation when labels
+   are unified *)
+module C = S.MakeIndexed (Constant)
 
 (** Sets of constants. Set union is used when two labels containing
   constant sets are unified *)
@@ -308,6 +388,71 @@ let no_sub = ref false
 (** If true, treat indexed edges as regular subtyping *)
 let analyze_mono = ref true
 
+(** If true, unify cyclic chains of subtype (m) edges between labels as
+    they are discovered (online cycle elimination, in the style of lazy
+    cycle detection). Labels on such a cycle flow to exactly the same
+    places, so collapsing them shrinks the graph that the reachability
+    phase has to explore. *)
+let eliminate_cycles = ref true
+
+(** If true, run the hybrid Steensgaard/GOLF analysis: a unification-based
+    (Steensgaard-style) partition of the labels is maintained alongside the
+    precise constraint graph, collapsing the two endpoints of every label
+    edge into one equivalence class. Labels in different classes can never
+    be related by any path in the precise analysis, so alias queries across
+    classes are answered negatively without running the (worst-case
+    exponential) DFA simulation or tabulation -- the precise machinery only
+    ever explores within one partition. *)
+let hybrid = ref false
+
+(** The Steensgaard partition for [hybrid] mode: a union-find over label
+    stamps, which are allocated densely and so index an array. *)
+module Partition =
+struct
+  (* parent.(s) is the parent stamp of [s], or [s] itself for a class
+     representative *)
+  let parent : int array ref = ref [||]
+
+  let ensure (s : int) : unit =
+    let n = Array.length !parent in
+      if s >= n then
+        begin
+          let n' = max (s + 1) (max 1024 (2 * n)) in
+          let a = Array.make n' 0 in
+            Array.blit !parent 0 a 0 n;
+            for i = n to n' - 1 do
+              a.(i) <- i
+            done;
+            parent := a
+        end
+
+  let rec find (s : int) : int =
+    let p = (!parent).(s) in
+      if p = s then s
+      else
+        let p' = (!parent).(p) in
+          (!parent).(s) <- p'; (* path halving *)
+          if p' = p then p else find p'
+
+  (* Merging towards the older stamp keeps the trees shallow enough in
+     combination with path halving. *)
+  let union (s : int) (s' : int) : unit =
+    ensure (if s > s' then s else s');
+    let r = find s
+    and r' = find s' in
+      if r < r' then (!parent).(r') <- r
+      else if r' < r then (!parent).(r) <- r'
+
+  let same (s : int) (s' : int) : bool =
+    ensure (if s > s' then s else s');
+    find s = find s'
+end
+
+(** Pairs of label stamps whose edge has already triggered a cycle
+    search. Searching from each edge at most once keeps the total
+    detection cost amortized over the number of edges. *)
+let lcd_searched : (int * int, unit) H.t = H.create 64
+
 (** A list of equality constraints. *)
 let eq_worklist : tconstraint Q.t = Q.create ()
 
@@ -880,6 +1025,8 @@ and unify_label (l, l' : label * label) : unit =
   in
     if !debug_constraints then
        Printf.printf "%s == %s\n" (string_of_label l) (string_of_label l');
+    if !hybrid then
+      Partition.union (get_label_stamp l) (get_label_stamp l');
     U.unify combine_label (l, l')
 and merge_vholes (vi, vi' : vinfo * vinfo) : unit =
   H.iter
@@ -974,6 +1121,8 @@ and leq_label (l,(i, p), l') : unit =
     Printf.printf
       "%s <={%d,%s} %s\n"
       (string_of_label l) i (string_of_polarity p) (string_of_label l');
+  if !hybrid then
+    Partition.union (get_label_stamp l) (get_label_stamp l');
   let li, li' = find l, find l' in
     match p with
         Pos ->
@@ -989,8 +1138,44 @@ and leq_label (l,(i, p), l') : unit =
           else
             begin
               li.m_ubounds <- B.add (make_bound(0, l')) li.m_ubounds;
-              li'.m_lbounds <- B.add (make_bound(0, l)) li'.m_lbounds
+              li'.m_lbounds <- B.add (make_bound(0, l)) li'.m_lbounds;
+              if !eliminate_cycles then check_label_cycle (l, l')
+            end
+and check_label_cycle (l, l' : label * label) : unit =
+  (* Called after inserting the m-edge [l] <= [l']. If [l] is reachable
+     from [l'] along m-edges, the new edge closed a cycle, and every
+     label on the discovered path is unified with [l]. Each edge starts
+     at most one search. *)
+  let key = (get_label_stamp l, get_label_stamp l') in
+    if not (H.mem lcd_searched key) then
+      begin
+        H.add lcd_searched key ();
+        let visited : (int, unit) H.t = H.create 16 in
+        let rec search (cur : label) : bool =
+          if U.equal (cur, l) then true
+          else if H.mem visited (get_label_stamp cur) then false
+          else
+            begin
+              H.add visited (get_label_stamp cur) ();
+              (* the bound set is functional, so the unifications done
+                 while unwinding do not disturb this iteration *)
+              let found = ref false in
+                B.iter
+                  (fun b -> if not !found && search b.info then found := true)
+                  (find cur).m_ubounds;
+                if !found then
+                  begin
+                    if !debug_constraints then
+                      Printf.printf
+                        "cycle: %s == %s\n"
+                        (string_of_label cur) (string_of_label l);
+                    unify_label (cur, l)
+                  end;
+                !found
             end
+        in
+          ignore (search l')
+      end
 and add_constraint_int (c : tconstraint) (toplev : bool) =
   if !debug_constraints && toplev then
     begin
@@ -1422,15 +1607,21 @@ let epoints_to (t : tau) : Cil.varinfo list =
     get_vinfos (points_to_aux t)
 
 let smart_alias_query (l : label) (l' : label) : bool =
+  if !hybrid
+     && not (Partition.same (get_label_stamp l) (get_label_stamp l'))
+  then
+    (* the Steensgaard partition already separates l and l' *)
+    false
+  else
   (* Set of dead configurations *)
-  let dead_configs : config_map = CH.create 16 in
+  let dead_configs : config_map = ConfigSet.create 16 in
     (* the set of discovered configurations *)
-  let discovered : config_map = CH.create 16 in
+  let discovered : config_map = ConfigSet.create 16 in
   let filter_match (i : int) =
     B.filter (fun (b : lblinfo bound) -> i = b.index)
   in
   let rec simulate c l l' =
-    let config = (c, get_label_stamp l, get_label_stamp l') in
+    let config = encode_configuration c (get_label_stamp l) (get_label_stamp l') in
       if U.equal (l, l') then
         begin
           if !debug then
@@ -1440,14 +1631,15 @@ let smart_alias_query (l : label) (l' : label) : bool =
               (string_of_label l');
           raise APFound
         end
-      else if CH.mem discovered config then ()
+      else if ConfigSet.mem discovered config then ()
       else
         begin
           if !debug_aliases then
             Printf.printf
               "Exploring configuration %s\n"
-              (string_of_configuration config);
-          CH.add discovered config ();
+              (string_of_configuration
+                 (c, get_label_stamp l, get_label_stamp l'));
+          ConfigSet.add discovered config;
           B.iter
             (fun lb -> simulate c lb.info l')
             (get_bounds Sub false l); (* epsilon closure of l *)
@@ -1490,7 +1682,7 @@ let smart_alias_query (l : label) (l' : label) : bool =
               | _ -> ()
           end;
           (* if we got this far, then the configuration was not used *)
-          CH.add dead_configs config ();
+          ConfigSet.add dead_configs config;
         end
   in
     try
@@ -1509,9 +1701,9 @@ let smart_alias_query (l : label) (l' : label) : bool =
           end
       end
     with APFound ->
-      CH.iter
-        (fun config -> fun _ ->
-           if not (CH.mem dead_configs config) then
+      ConfigSet.iter
+        (fun config ->
+           if not (ConfigSet.mem dead_configs config) then
              H.add
                cached_aliases
                (get_label_stamp l, get_label_stamp l')
@@ -1533,7 +1725,13 @@ let may_alias (t1 : tau) (t2 : tau) : bool =
         | Var v -> raise NoContents
         | _ -> raise WellFormed
     in
-      not (C.is_empty (C.inter (collect_ptsets l1) (collect_ptsets l2)))
+      (* In hybrid mode, labels in different Steensgaard classes have
+         disjoint points-to sets; skip the tabulation entirely. *)
+      if !hybrid
+         && not (Partition.same (get_label_stamp l1) (get_label_stamp l2))
+      then false
+      else
+        not (C.is_empty (C.inter (collect_ptsets l1) (collect_ptsets l2)))
   with NoContents -> false
 
 let alias_query (b : bool) (lvl : lvalue list) : int * int =
@@ -48,6 +48,8 @@ val print_constraints : bool ref
 val no_flow : bool ref
 val no_sub : bool ref
 val analyze_mono : bool ref
+val eliminate_cycles : bool ref
+val hybrid : bool ref
 val solve_constraints : unit -> unit
 val rvalue : lvalue -> tau
 val deref : tau -> lvalue
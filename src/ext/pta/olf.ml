@@ -50,6 +50,8 @@ exception UnknownLocation
 
 let solve_constraints () = () (* only for compatability with Golf *)
 
+let hybrid = ref false (* only for compatability with Golf *)
+
 open Cil
 
 module U = Uref
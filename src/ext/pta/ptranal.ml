@@ -42,12 +42,57 @@ open Feature
 
 module H = Hashtbl
 
-module A = Olf
-exception UnknownLocation = A.UnknownLocation
-
-type access = A.lvalue * bool
+(** The solver interface shared by the Olf and Golf backends. This is
+    the part of their (deliberately compatible) signatures that the
+    analysis below uses; the analysis body is a functor over it, so the
+    backend can be chosen per file at runtime. *)
+module type PtaSolver =
+sig
+  type lvalue
+  type tau
+  type absloc
+
+  exception UnknownLocation
+
+  val debug : bool ref
+  val debug_constraints : bool ref
+  val debug_aliases : bool ref
+  val smart_aliases : bool ref
+  val print_constraints : bool ref
+  val no_flow : bool ref
+  val no_sub : bool ref
+  val analyze_mono : bool ref
+  val hybrid : bool ref
+  val finished_constraints : unit -> unit
+  val rvalue : lvalue -> tau
+  val deref : tau -> lvalue
+  val join : tau -> tau -> tau
+  val join_inits : tau list -> tau
+  val address : lvalue -> tau
+  val instantiate : lvalue -> int -> lvalue
+  val assign : lvalue -> tau -> unit
+  val assign_ret : int -> lvalue -> tau -> unit
+  val apply : tau -> tau list -> (tau * int)
+  val apply_undefined : tau list -> (tau * int)
+  val assign_undefined : lvalue -> unit
+  val make_function : string -> lvalue list -> tau -> tau
+  val make_lvalue : bool -> string -> (Cil.varinfo option) -> lvalue
+  val bottom : unit -> tau
+  val return : tau -> tau -> unit
+  val make_fresh : string -> tau
+  val points_to_names : lvalue -> string list
+  val points_to : lvalue -> Cil.varinfo list
+  val epoints_to : tau -> Cil.varinfo list
+  val string_of_lvalue : lvalue -> string
+  val may_alias : tau -> tau -> bool
+  val absloc_points_to : lvalue -> absloc list
+  val absloc_epoints_to : tau -> absloc list
+  val absloc_of_lvalue : lvalue -> absloc
+  val absloc_eq : (absloc * absloc) -> bool
+  val d_absloc : unit -> absloc -> Pretty.doc
+end
 
-type access_map = (lval, access) H.t
+exception UnknownLocation = Olf.UnknownLocation
 
 (** a mapping from varinfo's back to fundecs *)
 module VarInfoKey =
@@ -65,37 +110,105 @@ module F = Map.Make (VarInfoKey)
 (*                                                                     *)
 (***********************************************************************)
 
+(* The flags live here rather than aliasing one backend's refs; they
+ * are copied into both backends when a file is analyzed. *)
 let model_strings = ref false
-let print_constraints = A.print_constraints
-let debug_constraints = A.debug_constraints
-let debug_aliases = A.debug_aliases
-let smart_aliases = A.smart_aliases
-let debug = A.debug
-let analyze_mono = A.analyze_mono
-let no_flow = A.no_flow
-let no_sub = A.no_sub
+let print_constraints = ref false
+let debug_constraints = ref false
+let debug_aliases = ref false
+let smart_aliases = ref false
+let debug = ref false
+let analyze_mono = ref false
+let no_flow = ref false
+let no_sub = ref false
+let hybrid = ref false
 let fun_ptrs_as_funs = ref false
 let show_progress = ref false
 let debug_may_aliases = ref false
+let assume_strict_aliasing = ref false
 
-let found_undefined = ref false
+(** Which solver backs the analysis: "olf" (fast, the historical
+    default), "golf" (precise) or "auto" (pick per file by problem
+    size). *)
+let solver = ref "olf"
+
+(** In auto mode, files with at most this many pointer-typed variables
+    get the precise solver; larger files get the fast one. *)
+let precise_solver_limit = ref 10000
+
+(** Wall-clock seconds a precise solve may take before the file is
+    re-analyzed with the fast solver; 0 disables the budget. *)
+let solver_time_budget = ref 0.0
 
 let conservative_undefineds = ref false
 
+(* This function should be set by the client if it
+ * knows of functions returning a result that have
+ * no side effects. If the result is not used, then
+ * the call will be eliminated. *)
+let callHasNoSideEffects : (exp -> bool) ref =
+  ref (fun _ -> false)
+
+(* Type-based alias pre-filter. Under the strict-aliasing rule an
+ * object is only accessed through a compatible type, so two scalar
+ * lvalues whose type signatures differ cannot overlap. The escape
+ * hatches: anything may be accessed as a character type or through
+ * void, corresponding signed/unsigned integer types are compatible,
+ * pointer values are routinely punned through generic pointer types,
+ * and aggregates may share members with anything. When the filter
+ * answers "no alias" the constraint graph is never touched. *)
+let types_may_alias (t1 : typ) (t2 : typ) : bool =
+  let b1 = unrollType t1
+  and b2 = unrollType t2 in
+    Util.equals (typeSig b1) (typeSig b2) ||
+    match b1, b2 with
+        (TVoid _ | TInt ((IChar | ISChar | IUChar), _)), _
+      | _, (TVoid _ | TInt ((IChar | ISChar | IUChar), _)) -> true
+      | (TInt _ | TEnum _), (TInt _ | TEnum _) -> true
+      | TPtr _, TPtr _ -> true
+      | (TInt _ | TEnum _ | TFloat _ | TPtr _),
+        (TInt _ | TEnum _ | TFloat _ | TPtr _) -> false
+      | _ -> true
+
+(* e1 and e2 are pointer expressions; compare the pointed-to types *)
+let exps_may_alias_by_type (e1 : exp) (e2 : exp) : bool =
+  match unrollType (typeOf e1), unrollType (typeOf e2) with
+      TPtr (b1, _), TPtr (b2, _) -> types_may_alias b1 b2
+    | _ -> true
+
+
+(***********************************************************************)
+(*                                                                     *)
+(* The Analysis, Parameterized by its Solver                           *)
+(*                                                                     *)
+(***********************************************************************)
+
+module Make (A : PtaSolver) =
+struct
+
+type access = A.lvalue * bool
+
+type access_map = (lval, access) H.t
+
+let found_undefined = ref false
+
 let current_fundec : fundec option ref = ref None
 
-let fun_access_map : (fundec, access_map) H.t = H.create 64
+(* These four tables (and the graph hanging off their range values)
+ * are the whole analysis state; they are refs so that a saved state
+ * can be swapped in wholesale by load_state below. *)
+let fun_access_map : (fundec, access_map) H.t ref = ref (H.create 64)
 
 (* A mapping from varinfos to fundecs *)
 let fun_varinfo_map = ref F.empty
 
 let current_ret : A.tau option ref = ref None
 
-let lvalue_hash : (varinfo,A.lvalue) H.t = H.create 64
+let lvalue_hash : (varinfo,A.lvalue) H.t ref = ref (H.create 64)
 
-let expressions : (exp,A.tau) H.t = H.create 64
+let expressions : (exp,A.tau) H.t ref = ref (H.create 64)
 
-let lvalues : (lval,A.lvalue) H.t = H.create 64
+let lvalues : (lval,A.lvalue) H.t ref = ref (H.create 64)
 
 let fresh_index : (unit -> int) =
   let count = ref 0 in
@@ -113,13 +226,6 @@ let alloc_names = [
   "kmalloc"
 ]
 
-(* This function should be set by the client if it
- * knows of functions returning a result that have
- * no side effects. If the result is not used, then
- * the call will be eliminated. *)
-let callHasNoSideEffects : (exp -> bool) ref =
-  ref (fun _ -> false)
-
 let all_globals : varinfo list ref = ref []
 let all_functions : fundec list ref = ref []
 
@@ -180,11 +286,11 @@ let is_effect_free_fun = function
 (* let analyzeOffset (o : offset ) : A.tau = A.bottom () *)
 
 let analyze_var_decl (v : varinfo ) : A.lvalue =
-  try H.find lvalue_hash v
+  try H.find !lvalue_hash v
   with Not_found ->
     let lv = A.make_lvalue false v.vname (Some v)
     in
-      H.add lvalue_hash v lv;
+      H.add !lvalue_hash v lv;
       lv
 
 let isFunPtrType (t : typ) : bool =
@@ -197,7 +303,7 @@ let rec analyze_lval (lv : lval ) : A.lvalue =
     match !current_fundec with
         None -> l
       | Some f ->
-          let accesses = H.find fun_access_map f in
+          let accesses = H.find !fun_access_map f in
             if H.mem accesses lv then l
             else
               begin
@@ -222,7 +328,7 @@ let rec analyze_lval (lv : lval ) : A.lvalue =
           in
             find_access alv false
   in
-    H.replace lvalues lv result;
+    H.replace !lvalues lv result;
     result
 and analyze_expr_as_lval (e : exp) : A.lvalue =
   match e with
@@ -233,6 +339,7 @@ and analyze_expr (e : exp ) : A.tau =
     match e with
         Const (CStr s) ->
           if !model_strings then
+            let s = cstringToString s in
             A.address (A.make_lvalue
                          false
                          s
@@ -258,7 +365,7 @@ and analyze_expr (e : exp ) : A.tau =
       | Imag __ -> failwith "not implemented yet"
       | Real __ -> failwith "not implemented yet"
  in
-  H.add expressions e result;
+  H.add !expressions e result;
   result
 
 
@@ -268,6 +375,7 @@ let rec analyze_init (i : init ) : A.tau =
       SingleInit e -> analyze_expr e
     | CompoundInit (t, oi) ->
         A.join_inits (Util.list_map (function (_, i) -> analyze_init i) oi)
+    | RepeatInit (i, _) -> analyze_init i
 
 let analyze_instr (i : instr ) : unit =
   match i with
@@ -352,7 +460,7 @@ let analyze_function (f : fundec ) : unit =
       Printf.printf "Analyzing function %s\n" f.svar.vname;
     fun_varinfo_map := F.add f.svar f (!fun_varinfo_map);
     current_fundec := Some f;
-    H.add fun_access_map f (H.create 8);
+    H.add !fun_access_map f (H.create 8);
     A.assign oldlv newf;
     current_ret := Some ret;
     analyze_block f.sbody
@@ -382,9 +490,28 @@ let analyze_file (f : file) : unit =
 (*                                                                     *)
 (***********************************************************************)
 
+(* Queries are demand-driven. The solver resolves constraints online
+ * as they are generated, and its flow step computes each location's
+ * points-to set lazily the first time that location is asked for,
+ * memoizing the result in the graph. So to answer a query we need
+ * only seal the constraint system; the caches below additionally make
+ * repeated queries for the same lvalue or expression free. *)
+let constraints_finalized : bool ref = ref false
+
+let finalize_constraints () : unit =
+  if not !constraints_finalized then
+    begin
+      constraints_finalized := true;
+      A.finished_constraints ()
+    end
+
+let lval_query_cache : (lval, varinfo list) H.t = H.create 64
+
+let exp_query_cache : (exp, varinfo list) H.t = H.create 64
+
 (* Same as analyze_expr, but no constraints. *)
 let rec traverse_expr (e : exp) : A.tau =
-  H.find expressions e
+  H.find !expressions e
 
 and traverse_expr_as_lval (e : exp) : A.lvalue =
   match e with
@@ -392,11 +519,19 @@ and traverse_expr_as_lval (e : exp) : A.lvalue =
     | _ -> assert false (* todo -- other kinds of expressions? *)
 
 and traverse_lval (lv : lval ) : A.lvalue =
-  H.find lvalues lv
+  H.find !lvalues lv
 
 let may_alias (e1 : exp) (e2 : exp) : bool =
-  let tau1,tau2 = traverse_expr e1, traverse_expr e2 in
-  let result = A.may_alias tau1 tau2 in
+  let result =
+    if !assume_strict_aliasing && not (exps_may_alias_by_type e1 e2) then
+      false
+    else
+      begin
+        finalize_constraints ();
+        let tau1,tau2 = traverse_expr e1, traverse_expr e2 in
+          A.may_alias tau1 tau2
+      end
+  in
     if !debug_may_aliases then
       begin
         let doc1 = d_exp () e1 in
@@ -412,13 +547,23 @@ let may_alias (e1 : exp) (e2 : exp) : bool =
     result
 
 let resolve_lval (lv : lval) : varinfo list =
-  A.points_to (traverse_lval lv)
+  try H.find lval_query_cache lv
+  with Not_found ->
+    finalize_constraints ();
+    let result = A.points_to (traverse_lval lv) in
+      H.add lval_query_cache lv result;
+      result
 
 let resolve_exp (e : exp) : varinfo list =
-  A.epoints_to (traverse_expr e)
+  try H.find exp_query_cache e
+  with Not_found ->
+    finalize_constraints ();
+    let result = A.epoints_to (traverse_expr e) in
+      H.add exp_query_cache e result;
+      result
 
 let resolve_funptr (e : exp) : fundec list =
-  let varinfos = A.epoints_to (traverse_expr e) in
+  let varinfos = resolve_exp e in
     List.fold_left
       (fun fdecs -> fun vinf ->
          try F.find vinf !fun_varinfo_map :: fdecs
@@ -428,7 +573,7 @@ let resolve_funptr (e : exp) : fundec list =
 
 let count_hash_elts h =
   let result = ref 0 in
-    H.iter (fun _ -> fun _ -> incr result) lvalue_hash;
+    H.iter (fun _ -> fun _ -> incr result) !lvalue_hash;
     !result
 
 let compute_may_aliases (b : bool) : unit =
@@ -439,13 +584,13 @@ let compute_may_aliases (b : bool) : unit =
           ignore (Util.list_map (may_alias h) t);
           compute_may_aliases_aux t
   and exprs : exp list ref = ref [] in
-    H.iter (fun e -> fun _ -> exprs := e :: !exprs) expressions;
+    H.iter (fun e -> fun _ -> exprs := e :: !exprs) !expressions;
     compute_may_aliases_aux !exprs
 
 
 let compute_results (show_sets : bool) : unit =
   let total_pointed_to = ref 0
-  and total_lvalues = H.length lvalue_hash
+  and total_lvalues = H.length !lvalue_hash
   and counted_lvalues = ref 0
   and lval_elts : (string * (string list)) list ref = ref [] in
   let print_result (name, set) =
@@ -479,7 +624,7 @@ let compute_results (show_sets : bool) : unit =
       Printf.printf "Computed flow for %d of %d sets\n" !counted total
   in
     if !conservative_undefineds && !found_undefined then hose_globals ();
-    A.finished_constraints ();
+    finalize_constraints ();
     if show_sets then
       begin
         print_endline "Computing points-to sets...";
@@ -488,7 +633,7 @@ let compute_results (show_sets : bool) : unit =
              show_progress_fn counted_lvalues total_lvalues;
              try lval_elts := (vinf.vname, A.points_to_names lv) :: !lval_elts
              with A.UnknownLocation -> ())
-          lvalue_hash;
+          !lvalue_hash;
         List.iter print_result !lval_elts;
         Printf.printf
           "Total number of things pointed to: %d\n"
@@ -505,7 +650,7 @@ let print_types () : unit =
   Hashtbl.iter
     (fun vi -> fun lv ->
        Printf.printf "%s : %s\n" vi.vname (A.string_of_lvalue lv))
-    lvalue_hash
+    !lvalue_hash
 
 
 
@@ -517,6 +662,77 @@ let print_types () : unit =
 let compute_aliases = compute_may_aliases
 
 
+(***********************************************************************)
+(*                                                                     *)
+(* Persistent Results                                                  *)
+(*                                                                     *)
+(***********************************************************************)
+
+(* The solved state is the constraint graph hanging off the tables
+ * above, and the table keys are AST nodes, so the analyzed file must
+ * travel with the state: marshaling both in one block preserves the
+ * sharing between the keys and the file that makes lookups work
+ * after a reload. The digest names the merged file the state was
+ * computed from; a load against any other digest is refused. The
+ * state is also typed by the solver that produced it, so the runtime
+ * dispatch below tags the digest with the solver name. *)
+
+let state_magic = "cil_pta_state"
+let state_version = 2
+
+let save_state (f : file) ~(digest : string) (filename : string) : unit =
+  finalize_constraints ();
+  let chn = open_out_bin filename in
+    Marshal.to_channel chn state_magic [];
+    Marshal.to_channel chn (state_version, digest) [];
+    Marshal.to_channel chn
+      (f,
+       !lvalue_hash, !expressions, !lvalues, !fun_access_map,
+       !fun_varinfo_map, !all_globals, !all_functions)
+      [];
+    close_out chn
+
+let load_state ~(digest : string) (filename : string) : file option =
+  try
+    let chn = open_in_bin filename in
+    let finish (result : file option) =
+      close_in chn;
+      result
+    in
+      if (Marshal.from_channel chn : string) <> state_magic then finish None
+      else
+        let version, saved_digest =
+          (Marshal.from_channel chn : int * string)
+        in
+          if version <> state_version || saved_digest <> digest then
+            finish None
+          else
+            let f, lh, ex, lv, fam, fvm, ag, af =
+              (Marshal.from_channel chn
+                 : file
+                 * (varinfo, A.lvalue) H.t
+                 * (exp, A.tau) H.t
+                 * (lval, A.lvalue) H.t
+                 * (fundec, access_map) H.t
+                 * fundec F.t
+                 * varinfo list
+                 * fundec list)
+            in
+              lvalue_hash := lh;
+              expressions := ex;
+              lvalues := lv;
+              fun_access_map := fam;
+              fun_varinfo_map := fvm;
+              all_globals := ag;
+              all_functions := af;
+              H.clear lval_query_cache;
+              H.clear exp_query_cache;
+              finalize_constraints ();
+              finish (Some f)
+  with
+      Sys_error _ | End_of_file | Failure _ -> None
+
+
 (***********************************************************************)
 (*                                                                     *)
 (* Abstract Location Interface                                         *)
@@ -526,7 +742,7 @@ let compute_aliases = compute_may_aliases
 type absloc = A.absloc
 
 let lvalue_of_varinfo (vi : varinfo) : A.lvalue =
-  H.find lvalue_hash vi
+  H.find !lvalue_hash vi
 
 let lvalue_of_lval = traverse_lval
 let tau_of_expr = traverse_expr
@@ -539,13 +755,16 @@ let absloc_of_lval lv =
   A.absloc_of_lvalue (lvalue_of_lval lv)
 
 let absloc_e_points_to e =
+  finalize_constraints ();
   A.absloc_epoints_to (tau_of_expr e)
 
 let absloc_lval_aliases lv =
+  finalize_constraints ();
   A.absloc_points_to (lvalue_of_lval lv)
 
 (* all abslocs that e transitively points to *)
 let absloc_e_transitive_points_to (e : Cil.exp) : absloc list =
+  finalize_constraints ();
   let rec lv_trans_ptsto (worklist : varinfo list) (acc : varinfo list) : absloc list =
     match worklist with
         [] -> Util.list_map absloc_of_varinfo acc
@@ -564,6 +783,218 @@ let absloc_eq a b = A.absloc_eq (a, b)
 
 let d_absloc: unit -> absloc -> Pretty.doc = A.d_absloc
 
+end (* module Make *)
+
+
+(***********************************************************************)
+(*                                                                     *)
+(* Runtime Solver Selection                                            *)
+(*                                                                     *)
+(***********************************************************************)
+
+module OlfA = Make (Olf)
+module GolfA = Make (Golf)
+
+type solver_choice = UseOlf | UseGolf
+
+(* The backend chosen for the last analyzed (or loaded) file; every
+ * query dispatches on it. Olf is the historical default, so queries
+ * made without a preceding analyze_file behave as before. *)
+let chosen_solver = ref UseOlf
+
+(* Copy the flags into both backends: the fallback path may switch
+ * backends in the middle of analyze_file. *)
+let set_solver_flags () : unit =
+  List.iter
+    (fun (flag, olf_flag, golf_flag) ->
+       olf_flag := !flag;
+       golf_flag := !flag)
+    [print_constraints, Olf.print_constraints, Golf.print_constraints;
+     debug_constraints, Olf.debug_constraints, Golf.debug_constraints;
+     debug_aliases, Olf.debug_aliases, Golf.debug_aliases;
+     smart_aliases, Olf.smart_aliases, Golf.smart_aliases;
+     debug, Olf.debug, Golf.debug;
+     analyze_mono, Olf.analyze_mono, Golf.analyze_mono;
+     no_flow, Olf.no_flow, Golf.no_flow;
+     no_sub, Olf.no_sub, Golf.no_sub;
+     hybrid, Olf.hybrid, Golf.hybrid]
+
+(* Dispatch a query to the chosen backend. Golf's location exception
+ * is distinct from Olf's; map it to the one this interface exposes. *)
+let dispatch (olf : unit -> 'a) (golf : unit -> 'a) : 'a =
+  match !chosen_solver with
+      UseOlf -> olf ()
+    | UseGolf ->
+        try golf ()
+        with Golf.UnknownLocation -> raise UnknownLocation
+
+(* The auto heuristic: the precise solver's cost grows with the number
+ * of pointer values in the constraint system, so count the
+ * pointer-typed variables the file declares (globals, formals and
+ * locals). *)
+let count_pointer_vars (f : file) : int =
+  let rec is_pointerish (t : typ) : bool =
+    match unrollType t with
+        TPtr _ -> true
+      | TArray (bt, _, _) -> is_pointerish bt
+      | _ -> false
+  in
+  let count = ref 0 in
+  let count_var (vi : varinfo) : unit =
+    if is_pointerish vi.vtype then incr count
+  in
+    iterGlobals f
+      (function
+           GVar (vi, _, _) -> count_var vi
+         | GFun (fd, _) ->
+             List.iter count_var fd.sformals;
+             List.iter count_var fd.slocals
+         | _ -> ());
+    !count
+
+exception Solver_timeout
+
+(* Run [job] under a wall-clock budget, delivered as SIGALRM. *)
+let with_time_budget (budget : float) (job : unit -> unit) : unit =
+  let previous =
+    Sys.signal Sys.sigalrm (Sys.Signal_handle (fun _ -> raise Solver_timeout))
+  in
+  let finish () =
+    ignore (Unix.setitimer Unix.ITIMER_REAL
+              { Unix.it_interval = 0.0; Unix.it_value = 0.0 });
+    Sys.set_signal Sys.sigalrm previous
+  in
+    ignore (Unix.setitimer Unix.ITIMER_REAL
+              { Unix.it_interval = 0.0; Unix.it_value = budget });
+    try
+      job ();
+      finish ()
+    with e ->
+      finish ();
+      raise e
+
+let analyze_file (f : file) : unit =
+  set_solver_flags ();
+  let choice =
+    match !solver with
+        "golf" -> UseGolf
+      | "auto" ->
+          if count_pointer_vars f <= !precise_solver_limit then UseGolf
+          else UseOlf
+      | _ -> UseOlf
+  in
+    chosen_solver := choice;
+    match choice with
+        UseOlf -> OlfA.analyze_file f
+      | UseGolf ->
+          if !solver_time_budget <= 0.0 then GolfA.analyze_file f
+          else
+            (* Seal the constraint system inside the budget, so the
+             * online solving it triggers is covered too. The aborted
+             * Golf instance is simply abandoned. *)
+            try
+              with_time_budget !solver_time_budget
+                (fun () ->
+                   GolfA.analyze_file f;
+                   GolfA.finalize_constraints ())
+            with Solver_timeout ->
+              if !show_progress || !debug then
+                Printf.printf
+                  "Precise solve exceeded %.1fs; falling back to olf\n"
+                  !solver_time_budget;
+              chosen_solver := UseOlf;
+              OlfA.analyze_file f
+
+let print_types () : unit =
+  dispatch OlfA.print_types GolfA.print_types
+
+let may_alias (e1 : exp) (e2 : exp) : bool =
+  dispatch (fun () -> OlfA.may_alias e1 e2) (fun () -> GolfA.may_alias e1 e2)
+
+let resolve_lval (lv : lval) : varinfo list =
+  dispatch (fun () -> OlfA.resolve_lval lv) (fun () -> GolfA.resolve_lval lv)
+
+let resolve_exp (e : exp) : varinfo list =
+  dispatch (fun () -> OlfA.resolve_exp e) (fun () -> GolfA.resolve_exp e)
+
+let resolve_funptr (e : exp) : fundec list =
+  dispatch
+    (fun () -> OlfA.resolve_funptr e)
+    (fun () -> GolfA.resolve_funptr e)
+
+let compute_results (show_sets : bool) : unit =
+  dispatch
+    (fun () -> OlfA.compute_results show_sets)
+    (fun () -> GolfA.compute_results show_sets)
+
+let compute_aliases (b : bool) : unit =
+  dispatch
+    (fun () -> OlfA.compute_aliases b)
+    (fun () -> GolfA.compute_aliases b)
+
+let save_state (f : file) ~(digest : string) (filename : string) : unit =
+  match !chosen_solver with
+      UseOlf -> OlfA.save_state f ~digest:("olf:" ^ digest) filename
+    | UseGolf -> GolfA.save_state f ~digest:("golf:" ^ digest) filename
+
+let load_state ~(digest : string) (filename : string) : file option =
+  set_solver_flags ();
+  match OlfA.load_state ~digest:("olf:" ^ digest) filename with
+      Some f ->
+        chosen_solver := UseOlf;
+        Some f
+    | None ->
+        match GolfA.load_state ~digest:("golf:" ^ digest) filename with
+            Some f ->
+              chosen_solver := UseGolf;
+              Some f
+          | None -> None
+
+type absloc = OlfLoc of OlfA.absloc | GolfLoc of GolfA.absloc
+
+let absloc_of_varinfo (vi : varinfo) : absloc =
+  dispatch
+    (fun () -> OlfLoc (OlfA.absloc_of_varinfo vi))
+    (fun () -> GolfLoc (GolfA.absloc_of_varinfo vi))
+
+let absloc_of_lval (lv : lval) : absloc =
+  dispatch
+    (fun () -> OlfLoc (OlfA.absloc_of_lval lv))
+    (fun () -> GolfLoc (GolfA.absloc_of_lval lv))
+
+let absloc_e_points_to (e : exp) : absloc list =
+  dispatch
+    (fun () -> Util.list_map (fun a -> OlfLoc a) (OlfA.absloc_e_points_to e))
+    (fun () -> Util.list_map (fun a -> GolfLoc a) (GolfA.absloc_e_points_to e))
+
+let absloc_e_transitive_points_to (e : exp) : absloc list =
+  dispatch
+    (fun () ->
+       Util.list_map
+         (fun a -> OlfLoc a)
+         (OlfA.absloc_e_transitive_points_to e))
+    (fun () ->
+       Util.list_map
+         (fun a -> GolfLoc a)
+         (GolfA.absloc_e_transitive_points_to e))
+
+let absloc_lval_aliases (lv : lval) : absloc list =
+  dispatch
+    (fun () -> Util.list_map (fun a -> OlfLoc a) (OlfA.absloc_lval_aliases lv))
+    (fun () -> Util.list_map (fun a -> GolfLoc a) (GolfA.absloc_lval_aliases lv))
+
+let absloc_eq (a : absloc) (b : absloc) : bool =
+  match a, b with
+      OlfLoc a1, OlfLoc a2 -> OlfA.absloc_eq a1 a2
+    | GolfLoc a1, GolfLoc a2 -> GolfA.absloc_eq a1 a2
+    | _ ->
+        failwith "Ptranal.absloc_eq: abstract locations from different solvers"
+
+let d_absloc () (a : absloc) : Pretty.doc =
+  match a with
+      OlfLoc a' -> OlfA.d_absloc () a'
+    | GolfLoc a' -> GolfA.d_absloc () a'
+
 
 let ptrResults = ref false
 let ptrTypes = ref false
@@ -581,11 +1012,22 @@ let feature = {
      " Print out results of may alias queries");
     ("--ptr_unify", Arg.Unit (fun _ -> no_sub := true),
      " Make the alias analysis unification-based");
+    ("--ptr_hybrid", Arg.Unit (fun _ -> hybrid := true),
+     " Partition pointers by unification, precise analysis per partition (GOLF backend only)");
+    ("--ptr_solver", Arg.String (fun s -> solver := s),
+     " Solver backing the alias analysis: olf (fast), golf (precise) or auto (pick by problem size)");
+    ("--ptr_precise_limit", Arg.Int (fun n -> precise_solver_limit := n),
+     " Most pointer variables for which --ptr_solver auto still picks the precise solver");
+    ("--ptr_time_budget", Arg.Float (fun t -> solver_time_budget := t),
+     " Seconds a precise solve may take before falling back to the fast solver (0 disables)");
     ("--ptr_model_strings", Arg.Unit (fun _ -> model_strings := true),
      " Make the alias analysis model string constants");
     ("--ptr_conservative",
      Arg.Unit (fun _ -> conservative_undefineds := true),
      " Treat undefineds conservatively in alias analysis");
+    ("--ptr_strict_aliasing",
+     Arg.Unit (fun _ -> assume_strict_aliasing := true),
+     " Assume strict aliasing; reject cross-type alias queries by type alone");
     ("--ptr_results", Arg.Unit (fun _ -> ptrResults := true),
      " print the results of the alias analysis");
     ("--ptr_mono", Arg.Unit (fun _ -> analyze_mono := true),
@@ -71,6 +71,26 @@ val show_progress : bool ref
 (** Treat undefined functions conservatively *)
 val conservative_undefineds : bool ref
 
+(** Assume the program obeys the strict-aliasing rule, letting
+ *  {!may_alias} reject pointers to incompatible types without
+ *  consulting the points-to graph.  Off by default; do not enable
+ *  for code that puns types through casts. *)
+val assume_strict_aliasing : bool ref
+
+(** The solver backing the analysis: ["olf"] (fast, the historical
+ *  default), ["golf"] (precise) or ["auto"], which picks per file --
+ *  precise when the problem size makes it affordable, fast otherwise. *)
+val solver : string ref
+
+(** In ["auto"] mode, files declaring at most this many pointer-typed
+ *  variables get the precise solver. *)
+val precise_solver_limit : int ref
+
+(** Wall-clock seconds a precise solve may take before {!analyze_file}
+ *  falls back to the fast solver for the file; 0 (the default)
+ *  disables the budget. *)
+val solver_time_budget : float ref
+
 (** client can specify particular external functions that
  *  have no side effects *)
 val callHasNoSideEffects : (Cil.exp -> bool) ref
@@ -93,12 +113,27 @@ val print_types : unit -> unit
 (*                                                                     *)
 (***********************************************************************)
 
-(** If undefined functions are analyzed conservatively, any of the 
+(** If undefined functions are analyzed conservatively, any of the
   high-level queries may raise this exception *)
 exception UnknownLocation
 
+(* Queries are demand-driven: the first one seals the constraint
+ * system, and each query then explores only the part of the
+ * points-to graph reachable from the queried value, memoizing
+ * per-location results in the graph.  Resolved lvalue and expression
+ * queries are also cached here, so asking the same question twice is
+ * free.  It is not necessary to call compute_results before
+ * querying; that function computes (and optionally prints) the sets
+ * for every lvalue in the program. *)
+
 val may_alias : Cil.exp -> Cil.exp -> bool
 
+(** The type-compatibility pre-filter used by {!may_alias} under
+  {!assume_strict_aliasing}: [false] means objects of the two types
+  can never overlap.  Exposed so that clients pairing up the results
+  of {!resolve_lval} can reject cross-type pairs in constant time. *)
+val types_may_alias : Cil.typ -> Cil.typ -> bool
+
 val resolve_lval : Cil.lval -> (Cil.varinfo list)
 
 val resolve_exp : Cil.exp -> (Cil.varinfo list)
@@ -156,5 +191,24 @@ val compute_alias_frequency : unit -> unit
 
 val compute_aliases : bool  -> unit
 
+(***********************************************************************)
+(*                                                                     *)
+(* Persistent results                                                  *)
+(*                                                                     *)
+(***********************************************************************)
+
+(** Save the solved points-to state to the named file, sealing the
+    constraint system first.  The analyzed file is saved along with
+    the state (the two share structure), and [digest] should identify
+    the merged file the analysis ran on -- for example a digest of
+    the sources it was built from. *)
+val save_state : Cil.file -> digest:string -> string -> unit
+
+(** Reload a state saved by {!save_state}.  Returns the analyzed
+    file, ready for querying, if the named file holds a compatible
+    state saved under the same [digest]; returns [None] (leaving the
+    current state untouched) if it is missing, stale or corrupt. *)
+val load_state : digest:string -> string -> Cil.file option
+
 
 val feature: Feature.t
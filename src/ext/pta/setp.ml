@@ -340,3 +340,316 @@ module Make(Ord: PolyOrderedType) =
     let choose = min_elt
 
   end
+
+
+(* Dense sets over indexed types.
+
+   Points-to style sets are dominated by union and intersection, and the
+   elements (labels, constants) already carry densely assigned integer
+   stamps.  MakeIndexed exploits this: a set is a persistent Patricia
+   trie keyed on the element index, whose leaves are 16-bit words of
+   membership bits.  Small sets are a single word leaf; unions of large
+   sets run word by word and share whole untouched subtrees between the
+   argument and the result.  The elements themselves are recorded once
+   in a side table the first time they are added, so the sets proper
+   contain only integers. *)
+
+module type IndexedType =
+  sig
+    type t
+    val index: t -> int
+  end
+
+module type IS =
+  sig
+    type elt
+    type t
+    val empty: t
+    val is_empty: t -> bool
+    val mem: elt -> t -> bool
+    val add: elt -> t -> t
+    val singleton: elt -> t
+    val remove: elt -> t -> t
+    val union: t -> t -> t
+    val inter: t -> t -> t
+    val diff: t -> t -> t
+    val compare: t -> t -> int
+    val equal: t -> t -> bool
+    val subset: t -> t -> bool
+    val iter: (elt -> unit) -> t -> unit
+    val fold: (elt -> 'b -> 'b) -> t -> 'b -> 'b
+    val for_all: (elt -> bool) -> t -> bool
+    val exists: (elt -> bool) -> t -> bool
+    val filter: (elt -> bool) -> t -> t
+    val partition: (elt -> bool) -> t -> t * t
+    val cardinal: t -> int
+    val elements: t -> elt list
+    val min_elt: t -> elt
+    val max_elt: t -> elt
+    val choose: t -> elt
+  end
+
+module MakeIndexed (Ord : IndexedType) =
+  struct
+    type elt = Ord.t
+
+    (* Sixteen membership bits per leaf, so the bit twiddling stays well
+       within the native int range even on 32-bit hosts *)
+    let wordOf (i : int) : int = i lsr 4
+    let bitOf (i : int) : int = 1 lsl (i land 15)
+
+    type t =
+        Empty
+      | Leaf of int * int               (* word number, nonzero bits *)
+      | Branch of int * int * t * t     (* prefix, branching bit, the
+                                         * subtree whose branching bit is
+                                         * zero, the other subtree *)
+
+    (* The side table from index to element. Entries are only added, and
+       an index always maps to the first element added under it *)
+    let revIndex : (int, elt) Hashtbl.t = Hashtbl.create 127
+
+    let register (x : elt) (i : int) : unit =
+      if not (Hashtbl.mem revIndex i) then Hashtbl.add revIndex i x
+
+    (* Big-endian Patricia helpers; keys (word numbers) are nonnegative,
+       so the left subtree always holds the smaller words *)
+    let zero_bit k m = (k land m) == 0
+    let mask k m = (k lor (m - 1)) land (lnot m)
+    let match_prefix k p m = mask k m == p
+    let rec highest_bit x =
+      let x' = x land (x - 1) in        (* clear the lowest set bit *)
+      if x' == 0 then x else highest_bit x'
+    let branching_bit p0 p1 = highest_bit (p0 lxor p1)
+
+    let join p0 t0 p1 t1 =
+      let m = branching_bit p0 p1 in
+      if zero_bit p0 m then Branch (mask p0 m, m, t0, t1)
+      else Branch (mask p0 m, m, t1, t0)
+
+    (* Like Branch, but collapses empty subtrees, keeping the
+       representation canonical so that equal is structural equality *)
+    let branch p m t0 t1 =
+      match t0, t1 with
+        Empty, t -> t
+      | t, Empty -> t
+      | _ -> Branch (p, m, t0, t1)
+
+    let empty = Empty
+
+    let is_empty s = s == Empty
+
+    let rec find_word w = function
+        Empty -> 0
+      | Leaf (w', b) -> if w == w' then b else 0
+      | Branch (p, m, t0, t1) ->
+          if not (match_prefix w p m) then 0
+          else if zero_bit w m then find_word w t0
+          else find_word w t1
+
+    let mem x s =
+      let i = Ord.index x in
+      (find_word (wordOf i) s) land (bitOf i) != 0
+
+    (* Or the bits [b] into word [w] *)
+    let rec add_word w b = function
+        Empty -> Leaf (w, b)
+      | Leaf (w', b') as t ->
+          if w == w' then
+            (if b lor b' == b' then t else Leaf (w, b lor b'))
+          else join w (Leaf (w, b)) w' t
+      | Branch (p, m, t0, t1) as t ->
+          if match_prefix w p m then
+            if zero_bit w m then Branch (p, m, add_word w b t0, t1)
+            else Branch (p, m, t0, add_word w b t1)
+          else join w (Leaf (w, b)) p t
+
+    let add x s =
+      let i = Ord.index x in
+      register x i;
+      add_word (wordOf i) (bitOf i) s
+
+    let singleton x = add x Empty
+
+    (* Clear the bits [b] from word [w] *)
+    let rec remove_word w b = function
+        Empty -> Empty
+      | Leaf (w', b') as t ->
+          if w == w' then
+            let b'' = b' land (lnot b) in
+            if b'' == 0 then Empty
+            else if b'' == b' then t
+            else Leaf (w, b'')
+          else t
+      | Branch (p, m, t0, t1) as t ->
+          if not (match_prefix w p m) then t
+          else if zero_bit w m then branch p m (remove_word w b t0) t1
+          else branch p m t0 (remove_word w b t1)
+
+    let remove x s =
+      let i = Ord.index x in
+      remove_word (wordOf i) (bitOf i) s
+
+    let rec union s t =
+      if s == t then s
+      else match s, t with
+        Empty, _ -> t
+      | _, Empty -> s
+      | Leaf (w, b), _ -> add_word w b t
+      | _, Leaf (w, b) -> add_word w b s
+      | Branch (p, m, s0, s1), Branch (q, n, t0, t1) ->
+          if m == n && p == q then
+            let u0 = union s0 t0 and u1 = union s1 t1 in
+            if u0 == s0 && u1 == s1 then s
+            else if u0 == t0 && u1 == t1 then t
+            else Branch (p, m, u0, u1)
+          else if m > n && match_prefix q p m then
+            (if zero_bit q m then
+              let u0 = union s0 t in
+              if u0 == s0 then s else Branch (p, m, u0, s1)
+            else
+              let u1 = union s1 t in
+              if u1 == s1 then s else Branch (p, m, s0, u1))
+          else if n > m && match_prefix p q n then
+            (if zero_bit p n then
+              let u0 = union s t0 in
+              if u0 == t0 then t else Branch (q, n, u0, t1)
+            else
+              let u1 = union s t1 in
+              if u1 == t1 then t else Branch (q, n, t0, u1))
+          else join p s q t
+
+    let rec inter s t =
+      if s == t then s
+      else match s, t with
+        Empty, _ -> Empty
+      | _, Empty -> Empty
+      | Leaf (w, b), _ ->
+          let b' = b land find_word w t in
+          if b' == 0 then Empty
+          else if b' == b then s
+          else Leaf (w, b')
+      | _, Leaf (w, b) ->
+          let b' = b land find_word w s in
+          if b' == 0 then Empty
+          else if b' == b then t
+          else Leaf (w, b')
+      | Branch (p, m, s0, s1), Branch (q, n, t0, t1) ->
+          if m == n && p == q then branch p m (inter s0 t0) (inter s1 t1)
+          else if m > n && match_prefix q p m then
+            inter (if zero_bit q m then s0 else s1) t
+          else if n > m && match_prefix p q n then
+            inter s (if zero_bit p n then t0 else t1)
+          else Empty
+
+    let rec diff s t =
+      if s == t then Empty
+      else match s, t with
+        Empty, _ -> Empty
+      | _, Empty -> s
+      | Leaf (w, b), _ ->
+          let b' = b land (lnot (find_word w t)) in
+          if b' == 0 then Empty
+          else if b' == b then s
+          else Leaf (w, b')
+      | _, Leaf (w, b) -> remove_word w b s
+      | Branch (p, m, s0, s1), Branch (q, n, t0, t1) ->
+          if m == n && p == q then branch p m (diff s0 t0) (diff s1 t1)
+          else if m > n && match_prefix q p m then
+            (if zero_bit q m then branch p m (diff s0 t) s1
+            else branch p m s0 (diff s1 t))
+          else if n > m && match_prefix p q n then
+            diff s (if zero_bit p n then t0 else t1)
+          else s
+
+    (* The representation is canonical (branch collapses empty subtrees
+       and leaves hold nonzero words), so structural comparison decides
+       set equality *)
+    let equal (s : t) (t' : t) = s = t'
+    let compare (s : t) (t' : t) = Stdlib.compare s t'
+
+    let subset s t = equal (diff s t) Empty
+
+    let rec nrTrailingZeros b =
+      (* [b] is a nonzero 16-bit value *)
+      let n = ref 0 in
+      let b = ref b in
+      if !b land 0xFF == 0 then begin n := !n + 8; b := !b lsr 8 end;
+      if !b land 0xF == 0 then begin n := !n + 4; b := !b lsr 4 end;
+      if !b land 0x3 == 0 then begin n := !n + 2; b := !b lsr 2 end;
+      if !b land 0x1 == 0 then n := !n + 1;
+      !n
+
+    (* Apply [f] to the element of each set bit of word [w], in
+       increasing index order *)
+    let iter_word (f : elt -> unit) (w : int) (b : int) : unit =
+      let rec loop b =
+        if b != 0 then begin
+          let bit = b land (- b) in
+          f (Hashtbl.find revIndex ((w lsl 4) + nrTrailingZeros bit));
+          loop (b land (b - 1))
+        end
+      in
+      loop b
+
+    let rec iter f = function
+        Empty -> ()
+      | Leaf (w, b) -> iter_word f w b
+      | Branch (_, _, t0, t1) -> iter f t0; iter f t1
+
+    let fold_word (f : elt -> 'b -> 'b) (w : int) (b : int) (accu : 'b) : 'b =
+      let rec loop b accu =
+        if b == 0 then accu
+        else
+          let bit = b land (- b) in
+          loop (b land (b - 1))
+            (f (Hashtbl.find revIndex ((w lsl 4) + nrTrailingZeros bit)) accu)
+      in
+      loop b accu
+
+    let rec fold f s accu =
+      match s with
+        Empty -> accu
+      | Leaf (w, b) -> fold_word f w b accu
+      | Branch (_, _, t0, t1) -> fold f t1 (fold f t0 accu)
+
+    let for_all p s = fold (fun x acc -> acc && p x) s true
+
+    let exists p s = fold (fun x acc -> acc || p x) s false
+
+    let filter p s =
+      fold (fun x acc -> if p x then add x acc else acc) s Empty
+
+    let partition p s =
+      fold
+        (fun x (yes, no) -> if p x then (add x yes, no) else (yes, add x no))
+        s (Empty, Empty)
+
+    let rec cardinal = function
+        Empty -> 0
+      | Leaf (_, b) ->
+          let rec count b n = if b == 0 then n else count (b land (b - 1)) (n + 1) in
+          count b 0
+      | Branch (_, _, t0, t1) -> cardinal t0 + cardinal t1
+
+    let elements s =
+      List.rev (fold (fun x accu -> x :: accu) s [])
+
+    let rec min_elt = function
+        Empty -> raise Not_found
+      | Leaf (w, b) ->
+          Hashtbl.find revIndex ((w lsl 4) + nrTrailingZeros (b land (- b)))
+      | Branch (_, _, t0, _) -> min_elt t0
+
+    let rec max_elt = function
+        Empty -> raise Not_found
+      | Leaf (w, b) ->
+          let rec top b last =
+            if b == 0 then last else top (b land (b - 1)) (b land (- b))
+          in
+          Hashtbl.find revIndex ((w lsl 4) + nrTrailingZeros (top b 0))
+      | Branch (_, _, _, t1) -> max_elt t1
+
+    let choose = min_elt
+
+  end
@@ -45,6 +45,11 @@ let doSfi = ref false
 let doSfiReads = ref false
 let doSfiWrites = ref true
 
+(* Check accesses with inline range comparisons against the sandbox bounds
+ * instead of a call into the runtime per access, and emit one guard per
+ * base pointer per block *)
+let doSfiInline = ref false
+
 (* A number of functions to be skipped *)
 let skipFunctions : (string, unit) H.t = H.create 13
 let mustSfiFunction (f: fundec) : bool =
@@ -214,6 +219,27 @@ let callLogFree  (dataloc: dataLocation)
        [ data; mkString !currentLoc.file;
          integer !currentLoc.line ], !currentLoc )
 
+(* Append allocation/deallocation logging, if the called function is a known
+ * allocator or deallocator, to the instructions resulting from a call *)
+let instrumentCall (f: exp) (args: exp list) (lvo: lval option)
+    (il: instr list) : instr list =
+  match f with
+    Lval (Var fv, NoOffset) -> begin
+      (* Is it an allocator? *)
+      try
+        let szloc, resloc = H.find allocators fv.vname in
+        il @ [callLogAlloc szloc resloc args lvo]
+      with Not_found -> begin
+        (* Is it a deallocator? *)
+        try
+          let resloc = H.find deallocators fv.vname in
+          il @ [ callLogFree resloc args lvo ]
+        with Not_found ->
+          il
+      end
+    end
+  | _ -> il
+
 class sfiVisitorClass : Cil.cilVisitor = object (self)
   inherit nopCilVisitor
 
@@ -244,22 +270,7 @@ class sfiVisitorClass : Cil.cilVisitor = object (self)
           ([i],
            (fun il ->
              currentLoc := l;
-             match f with
-               Lval (Var fv, NoOffset) -> begin
-                 (* Is it an allocator? *)
-                 try
-                   let szloc, resloc = H.find allocators fv.vname in
-                   il @ [callLogAlloc szloc resloc args lvo]
-                 with Not_found -> begin
-                   (* Is it a deallocator? *)
-                   try
-                     let resloc = H.find deallocators fv.vname in
-                     il @ [ callLogFree resloc args lvo ]
-                   with Not_found ->
-                     il
-                 end
-               end
-             | _ -> il))
+             instrumentCall f args lvo il))
 
     | _ -> DoChildren
 
@@ -276,8 +287,214 @@ class sfiVisitorClass : Cil.cilVisitor = object (self)
 
 end
 
+(** Support for the inline checks. The sandbox bounds are defined by the
+ * runtime *)
+let sfiLow =
+  let v = makeGlobalVar "sfi_low" ulongType in
+  v.vstorage <- Extern;
+  v
+let sfiHigh =
+  let v = makeGlobalVar "sfi_high" ulongType in
+  v.vstorage <- Extern;
+  v
+
+(* Called when an inline check fails *)
+let sfiFault = mkProto "sfiFault" [ ("addr", voidPtrType, []);
+                                    ("file", charPtrType, []);
+                                    ("line", intType, []) ]
+
+(* A single unsigned comparison checks both bounds at once: when the base
+ * pointer is below sfi_low the subtraction wraps around and the result is
+ * large. We guard the base pointer only, not each derived address, and rely
+ * on the runtime keeping guard zones around the sandbox to catch small
+ * offsets past the bounds, as is usual for SFI *)
+let mkGuard (base: exp) : stmt =
+  let test =
+    BinOp(Ge,
+          BinOp(MinusA, mkCast ~e:base ~newt:ulongType,
+                Lval (var sfiLow), ulongType),
+          BinOp(MinusA, Lval (var sfiHigh), Lval (var sfiLow), ulongType),
+          intType)
+  in
+  let fault =
+    Call(None,
+         Lval (var sfiFault.svar),
+         [ mkCast ~e:base ~newt:voidPtrType; mkString !currentLoc.file;
+           integer !currentLoc.line ], !currentLoc)
+  in
+  mkStmt (If(test, mkBlock [ mkStmtOneInstr fault ], mkBlock [], !currentLoc))
+
+(* Collect the base pointers of the memory reads in an expression *)
+class readBasesClass (acc: exp list ref) = object
+  inherit nopCilVisitor
+
+  method! vexpr (e: exp) =
+    (match e with
+      Lval ((Mem b, _) as lv) when mustLogLval false lv ->
+        acc := stripCasts b :: !acc
+    | _ -> ());
+    DoChildren
+end
+
+let readBases (e: exp) : exp list =
+  let acc = ref [] in
+  ignore (visitCilExpr (new readBasesClass acc) e);
+  List.rev !acc
+
+(* The base pointers that an instruction accesses, reads and writes alike *)
+let instrBases (i: instr) : exp list =
+  let acc = ref [] in
+  let vis = new readBasesClass acc in
+  let doWrite (lv: lval) =
+    match lv with
+      Mem b, _ when mustLogLval true lv -> acc := stripCasts b :: !acc
+    | _ -> ()
+  in
+  (match i with
+    Set (lv, e, _) ->
+      (* The pointer and the offsets of the written lvalue are reads *)
+      ignore (visitCilLval vis lv);
+      ignore (visitCilExpr vis e);
+      doWrite lv
+  | Call (lvo, f, args, _) ->
+      ignore (visitCilExpr vis f);
+      List.iter (fun a -> ignore (visitCilExpr vis a)) args;
+      (match lvo with
+        Some lv -> ignore (visitCilLval vis lv); doWrite lv
+      | None -> ())
+  | Asm (_, _, outs, ins, _, _) ->
+      List.iter (fun (_, _, e) -> ignore (visitCilExpr vis e)) ins;
+      List.iter (fun (_, _, lv) -> ignore (visitCilLval vis lv); doWrite lv)
+        outs
+  | _ -> ());
+  List.rev !acc
+
+(* What a guarded base expression depends on: the local variables it
+ * mentions, and whether it reads memory that a store or a call might change
+ * (globals and address-taken locals included) *)
+class expDepsClass (vids: int list ref) (readsMem: bool ref) = object
+  inherit nopCilVisitor
+
+  method! vvrbl (v: varinfo) =
+    if v.vglob || v.vaddrof then readsMem := true;
+    if not v.vglob then vids := v.vid :: !vids;
+    SkipChildren
+
+  method! vlval (lv: lval) =
+    (match lv with
+      Mem _, _ -> readsMem := true
+    | _ -> ());
+    DoChildren
+end
+
+class sfiInlineVisitorClass : Cil.cilVisitor = object
+  inherit nopCilVisitor
+
+  method! vstmt (s: stmt) : stmt visitAction =
+    match s.skind with
+      Instr il ->
+        (* The instruction list is the straight-line basic block: the first
+         * access to a base pointer dominates the later ones, so one guard
+         * per base suffices until something the base depends on changes *)
+        let guarded : (exp * int list * bool) list ref = ref [] in
+        let changed = ref false in
+        let killVid (vid: int) =
+          guarded :=
+            List.filter (fun (_, vids, _) -> not (List.mem vid vids)) !guarded
+        in
+        let killMem () =
+          guarded := List.filter (fun (_, _, rm) -> not rm) !guarded
+        in
+        let isGuarded (b: exp) =
+          List.exists
+            (fun (b', _, _) -> Expcompare.compareExpStripCasts b b')
+            !guarded
+        in
+        let doInstr (acc: stmt list) (i: instr) : stmt list =
+          currentLoc := get_instrLoc i;
+          let guards =
+            List.fold_left
+              (fun acc b ->
+                if isGuarded b then acc
+                else begin
+                  let vids = ref [] in
+                  let rm = ref false in
+                  ignore (visitCilExpr (new expDepsClass vids rm) b);
+                  guarded := (b, !vids, !rm) :: !guarded;
+                  changed := true;
+                  mkGuard b :: acc
+                end)
+              [] (instrBases i)
+          in
+          (* Invalidate the guards that this instruction may break *)
+          let il' =
+            match i with
+              Set ((Var v, _), _, _) ->
+                killVid v.vid;
+                if v.vglob || v.vaddrof then killMem ();
+                [ i ]
+            | Set ((Mem _, _), _, _) -> killMem (); [ i ]
+            | Call (lvo, f, args, _) ->
+                killMem ();
+                (match lvo with
+                  Some (Var v, _) -> killVid v.vid
+                | _ -> ());
+                instrumentCall f args lvo [ i ]
+            | Asm _ -> guarded := []; [ i ]
+            | _ -> [ i ]
+          in
+          (match il' with
+            [ _ ] -> ()
+          | _ -> changed := true);
+          List.rev_append (List.map mkStmtOneInstr il') (guards @ acc)
+        in
+        let stmts = List.rev (List.fold_left doInstr [] il) in
+        if !changed then
+          s.skind <- Block (mkBlock stmts);
+        SkipChildren
+
+    | If (e, _, _, l) | Switch (e, _, _, l)
+    | Return (Some e, l) | ComputedGoto (e, l) ->
+        currentLoc := l;
+        let bases =
+          List.fold_left
+            (fun acc b ->
+              if List.exists (Expcompare.compareExpStripCasts b) acc then acc
+              else b :: acc)
+            [] (readBases e)
+        in
+        if bases = [] then
+          DoChildren
+        else
+          ChangeDoChildrenPost
+            (s,
+             fun s ->
+               (* Keep the labels on the original statement *)
+               let inner = mkStmt s.skind in
+               s.skind <-
+                 Block (mkBlock (List.rev_map mkGuard bases @ [ inner ]));
+               s)
+
+    | _ -> DoChildren
+
+  method! vfunc (fdec: fundec) =
+    (* Insert a stack log at the start of a function *)
+    ChangeDoChildrenPost
+      (fdec,
+       fun fdec ->
+         fdec.sbody <-
+           mkBlock
+             [ mkStmtOneInstr (callLogStack fdec.svar.vname);
+               mkStmt (Block fdec.sbody) ];
+         fdec)
+
+end
+
 let doit (f: file) =
-  let sfiVisitor = new sfiVisitorClass in
+  let sfiVisitor : cilVisitor =
+    if !doSfiInline then new sfiInlineVisitorClass
+    else new sfiVisitorClass
+  in
   let compileLoc (l: location) = function
       ACons("inres", []) -> InResult
     | ACons("inarg", [AInt n]) -> InArg n
@@ -314,10 +531,17 @@ let doit (f: file) =
 
 
       | _ -> ());
-  (* Now add the prototypes for the instrumentation functions *)
+  (* Now add the prototypes for the instrumentation functions. The inline
+   * checks replace the read/write logging calls by comparisons against the
+   * sandbox bounds *)
   f.globals <-
-    GVarDecl (logReads.svar, locUnknown) ::
-    GVarDecl (logWrites.svar, locUnknown) ::
+    (if !doSfiInline then
+      GVarDecl (sfiLow, locUnknown) ::
+      GVarDecl (sfiHigh, locUnknown) ::
+      GVarDecl (sfiFault.svar, locUnknown) :: []
+    else
+      GVarDecl (logReads.svar, locUnknown) ::
+      GVarDecl (logWrites.svar, locUnknown) :: []) @
     GVarDecl (logStackFrame.svar, locUnknown) ::
     GVarDecl (logAlloc.svar, locUnknown) ::
     GVarDecl (logFree.svar, locUnknown) :: f.globals
@@ -330,6 +554,8 @@ let feature =
     fd_extraopt = [
     "--sfireads", Arg.Set doSfiReads, " SFI for reads";
     "--sfiwrites", Arg.Set doSfiWrites, " SFI for writes";
+    "--sfiinline", Arg.Set doSfiInline,
+                 " SFI with inline bounds checks, one per base pointer per block";
     ];
     fd_doit = doit;
     fd_post_check = true;
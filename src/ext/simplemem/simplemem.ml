@@ -133,3 +133,6 @@ let feature =
   }
 
 let () = Feature.register feature
+(* the transformation only introduces temporaries local to each
+ * function, so it may run on a partition of the file's functions *)
+let () = Feature.markFunctionParallel "simpleMem"
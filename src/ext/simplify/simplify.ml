@@ -112,6 +112,11 @@ let convertFieldOffsets = ref true
 let onlyVariableBasics = ref false
 let noStringConstantsBasics = ref false
 
+(* Whether to lower in place: mutate statements only where something actually
+ * needs lowering and skip functions that are already in three-address form,
+ * instead of rebuilding every function body *)
+let inPlace = ref false
+
 exception BitfieldAccess
 
 (* Turn an expression into a three address expression (and queue some
@@ -289,6 +294,64 @@ and simplifyOffset (setTemp: taExp -> bExp) = function
       Index(ei', simplifyOffset setTemp off)
 
 
+(* Check whether an expression is already in the simple form of the grammar
+ * above, so the in-place mode can leave it alone. The checks err on the side
+ * of answering false: saying false for a simple expression only costs a
+ * rewrite, while saying true for a compound one would let it through
+ * unsimplified. In particular StartOf is always rewritten, so it is never
+ * considered simple, and a variable whose address is taken is never a basic
+ * expression. *)
+let rec isBasicExp (e: exp) : bool =
+  match e with
+    Const (CStr _) | Const (CWStr _) ->
+      not !onlyVariableBasics && not !noStringConstantsBasics
+  | Const _ | AddrOf (Var _, NoOffset) -> not !onlyVariableBasics
+  | Lval (Var v, off) -> not v.vaddrof && isSimpleOffset off
+  | _ -> false
+
+and isSimpleOffset (off: offset) : bool =
+  match off with
+    NoOffset -> true
+  | Field (_, off') -> isSimpleOffset off'
+  | Index (ei, off') -> isBasicExp ei && isSimpleOffset off'
+
+and isSimpleLval (lv: lval) : bool =
+  match lv with
+    Mem a, NoOffset -> isBasicExp a
+  | Var v, off -> not v.vaddrof && isSimpleOffset off
+  | _ -> false
+
+and isSimpleExp (e: exp) : bool =
+  isBasicExp e ||
+  (match e with
+    Lval (Mem a, NoOffset) -> isBasicExp a
+  | BinOp (_, e1, e2, _) -> isBasicExp e1 && isBasicExp e2
+  | UnOp (_, e1, _) -> isBasicExp e1
+  | CastE (_, e1) -> isBasicExp e1
+  | _ -> false)
+
+let isSimpleInstr (i: instr) : bool =
+  match i with
+    Set (lv, e, _) -> isSimpleLval lv && isSimpleExp e
+  | Call (ret, f, args, _) ->
+      (match ret with None -> true | Some lv -> isSimpleLval lv) &&
+      isBasicExp f && List.for_all isBasicExp args
+  | _ -> false
+
+let rec isSimpleStmt (s: stmt) : bool =
+  match s.skind with
+    Instr il -> List.for_all isSimpleInstr il
+  | Return (Some e, _) | ComputedGoto (e, _) -> isSimpleExp e
+  | Return (None, _) | Goto _ | Break _ | Continue _ -> true
+  | If (e, tb, fb, _) ->
+      isSimpleExp e && isSimpleBlock tb && isSimpleBlock fb
+  | Switch (e, b, _, _) -> isSimpleExp e && isSimpleBlock b
+  | Loop (b, _, _, _) -> isSimpleBlock b
+  | Block b -> isSimpleBlock b
+  | TryFinally _ | TryExcept _ -> false
+
+and isSimpleBlock (b: block) : bool =
+  List.for_all isSimpleStmt b.bstmts
 
 
 (** This is a visitor that will turn all expressions into three address code *)
@@ -329,6 +392,29 @@ class threeAddressVisitor (fi: fundec) = object (self)
 end
 
 
+(** Like threeAddressVisitor, but leaves alone whatever is already in the
+ * simple form. Since the visitor copies a statement list only when a member
+ * actually changes, statements that need no lowering keep their identity and
+ * the enclosing blocks are reused rather than rebuilt. *)
+class threeAddressInPlaceVisitor (fi: fundec) = object (self)
+  inherit threeAddressVisitor fi as super
+
+  method! vstmt (s: stmt) =
+    if isSimpleStmt s then SkipChildren else DoChildren
+
+  method! vexpr (e: exp) =
+    if isSimpleExp e then SkipChildren
+    else ChangeTo (makeThreeAddress self#makeTemp e)
+
+  method! vinst (i: instr) =
+    if isSimpleInstr i then SkipChildren else super#vinst i
+
+  method! vlval (lv: lval) =
+    if isSimpleLval lv then SkipChildren
+    else ChangeTo (simplifyLval self#makeTemp lv)
+end
+
+
 (* Whether to split the arguments of functions *)
 let splitArguments = true
 
@@ -731,8 +817,17 @@ end
 let doGlobal = function
     GFun(fi, _) ->
       (* Visit the body and change all expressions into three address code *)
-      let v = new threeAddressVisitor fi in
-      fi.sbody <- visitCilBlock v fi.sbody;
+      if !inPlace then begin
+        (* A cheap prescan decides whether the body needs any lowering at
+         * all; most generated code is already simple *)
+        if not (isSimpleBlock fi.sbody) then begin
+          let v = new threeAddressInPlaceVisitor fi in
+          fi.sbody <- visitCilBlock v fi.sbody
+        end
+      end else begin
+        let v = new threeAddressVisitor fi in
+        fi.sbody <- visitCilBlock v fi.sbody
+      end;
       if !splitStructs then begin
         H.clear dontSplitLocals;
         let splitVarVisitor = new splitVarVisitorClass (Some fi) in
@@ -754,6 +849,10 @@ let feature =
     fd_extraopt = [
       ("--no-split-structs", Arg.Clear splitStructs,
                     " do not split structured variables");
+      ("--simplify-in-place", Arg.Set inPlace,
+                    " only rewrite expressions that are not already in \
+                      three-address form, and skip functions that need no \
+                      lowering");
       ("--no-convert-direct-calls", Arg.Clear convertDirectCalls,
                     " do not convert direct function calls to function pointer \
                       calls if the address of the function was taken");
@@ -770,4 +869,23 @@ let feature =
     fd_post_check = true;
 }
 
+(* With simpleMem on, the lowering above also establishes the simplemem
+ * invariant: what is under a Mem constructor is a basic expression, so every
+ * lvalue contains at most one Mem. Registering that combination as its own
+ * feature lets pipelines that ran simpleMem followed by simplify establish
+ * both invariants in a single traversal, with a single generation of
+ * temporaries instead of simplemem temps that simplify then re-splits. *)
+let fusedFeature =
+  { fd_name = "simplifyMem";
+    fd_enabled = false;
+    fd_description = "compiles CIL to 3-address code, \
+                      also simplifying all memory expressions";
+    fd_extraopt = [];
+    fd_doit = (function f ->
+      simpleMem := true;
+      iterGlobals f doGlobal);
+    fd_post_check = true;
+}
+
 let () = Feature.register feature
+let () = Feature.register fusedFeature
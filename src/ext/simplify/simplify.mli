@@ -14,3 +14,7 @@ val noStringConstantsBasics : bool ref
 val doGlobal : Cil.global -> unit
 
 val feature : Feature.t
+
+(** Three-address lowering and memory-expression simplification in a single
+    traversal; a fusion of the "simplify" and "simpleMem" features *)
+val fusedFeature : Feature.t
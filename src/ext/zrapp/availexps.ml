@@ -1,7 +1,7 @@
 (* compute available expressions, although in a somewhat
    non-traditional way. the abstract state is a mapping from
-   variable ids to expressions as opposed to a set of
-   expressions *)
+   variable ids to value numbers of expressions as opposed to a
+   set of expressions *)
 
 open Cil
 open Pretty
@@ -45,44 +45,6 @@ let registerIgnoreCall (f : instr -> bool) : unit =
   ignore_call := (fun i -> (f i) || (f' i))
 
 
-(* exp IH.t -> exp IH.t -> bool *)
-let eh_equals eh1 eh2 =
-  if not(IH.length eh1 = IH.length eh2)
-  then false
-  else IH.fold (fun vid e b ->
-    if not b then b else
-    try let e2 = IH.find eh2 vid in
-    if not(compareExpStripCasts e e2)
-    then false
-    else true
-    with Not_found -> false)
-      eh1 true
-
-let eh_pretty () eh = line ++ seq ~sep:line ~doit:(fun (vid,e) ->
-  text "AE:vid:" ++ num vid ++ text ": " ++
-    (d_exp () e)) ~elements:(IH.tolist eh)
-
-(* the result must be the intersection of eh1 and eh2 *)
-(* exp IH.t -> exp IH.t -> exp IH.t *)
-let eh_combine eh1 eh2 =
-  if !debug then ignore(E.log "eh_combine: combining %a\n and\n %a\n"
-			  eh_pretty eh1 eh_pretty eh2);
-  let eh' = IH.copy eh1 in (* eh' gets all of eh1 *)
-  IH.iter (fun vid e1 ->
-    try let e2l = IH.find_all eh2 vid in
-    if not(List.exists (fun e2 -> compareExpStripCasts e1 e2) e2l)
-    (* remove things from eh' that eh2 doesn't have *)
-    then let e1l = IH.find_all eh' vid in
-    let e1l' = List.filter (fun e -> not(compareExpStripCasts e e1)) e1l in
-    IH.remove_all eh' vid;
-    List.iter (fun e -> IH.add eh' vid e) e1l'
-    with Not_found ->
-      IH.remove_all eh' vid) eh1;
-  if !debug then ignore(E.log "with result %a\n"
-			  eh_pretty eh');
-  eh'
-
-
 (* On a memory write, kill expressions containing memory reads
    variables whose address has been taken, and globals. *)
 class memReadOrAddrOfFinderClass br = object(self)
@@ -114,35 +76,6 @@ let exp_has_mem_read e =
   !br
 
 
-let eh_kill_mem eh =
-  IH.iter (fun vid e ->
-    if exp_has_mem_read e
-    then IH.remove eh vid)
-    eh
-
-(* need to kill exps containing a particular vi sometimes *)
-class viFinderClass vi br = object(self)
-  inherit nopCilVisitor
-
-  method! vvrbl vi' =
-    if vi.vid = vi'.vid
-    then (br := true; SkipChildren)
-    else DoChildren
-
-end
-
-let exp_has_vi vi e =
-  let br = ref false in
-  let vis = new viFinderClass vi br in
-  ignore(visitCilExpr vis e);
-  !br
-
-let eh_kill_vi eh vi =
-  IH.iter (fun vid e ->
-    if exp_has_vi vi e
-    then IH.remove eh vid)
-    eh
-
 (* need to kill exps containing a particular lval sometimes *)
 class lvalFinderClass lv br = object(self)
   inherit nopCilVisitor
@@ -160,13 +93,6 @@ let exp_has_lval lv e =
   ignore(visitCilExpr vis e);
   !br
 
-let eh_kill_lval eh lv =
-  IH.iter (fun vid e ->
-    if exp_has_lval lv e
-    then IH.remove eh vid)
-    eh
-
-
 class volatileFinderClass br = object(self)
   inherit nopCilVisitor
 
@@ -182,6 +108,122 @@ let exp_is_volatile e : bool =
   ignore(visitCilExpr vis e);
   !br
 
+(* Value numbering: right-hand sides are hash-consed into integer
+   value numbers, once per function, so that the dataflow inner loop
+   compares and intersects integers instead of walking expression
+   trees. Two expressions get the same number only if
+   compareExpStripCasts accepts them, and the answers the kill
+   functions need are computed once per number *)
+type vninfo = {
+    vnExp : exp;       (* representative expression (as first seen) *)
+    vnMemRead : bool;  (* reads memory, an address-taken var, or a global *)
+    vnVids : int list; (* ids of the variables read by the expression *)
+  }
+
+(* value number -> info *)
+let vnInfoHash = IH.create 128
+
+(* hash of the cast-stripped expression -> (stripped exp, number) list.
+   The hash only picks the bucket; the stored expression decides *)
+let vnBuckets : (int, (exp * int) list) Hashtbl.t = Hashtbl.create 128
+
+let vnNext = ref 0
+
+let vn_clear () =
+  IH.clear vnInfoHash;
+  Hashtbl.clear vnBuckets;
+  vnNext := 0
+
+(* collect the ids of the variables read by an expression *)
+class vidCollectorClass vidsr = object(self)
+  inherit nopCilVisitor
+
+  method! vvrbl vi =
+    (if not(List.mem vi.vid (!vidsr))
+    then vidsr := vi.vid::(!vidsr));
+    DoChildren
+
+end
+
+let exp_vids e =
+  let vidsr = ref [] in
+  ignore(visitCilExpr (new vidCollectorClass vidsr) e);
+  !vidsr
+
+(* exp -> int *)
+let vn_of_exp e =
+  let stripped = stripNopCasts e in
+  let key = Hashtbl.hash stripped in
+  let bucket = try Hashtbl.find vnBuckets key with Not_found -> [] in
+  try snd(List.find (fun (e',_) -> compareExp stripped e') bucket)
+  with Not_found ->
+    let vn = !vnNext in
+    incr vnNext;
+    Hashtbl.replace vnBuckets key ((stripped,vn)::bucket);
+    IH.add vnInfoHash vn {vnExp = e;
+			  vnMemRead = exp_has_mem_read e;
+			  vnVids = exp_vids e};
+    vn
+
+let vn_info vn =
+  try IH.find vnInfoHash vn
+  with Not_found -> E.s (E.bug "availexps: no info for value number %d" vn)
+
+(* the expression a value number stands for *)
+let exp_of_vn vn = (vn_info vn).vnExp
+
+(* int IH.t -> int IH.t -> bool *)
+let eh_equals eh1 eh2 =
+  if not(IH.length eh1 = IH.length eh2)
+  then false
+  else IH.fold (fun vid vn b ->
+    if not b then b else
+    try IH.find eh2 vid = vn
+    with Not_found -> false)
+      eh1 true
+
+let eh_pretty () eh = line ++ seq ~sep:line ~doit:(fun (vid,vn) ->
+  text "AE:vid:" ++ num vid ++ text ": " ++
+    (d_exp () (exp_of_vn vn))) ~elements:(IH.tolist eh)
+
+(* the result must be the intersection of eh1 and eh2 *)
+(* int IH.t -> int IH.t -> int IH.t *)
+let eh_combine eh1 eh2 =
+  if !debug then ignore(E.log "eh_combine: combining %a\n and\n %a\n"
+			  eh_pretty eh1 eh_pretty eh2);
+  let eh' = IH.copy eh1 in (* eh' gets all of eh1 *)
+  IH.iter (fun vid vn1 ->
+    try let vn2l = IH.find_all eh2 vid in
+    if not(List.mem vn1 vn2l)
+    (* remove things from eh' that eh2 doesn't have *)
+    then let vn1l = IH.find_all eh' vid in
+    let vn1l' = List.filter (fun vn -> vn <> vn1) vn1l in
+    IH.remove_all eh' vid;
+    List.iter (fun vn -> IH.add eh' vid vn) vn1l'
+    with Not_found ->
+      IH.remove_all eh' vid) eh1;
+  if !debug then ignore(E.log "with result %a\n"
+			  eh_pretty eh');
+  eh'
+
+let eh_kill_mem eh =
+  IH.iter (fun vid vn ->
+    if (vn_info vn).vnMemRead
+    then IH.remove eh vid)
+    eh
+
+let eh_kill_vi eh vi =
+  IH.iter (fun vid vn ->
+    if List.mem vi.vid (vn_info vn).vnVids
+    then IH.remove eh vid)
+    eh
+
+let eh_kill_lval eh lv =
+  IH.iter (fun vid vn ->
+    if exp_has_lval lv (exp_of_vn vn)
+    then IH.remove eh vid)
+    eh
+
 let varHash = IH.create 32
 
 let eh_kill_addrof_or_global eh =
@@ -218,11 +260,11 @@ let eh_handle_inst i eh =
 	(match e with
 	  Lval(Var vi', NoOffset) -> (* ignore x = x *)
 	    if vi'.vid = vi.vid then eh else
-	    (IH.replace eh vi.vid e;
+	    (IH.replace eh vi.vid (vn_of_exp e);
 	     eh_kill_vi eh vi;
 	     eh)
 	| _ ->
-	    (IH.replace eh vi.vid e;
+	    (IH.replace eh vi.vid (vn_of_exp e);
 	     eh_kill_vi eh vi;
 	     eh))
     | (Var vi, _ ) -> begin
@@ -258,8 +300,8 @@ module AvailableExps =
 
     let debug = debug
 
-    (* mapping from var id to expression *)
-    type t = exp IH.t
+    (* mapping from var id to value number of the expression *)
+    type t = int IH.t
 
     let copy = IH.copy
 
@@ -287,9 +329,7 @@ module AvailableExps =
 
 module AE = DF.ForwardsDataFlow(AvailableExps)
 
-(* make an exp IH.t with everything in it,
- * also, fill in varHash while we're here.
- *)
+(* fill in varHash *)
 class varHashMakerClass = object(self)
   inherit nopCilVisitor
 
@@ -318,6 +358,7 @@ let computeAEs fd =
   try let slst = fd.sbody.bstmts in
   let first_stm = List.hd slst in
   time "make_var_hash" make_var_hash fd;
+  vn_clear (); (* number expressions afresh for each function *)
   IH.clear AvailableExps.stmtStartData;
   IH.add AvailableExps.stmtStartData first_stm.sid (IH.create 4);
   time "compute" AE.compute [first_stm]
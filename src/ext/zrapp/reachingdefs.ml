@@ -21,6 +21,8 @@ open Pretty
 
 module E = Errormsg
 module DF = Dataflow
+module BV = Bitvecdataflow
+module B = Bitmap
 module UD = Usedef
 module L = Liveness
 module IH = Inthash
@@ -440,6 +442,14 @@ let clearMemos () =
 
 (* Computes the reaching definitions for a
    function. *)
+(* The fixpoint is solved over bitmaps: every definition in the
+   function gets a bit, assigned in a depth-first traversal of the CFG
+   so that the ids are compatible with the sequential numbering that
+   instrRDs and getDefRhs expect, plus one bit per defined variable
+   standing for "no definition reaches along some path" (the None
+   element of the IOS sets). The iosh structures that clients consume
+   are rebuilt from the solution, so they look just as if ReachingDef
+   had been run through the tree-based framework. *)
 (* Cil.fundec -> unit *)
 let computeRDs fdec =
   try
@@ -450,22 +460,125 @@ let computeRDs fdec =
     let slst = bdy.bstmts in
     IH.clear ReachingDef.stmtStartData;
     IH.clear ReachingDef.defIdStmtHash;
+    IH.clear ReachingDef.sidStmtHash;
     IH.clear rhsHtbl;
     Hashtbl.clear iRDsHtbl;
     ReachingDef.nextDefId := 0;
     let fst_stm = List.hd slst in
-    let fst_iosh = IH.create 32 in
     UD.onlyNoOffsetsAreDefs := true;
-    IH.add ReachingDef.stmtStartData fst_stm.sid ((), 0, fst_iosh);
     time "liveness" L.computeLiveness fdec;
     UD.onlyNoOffsetsAreDefs := true;
-    ignore(ReachingDef.computeFirstPredecessor fst_stm ((), 0, fst_iosh));
-    (match L.getLiveSet fst_stm.sid with
-    | None -> if !debug then ignore(E.log "Nothing live at fst_stm\n")
-    | Some vs -> ignore(iosh_filter_dead fst_iosh vs));
     if !debug then
       ignore (E.log "computeRDs: fst_stm.sid=%d\n" fst_stm.sid);
-    RD.compute [fst_stm];
+    (* The statements reachable from the entry, in depth-first order *)
+    let visited = IH.create 64 in
+    let revStmts = ref [] in
+    let rec dfs s =
+      if not (IH.mem visited s.sid) then begin
+	IH.add visited s.sid ();
+	revStmts := s :: !revStmts;
+	List.iter dfs s.succs
+      end
+    in
+    dfs fst_stm;
+    let stmts = List.rev !revStmts in
+    (* The definitions made by each statement, one set per
+       instruction, in the shape proc_defs sees them *)
+    let defsOf (stm: stmt) : UD.VS.t list =
+      match stm.skind with
+	Instr il -> U.list_map (fun i -> snd (UD.computeUseDefInstr i)) il
+      | sk -> [snd (UD.computeUseDefStmtKind sk)]
+    in
+    let stmtDefs = IH.create 64 in
+    List.iter (fun stm -> IH.add stmtDefs stm.sid (defsOf stm)) stmts;
+    (* Number the definitions. Within an instruction the ids go in
+       vid order, matching the VS.iter order used by proc_defs *)
+    let startIdOf = IH.create 64 in
+    let varOfDefRev = ref [] in
+    let nextId = ref 0 in
+    List.iter (fun stm ->
+      IH.add startIdOf stm.sid !nextId;
+      IH.add ReachingDef.sidStmtHash stm.sid stm;
+      List.iter (fun d ->
+	UD.VS.iter (fun vi ->
+	  if !debug then
+	    ignore (E.log "RD: defId %d -> stm %d\n" !nextId stm.sid);
+	  IH.add ReachingDef.defIdStmtHash !nextId stm;
+	  varOfDefRev := vi.vid :: !varOfDefRev;
+	  incr nextId) d)
+	(IH.find stmtDefs stm.sid)) stmts;
+    let numDefs = !nextId in
+    ReachingDef.nextDefId := numDefs;
+    let varOfDef = Array.of_list (List.rev !varOfDefRev) in
+    (* One extra bit per defined variable for the pseudo-definition
+       standing for None *)
+    let undefBit = IH.create 64 in
+    let undefVarRev = ref [] in
+    let numBits = ref numDefs in
+    Array.iter (fun vid ->
+      if not (IH.mem undefBit vid) then begin
+	IH.add undefBit vid !numBits;
+	undefVarRev := vid :: !undefVarRev;
+	incr numBits
+      end) varOfDef;
+    let undefVarOf = Array.of_list (List.rev !undefVarRev) in
+    (* For each variable, the bits killed by a definition of it *)
+    let killOf = IH.create 64 in
+    Array.iteri (fun id vid ->
+      let b =
+	try IH.find killOf vid
+	with Not_found ->
+	  let b = B.make !numBits in
+	  B.setTo b (IH.find undefBit vid) true;
+	  IH.add killOf vid b;
+	  b
+      in
+      B.setTo b id true) varOfDef;
+    let genKillOf (stm: stmt) : B.t * B.t =
+      let gen = B.make !numBits in
+      let kill = B.make !numBits in
+      let id = ref (IH.find startIdOf stm.sid) in
+      List.iter (fun d ->
+	UD.VS.iter (fun vi ->
+	  let kv = IH.find killOf vi.vid in
+	  B.diff gen kv; (* a later definition of vi supersedes *)
+	  ignore (B.union kill kv);
+	  B.setTo gen !id true;
+	  incr id) d)
+	(IH.find stmtDefs stm.sid);
+      (gen, kill)
+    in
+    let gkh = IH.create 64 in
+    List.iter (fun s -> IH.add gkh s.sid (genKillOf s)) stmts;
+    let problem = { BV.bvName = ReachingDef.name;
+		    bvGen = (fun s -> fst (IH.find gkh s.sid));
+		    bvKill = (fun s -> snd (IH.find gkh s.sid)) } in
+    (* At the entry every variable is undefined *)
+    let entry = B.make !numBits in
+    IH.iter (fun _ bit -> B.setTo entry bit true) undefBit;
+    let sol = time "bitvector solve"
+	(BV.solveForwards problem [(fst_stm, entry)]) stmts in
+    (* Rebuild the iosh structures from the bit vectors. A variable
+       gets an entry only if a real definition of it reaches, matching
+       the sets built up by iosh_combine; the pseudo-definition bit
+       then contributes the None element *)
+    IH.iter (fun sid b ->
+      let iosh = IH.create 32 in
+      B.iter (fun bit ->
+	if bit < numDefs then begin
+	  let vid = varOfDef.(bit) in
+	  let old = try IH.find iosh vid with Not_found -> IOS.empty in
+	  IH.replace iosh vid (IOS.add (Some bit) old)
+	end) b;
+      B.iter (fun bit ->
+	if bit >= numDefs then begin
+	  let vid = undefVarOf.(bit - numDefs) in
+	  match IH.tryfind iosh vid with
+	    Some ios -> IH.replace iosh vid (IOS.add None ios)
+	  | None -> () (* no real definition reaches: no entry *)
+	end) b;
+      IH.add ReachingDef.stmtStartData sid
+	((), IH.find startIdOf sid, iosh)) sol;
     if compare fdec.svar.vname (!debug_fn) = 0 then
       debug := false
     (* now ReachingDef.stmtStartData has the reaching def data in it *)
@@ -10,6 +10,7 @@ module AELV = Availexpslv
 module UD = Usedef
 module IH = Inthash
 module S = Stats
+module DCE = Deadcodeelim
 
 module IS =
   Set.Make(struct
@@ -193,10 +194,17 @@ end
 
 let defCollector = new defCollectorClass
 
+(* The defined variables of a function do not change between the
+   candidate queries made while it is being printed, so visit the
+   function only for the first query *)
+let funDefsHtbl = IH.create 16
 let collect_fun_defs fd =
-  fdefs := UD.VS.empty;
-  ignore(visitCilFunction defCollector fd);
-  !fdefs
+  try IH.find funDefsHtbl fd.svar.vid
+  with Not_found ->
+    fdefs := UD.VS.empty;
+    ignore(visitCilFunction defCollector fd);
+    IH.add funDefsHtbl fd.svar.vid (!fdefs);
+    !fdefs
 
 (* ok_to_replace *)
 (* is it alright to replace a variable use with the expression
@@ -242,27 +250,49 @@ let ok_to_replace vi curiosh sid defiosh dsid f r =
   let _ = if !debug then ignore (E.log "ok_to_replace: card uses = %d\n" (UD.VS.cardinal uses)) in
   verify_unmodified uses fdefs curiosh defiosh
 
-let useList = ref []
-(* Visitor for making a list of statements that use a definition *)
-class useListerClass (defid:int) (vi:varinfo) = object(self)
+(* Def-use chains: for every definition id, the ids of the statements
+   containing a use of the defined variable that the definition
+   reaches. Def ids are numbered densely from zero for each function,
+   so the chains live in an array indexed by def id. They are built in
+   a single pass over the function (below, between the elimination
+   passes) and consulted instead of re-scanning the function for each
+   candidate temporary *)
+let defUses : int list array ref = ref [||]
+
+(* Visitor that records, for each use of a variable, the statement id
+   under every definition of that variable reaching the use *)
+class defUseBuilderClass = object(self)
     inherit RD.rdVisitorClass
 
   method! vexpr e =
     match e with
-    | Lval(Var vi', off) -> begin
+    | Lval(Var vi, NoOffset) -> begin
 	match self#get_cur_iosh() with
-	  Some iosh ->
-	    let vido = RD.iosh_defId_find iosh defid in
-	    let exists = match vido with Some _ -> true | None -> false in
-	    if Util.equals vi vi' && exists
-	    then (useList := sid::(!useList); DoChildren)
-	    else DoChildren
-	| _ -> DoChildren (*E.s (E.error "useLister: no data for statement")*)
+	  Some iosh -> begin
+	    (match RD.iosh_lookup iosh vi with
+	      Some ios ->
+		RD.IOS.iter (function
+		    Some id -> (!defUses).(id) <- sid::((!defUses).(id))
+		  | None -> ()) ios
+	    | None -> ());
+	    DoChildren
+	  end
+	| _ -> DoChildren
     end
     | _ -> DoChildren
 
 end
 
+(* build the chains for a function whose reaching definitions have
+   been computed *)
+let compute_def_use_chains fd =
+  defUses := Array.make (max !RD.ReachingDef.nextDefId 1) [];
+  ignore(visitCilFunction (new defUseBuilderClass :> cilVisitor) fd)
+
+(* the statements containing a use reached by the given definition *)
+let def_uses defid =
+  if defid < Array.length (!defUses) then (!defUses).(defid) else []
+
 (* ok_to_replace_with_incdec *)
 (* Find out if it is alright to replace the use of a variable
    with a post-increment/decrement of the variable it is assigned to be *)
@@ -270,15 +300,10 @@ end
    reaching the place where the variable was defined, the fundec,
    the varinfo for the variable being considered and the right
    hand side of its definition. *)
-let ok_to_replace_with_incdec curiosh defiosh f id vi r =
+let ok_to_replace_with_incdec curiosh defiosh _f id vi r =
 
   (* number of uses of vi where definition id reaches *)
-  let num_uses () =
-    let _ = useList := [] in
-    let ulc = new useListerClass id vi in
-    let _ = visitCilFunction (ulc :> cilVisitor) f in
-    List.length (!useList)
-  in
+  let num_uses () = List.length (def_uses id) in
 
   (* Is e the addition or subtraction of one to vi?
      Return Some(PlusA) if it's an addition,
@@ -724,6 +749,10 @@ class expTempElimClass (fd:fundec) = object (self)
 
 end
 
+(* set when a run of the forward substitution visitor rewrites at
+   least one expression *)
+let subst_changed = ref false
+
 class expLvTmpElimClass (fd : fundec) = object(self)
   inherit AELV.aeVisitorClass
 
@@ -731,7 +760,8 @@ class expLvTmpElimClass (fd : fundec) = object(self)
     match self#get_cur_eh () with
     | None -> DoChildren
     | Some eh -> begin
-	let e', _ = ae_lv_fwd_subst ~propStrings:true eh sid e fd false in
+	let e', b = ae_lv_fwd_subst ~propStrings:true eh sid e fd false in
+	if b then subst_changed := true;
 	ChangeTo e'
     end
 
@@ -1068,9 +1098,11 @@ let eliminate_temps f =
   IH.clear iioh;
   IH.clear incdecHash;
   IH.clear idDefHash;
+  IH.clear funDefsHtbl;
   let etec = new expLvTmpElimClass f in
   let f' = visitCilFunction (etec :> cilVisitor) f in
   RD.clearMemos (); (* we changed instructions and invalidated the "cache" *)
+  compute_def_use_chains f';
   let idtec = new incdecTempElimClass f' in
   let f' = visitCilFunction (idtec :> cilVisitor) f' in
   let ctec = new callTempElimClass f' in
@@ -1090,11 +1122,37 @@ let eliminateTempsForExpPrinting f =
   IH.clear iioh;
   IH.clear incdecHash;
   IH.clear idDefHash;
+  IH.clear funDefsHtbl;
   let etec = new expLvTmpElimClass f in
   let f' = visitCilFunction (etec :> cilVisitor) f in
   RD.clearMemos (); (* we changed instructions and invalidated the "cache" *)
+  compute_def_use_chains f';
   let idtec = new incdecTempElimClass f' in
   let f' = visitCilFunction (idtec :> cilVisitor) f' in
   let ctec = new callTempElimClass f' in
   let f' = visitCilFunction (ctec :> cilVisitor) f' in
   f'
+
+(* Interleave temp elimination and dead code elimination until
+   neither makes a change. Each exposes work for the other:
+   substituting a temp's definition into its use leaves the
+   definition dead, and removing a dead definition can leave another
+   temp with a single reaching definition, so running the passes back
+   to back a fixed number of times either stops short of convergence
+   or wastes traversals. Dead code elimination goes first in each
+   round so that the inc/dec and call substitution tables consulted
+   by the pretty printer are computed against the final form of the
+   code. *)
+(* Cil.fundec -> Cil.fundec *)
+let eliminate_temps_and_dead_code f =
+  let rec loop f =
+    Cfg.clearCFGinfo f;
+    ignore(Cfg.cfgFun f);
+    let f' = DCE.elim_dead_code f in
+    subst_changed := false;
+    let f' = eliminate_temps f' in
+    if !subst_changed || !DCE.removedCount > 0
+    then loop f'
+    else f'
+  in
+  loop f
@@ -19,6 +19,7 @@ module DCE = Deadcodeelim
 module EC = Expcompare
 
 let doElimTemps = ref false
+let doElimTempsDeadCode = ref false
 let debug = ref false
 let printComments = ref false
 let envWarnings = ref false
@@ -187,6 +188,85 @@ let get_loop_condition b =
        None, sl)
 
 
+(* ---------- persistent per-function optimization cache ---------- *)
+(* Temp elimination and dead code elimination are by far the most
+ * expensive part of zrapp printing, and from one run to the next most
+ * functions have not changed at all. When --zrapp_cache names a file,
+ * the optimized form of each function is kept there, keyed by a digest
+ * of the function as parsed and of the zrapp settings, and a hit skips
+ * the whole dataflow stack. The inc/dec and call substitution tables
+ * that pVar consults are part of a cached entry, since the printed
+ * output depends on them. Failures to read or write the cache are
+ * silent, as with the AST caches. *)
+
+let optCacheName = ref ""
+
+type optCacheEntry = {
+    ocFun: fundec;                     (* the optimized function *)
+    ocIioh: (int * instr option) list; (* RCT.iioh, for this function *)
+    ocIncdec: (int * (int * varinfo * binop)) list; (* RCT.incdecHash *)
+  }
+
+let optCacheMagic = "ZRAPPOPT1"
+let optCache : (string, optCacheEntry) H.t = H.create 113
+let optCacheLoaded = ref false
+let optCacheDirty = ref false
+
+let loadOptCache () =
+  try
+    let ic = open_in_bin !optCacheName in
+    let magic = really_input_string ic (String.length optCacheMagic) in
+    if magic = optCacheMagic then begin
+      let saved = (Marshal.from_channel ic : (string, optCacheEntry) H.t) in
+      H.iter (fun k e -> H.replace optCache k e) saved
+    end;
+    close_in ic
+  with Sys_error _ | End_of_file | Failure _ -> ()
+
+let saveOptCache () =
+  if !optCacheDirty then
+    try
+      let oc = open_out_bin !optCacheName in
+      output_string oc optCacheMagic;
+      Marshal.to_channel oc optCache [];
+      close_out oc
+    with Sys_error _ -> ()
+
+(* digest of the function about to be optimized, together with the
+ * settings that influence what the optimizers do to it *)
+let fundecDigest (f: fundec) : string =
+  let settings = Printf.sprintf "%B %B" !doElimTemps !doElimTempsDeadCode in
+  Digest.string (settings ^ Marshal.to_string f [])
+
+let optimizeFun (optimize: fundec -> fundec) (f: fundec) : fundec =
+  if !optCacheName = "" then optimize f
+  else begin
+    if not !optCacheLoaded then begin
+      loadOptCache ();
+      optCacheLoaded := true;
+      at_exit saveOptCache
+    end;
+    let key = fundecDigest f in
+    match (try Some (H.find optCache key) with Not_found -> None) with
+      Some e ->
+	(* splice in the cached result, including the substitution
+	 * tables the printer consults. The optimizers clear these
+	 * tables per function, so we do the same *)
+	IH.clear RCT.iioh;
+	IH.clear RCT.incdecHash;
+	List.iter (fun (vid, io) -> IH.replace RCT.iioh vid io) e.ocIioh;
+	List.iter (fun (vid, d) -> IH.replace RCT.incdecHash vid d) e.ocIncdec;
+	e.ocFun
+    | None ->
+	let nf = optimize f in
+	H.replace optCache key
+	  { ocFun = nf;
+	    ocIioh = IH.tolist RCT.iioh;
+	    ocIncdec = IH.tolist RCT.incdecHash };
+	optCacheDirty := true;
+	nf
+  end
+
 class zraCilPrinterClass : cilPrinter = object (self)
   inherit defaultCilPrinterClass as super
 
@@ -555,8 +635,10 @@ class zraCilPrinterClass : cilPrinter = object (self)
     (* add the arguments to the local environment *)
     List.iter (fun vi -> H.add lenvHtbl vi.vname vi) f.sformals;
     let nf =
-      if !doElimTemps
-      then RCT.eliminate_temps f
+      if !doElimTempsDeadCode
+      then optimizeFun RCT.eliminate_temps_and_dead_code f
+      else if !doElimTemps
+      then optimizeFun RCT.eliminate_temps f
       else f in
     let decls = docList ~sep:line (fun vi -> self#pVDecl () vi ++ text ";")
 	() nf.slocals in
@@ -628,6 +710,9 @@ let feature =
     "--zrapp_elim_temps",
     Arg.Unit (fun n -> doElimTemps := true),
     "Try to eliminate temporary variables during pretty printing";
+    "--zrapp_elim_temps_dce",
+    Arg.Unit (fun n -> doElimTempsDeadCode := true),
+    "Interleave temp elimination and dead code elimination to a fixpoint during pretty printing";
     "--zrapp_debug",
     Arg.Unit (fun n -> debug := true; RD.debug := true),
     "Lots of debugging info for pretty printing and reaching definitions";
@@ -636,7 +721,10 @@ let feature =
     "Only output debugging info for one function";
     "--zrapp_comments",
     Arg.Unit (fun _ -> printComments := true),
-    "Print comments from source file in output";];
+    "Print comments from source file in output";
+    "--zrapp_cache",
+    Arg.String (fun s -> optCacheName := s),
+    "Cache optimized function bodies in this file, keyed by a digest of the unoptimized function, and reuse them for unchanged functions";];
     fd_doit =
     (function (f: file) ->
       lineDirectiveStyle := None;
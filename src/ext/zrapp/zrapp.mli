@@ -2,6 +2,8 @@ val debug : bool ref
 
 val doElimTemps : bool ref
 
+val doElimTempsDeadCode : bool ref
+
 val deputyAttrs : bool ref
 
 class zraCilPrinterClass : Cil.cilPrinter
@@ -37,6 +37,7 @@ open Cil
 module E = Errormsg
 module D = Dynlink
 module F = Findlib
+module IH = Inthash
 
 type t = {
     mutable fd_enabled: bool;
@@ -72,6 +73,241 @@ let enable s =
   with Not_found ->
     E.s (E.error "cannot enable feature %s: not found" s)
 
+(** Lazy feature initialization *)
+
+(* A feature module is linked (or dynamically loaded) into every
+ * invocation, so whatever its module initializers compute is paid even
+ * by runs that never enable the feature. A feature with nontrivial
+ * set-up -- large tables, precomputed maps -- can register that work
+ * here as a thunk instead; the driver runs it once, just before the
+ * feature's first fd_doit invocation. Rarely-used features can
+ * alternatively be kept out of the executable entirely and brought in
+ * on demand with loadWithDeps below. As with functionParallel, the
+ * thunk lives in a side table rather than a new record field, so that
+ * existing feature definitions keep compiling unchanged. *)
+let initThunks : (string, unit -> unit) Hashtbl.t = Hashtbl.create 13
+
+let registerInit (name: string) (thunk: unit -> unit) : unit =
+  Hashtbl.replace initThunks name thunk
+
+let initializeFeature (f: t) : unit =
+  try
+    let thunk = Hashtbl.find initThunks f.fd_name in
+    (* remove first, so the thunk runs at most once even if it runs
+     * fd_doit itself or fails part-way *)
+    Hashtbl.remove initThunks f.fd_name;
+    thunk ()
+  with Not_found -> ()
+
+(** Function-parallel features *)
+
+(* how many worker processes runFunctionParallel may use *)
+let parallelJobs : int ref = ref 1
+
+(* Most features are function-local: fd_doit walks the globals and
+ * processes one GFun at a time, with no state flowing between
+ * functions. Such a feature can be declared function-parallel, and the
+ * driver will then partition the functions of the file over concurrent
+ * worker processes (the same forked-worker scheme as the parallel
+ * parser in Frontc: OCaml has no shared-memory threads that run OCaml
+ * code in parallel at the compiler versions we support, so we fork and
+ * marshal the transformed functions back over a pipe).
+ *
+ * We keep the marker in a side table rather than in a new field of the
+ * record above, so that the many existing feature definitions, in this
+ * tree and in dynamically loaded plugins, keep compiling unchanged. *)
+let functionParallel : (string, unit) Hashtbl.t = Hashtbl.create 13
+
+let markFunctionParallel (name: string) : unit =
+  Hashtbl.replace functionParallel name ()
+
+let isFunctionParallel (f: t) : bool =
+  Hashtbl.mem functionParallel f.fd_name
+
+(* Marshaling through a pipe breaks the sharing between a function body
+ * and the rest of the file: the copy that comes back has its own copies
+ * of the global varinfos, compinfos, enuminfos and typeinfos it
+ * mentions. Map them back to the parent's records, which are collected
+ * in the tables below. *)
+class restoreSharingClass (vars: varinfo IH.t)
+                          (comps: compinfo IH.t)
+                          (enums: (string, enuminfo) Hashtbl.t)
+                          (typs: (string, typeinfo) Hashtbl.t) = object
+  inherit nopCilVisitor
+
+  method! vvrbl (vi: varinfo) =
+    if not vi.vglob then SkipChildren
+    else
+      match IH.tryfind vars vi.vid with
+        Some vi' when vi' != vi -> ChangeTo vi'
+      | _ -> SkipChildren
+
+  method! vtype (t: typ) =
+    match t with
+      TComp (ci, a) -> begin
+        match IH.tryfind comps ci.ckey with
+          Some ci' when ci' != ci ->
+            ChangeDoChildrenPost (TComp (ci', a), fun t -> t)
+        | _ -> DoChildren
+      end
+    | TEnum (ei, a) when Hashtbl.mem enums ei.ename ->
+        let ei' = Hashtbl.find enums ei.ename in
+        if ei' != ei then ChangeDoChildrenPost (TEnum (ei', a), fun t -> t)
+        else DoChildren
+    | TNamed (ti, a) when Hashtbl.mem typs ti.tname ->
+        let ti' = Hashtbl.find typs ti.tname in
+        if ti' != ti then ChangeDoChildrenPost (TNamed (ti', a), fun t -> t)
+        else DoChildren
+    | _ -> DoChildren
+
+  method! voffs (o: offset) =
+    match o with
+      Field (fi, rest) -> begin
+        match IH.tryfind comps fi.fcomp.ckey with
+          Some ci' when ci' != fi.fcomp -> begin
+            try
+              let fi' =
+                List.find (fun fi' -> fi'.fname = fi.fname) ci'.cfields in
+              ChangeDoChildrenPost (Field (fi', rest), fun o -> o)
+            with Not_found ->
+              E.s (E.bug "Feature: no field %s in %s after parallel run"
+                     fi.fname (compFullName ci'))
+          end
+        | _ -> DoChildren
+      end
+    | _ -> DoChildren
+end
+
+(* Run a function-parallel feature on a file, partitioning the function
+ * definitions over up to !parallelJobs forked workers. Each worker sees
+ * the whole file minus the GFuns that are not in its slice, runs
+ * fd_doit on it, and sends its transformed functions back; the parent
+ * splices them into the original file. *)
+let runFunctionParallel (fdesc: t) (cil: file) : unit =
+  let jobs = max 1 !parallelJobs in
+  let globals = Array.of_list cil.globals in
+  let funIdxs = ref [] in
+  for i = Array.length globals - 1 downto 0 do
+    match globals.(i) with
+      GFun _ -> funIdxs := i :: !funIdxs
+    | _ -> ()
+  done;
+  let nfuns = List.length !funIdxs in
+  if jobs = 1 || nfuns <= 1 then
+    fdesc.fd_doit cil
+  else begin
+    let nw = min jobs nfuns in
+    if !E.verboseFlag then
+      ignore (E.log "Running %s on %d functions with %d workers\n"
+                fdesc.fd_name nfuns nw);
+    (* Deal the functions out round-robin, so that a stretch of large
+     * functions does not all land on the same worker *)
+    let slices = Array.make nw [] in
+    let k = ref 0 in
+    List.iter
+      (fun i -> slices.(!k) <- i :: slices.(!k); k := (!k + 1) mod nw)
+      !funIdxs;
+    let forkWorker (mine: int list) : int * Unix.file_descr =
+      let (rd, wr) = Unix.pipe () in
+      match Unix.fork () with
+      | 0 -> begin (* child *)
+          Unix.close rd;
+          let result =
+            try
+              let keep : unit IH.t = IH.create (List.length mine) in
+              List.iter (fun i -> IH.replace keep i ()) mine;
+              (* the worker sees every declaration, but only its own
+               * slice of the function definitions *)
+              let sub = ref [] in
+              Array.iteri
+                (fun i g ->
+                  match g with
+                    GFun _ when not (IH.mem keep i) -> ()
+                  | _ -> sub := g :: !sub)
+                globals;
+              fdesc.fd_doit { cil with globals = List.rev !sub;
+                                       gindex = None };
+              Ok (!E.hadErrors,
+                  Util.list_map
+                    (fun i ->
+                      match globals.(i) with
+                        GFun (fd, _) -> (i, fd)
+                      | _ -> E.s (E.bug "Feature: worker slice entry %d is not a function" i))
+                    mine)
+            with e -> Error (Printexc.to_string e)
+          in
+          let oc = Unix.out_channel_of_descr wr in
+          Marshal.to_channel oc
+            (result: (bool * (int * fundec) list, string) result) [];
+          flush oc;
+          (* Do not run at_exit handlers of the parent in the child *)
+          Unix.close wr;
+          exit 0
+        end
+      | pid ->
+          Unix.close wr;
+          (pid, rd)
+    in
+    let workers = Array.map forkWorker slices in
+    (* Collect the parent's global records, to rebuild the sharing that
+     * marshaling broke *)
+    let vars : varinfo IH.t = IH.create 113 in
+    let comps : compinfo IH.t = IH.create 113 in
+    let enums : (string, enuminfo) Hashtbl.t = Hashtbl.create 113 in
+    let typs : (string, typeinfo) Hashtbl.t = Hashtbl.create 113 in
+    Array.iter
+      (function
+          GVar (vi, _, _) | GVarDecl (vi, _) -> IH.replace vars vi.vid vi
+        | GFun (fd, _) -> IH.replace vars fd.svar.vid fd.svar
+        | GCompTag (ci, _) | GCompTagDecl (ci, _) -> IH.replace comps ci.ckey ci
+        | GEnumTag (ei, _) | GEnumTagDecl (ei, _) ->
+            Hashtbl.replace enums ei.ename ei
+        | GType (ti, _) -> Hashtbl.replace typs ti.tname ti
+        | _ -> ())
+      globals;
+    let sharer = new restoreSharingClass vars comps enums typs in
+    let spliceFunction (i: int) (fd: fundec) : unit =
+      match globals.(i) with
+        GFun (orig, loc) ->
+          (* a function-parallel feature must not change signatures, so
+           * keep the parent's varinfo for the function itself *)
+          fd.svar <- orig.svar;
+          let fd = visitCilFunction (sharer :> cilVisitor) fd in
+          (* fresh ids for the locals: two workers may have created
+           * temporaries with the same id *)
+          List.iter (fun vi -> vi.vid <- newVID ()) fd.sformals;
+          List.iter (fun vi -> vi.vid <- newVID ()) fd.slocals;
+          globals.(i) <- GFun (fd, loc)
+      | _ -> E.s (E.bug "Feature: global %d is not a function" i)
+    in
+    let hadErrors = ref !E.hadErrors in
+    Array.iteri
+      (fun k (pid, rd) ->
+        let ic = Unix.in_channel_of_descr rd in
+        let result : (bool * (int * fundec) list, string) result =
+          try Marshal.from_channel ic
+          with End_of_file ->
+            Error "worker died without producing a result"
+        in
+        close_in ic;  (* closes rd as well *)
+        let (_, status) = Unix.waitpid [] pid in
+        (match status with
+           Unix.WEXITED 0 -> ()
+         | _ -> ignore (E.log "Warning: %s worker %d exited abnormally\n"
+                          fdesc.fd_name k));
+        match result with
+          Ok (we, updated) ->
+            if we then hadErrors := true;
+            List.iter (fun (i, fd) -> spliceFunction i fd) updated
+        | Error msg ->
+            E.s (E.error "Feature %s failed in a worker: %s"
+                   fdesc.fd_name msg))
+      workers;
+    E.hadErrors := !hadErrors;
+    cil.globals <- Array.to_list globals;
+    invalidateGlobalIndex cil
+  end
+
 (** Dynamic linking *)
 
 let load s =
@@ -80,6 +80,43 @@ val enable : string -> unit
  * registered. *)
 val enabled : string -> bool
 
+(** {2 Lazy feature initialization} *)
+
+(** Register one-time set-up work for the feature with the given name.
+ * The thunk runs at most once, just before the feature's first fd_doit
+ * invocation, so a feature that needs large tables or precomputed maps
+ * can build them here instead of in its module initializer, where every
+ * invocation would pay for them whether or not the feature is enabled. *)
+val registerInit : string -> (unit -> unit) -> unit
+
+(** Run the registered set-up thunk of a feature, if any and if it has
+ * not run yet. Called by the driver before running an enabled feature. *)
+val initializeFeature : t -> unit
+
+(** {2 Function-parallel features} *)
+
+(** How many worker processes {!runFunctionParallel} may use. The default
+ * of 1 keeps everything in the current process. *)
+val parallelJobs : int ref
+
+(** Declare the feature with the given name to be function-parallel: its
+ * fd_doit processes one function definition at a time, with no state
+ * flowing between functions, it does not add or remove globals, and it
+ * does not change function signatures. The driver may then run it on a
+ * partition of the file's functions in concurrent worker processes. *)
+val markFunctionParallel : string -> unit
+
+(** Check if a feature has been declared function-parallel. *)
+val isFunctionParallel : t -> bool
+
+(** Run a feature on a file, partitioning the function definitions over
+ * up to {!parallelJobs} forked worker processes and splicing the
+ * transformed functions back into the file. Only sound for features
+ * that satisfy the contract of {!markFunctionParallel}. Falls back to a
+ * plain fd_doit call when only one job is requested or the file has at
+ * most one function. *)
+val runFunctionParallel : t -> Cil.file -> unit
+
 (**/**)
 
 (** Initialize the module. This needs to be called before {!loadWithDeps} is
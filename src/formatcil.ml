@@ -123,6 +123,19 @@ let cStmts (prog: string) :
 
 
 
+(* Compile a pattern once, returning the constructor closure. These
+ * produce the same closures as the c* functions above, but make the
+ * staging explicit: the parse (or memo table lookup) happens when the
+ * pattern is compiled, so a caller that keeps the closure pays nothing
+ * per constructed node. Use these for patterns applied many times. *)
+let compileExp = cExp
+let compileLval = cLval
+let compileType = cType
+let compileInstr = cInstr
+let compileStmt = cStmt
+let compileStmts = cStmts
+
+
 (* Match an expression *)
 let dExp (prog: string) : exp -> formatArg list option =
   let df = doParse prog Formatparse.expression expMemoTable in
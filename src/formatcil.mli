@@ -77,7 +77,31 @@ val cStmts: string ->
             Cil.location -> (string * Cil.formatArg) list -> 
             Cil.stmt list
 
-(** Deconstructs an expression based on the program. Produces an optional 
+(** Compile-once variants of the constructors above. Applying one of
+ * these to a pattern parses it (or finds it in the memo table) right
+ * away and returns the constructor closure, so a caller that keeps the
+ * closure pays neither the parse nor the memo table lookup when
+ * constructing nodes. Use these for patterns that are applied many
+ * times, e.g. in instrumentation passes. *)
+val compileExp: string -> ((string * Cil.formatArg) list -> Cil.exp)
+
+val compileLval: string -> ((string * Cil.formatArg) list -> Cil.lval)
+
+val compileType: string -> ((string * Cil.formatArg) list -> Cil.typ)
+
+val compileInstr: string -> (Cil.location ->
+                             (string * Cil.formatArg) list -> Cil.instr)
+
+val compileStmt: string ->
+                 ((string -> Cil.typ -> Cil.varinfo) ->
+                  Cil.location -> (string * Cil.formatArg) list -> Cil.stmt)
+
+val compileStmts: string ->
+                  ((string -> Cil.typ -> Cil.varinfo) ->
+                   Cil.location -> (string * Cil.formatArg) list ->
+                   Cil.stmt list)
+
+(** Deconstructs an expression based on the program. Produces an optional
  * list of format arguments. The parsing of the string is memoized. *)
 val dExp: string -> Cil.exp -> Cil.formatArg list option
 
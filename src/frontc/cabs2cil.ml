@@ -97,6 +97,22 @@ let doCollapseCallCast: bool ref = ref false
   * to parse additional source files without hearing about confclits. *)
 let cacheGlobals: bool ref = ref true
 
+(** Configure the conversion for analysis clients that never compile the
+    printed output: no implicit CastE nodes (about a fifth of the nodes
+    in a typical tree, and one more constructor to peel in every
+    expression match), constants lowered so folding sees them, and no
+    temporary for the implicit cast at a call destination
+    (doCollapseCallCast). The result still passes {!Check.checkFile},
+    whose type matching is relaxed accordingly when
+    {!Cil.insertImplicitCasts} is off. Printing such a tree produces
+    valid C only insofar as the compiler re-inserts the implicit
+    conversions, so keep this off in source-to-source pipelines.
+    Call before {!Frontc.parse}. *)
+let setAnalysisMode () : unit =
+  Cil.insertImplicitCasts := false;
+  Cil.lowerConstants := true;
+  doCollapseCallCast := true
+
 (** A hook into the code for processing typeof. *)
 let typeForTypeof: (Cil.typ -> Cil.typ) ref = ref (fun t -> t)
 
@@ -193,7 +209,8 @@ let debugLoc = false
 let convLoc (l : cabsloc) =
   if debugLoc then
     ignore (E.log "convLoc at %s: line %d, byte %d\n" l.filename l.lineno l.byteno);
-  {line = l.lineno; file = l.filename; byte = l.byteno;}
+  (* share one canonical copy of each file name over all locations *)
+  {line = l.lineno; file = internFileName l.filename; byte = l.byteno;}
 
 
 let isOldStyleVarArgName n =
@@ -339,15 +356,23 @@ let env : (string, envdata * location) H.t = H.create 307
 (* We also keep a global environment. This is always a subset of the env *)
 let genv : (string, envdata * location) H.t = H.create 307
 
- (* In the scope we keep the original name, so we can remove them from the
-  * hash table easily *)
-type undoScope =
-    UndoRemoveFromEnv of string
-  | UndoResetAlphaCounter of location AL.alphaTableData ref *
+ (* In the scope we keep the original names of the locals added to env,
+  * so we can remove them from the hash table easily, and separately the
+  * undo information for the alpha table. The alpha undos always go to
+  * the scope of the enclosing function (see newAlphaName below), so
+  * keeping them apart from the names leaves the per-symbol cost of
+  * entering a local at a single cons *)
+type undoAlpha =
+    UndoResetAlphaCounter of location AL.alphaTableData ref *
                              location AL.alphaTableData
   | UndoRemoveFromAlphaTable of string
 
-let scopes :  undoScope list ref list ref = ref []
+type scope = {
+    mutable sEnvNames: string list;  (* names to remove from env *)
+    mutable sAlphaUndo: undoAlpha list;
+  }
+
+let scopes : scope list ref = ref []
 
 let isAtTopLevel () =
   !scopes = []
@@ -367,7 +392,7 @@ let addLocalToEnv (n: string) (d: envdata) =
       | _ -> () (* We might add types *)
     end
   | s :: _ ->
-      s := (UndoRemoveFromEnv n) :: !s)
+      s.sEnvNames <- n :: s.sEnvNames)
 
 
 let addGlobalToEnv (k: string) (d: envdata) : unit =
@@ -418,9 +443,10 @@ let newAlphaName (globalscope: bool) (* The name should have global scope *)
         let prefix = AL.getAlphaPrefix ~lookupname:lookupname in
         try
           let countref = H.find alphaTable prefix in
-          s := (UndoResetAlphaCounter (countref, !countref)) :: !s
+          s.sAlphaUndo <- (UndoResetAlphaCounter (countref, !countref))
+                          :: s.sAlphaUndo
         with Not_found ->
-          s := (UndoRemoveFromAlphaTable prefix) :: !s
+          s.sAlphaUndo <- (UndoRemoveFromAlphaTable prefix) :: s.sAlphaUndo
     end
     | _ :: rest -> findEnclosingFun rest
   in
@@ -487,7 +513,7 @@ let startFile () =
 
 
 let enterScope () =
-  scopes := (ref []) :: !scopes
+  scopes := { sEnvNames = []; sAlphaUndo = [] } :: !scopes
 
      (* Exit a scope and clean the environment. We do not yet delete from
       * the name table *)
@@ -498,16 +524,12 @@ let exitScope () =
     | [] -> E.s (error "Not in a scope")
   in
   scopes := rest;
-  let rec loop = function
-      [] -> ()
-    | UndoRemoveFromEnv n :: t ->
-        H.remove env n; loop t
-    | UndoRemoveFromAlphaTable n :: t -> H.remove alphaTable n; loop t
-    | UndoResetAlphaCounter (vref, oldv) :: t ->
-        vref := oldv;
-        loop t
-  in
-  loop !this
+  List.iter (fun n -> H.remove env n) this.sEnvNames;
+  List.iter
+    (function
+        UndoRemoveFromAlphaTable n -> H.remove alphaTable n
+      | UndoResetAlphaCounter (vref, oldv) -> vref := oldv)
+    this.sAlphaUndo
 
 (* Lookup a variable name. Return also the location of the definition. Might
  * raise Not_found  *)
@@ -625,7 +647,7 @@ let rec stripConstLocalType (t: typ) : typ =
       let t' = stripConstLocalType ti.ttype in
       if t != t' then begin
         (* ignore (warn "Stripping \"const\" from typedef %s" ti.tname); *)
-        ti.ttype <- t'
+        setTypeinfoType ti t'
       end;
       let a' = dc a in if a != a' then TNamed(ti, a') else t
 
@@ -820,7 +842,11 @@ let canDropStatement (s: stmt) : bool =
 module BlockChunk =
   struct
     type chunk = {
-        stmts: stmt list;
+        stmts: stmt Clist.clist;          (* Built with constant-time
+                                           * appends; the adjacent Instr
+                                           * statements are merged only
+                                           * when the chunk is turned
+                                           * into a list of statements *)
         postins: instr list;              (* Some instructions to append at
                                            * the ends of statements (in
                                            * reverse order)  *)
@@ -831,35 +857,33 @@ module BlockChunk =
 
     let d_chunk () (c: chunk) =
       dprintf "@[{ @[%a@] };@?%a@]"
-           (docList ~sep:(chr ';') (d_stmt ())) c.stmts
+           (docList ~sep:(chr ';') (d_stmt ())) (Clist.toList c.stmts)
            (docList ~sep:(chr ';') (d_instr ())) (List.rev c.postins)
 
     let empty =
-      { stmts = []; postins = []; cases = []; }
+      { stmts = Clist.empty; postins = []; cases = []; }
 
     let isEmpty (c: chunk) =
-      c.postins == [] && c.stmts == []
+      c.postins == [] && c.stmts = Clist.empty
 
     let isNotEmpty (c: chunk) = not (isEmpty c)
 
     let i2c (i: instr) =
       { empty with postins = [i] }
 
-    (* Occasionally, we'll have to push postins into the statements *)
-    let pushPostIns (c: chunk) : stmt list =
+    (* The statements of the chunk, with the postins made into one more
+     * Instr statement at the end *)
+    let flushPostIns (c: chunk) : stmt Clist.clist =
       if c.postins = [] then c.stmts
       else
-        let rec toLast = function
-            [{skind=Instr il; _} as s] as stmts ->
-              s.skind <- Instr (il @ (List.rev c.postins));
-              stmts
-
-          | [] -> [mkStmt (Instr (List.rev c.postins))]
-
-          | a :: rest -> a :: toLast rest
-        in
-        compactStmts (toLast c.stmts)
+        Clist.append c.stmts
+          (Clist.single (mkStmt (Instr (List.rev c.postins))))
 
+    (* Occasionally, we'll have to push postins into the statements. This
+     * is the only place where the chunk is materialized, so this is
+     * where the adjacent Instr statements get merged *)
+    let pushPostIns (c: chunk) : stmt list =
+      compactStmts (Clist.toList (flushPostIns c))
 
     let c2block (c: chunk) : block =
       { battrs = [];
@@ -874,7 +898,7 @@ module BlockChunk =
     (* Append two chunks. Never refer to the original chunks after you call
      * this. And especially never share c2 with somebody else *)
     let (@@) (c1: chunk) (c2: chunk) =
-      { stmts = compactStmts (pushPostIns c1 @ c2.stmts);
+      { stmts = Clist.append (flushPostIns c1) c2.stmts;
         postins = c2.postins;
         cases = c1.cases @ c2.cases;
       }
@@ -882,14 +906,14 @@ module BlockChunk =
     let skipChunk = empty
 
     let returnChunk (e: exp option) (l: location) : chunk =
-      { stmts = [ mkStmt (Return(e, l)) ];
+      { stmts = Clist.single (mkStmt (Return(e, l)));
         postins = [];
         cases = []
       }
 
     let ifChunk (be: exp) (l: location) (t: chunk) (e: chunk) : chunk =
 
-      { stmts = [ mkStmt(If(be, c2block t, c2block e, l))];
+      { stmts = Clist.single (mkStmt(If(be, c2block t, c2block e, l)));
         postins = [];
         cases = t.cases @ e.cases;
       }
@@ -903,7 +927,7 @@ module BlockChunk =
       if c.cases != [] then raise (Failure "cannot duplicate: has cases") else
       let pCount = ref (List.length c.postins) in
       { stmts =
-        Util.list_map
+        Clist.map
           (fun s ->
             if s.labels != [] then
               raise (Failure "cannot duplicate: has labels");
@@ -927,24 +951,24 @@ module BlockChunk =
 *)
     (* We can drop a chunk if it does not have labels inside *)
     let canDrop (c: chunk) =
-      List.for_all canDropStatement c.stmts
+      Clist.fold_left (fun acc s -> acc && canDropStatement s) true c.stmts
 
     let loopChunk (body: chunk) : chunk =
       (* Make the statement *)
       let loop = mkStmt (Loop (c2block body, !currentLoc, None, None)) in
-      { stmts = [ loop (* ; n *) ];
+      { stmts = Clist.single loop;
         postins = [];
         cases = body.cases;
       }
 
     let breakChunk (l: location) : chunk =
-      { stmts = [ mkStmt (Break l) ];
+      { stmts = Clist.single (mkStmt (Break l));
         postins = [];
         cases = [];
       }
 
     let continueChunk (l: location) : chunk =
-      { stmts = [ mkStmt (Continue l) ];
+      { stmts = Clist.single (mkStmt (Continue l));
         postins = [];
         cases = []
       }
@@ -982,13 +1006,21 @@ module BlockChunk =
 
         (* Get the first statement in a chunk. Might need to change the
          * statements in the chunk *)
-    let getFirstInChunk (c: chunk) : stmt * stmt list =
+    let getFirstInChunk (c: chunk) : stmt * stmt Clist.clist =
       (* Get the first statement and add the label to it *)
-      match c.stmts with
-        s :: _ -> s, c.stmts
-      | [] -> (* Add a statement *)
+      let rec first = function
+          Clist.CList (s :: _) | Clist.CConsL (s, _) -> Some s
+        | Clist.CList [] -> None
+        | Clist.CConsR (l, s) ->
+            (match first l with None -> Some s | fo -> fo)
+        | Clist.CSeq (_, l1, l2) ->
+            (match first l1 with None -> first l2 | fo -> fo)
+      in
+      match first c.stmts with
+        Some s -> s, c.stmts
+      | None -> (* Add a statement *)
           let n = mkEmptyStmt () in
-          n, n :: c.stmts
+          n, Clist.append (Clist.single n) c.stmts
 
     let consLabel (l: string) (c: chunk) (loc: location)
 				(in_original_program_text : bool) : chunk =
@@ -1001,7 +1033,7 @@ module BlockChunk =
       if c.stmts == stmts' then c else {c with stmts = stmts'}
 
     let s2c (s:stmt) : chunk =
-      { stmts = [ s ];
+      { stmts = Clist.single s;
         postins = [];
         cases = [];
       }
@@ -1009,7 +1041,7 @@ module BlockChunk =
     let gotoChunk (ln: string) (l: location) : chunk =
       let gref = ref dummyStmt in
       addGoto ln gref;
-      { stmts = [ mkStmt (Goto (gref, l)) ];
+      { stmts = Clist.single (mkStmt (Goto (gref, l)));
         postins = [];
         cases = [];
       }
@@ -1076,7 +1108,7 @@ module BlockChunk =
           body.cases)
       in
       let switch = mkStmt (Switch (e, block, cases, l)) in
-      { stmts = [ switch (* ; n *) ];
+      { stmts = Clist.single switch;
         postins = [];
         cases = [];
       }
@@ -1338,7 +1370,9 @@ let rec castTo ?(fromsource=false)
               (if fromsource then "(source)" else "")
               d_type ot d_type nt);
 
-  if not fromsource && Util.equals (typeSig ot) (typeSig nt) then
+  if not fromsource &&
+     (ot == nt (* fast path when types are interned *)
+      || Util.equals (typeSig ot) (typeSig nt)) then
     (* Do not put the cast if it is not necessary, unless it is from the
      * source. *)
     (ot, e)
@@ -1375,7 +1409,7 @@ let rec castTo ?(fromsource=false)
     | TArray _, TPtr _ -> result
 
     | TArray(t1,_,_), TArray(t2,None,_)
-        when Util.equals (typeSig t1) (typeSig t2) -> (nt', e)
+        when t1 == t2 || Util.equals (typeSig t1) (typeSig t2) -> (nt', e)
 
     | TPtr _, TArray(_,_,_) -> (nt', e)
 
@@ -2020,8 +2054,39 @@ let rec collectInitializer
                  !pMaxIdx len);
         (* Missing initializers must be set to zero but this is not done here.
          * See assignInit. *)
+        (* Runs of at least !repeatInitThreshold uninitialized slots are
+         * collapsed into one RepeatInit entry instead of one zero
+         * initializer per element *)
+        let zi = ref None in    (* create the zero initializer at most once *)
+        let getZi () =
+          match !zi with
+            Some i -> i
+          | None -> let i = makeZeroInit bt in zi := Some i; i
+        in
         let rec collect (acc: (offset * init) list) (idx: int) =
           if idx = -1 then acc
+          else if !pArray.(idx) = NoInitPre then begin
+            (* Find the start of the run of uninitialized slots *)
+            let first = ref idx in
+            while !first > 0 && !pArray.(!first - 1) = NoInitPre do
+              decr first
+            done;
+            let n = idx - !first + 1 in
+            let acc' =
+              if n >= !repeatInitThreshold then
+                (Index(integer !first, NoOffset), RepeatInit(getZi (), n))
+                :: acc
+              else
+                let rec expand acc k =
+                  if k < !first then acc
+                  else
+                    expand ((Index(integer k, NoOffset), getZi ()) :: acc)
+                           (k - 1)
+                in
+                expand acc idx
+            in
+            collect acc' (!first - 1)
+          end
           else
             let thisi = fst (collectInitializer isfield isconst !pArray.(idx) bt)
             in
@@ -2276,7 +2341,7 @@ let afterConversion (c: chunk) : chunk =
   let sl = pushPostIns c in
   if !doCollapseCallCast then
     peepHole2 collapseCallCast sl;
-  { c with stmts = sl; postins = [] }
+  { c with stmts = Clist.fromList sl; postins = [] }
 
 (***** Try to suggest a name for the anonymous structures *)
 let suggestAnonName (nl: A.name list) =
@@ -2625,7 +2690,7 @@ let rec doSpecList (suggestedAnonName: string) (* This string will be part of
     | _ ->
         E.s (error "Invalid combination of type specifiers")
   in
-  bt,!storage,!isinline,List.rev (!attrs @ (convertCVtoAttr !cvattrs))
+  internType bt,!storage,!isinline,List.rev (!attrs @ (convertCVtoAttr !cvattrs))
 
 (* given some cv attributes, convert them into named attributes for
  * uniform processing *)
@@ -3051,7 +3116,9 @@ and doType (nameortype: attributeClass) (* This is AttrName if we are doing
         doDeclType (TFun (tres, args, isva', [])) acc d
 
   in
-  doDeclType bt [] dt
+  let restyp, nattr = doDeclType bt [] dt in
+  (* Share the representation of the type we just built *)
+  internType restyp, nattr
 
 (* If this is a declarator for a variable size array then turn it into a
    pointer type and a length *)
@@ -3187,8 +3254,12 @@ and makeCompType (isstruct: bool)
     let fieldsSig fs = Util.list_map (fun f -> typeSig f.ftype) fs in
     if not (Util.equals (fieldsSig comp.cfields) (fieldsSig flds)) then
       ignore (error "%s seems to be multiply defined" (compFullName comp))
-  end else
+  end else begin
     comp.cfields <- flds;
+    (* The compinfo may have been created by a forward reference, and its
+     * (empty) layout may have been computed and cached since *)
+    invalidateCompLayout comp
+  end;
 
 (*  ignore (E.log "makeComp: %s: %a\n" comp.cname d_attrlist a); *)
   comp.cattr <- a;
@@ -3344,7 +3415,7 @@ and doExp (asconst: bool)   (* This expression is used as a constant *)
     | A.PAREN e -> E.s (bug "stripParen")
     | A.NOTHING when what = ADrop -> finishExp empty (integer 0) intType
     | A.NOTHING ->
-        let res = Const(CStr "exp_nothing") in
+        let res = mkString "exp_nothing" in
         finishExp empty res (typeOf res)
 
     (* Do the potential lvalues first *)
@@ -3510,7 +3581,9 @@ and doExp (asconst: bool)   (* This expression is used as a constant *)
               *)
 
         | A.CONST_WSTRING (ws: int64 list) ->
-            let res = Const(CWStr ((* intlist_to_wstring *) ws)) in
+            (* The parser accumulates wide strings character by
+             * character; pack them once here *)
+            let res = Const(CWStr (wstringOfList ws)) in
             finishExp empty res (typeOf res)
 
         | A.CONST_STRING s ->
@@ -3530,7 +3603,7 @@ and doExp (asconst: bool)   (* This expression is used as a constant *)
                   s
               with Not_found -> s
             in
-            let res = Const(CStr s') in
+            let res = mkString s' in
             finishExp empty res (typeOf res)
 
         | A.CONST_CHAR char_list ->
@@ -3575,7 +3648,7 @@ and doExp (asconst: bool)   (* This expression is used as a constant *)
               ignore (E.log "float_of_string %s (%s)\n" str
                         (Printexc.to_string e));
               E.hadErrors := true;
-              let res = Const(CStr "booo CONS_FLOAT") in
+              let res = mkString "booo CONS_FLOAT" in
               finishExp empty res (typeOf res)
             end
         end
@@ -3605,7 +3678,7 @@ and doExp (asconst: bool)   (* This expression is used as a constant *)
               ignore (E.log "float_of_string_2 %s (%s)\n" baseint
                         (Printexc.to_string e));
               E.hadErrors := true;
-              let res = Const(CStr "booo CONS_FLOAT") in
+              let res = mkString "booo CONS_FLOAT" in
               finishExp empty res (typeOf res)
             end
         end
@@ -5735,7 +5808,7 @@ and createLocal ?allow_var_decl:(allow_var_decl=true) ((_, sto, _, _) as specs)
         | TArray(TInt((IChar|IUChar|ISChar), _) as bt, None, a),
              SingleInit(Const(CStr s)), _ ->
                vi.vtype <- TArray(bt,
-                                  Some (integer (String.length s + 1)),
+                                  Some (integer (cstringLength s + 1)),
                                   a)
         | _, _, _ -> ());
         if vi.vstorage = Static && not !makeStaticGlobal then begin
@@ -5898,6 +5971,8 @@ and doDecl (isglobal: bool) : A.definition -> chunk = function
                  sbody    = dummyFunDec.sbody; (* Not final yet *)
 		 smaxstmtid = None;
                  sallstmts = [];
+                 scfgprepared = false;
+                 smodgen = 0;
                };
 	    !currentFunctionFDEC.svar.vdecl <- funloc;
 
@@ -6103,7 +6178,7 @@ and doDecl (isglobal: bool) : A.definition -> chunk = function
                   (* We must still share the old switch statement since we
                   * have already inserted the goto's *)
                   let newswitchkind =
-                    match newswitch.stmts with
+                    match Clist.toList newswitch.stmts with
                       [ s]
                         when newswitch.postins == [] && newswitch.cases == []->
                           s.skind
@@ -6347,7 +6422,8 @@ and doTypedef ((specs, nl): A.name_group) =
         * variables to avoid confusion between variable names and types. This
         * is actually necessary in some cases.  *)
         let n', _  = newAlphaName true "" n in
-        let ti = { tname = n'; ttype = newTyp'; treferenced = false } in
+        let ti = { tname = n'; ttype = newTyp'; treferenced = false;
+                   tunrolled = None; tunrolledGen = 0 } in
         (* Since we use the same name space, we might later hit a global with
          * the same name and we would want to change the name of the global.
          * It is better to change the name of the type instead. So, remember
@@ -6424,7 +6500,7 @@ and assignInit (lv: lval)
                 ~ct:t
                 ~initl:initl
                 ~acc:acc in
-              let ilen = List.length initl in
+              let ilen = compoundInitLength initl in
               if ilen >= i64_to_int ni then
                 (* There are no remaining initializations *)
                 b
@@ -6464,6 +6540,9 @@ and assignInit (lv: lval)
         ~initl:initl
         ~acc:acc
   end
+  | RepeatInit _ ->
+      (* foldLeftCompound expands RepeatInit entries before calling us *)
+      E.s (bug "assignInit: unexpected RepeatInit")
 
   (* Now define the processors for body and statement *)
 and doBody (blk: A.block) : chunk =
@@ -6489,7 +6568,7 @@ and doBody (blk: A.block) : chunk =
   else begin
     let b = c2block bodychunk in
     b.battrs <- battrs;
-    { stmts = [ mkStmt (Block b) ];
+    { stmts = Clist.single (mkStmt (Block b));
       postins = [];
       cases = bodychunk.cases;
     }
@@ -6779,7 +6858,7 @@ and doStatement (s : A.statement) : chunk =
         (* Now take se and try to convert it to a list of instructions. This
          * might not be always possible *)
         let il' =
-          match compactStmts se.stmts with
+          match compactStmts (Clist.toList se.stmts) with
             [] -> se.postins
           | [ s ] -> begin
               match s.skind with
@@ -6810,15 +6889,20 @@ class stripParenClass : V.cabsVisitor = object (self)
   | _ -> V.DoChildren
 end
 
-let stripParenFile file = V.visitCabsFile (new stripParenClass) file
 
 
 (* Translate a file *)
-let convFile (f : A.file) : Cil.file =
-  Cil.initCIL (); (* make sure we have initialized CIL *)
+(* The elaboration can also be driven one definition at a time: call
+ * initConvFile, feed each definition to convOneGlobal and finish with
+ * finishConvFile. A caller with no further use for the Cabs tree can
+ * this way let each definition become garbage as soon as it has been
+ * elaborated, instead of keeping both full ASTs alive (see
+ * Frontc.parse). convFile below is the batch form of the same loop. *)
 
-  (* remove parentheses from the Cabs *)
-  let fname,dl = stripParenFile f in
+let globalidx = ref 0
+
+let initConvFile () =
+  Cil.initCIL (); (* make sure we have initialized CIL *)
 
   (* Clean up the global types *)
   initGlobals();
@@ -6832,6 +6916,7 @@ let convFile (f : A.file) : Cil.file =
   H.clear typedefs;
   H.clear isomorphicStructs;
   annonCompFieldNameId := 0;
+  globalidx := 0;
   if !E.verboseFlag || !Cilutil.printStages then
     ignore (E.log "Converting CABS->CIL\n");
   (* Setup the built-ins, but do not add their prototypes to the file *)
@@ -6845,10 +6930,10 @@ let convFile (f : A.file) : Cil.file =
     (* Add it to the file as well *)
     cabsPushGlobal (GVarDecl (v, Cil.builtinLoc))
   in
-  H.iter setupBuiltin Cil.builtinFunctions;
+  H.iter setupBuiltin Cil.builtinFunctions
 
-  let globalidx = ref 0 in
-  let doOneGlobal (d: A.definition) =
+let convOneGlobal (d: A.definition) =
+  let doOne (d: A.definition) =
     let s = doDecl true d in
     if isNotEmpty s then
       E.s (bug "doDecl returns non-empty statement for global");
@@ -6886,7 +6971,10 @@ let convFile (f : A.file) : Cil.file =
           cabsPushGlobal (GText(Buffer.contents buff))
     end
   in
-  List.iter doOneGlobal dl;
+  (* remove parentheses from the Cabs *)
+  List.iter doOne (V.visitCabsDefinition (new stripParenClass) d)
+
+let finishConvFile (fname: string) : Cil.file =
   let globals = ref (popGlobals ()) in
 
   IH.clear noProtoFunctions;
@@ -6907,4 +6995,10 @@ let convFile (f : A.file) : Cil.file =
     globals  = !globals;
     globinit = None;
     globinitcalled = false;
+    gindex = None;
   }
+
+let convFile ((fname, dl) : A.file) : Cil.file =
+  initConvFile ();
+  List.iter convOneGlobal dl;
+  finishConvFile fname
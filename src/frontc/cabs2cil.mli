@@ -38,6 +38,18 @@
 (** The main entry point *)
 val convFile: Cabs.file -> Cil.file
 
+(** The elaboration can also be driven one definition at a time: call
+ * [initConvFile], feed each definition to [convOneGlobal] and finish
+ * with [finishConvFile], passing the file name. This is what
+ * {!Cabs2cil.convFile} does internally; a caller with no further use
+ * for the Cabs tree can use the split form to let each definition
+ * become garbage as soon as it has been elaborated. *)
+val initConvFile: unit -> unit
+
+val convOneGlobal: Cabs.definition -> unit
+
+val finishConvFile: string -> Cil.file
+
 (** Turn on tranformation that forces correct parameter evaluation order *)
 val forceRLArgEval: bool ref
 
@@ -66,6 +78,15 @@ val doCollapseCallCast: bool ref
   * to parse additional source files without hearing about confclits. *)
 val cacheGlobals: bool ref
 
+(** Configure the conversion for analysis clients that never compile the
+    printed output: implicit casts are not inserted, constants are
+    lowered, and calls keep their destination instead of going through a
+    temporary when only an implicit cast separates the types. The
+    resulting tree is leaner but prints to C that relies on the compiler
+    to re-insert the implicit conversions; {!Check.checkFile} accepts
+    it. Call before {!Frontc.parse}. *)
+val setAnalysisMode: unit -> unit
+
 (** A hook into the code for processing typeof. *)
 val typeForTypeof: (Cil.typ -> Cil.typ) ref
 
@@ -6,18 +6,39 @@ let getident () =
     nextident := !nextident + 1;
     !nextident
 
-let currentLoc () = 
-  let l, f, c = Errormsg.getPosition () in
-  { lineno   = l; 
-    filename = f; 
-    byteno   = c;
-    ident    = getident ();}
-
-let cabslu = {lineno = -10; 
-	      filename = "cabs loc unknown"; 
+let cabslu = {lineno = -10;
+	      filename = "cabs loc unknown";
 	      byteno = -10;
               ident = 0}
 
+(* Set this if some consumer needs a distinct location record, with an
+ * exact byteno, for every token, as the whitetrack exact printer does.
+ * When clear (the default), currentLoc hands out one shared record for
+ * all the tokens of a line: nearly every Cabs node carries a location,
+ * so for big files the records are a sizable part of the tree, and
+ * within a line they only differ in byteno and in ident (which is just
+ * a diagnostic tag). The byteno of a shared record is that of the first
+ * token requested on its line. *)
+let exactTokenLocations = ref false
+
+let lastLoc = ref cabslu
+
+let currentLoc () =
+  let l, f, c = Errormsg.getPosition () in
+  (* The filename string is the one parseinfo holds; it changes
+   * physically only at a #line directive, so == suffices here *)
+  let last = !lastLoc in
+  if not !exactTokenLocations && last.lineno = l && last.filename == f then
+    last
+  else begin
+    let loc = { lineno   = l;
+                filename = f;
+                byteno   = c;
+                ident    = getident ();} in
+    lastLoc := loc;
+    loc
+  end
+
 (* clexer puts comments here *)
 let commentsGA = GrowArray.make 100 (GrowArray.Elem(cabslu,"",false))
 
@@ -582,7 +582,8 @@ and childrenAttribute vis ((n, el) as input) =
 and visitCabsAttributes vis (al: attribute list) : attribute list =
   mapNoCopyList (visitCabsAttribute vis) al
 
-let visitCabsFile (vis: cabsVisitor) ((fname, f): file) : file =
-  (fname, mapNoCopyList (visitCabsDefinition vis) f)
+let visitCabsFile (vis: cabsVisitor) (((fname, f) as input): file) : file =
+  let f' = mapNoCopyList (visitCabsDefinition vis) f in
+  if f' != f then (fname, f') else input
 
     (* end of file *)
@@ -45,6 +45,11 @@
 val init: filename:string -> Lexing.lexbuf
 val finish: unit -> unit
 
+(* The source files contributing to the translation unit being lexed: the
+ * file given to init plus every distinct name seen in a # line marker,
+ * as the preprocessor wrote them. Reset by init *)
+val contributingFiles: unit -> string list
+
 (* This is the main parser function *)
 val initial: Lexing.lexbuf -> Cparser.token
 
@@ -106,7 +106,9 @@ let space () = ()
 let indent () = ()
 let unindent () = ()
 let force_new_line () = ()
-let flush () = ()
+(* the printed tokens are batched in Whitetrack's buffer; drain it so
+ * that output written to the channel directly lands after ours *)
+let flush () = Whitetrack.flushOutput ()
 let commit () = ()
 
 (* sm: for some reason I couldn't just call print from frontc.... ? *)
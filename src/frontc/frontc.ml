@@ -88,6 +88,30 @@ end
 
 let printNotice = ref false
 
+(* how many translation units parse_parallel may process concurrently *)
+let parallelJobs : int ref = ref 1
+
+(* where parse workers put their result segments, normally a
+ * memory-backed filesystem; the empty string (or a directory that does
+ * not exist) makes the workers marshal their results over the pipe
+ * instead. See the comment at parse_parallel *)
+let shmTransferDir : string ref = ref "/dev/shm"
+
+(* directory of the parse cache; the empty string disables the cache *)
+let parseCacheDir : string ref = ref ""
+
+(* also keep elaborated files in memory, keyed by the same digest, so
+ * that one process never elaborates identical preprocessed input
+ * twice. Trades memory for front-end CPU *)
+let parseCacheMem : bool ref = ref false
+
+(* when set, parsing a file also writes <file>.deps beside it: one
+ * line per source file contributing to the translation unit (the
+ * lexer collects them from the # line markers), with its digest.
+ * Cache layers keyed on the original sources can check staleness
+ * against the manifest without re-preprocessing *)
+let emitDepsManifest : bool ref = ref false
+
 (*
 ** Argument definition
 *)
@@ -104,11 +128,41 @@ let args : (string * Arg.spec * string) list =
              " print prototypes to safec.proto.h after parsing";
   "--printNotice", Arg.Set printNotice,
              " include a comment saying printed by FrontC";
+  "--parseJobs", Arg.Int (fun n -> parallelJobs := n),
+             "<n> parse up to n translation units concurrently";
+  "--parseShmDir", Arg.String (fun d -> shmTransferDir := d),
+             "<dir> where parse workers put their result segments; an empty string makes them marshal over the pipe instead";
+  "--parseCacheDir", Arg.String (fun d -> parseCacheDir := d),
+             "<dir> cache the elaborated files, keyed by the digest of the preprocessed input";
+  "--parseCacheMem", Arg.Set parseCacheMem,
+             " also keep elaborated files in memory, so identical preprocessed input is never elaborated twice in one process";
+  "--parseDeps", Arg.Set emitDepsManifest,
+             " write a <file>.deps manifest beside each parsed file, listing the contributing source files with digests";
 ]
 
 exception ParseError of string
 exception CabsOnly
 
+(* One line per contributing file: the digest (or "-" when the file
+ * cannot be read, e.g. "<built-in>") and the name as the # line
+ * markers reported it, separated by one space. The first line is a
+ * format marker *)
+let writeDepsManifest (fname: string) : unit =
+  try
+    let chn = open_out (fname ^ ".deps") in
+    output_string chn "# cil-deps 1\n";
+    List.iter
+      (fun src ->
+        let digest =
+          try Digest.to_hex (Digest.file src)
+          with Sys_error _ -> "-"
+        in
+        output_string chn (digest ^ " " ^ src ^ "\n"))
+      (List.sort compare (Clexer.contributingFiles ()));
+    close_out chn
+  with Sys_error msg ->
+    ignore (E.warn "Cannot write dependency manifest for %s: %s" fname msg)
+
 (* parse, and apply patching *)
 let rec parse_to_cabs fname =
 begin
@@ -191,6 +245,7 @@ and parse_to_cabs_inner (fname : string) =
     let cabs = Stats.time "parse" (Cparser.interpret (Whitetrack.wraplexer clexer)) lexbuf in
     Whitetrack.setFinalWhite (Clexer.get_white ());
     Clexer.finish ();
+    if !emitDepsManifest then writeDepsManifest fname;
     (fname, cabs)
   with (Sys_error msg) -> begin
     ignore (E.log "Cannot open %s : %s\n" fname msg);
@@ -251,16 +306,344 @@ end
 
 
 
+(* Run f inside a Cilgc allocation phase, unwinding the phase on
+ * exceptions. The Cabs tree built by the parser dies wholesale once
+ * elaboration is done, and the lazier major collector of the
+ * allocation phase keeps the GC from repeatedly tracing the doomed
+ * tree while it is live. Phases nest, so drivers that already bracket
+ * the whole parse-and-merge stage are unaffected *)
+let inAllocPhase (f: unit -> 'a) : 'a =
+  Cilgc.beginAllocPhase ();
+  try
+    let r = f () in
+    Cilgc.endAllocPhase ();
+    r
+  with e ->
+    Cilgc.endAllocPhase ();
+    raise e
+
 let parse_helper fname =
   (trace "sm" (dprintf "parsing %s to Cabs\n" fname));
-  let cabs = parse_to_cabs fname in
+  let cabs = inAllocPhase (fun () -> parse_to_cabs fname) in
   (* Now (return a function that will) convert to CIL *)
   fun _ ->
     (trace "sm" (dprintf "converting %s from Cabs to CIL\n" fname));
-    let cil = Stats.time "convert to CIL" Cabs2cil.convFile cabs in
+    let cil = inAllocPhase
+        (fun () -> Stats.time "convert to CIL" Cabs2cil.convFile cabs) in
     if !doPrintProtos then (printPrototypes cabs);
     cabs, cil
 
-let parse fname = (fun () -> snd(parse_helper fname ()))
+(* A Cil.file produced in another process — unmarshaled from a parse
+ * worker or loaded from the parse cache — carries vids and ckeys that
+ * may collide with ids already allocated here. Renumber them to restore
+ * the global-uniqueness invariant that sequential parsing provides.
+ * Within one file the old ids are unique, so they serve as memoization
+ * keys. *)
+class collectIdsVisitor (vars: Cil.varinfo Inthash.t)
+                        (comps: Cil.compinfo Inthash.t) = object
+  inherit Cil.nopCilVisitor
+  method! vvdec (vi: Cil.varinfo) =
+    Inthash.replace vars vi.Cil.vid vi; Cil.DoChildren
+  method! vvrbl (vi: Cil.varinfo) =
+    Inthash.replace vars vi.Cil.vid vi; Cil.DoChildren
+  method! vglob (g: Cil.global) =
+    (match g with
+      Cil.GCompTag (ci, _) | Cil.GCompTagDecl (ci, _) ->
+        Inthash.replace comps ci.Cil.ckey ci
+    | _ -> ());
+    Cil.DoChildren
+end
+
+let renumberIds (f: Cil.file) : unit =
+  let vars : Cil.varinfo Inthash.t = Inthash.create 113 in
+  let comps : Cil.compinfo Inthash.t = Inthash.create 113 in
+  Cil.visitCilFileSameGlobals (new collectIdsVisitor vars comps) f;
+  (* The varinfo and compinfo records are shared, so assigning each
+   * distinct record once renumbers every occurrence *)
+  Inthash.iter (fun _ vi -> vi.Cil.vid <- Cil.newVID ()) vars;
+  Inthash.iter (fun _ ci -> ci.Cil.ckey <- Cil.newCompinfoKey ()) comps
+
+(*
+** The parse cache. When --parseCacheDir is set we digest the
+** preprocessed input and keep the elaborated file in binary form
+** (Cil.saveBinaryFile) under <dir>/<digest>.cilb. Consecutive builds
+** preprocess most files to identical bytes, so a warm cache replaces
+** lexing, parsing and elaboration with a binary load. Entries written
+** by a CIL with a different binary format version fail to load and
+** count as misses. The digest covers only the file contents, not the
+** machine model or the front-end flags; use separate cache directories
+** for different configurations.
+**
+** With --parseCacheMem the elaborated files are additionally kept
+** marshaled in memory under the same digests, so one process never
+** elaborates identical preprocessed input twice even without a cache
+** directory.
+*)
+
+(* The digest keying the caches for fname, or None when caching does
+ * not apply. The Cabs tree is not cached, so anything that needs it
+ * (patching, --cabsonly, --printProtos) bypasses the caches *)
+let parseDigest (fname: string) : string option =
+  if fname = "-" || !patchFileName <> ""
+      || not (isNone !out) || !doPrintProtos then
+    None
+  else
+    try Some (Digest.to_hex (Digest.file fname))
+    with Sys_error _ -> None
+
+(* The on-disk cache entry for the given digest, or None when the
+ * on-disk cache is disabled *)
+let parseCacheEntryOfDigest (digest: string) : string option =
+  if !parseCacheDir = "" then None
+  else Some (Filename.concat !parseCacheDir (digest ^ ".cilb"))
+
+let loadCachedParse (fname: string) (entry: string) : Cil.file option =
+  if not (Sys.file_exists entry) then None
+  else begin
+    (* Cil.loadBinaryFile reports a bad entry through Errormsg; remember
+     * the error state so that a recovered miss does not count as a
+     * parse error *)
+    let hadErrors = !E.hadErrors in
+    try
+      if !E.verboseFlag then
+        ignore (E.log "Frontc: loading %s from the parse cache\n" fname);
+      let file = Stats.time "parse cache" Cil.loadBinaryFile entry in
+      (* The ids in the entry were allocated by the process that wrote
+       * it *)
+      renumberIds file;
+      Some file
+    with e ->
+      E.hadErrors := hadErrors;
+      ignore (E.warn "Ignoring parse cache entry %s: %s"
+                entry (Printexc.to_string e));
+      None
+  end
+
+(* The in-process layer of the parse cache: digest of the preprocessed
+ * input -> marshaled elaborated file. A build that elaborates the same
+ * preprocessed bytes twice in one process (generated headers, repeated
+ * library calls to parse) gets the second elaboration for the cost of
+ * an unmarshal plus renumbering. The file is marshaled at store time,
+ * before the caller can mutate it, and every reuse unmarshals a fresh
+ * copy so callers never alias each other's trees *)
+let memParseCache : (string, string) Hashtbl.t = Hashtbl.create 17
+
+let loadMemCachedParse (digest: string) : Cil.file option =
+  if not !parseCacheMem then None
+  else
+    try
+      let bytes = Hashtbl.find memParseCache digest in
+      if !E.verboseFlag then
+        ignore (E.log "Frontc: reusing the in-memory parse cache entry %s\n"
+                  digest);
+      let file : Cil.file = Marshal.from_string bytes 0 in
+      (* The ids in the entry were allocated for another Cil.file *)
+      renumberIds file;
+      Some file
+    with Not_found -> None
+
+let storeMemCachedParse (digest: string) (cil: Cil.file) : unit =
+  if !parseCacheMem && not (Hashtbl.mem memParseCache digest) then
+    Hashtbl.replace memParseCache digest (Marshal.to_string cil [])
+
+let storeCachedParse (entry: string) (cil: Cil.file) : unit =
+  try
+    (* Write under a temporary name first, so that a concurrent build
+     * never sees a partial entry *)
+    let tmp = entry ^ "." ^ string_of_int (Unix.getpid ()) ^ ".tmp" in
+    Cil.saveBinaryFile cil tmp;
+    Sys.rename tmp entry
+  with e ->
+    ignore (E.warn "Cannot write parse cache entry %s: %s"
+              entry (Printexc.to_string e))
+
+(* Elaborate the definitions one at a time. Nothing holds on to the
+ * head of the definition list, so each Cabs definition becomes garbage
+ * as soon as it has been elaborated and peak memory holds one full AST
+ * instead of two *)
+let convStreaming ((fname, dl): Cabs.file) : Cil.file =
+  Cabs2cil.initConvFile ();
+  List.iter Cabs2cil.convOneGlobal dl;
+  Cabs2cil.finishConvFile fname
+
+(* Like parse_helper, for callers that want only the Cil.file and thus
+ * have no use for the Cabs tree once it is elaborated *)
+let parse_uncached (fname: string) : Cil.file =
+  if !doPrintProtos then
+    (* printPrototypes needs the whole Cabs tree *)
+    snd (parse_helper fname ())
+  else
+    inAllocPhase
+      (fun () ->
+        (trace "sm" (dprintf "parsing %s to Cabs\n" fname));
+        let cabs = parse_to_cabs fname in
+        (trace "sm" (dprintf "converting %s from Cabs to CIL\n" fname));
+        Stats.time "convert to CIL" convStreaming cabs)
+
+let parse fname =
+  (fun () ->
+    if !parseCacheDir = "" && not !parseCacheMem then parse_uncached fname
+    else match parseDigest fname with
+      None -> parse_uncached fname
+    | Some digest -> begin
+        match loadMemCachedParse digest with
+          Some cil -> cil
+        | None ->
+            let cil =
+              match parseCacheEntryOfDigest digest with
+                Some entry -> begin
+                  match loadCachedParse fname entry with
+                    Some cil -> cil
+                  | None ->
+                      let cil = parse_uncached fname in
+                      storeCachedParse entry cil;
+                      cil
+                end
+              | None -> parse_uncached fname
+            in
+            storeMemCachedParse digest cil;
+            cil
+      end)
 
 let parse_with_cabs fname = (fun () -> parse_helper fname ())
+
+(*
+** Parallel parsing. The lexer, the parser and cabs2cil all keep their
+** state in globals, so we cannot elaborate two translation units inside
+** one process. Instead we fork one worker per file (at most
+** !parallelJobs at a time); the parent returns the files in the order
+** the names were given.
+**
+** Results come back one of two ways. When a memory-backed directory is
+** available (see shmTransferDir) each worker encodes its file in the
+** compact binary format (Cil.saveBinaryFile) into a scratch file
+** there, and only signals success or failure over the pipe; the parent
+** then decodes the segment with lazy function bodies, so a body costs
+** nothing until something touches it. The compact encoding is several
+** times smaller than a marshaled heap image and nothing large streams
+** through the pipe. When no such directory exists the worker marshals
+** the whole Cil.file over the pipe, as before.
+*)
+
+let shmAvailable () : bool =
+  !shmTransferDir <> ""
+  && (try Sys.is_directory !shmTransferDir with Sys_error _ -> false)
+
+let shmSeq : int ref = ref 0
+
+(* What a worker reports over the pipe: the file itself on the marshal
+ * path, nothing on the shm path (the segment name was chosen by the
+ * parent before the fork), or a failure message *)
+type parseWorkerReply = (Cil.file option, string) result
+
+(* Run one worker for fname. Returns the pid, the read side of the
+ * pipe, and the name of the result segment on the shm path *)
+let forkParseWorker (fname: string) : int * Unix.file_descr * string option =
+  let shmFile =
+    if shmAvailable () then begin
+      incr shmSeq;
+      Some (Filename.concat !shmTransferDir
+              (Printf.sprintf "cil-fe-%d-%d.cilb"
+                 (Unix.getpid ()) !shmSeq))
+    end else
+      None
+  in
+  let (rd, wr) = Unix.pipe () in
+  match Unix.fork () with
+  | 0 -> begin (* child *)
+      Unix.close rd;
+      let result : parseWorkerReply =
+        try
+          let cil = parse fname () in
+          match shmFile with
+            Some sf -> Cil.saveBinaryFile cil sf; Ok None
+          | None -> Ok (Some cil)
+        with
+        | ParseError msg -> Error msg
+        | e -> Error (Printexc.to_string e)
+      in
+      let oc = Unix.out_channel_of_descr wr in
+      Marshal.to_channel oc (result: parseWorkerReply) [];
+      flush oc;
+      (* Do not run at_exit handlers of the parent in the child *)
+      Unix.close wr;
+      exit 0
+    end
+  | pid ->
+      Unix.close wr;
+      (pid, rd, shmFile)
+
+(* Collect the answer of one worker. The returned file already has
+ * fresh ids, whichever path it came back on *)
+let joinParseWorker (fname: string)
+    ((pid, rd, shmFile): int * Unix.file_descr * string option)
+    : Cil.file =
+  let ic = Unix.in_channel_of_descr rd in
+  let result : parseWorkerReply =
+    try Marshal.from_channel ic
+    with End_of_file ->
+      Error ("worker for " ^ fname ^ " died without producing a result")
+  in
+  close_in ic;  (* closes rd as well *)
+  let (_, status) = Unix.waitpid [] pid in
+  (match status with
+     Unix.WEXITED 0 -> ()
+   | _ -> ignore (E.log "Warning: parse worker for %s exited abnormally\n"
+                    fname));
+  let removeSegment () =
+    match shmFile with
+      Some sf -> (try Sys.remove sf with Sys_error _ -> ())
+    | None -> ()
+  in
+  match result with
+  | Ok None -> begin
+      match shmFile with
+        Some sf ->
+          let file =
+            try Cil.loadBinaryFileLazyRenumber sf
+            with e -> removeSegment (); raise e
+          in
+          removeSegment ();
+          file
+      | None ->
+          raise (ParseError ("worker for " ^ fname
+                             ^ " sent an empty result"))
+    end
+  | Ok (Some file) ->
+      renumberIds file;
+      file
+  | Error msg ->
+      removeSegment ();
+      raise (ParseError msg)
+
+(* Parse and elaborate the given files, running up to !parallelJobs
+ * workers concurrently. Falls back to sequential parsing when only one
+ * job is requested. *)
+let parse_parallel (fnames: string list) : Cil.file list =
+  let jobs = max 1 !parallelJobs in
+  if jobs = 1 || List.length fnames <= 1 then
+    List.map (fun fn -> parse fn ()) fnames
+  else begin
+    if !E.verboseFlag then
+      ignore (E.log "Frontc: parsing %d files with %d workers\n"
+                (List.length fnames) jobs);
+    (* Keep a window of at most jobs running workers; join them in issue
+     * order, which is also the order in which we must return results *)
+    let results : Cil.file list ref = ref [] in
+    let pending
+        : (string * (int * Unix.file_descr * string option)) Queue.t =
+      Queue.create () in
+    let join_one () =
+      let (fn, w) = Queue.pop pending in
+      (* joinParseWorker renumbers the ids itself *)
+      let file = joinParseWorker fn w in
+      results := file :: !results
+    in
+    List.iter
+      (fun fn ->
+        if Queue.length pending >= jobs then join_one ();
+        Queue.push (fn, forkParseWorker fn) pending)
+      fnames;
+    while not (Queue.is_empty pending) do join_one () done;
+    List.rev !results
+  end
@@ -54,3 +54,39 @@ val args: (string * Arg.spec * string) list
 val parse: string -> (unit -> Cil.file)
 
 val parse_with_cabs: string -> (unit -> Cabs.file * Cil.file)
+
+    (* how many translation units parse_parallel may process
+     * concurrently (also settable with --parseJobs) *)
+val parallelJobs: int ref
+
+    (* where the parse workers put their result segments, normally a
+     * memory-backed filesystem; the workers encode their files there in
+     * the compact binary format and the parent decodes them with lazy
+     * function bodies. The empty string, or a directory that does not
+     * exist, makes the workers marshal their results over the pipe
+     * instead (also settable with --parseShmDir) *)
+val shmTransferDir: string ref
+
+    (* directory in which parse keeps elaborated files in binary form,
+     * keyed by the digest of the preprocessed input (also settable with
+     * --parseCacheDir). The empty string disables the cache. *)
+val parseCacheDir: string ref
+
+    (* when true, parse also keeps elaborated files marshaled in
+     * memory under the same digests, so one process never elaborates
+     * identical preprocessed input twice (also settable with
+     * --parseCacheMem). Trades memory for front-end CPU. *)
+val parseCacheMem: bool ref
+
+    (* when true, parsing a file also writes a <file>.deps manifest
+     * beside it: one line per source file contributing to the
+     * translation unit, as collected from the # line markers, with
+     * its digest (also settable with --parseDeps). Cache layers keyed
+     * on the original sources can check staleness against it without
+     * re-preprocessing. *)
+val emitDepsManifest: bool ref
+
+    (* parse and elaborate several files, forking up to !parallelJobs
+     * worker processes. The results come back in the order in which the
+     * file names were given. *)
+val parse_parallel: string list -> Cil.file list
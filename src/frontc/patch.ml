@@ -331,6 +331,58 @@ end
 let gettime () : float =
   (Unix.times ()).Unix.tms_utime
 
+(* Decide once, for each patch entry, which definitions it could
+ * possibly match: the root constructor of its pattern and, when the
+ * pattern fixes it, the name of the first declarator. unifyDefn pairs
+ * the first declarator of the pattern with the first declarator of the
+ * target and concrete names must be equal, so a definition with a
+ * different constructor or a different leading name can be skipped
+ * without attempting the unification at all. Patch files are large and
+ * this turns the all-pairs walk below into a cheap constructor
+ * comparison for almost every pair. *)
+type defnFilter =
+  | FAlways                         (* always attempt this entry *)
+  | FNever                          (* this entry never matches *)
+  | FDecDef of string option        (* DECDEF, and the concrete name of
+                                     * the first declarator if the
+                                     * pattern has one *)
+  | FTypedef of string option
+  | FOnlyTypedef
+
+let defnFilter (patd : definition) : defnFilter =
+begin
+  match patd with
+  | TRANSFORMER(srcpattern, _, _) -> (
+      match srcpattern with
+      | DECDEF((_, ((n, _, _, _), _) :: _), _) ->
+          FDecDef (if isPatternVar n then None else Some n)
+      | DECDEF(_, _) -> FDecDef None
+      | TYPEDEF((_, (n, _, _, _) :: _), _) ->
+          FTypedef (if isPatternVar n then None else Some n)
+      | TYPEDEF(_, _) -> FTypedef None
+      | ONLYTYPEDEF(_, _) -> FOnlyTypedef
+      | _ -> FNever     (* unifyDefn matches only the three kinds above *)
+    )
+  | EXPRTRANSFORMER(_, _, _) -> FAlways
+  | _ -> FNever         (* not a transformer *)
+end
+
+(* can this filter possibly accept the definition? *)
+let filterAccepts (f : defnFilter) (d : definition) : bool =
+begin
+  match f, d with
+  | FAlways, _ -> true
+  | FNever, _ -> false
+  | FDecDef None, DECDEF(_, _) -> true
+  | FDecDef (Some n), DECDEF((_, ((tn, _, _, _), _) :: _), _) -> tn = n
+  | FDecDef _, _ -> false
+  | FTypedef None, TYPEDEF(_, _) -> true
+  | FTypedef (Some n), TYPEDEF((_, (tn, _, _, _) :: _), _) -> tn = n
+  | FTypedef _, _ -> false
+  | FOnlyTypedef, ONLYTYPEDEF(_, _) -> true
+  | FOnlyTypedef, _ -> false
+end
+
 let rec applyPatch (patchFile : file) (srcFile : file) : file =
 begin
   let patch : definition list = (snd patchFile) in
@@ -345,11 +397,58 @@ begin
   (* more hackery *)
   unifyExprFwd := unifyExpr;
 
+  (* pair each patch entry with its prefilter, once *)
+  let fpatch : (defnFilter * definition) list =
+    (Util.list_map (fun pd -> ((defnFilter pd), pd)) patch) in
+
+  (* Aggregate the per-entry filters into one whole-patch summary: the
+   * set of leading declarator names the patch can affect, per target
+   * constructor. When every DECDEF entry fixes a concrete name, a
+   * DECDEF whose own leading name is not in the table cannot match any
+   * entry and is passed through without walking the entry list at all;
+   * likewise for TYPEDEFs. Expression transformers can fire anywhere
+   * and disable the short-circuit. *)
+  let decdefNames : (string, unit) Hashtbl.t = Hashtbl.create 17 in
+  let typedefNames : (string, unit) Hashtbl.t = Hashtbl.create 17 in
+  let anyAlways = ref false in
+  let anyDecDefWild = ref false in
+  let anyTypedefWild = ref false in
+  let anyOnlyTypedef = ref false in
+  (List.iter
+    (fun (f, _) -> match f with
+      | FAlways -> anyAlways := true
+      | FNever -> ()
+      | FDecDef None -> anyDecDefWild := true
+      | FDecDef (Some n) -> Hashtbl.replace decdefNames n ()
+      | FTypedef None -> anyTypedefWild := true
+      | FTypedef (Some n) -> Hashtbl.replace typedefNames n ()
+      | FOnlyTypedef -> anyOnlyTypedef := true)
+    fpatch);
+
+  (* can any entry in the patch possibly affect this definition? *)
+  let patchCanAffect (d : definition) : bool =
+    !anyAlways ||
+    (match d with
+     | DECDEF((_, ((n, _, _, _), _) :: _), _) ->
+         !anyDecDefWild || (Hashtbl.mem decdefNames n)
+     | DECDEF(_, _) -> !anyDecDefWild
+     | TYPEDEF((_, (n, _, _, _) :: _), _) ->
+         !anyTypedefWild || (Hashtbl.mem typedefNames n)
+     | TYPEDEF(_, _) -> !anyTypedefWild
+     | ONLYTYPEDEF(_, _) -> !anyOnlyTypedef
+     | _ -> false)
+  in
+
   (* patch a single source definition, yield transformed *)
-  let rec patchDefn (patch : definition list) (d : definition) : definition list =
+  let rec patchDefn (patch : (defnFilter * definition) list)
+                    (d : definition) : definition list =
   begin
     match patch with
-    | TRANSFORMER(srcpattern, destpattern, loc) :: rest -> (
+    | (f, _) :: rest when not (filterAccepts f d) -> (
+        (* this entry cannot match 'd'; do not even try *)
+        (patchDefn rest d)
+      )
+    | (_, TRANSFORMER(srcpattern, destpattern, loc)) :: rest -> (
         if verbose then
           (trace "patchDebug"
             (dprintf "considering applying defn pattern at line %d to src at %a\n"
@@ -373,7 +472,7 @@ begin
         )
       )
 
-    | EXPRTRANSFORMER(srcpattern, destpattern, loc) :: rest -> (
+    | (_, EXPRTRANSFORMER(srcpattern, destpattern, loc)) :: rest -> (
         if verbose then
           (trace "patchDebug"
             (dprintf "considering applying expr pattern at line %d to src at %a\n"
@@ -406,7 +505,10 @@ begin
 
   (* transform all the definitions *)
   let result : definition list =
-    (List.flatten (Util.list_map (fun d -> (patchDefn patch d)) src)) in
+    (List.flatten
+      (Util.list_map
+        (fun d -> if (patchCanAffect d) then (patchDefn fpatch d) else [d])
+        src)) in
 
   (*Cprint.print_defs result;*)
 
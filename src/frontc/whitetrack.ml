@@ -9,15 +9,12 @@ open Cabshelper
 (* In particular, most of the tokens we hold will be
    header files that we don't need *)
 
-(* map cabslocs to token indexes *)
-
 (* TODO: gather until end of line, then decide where to split *)
 
 (* NOTE: If you find yourself getting lots of nomatch errors with
  * parens in them, then that may mean you are printing 
  * a cabs file that has had it's parens removed *)
 
-let tokenmap : ((string * int),int) Hashtbl.t = Hashtbl.create 1000
 let nextidx = ref 0
 
 let gonebad = ref false
@@ -25,6 +22,27 @@ let gonebad = ref false
 (* array of tokens and whitespace *)
 let tokens = GrowArray.make 0 (GrowArray.Elem  ("",""))
 
+(* Start offset of each token, in the order the lexer produced them. The
+ * lexer works through a single preprocessed buffer, so byteno
+ * (Lexing.lexeme_start) increases across the whole run regardless of
+ * which file a token came from, and the array is sorted; setLoc finds a
+ * token by binary search on its byteno *)
+let tokenoffs = GrowArray.make 0 (GrowArray.Elem 0)
+
+(* The index of the token starting at the given byte offset. Returns the
+ * rightmost match in case the lexer reported the same offset twice,
+ * matching the old hashtable behavior of finding the latest entry *)
+let findTokenIdx (byteno: int) : int =
+    let lo = ref 0 in
+    let hi = ref !nextidx in
+    while !hi - !lo > 1 do
+        let mid = (!lo + !hi) / 2 in
+        if GrowArray.getg tokenoffs mid <= byteno then lo := mid
+        else hi := mid
+    done;
+    if !nextidx > 0 && GrowArray.getg tokenoffs !lo = byteno then !lo
+    else raise Not_found
+
 let cabsloc_to_str cabsloc =
     cabsloc.filename ^ ":" ^ string_of_int cabsloc.lineno ^ ":" ^ 
     string_of_int cabsloc.byteno ^ ":" ^ 
@@ -35,7 +53,7 @@ let lastline = ref 0
 let wraplexer_enabled lexer lexbuf = 
     let white,lexeme,token,cabsloc = lexer lexbuf in
     GrowArray.setg tokens !nextidx (white,lexeme);
-    Hashtbl.add tokenmap (cabsloc.filename,cabsloc.byteno) !nextidx;
+    GrowArray.setg tokenoffs !nextidx cabsloc.byteno;
     nextidx := !nextidx + 1;
     token
 
@@ -46,28 +64,44 @@ let wraplexer_disabled lexer lexbuf =
 let enabled = ref false
 
 let wraplexer lexer =
-    if !enabled then wraplexer_enabled lexer 
+    if !enabled then begin
+        (* setLoc finds tokens by their byteno, so every token needs its
+         * own location record with an exact offset *)
+        Cabshelper.exactTokenLocations := true;
+        wraplexer_enabled lexer
+    end
     else wraplexer_disabled lexer
     
 let finalwhite = ref "\n"    
     
 let setFinalWhite w = finalwhite := w 
     
-let curidx = ref 0  
-let noidx = -1  
+let curidx = ref 0
+let noidx = -1
 let out = ref stdout
-    
+
+(* The tokens are tiny, so we batch them in a buffer instead of writing
+ * each one to the channel; the buffer is drained by flushOutput, which
+ * runs when the output channel changes, at the end of the file, and
+ * from Cprint.flush *)
+let outbuf = Buffer.create 65536
+
+let flushOutput () =
+    Buffer.output_buffer !out outbuf;
+    Buffer.clear outbuf
+
 let setLoc cabsloc =
     if cabsloc != cabslu && !enabled then begin
-        try 
-            curidx := Hashtbl.find tokenmap (cabsloc.filename,cabsloc.byteno)
+        try
+            curidx := findTokenIdx cabsloc.byteno
         with
-            Not_found -> Errormsg.s 
+            Not_found -> Errormsg.s
                 (Errormsg.error "setLoc with location for non-lexed token: %s"
-                    (cabsloc_to_str cabsloc)) 
+                    (cabsloc_to_str cabsloc))
     end else begin curidx := noidx; () end
-    
-let setOutput out_chan = 
+
+let setOutput out_chan =
+    flushOutput ();
     out := out_chan
 
 let getOutput () = !out
@@ -75,35 +109,39 @@ let getOutput () = !out
 (* TODO: do this properly *)
 let invent_white () = " "
 
-let rec chopwhite str =
-    if String.length str = 0 then str 
-    else if String.get str (String.length str - 1) = ' ' then
-        chopwhite (String.sub str 0 (String.length str - 1))
-    else if String.get str 0 = ' ' then
-        chopwhite (String.sub str 1 (String.length str - 1)) 
-    else str
-    
-let last_was_maybe = ref false    
+(* trim the spaces at either end, allocating only when there are any *)
+let chopwhite str =
+    let n = String.length str in
+    let b = ref 0 in
+    let e = ref n in
+    while !b < !e && String.get str !b = ' ' do incr b done;
+    while !e > !b && String.get str (!e - 1) = ' ' do decr e done;
+    if !b = 0 && !e = n then str
+    else String.sub str !b (!e - !b)
+
+let last_was_maybe = ref false
 let last_str = ref ""
-    
+
 let print str =
     let str = chopwhite str in
     if str = "" then ()
-    else if !curidx == noidx || not !enabled then 
-        output_string !out (invent_white() ^ str) 
-    else begin
+    else if !curidx == noidx || not !enabled then begin
+        Buffer.add_string outbuf (invent_white ());
+        Buffer.add_string outbuf str
+    end else begin
         let srcwhite,srctok = GrowArray.getg tokens !curidx in
-        let white = if str = srctok 
+        let white = if str = srctok
             then srcwhite
             else if !gonebad then invent_white ()
-            else begin                
-                ignore (Errormsg.warnOpt "%s" ("nomatch:["^String.escaped str^"] expected:["^String.escaped srctok ^ 
+            else begin
+                ignore (Errormsg.warnOpt "%s" ("nomatch:["^String.escaped str^"] expected:["^String.escaped srctok ^
                     "] - NOTE: cpp not supported"));
                 gonebad := true;
                 invent_white ()
             end in
         if !last_was_maybe && str = !last_str then () else begin
-            output_string !out (white ^ str);
+            Buffer.add_string outbuf white;
+            Buffer.add_string outbuf str;
             curidx := !curidx + 1
         end
     end;
@@ -136,6 +174,8 @@ let print_maybe str =
         end else ()
 
 
-let printEOF () = output_string !out !finalwhite
+let printEOF () =
+    Buffer.add_string outbuf !finalwhite;
+    flushOutput ()
 
 
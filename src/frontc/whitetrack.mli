@@ -19,5 +19,9 @@ val setLoc : Cabs.cabsloc -> unit
 val setOutput : out_channel -> unit
 val getOutput : unit -> out_channel
 
+(* drain the internal print buffer to the output channel. Call this
+ * before writing to the channel directly *)
+val flushOutput : unit -> unit
+
 (* is whitespace tracking enabled *)
 val enabled : bool ref
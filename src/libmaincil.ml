@@ -96,11 +96,112 @@ let getDummyTypes () : typ * typ =
   ( TPtr(TVoid [], []), TInt(IInt, []) )
 ;;
 
+(* HANDLE-BASED EMBEDDING API. A long-running client parses once and
+ * keeps the result behind a small integer handle, then walks and
+ * renders individual globals through the handle, instead of having a
+ * whole rendered file marshaled across the boundary on every call.
+ * The handle table also keeps the file alive, since the OCaml GC does
+ * not see roots held in the client's heap. *)
+
+type cilHandle = {
+    hfile: file;
+    hglobals: global array;     (* the globals, indexable in O(1) *)
+  }
+
+let handles : (int, cilHandle) Hashtbl.t = Hashtbl.create 7
+let nextHandle = ref 1
+
+let getHandle (h: int) : cilHandle =
+  try Hashtbl.find handles h
+  with Not_found -> E.s (E.bug "libmaincil: unknown CIL handle %d" h)
+;;
+
+(* parse a C file, unroll its typedefs as parseOneFile does, and return
+ * a handle to the result *)
+let parseToHandle (fname: string) : int =
+  let ast = parseOneFile fname in
+  let h = !nextHandle in
+  incr nextHandle;
+  Hashtbl.add handles h { hfile = ast;
+                          hglobals = Array.of_list ast.globals };
+  h
+;;
+
+(* drop a handle; the file becomes collectable unless the client still
+ * holds other roots into it *)
+let releaseHandle (h: int) : unit =
+  Hashtbl.remove handles h
+;;
+
+let numGlobals (h: int) : int =
+  Array.length (getHandle h).hglobals
+;;
+
+let handleFileName (h: int) : string =
+  (getHandle h).hfile.fileName
+;;
+
+(* a small integer tag for the kind of a global, in the order of the
+ * constructors of Cil.global *)
+let globalKind (h: int) (i: int) : int =
+  match (getHandle h).hglobals.(i) with
+    GType _ -> 0
+  | GCompTag _ -> 1
+  | GCompTagDecl _ -> 2
+  | GEnumTag _ -> 3
+  | GEnumTagDecl _ -> 4
+  | GVarDecl _ -> 5
+  | GVar _ -> 6
+  | GFun _ -> 7
+  | GAsm _ -> 8
+  | GPragma _ -> 9
+  | GText _ -> 10
+;;
+
+(* the name a global defines or declares; the canonical string itself,
+ * not a copy, so iterating the names allocates nothing *)
+let globalName (h: int) (i: int) : string =
+  match (getHandle h).hglobals.(i) with
+    GType (ti, _) -> ti.tname
+  | GCompTag (ci, _) | GCompTagDecl (ci, _) -> ci.cname
+  | GEnumTag (ei, _) | GEnumTagDecl (ei, _) -> ei.ename
+  | GVarDecl (vi, _) | GVar (vi, _, _) -> vi.vname
+  | GFun (fd, _) -> fd.svar.vname
+  | GAsm _ | GPragma _ | GText _ -> ""
+;;
+
+(* scratch for renderGlobal, reused across calls so a render allocates
+ * only what the printer itself needs *)
+let renderBuf = Buffer.create 65536
+
+(* render the i-th global of a handle into the caller-provided buffer.
+ * Returns the number of bytes written, or the negated number of bytes
+ * needed when the buffer is too small; nothing is written in that
+ * case, so the caller can retry with a larger buffer. *)
+let renderGlobal (h: int) (i: int) (buf: Bytes.t) : int =
+  Buffer.clear renderBuf;
+  Pretty.bprint renderBuf ~width:80 (d_global () (getHandle h).hglobals.(i));
+  let n = Buffer.length renderBuf in
+  if n > Bytes.length buf then (- n)
+  else begin
+    Buffer.blit renderBuf 0 buf 0 n;
+    n
+  end
+;;
+
 (* register some functions - these may be called from C code *)
 Callback.register "cil_parse" parseOneFile;
 Callback.register "cil_unparse" unparseToStdout;
 (* Callback.register "unroll_type_deep" unrollTypeDeep; *)
 Callback.register "get_dummy_types" getDummyTypes;
+(* the handle-based API *)
+Callback.register "cil_parse_handle" parseToHandle;
+Callback.register "cil_release_handle" releaseHandle;
+Callback.register "cil_num_globals" numGlobals;
+Callback.register "cil_file_name" handleFileName;
+Callback.register "cil_global_kind" globalKind;
+Callback.register "cil_global_name" globalName;
+Callback.register "cil_render_global" renderGlobal;
 
 (* initialize CIL *)
 initCIL ();
@@ -44,7 +44,86 @@ let getAlignof = getNthInt 1
 
 let respace = Str.global_replace (Str.regexp "_") " "
 
-let modelParse (s:string) : mach = 
+(* Deriving a machine model dynamically means compiling and running the
+   machdep probe (machdep-ml.c) with the target compiler -- an external
+   compiler round-trip on every CIL invocation. Cache the probe's
+   specification string on disk, keyed by the compiler path, its version
+   banner and the target flags, so only the first run of a given
+   configuration pays for the probe. *)
+
+(* Run a command, returning its standard output when it exits cleanly *)
+let commandOutput (cmd: string) : string option =
+  let ic = Unix.open_process_in cmd in
+  let buf = Buffer.create 1024 in
+  (try
+    while true do
+      Buffer.add_string buf (input_line ic);
+      Buffer.add_char buf '\n'
+    done
+  with End_of_file -> ());
+  match Unix.close_process_in ic with
+  | Unix.WEXITED 0 -> Some (Buffer.contents buf)
+  | _ -> None
+
+let probeCacheDir () : string =
+  try Sys.getenv "CIL_MACHDEP_CACHE"
+  with Not_found ->
+    try Filename.concat (Sys.getenv "HOME") ".cil-machdep-cache"
+    with Not_found ->
+      Filename.concat (Filename.get_temp_dir_name ()) "cil-machdep-cache"
+
+(* The machine model specification string for this compiler, flags and
+   probe source, from the cache when possible *)
+let probeModelString (cc: string) (flags: string list)
+    (probeSource: string) : string =
+  let version =
+    match commandOutput (Filename.quote cc ^ " --version 2>/dev/null") with
+      Some s -> s
+    | None -> ""
+  in
+  let key =
+    Digest.to_hex
+      (Digest.string
+         (String.concat "\000" (cc :: version :: probeSource :: flags)))
+  in
+  let dir = probeCacheDir () in
+  let cacheFile = Filename.concat dir ("machdep-" ^ key) in
+  if Sys.file_exists cacheFile then begin
+    let ic = open_in cacheFile in
+    let spec = input_line ic in
+    close_in ic;
+    spec
+  end
+  else begin
+    let exe = Filename.temp_file "cilmachdep" ".exe" in
+    let cmd =
+      String.concat " "
+        (Filename.quote cc :: flags
+         @ ["-o"; Filename.quote exe; Filename.quote probeSource])
+    in
+    if Sys.command cmd <> 0 then
+      raise (Failure ("cannot compile the machine model probe: " ^ cmd));
+    let spec =
+      match commandOutput (Filename.quote exe ^ " --env 2>/dev/null") with
+        Some s -> String.trim s
+      | None -> raise (Failure "the machine model probe failed to run")
+    in
+    (try Sys.remove exe with Sys_error _ -> ());
+    (* fill the cache; write-then-rename keeps concurrent runs from
+       seeing a partial entry, and a failure here only costs the reuse *)
+    (try
+      if not (Sys.file_exists dir) then Unix.mkdir dir 0o755;
+      let tmp = Filename.temp_file ~temp_dir:dir "machdep" ".tmp" in
+      let oc = open_out tmp in
+      output_string oc spec;
+      output_char oc '\n';
+      close_out oc;
+      Sys.rename tmp cacheFile
+    with Unix.Unix_error _ | Sys_error _ -> ());
+    spec
+  end
+
+let modelParse (s:string) : mach =
   let entries =
     try
       preparse s 
@@ -94,3 +173,9 @@ let modelParse (s:string) : mach =
     __thread_is_keyword = getBool entries "__thread_is_keyword";
     __builtin_va_list = getBool entries "__builtin_va_list";
   }
+
+(* The machine model of the given compiler and target flags, probed at
+   most once per configuration *)
+let modelFromCompiler (cc: string) (flags: string list)
+    (probeSource: string) : mach =
+  modelParse (probeModelString cc flags probeSource)
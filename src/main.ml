@@ -52,9 +52,29 @@ type outfile =
       fchan: out_channel }
 let outChannel : outfile option ref = ref None
 let mergedChannel : outfile option ref = ref None
+(* Emit the output with declarations grouped before definitions *)
+let groupedOutput = ref false
+(* Render the output with this many forked printing workers *)
+let dumpJobs = ref 1
+(* Renumber the ids of the final file densely before the features run *)
+let compactIds = ref false
+
+(* The printing entry point, honoring --dumpJobs and --groupedOutput *)
+let dumpFile pp chan name cil =
+  if !dumpJobs > 1 then C.dumpFileParallel pp chan name cil !dumpJobs
+  else if !groupedOutput then C.dumpFileGrouped pp chan name cil
+  else C.dumpFile pp chan name cil
 
 
 let parseOneFile (fname: string) : C.file =
+  (* Inputs in the compact binary format (saved by an earlier run with
+   * --binout, e.g. the compile step of cilly --merge --bincil) are
+   * loaded outright; they were elaborated and pruned already *)
+  if Filename.check_suffix fname ".cilb" then begin
+    if !Cilutil.printStages then ignore (E.log "Loading %s\n" fname);
+    C.loadBinaryFileRenumber fname
+  end
+  else begin
   (* PARSE and convert to CIL *)
   if !Cilutil.printStages then ignore (E.log "Parsing %s\n" fname);
   let cil = F.parse fname () in
@@ -66,13 +86,67 @@ let parseOneFile (fname: string) : C.file =
     (Rmtmps.removeUnusedTemps cil)
   );
   cil
+  end
+
+(* INCREMENTAL MERGING. With --mergeCache <dir> the elaborated AST of
+ * every translation unit is kept in the cache directory in binary form,
+ * keyed by the digest of the (preprocessed) source, and the merged
+ * result is kept keyed by the digest vector of all the inputs. A
+ * re-merge where few inputs changed then re-parses only the changed
+ * files, and one where nothing changed loads the previous result
+ * outright. *)
+let mergeCacheDir : string ref = ref ""
+
+(* With --binout <file> the processed file is also saved in the compact
+ * binary format, so a later run can take it as an input and skip the
+ * whole parse *)
+let binOutName : string ref = ref ""
+
+(* Save a binary AST under a cache path, through a temporary so that an
+ * interrupted run never leaves a torn cache entry *)
+let saveCached (cil: C.file) (cfile: string) : unit =
+  try
+    let tmp = cfile ^ "." ^ string_of_int (Unix.getpid ()) ^ ".tmp" in
+    C.saveBinaryFile cil tmp;
+    Sys.rename tmp cfile
+  with Sys_error _ | Unix.Unix_error _ ->
+    () (* an unwritable cache only costs time *)
+
+(* Parse one file through the merge cache. Loaded ASTs get fresh ids,
+ * since every cached file was saved with its own counters *)
+let cachedParse (fname: string) : C.file =
+  if Filename.check_suffix fname ".cilb" then
+    (* already a binary artifact; nothing to gain from caching it *)
+    parseOneFile fname
+  else
+  let digest = Digest.to_hex (Digest.file fname) in
+  let cfile = Filename.concat !mergeCacheDir ("tu-" ^ digest ^ ".cilb") in
+  if Sys.file_exists cfile then begin
+    if !Cilutil.printStages then
+      ignore (E.log "Loading cached AST of %s\n" fname);
+    C.loadBinaryFileRenumber cfile
+  end
+  else begin
+    let cil = parseOneFile fname in
+    if not !E.hadErrors then saveCached cil cfile;
+    cil
+  end
 
 let processOneFile (cil: C.file) =
   begin
 
+    (* Run the consistency check, over several worker processes when
+     * --parallel asks for them *)
+    let runCheck (flags: CK.checkFlags list) : bool =
+      if !Fe.parallelJobs > 1 then
+        CK.checkFileParallel !Fe.parallelJobs flags cil
+      else
+        CK.checkFile flags cil
+    in
+
     if !Cilutil.doCheck then begin
       ignore (E.log "First CIL check\n");
-      if not (CK.checkFile [] cil) && !Cilutil.strictChecking then begin
+      if not (runCheck []) && !Cilutil.strictChecking then begin
         E.bug ("CIL's internal data structures are inconsistent "
                ^^"(see the warnings above).  This may be a bug "
                ^^"in CIL.\n")
@@ -87,13 +161,23 @@ let processOneFile (cil: C.file) =
           if !E.verboseFlag then
             ignore (E.log "Running CIL feature %s (%s)\n"
                       fdesc.Fe.fd_name fdesc.Fe.fd_description);
-          (* Run the feature, and see how long it takes. *)
+          (* Run the set-up the feature deferred out of its module
+           * initializer, if any *)
+          Fe.initializeFeature fdesc;
+          (* Run the feature, and see how long it takes. Function-local
+           * features may be spread over several worker processes. *)
           Stats.time fdesc.Fe.fd_name
-            fdesc.Fe.fd_doit cil;
+            (if !Fe.parallelJobs > 1 && Fe.isFunctionParallel fdesc
+             then Fe.runFunctionParallel fdesc
+             else fdesc.Fe.fd_doit) cil;
           (* See if we need to do some checking *)
           if !Cilutil.doCheck && fdesc.Fe.fd_post_check then begin
             ignore (E.log "CIL check after %s\n" fdesc.Fe.fd_name);
-            if not (CK.checkFile [] cil) && !Cilutil.strictChecking then begin
+            (* If the feature told us which functions it changed, only
+             * their bodies need re-checking *)
+            let flags =
+              if CK.anyReportedModified () then [CK.OnlyModified] else [] in
+            if not (runCheck flags) && !Cilutil.strictChecking then begin
               E.error ("Feature \"%s\" left CIL's internal data "
                        ^^"structures in an inconsistent state. "
                        ^^"(See the warnings above)") fdesc.Fe.fd_name
@@ -106,13 +190,76 @@ let processOneFile (cil: C.file) =
     (match !outChannel with
       None -> ()
     | Some c -> Stats.time "printCIL"
-	(C.dumpFile (!C.printerForMaincil) c.fchan c.fname) cil);
+	(dumpFile (!C.printerForMaincil) c.fchan c.fname) cil);
+
+    if !binOutName <> "" then begin
+      try Stats.time "saveBinary" (C.saveBinaryFile cil) !binOutName
+      with Sys_error msg ->
+        E.s (E.error "Cannot write binary output %s: %s" !binOutName msg)
+    end;
 
     if !E.hadErrors then
       E.s (E.error "Error while processing file; see above for details.");
 
   end
 
+(***** SERVER MODE *****)
+
+(* Process jobs over a Unix domain socket from a single persistent
+ * process, so that initCIL, machdep setup and feature loading are paid
+ * once per build instead of once per file. A job is two lines: the
+ * source file to process and the output file (an empty line for no
+ * output). Diagnostics are echoed back over the connection, followed by
+ * a final "CILLY-STATUS: <code>" line (0 = success). The features and
+ * options given on the server's command line apply to every job. *)
+let serverSocket : string ref = ref ""
+
+let runServer (sockname: string) : unit =
+  (* a client that hangs up early must not kill the server *)
+  Sys.set_signal Sys.sigpipe Sys.Signal_ignore;
+  if Sys.file_exists sockname then Sys.remove sockname;
+  let sock = Unix.socket Unix.PF_UNIX Unix.SOCK_STREAM 0 in
+  Unix.bind sock (Unix.ADDR_UNIX sockname);
+  Unix.listen sock 8;
+  ignore (E.log "cilly server listening on %s\n" sockname);
+  let processJob (conn: Unix.file_descr) : unit =
+    let inc = Unix.in_channel_of_descr conn in
+    let outc = Unix.out_channel_of_descr conn in
+    let oldLog = !E.logChannel in
+    let finishJob (code: int) : unit =
+      E.logChannel := oldLog;
+      (match !outChannel with
+        Some c -> (try close_out c.fchan with _ -> ()); outChannel := None
+      | None -> ());
+      (try
+        Printf.fprintf outc "CILLY-STATUS: %d\n" code;
+        flush outc
+      with _ -> ());
+      (try close_out outc with _ -> ())
+    in
+    try
+      let srcname = input_line inc in
+      let dstname = input_line inc in
+      E.hadErrors := false;
+      E.logChannel := outc;
+      if dstname <> "" then
+        outChannel := Some { fname = dstname; fchan = open_out dstname };
+      let cil = parseOneFile srcname in
+      processOneFile cil;
+      finishJob (if !E.hadErrors then 1 else 0)
+    with
+      End_of_file -> finishJob 2 (* malformed job *)
+    | F.CabsOnly -> finishJob 0
+    | E.Error -> finishJob 1
+    | e ->
+        ignore (E.log "Server: exception %s\n" (Printexc.to_string e));
+        finishJob 1
+  in
+  while true do
+    let (conn, _) = Unix.accept sock in
+    processJob conn
+  done
+
 (***** MAIN *****)
 let theMain () =
   let usageMsg = "Usage: cilly [options] source-files" in
@@ -173,6 +320,31 @@ let theMain () =
           "--mergedout", Arg.String (openFile "merged output"
                                        (fun oc -> mergedChannel := Some oc)),
               " specify the name of the merged file";
+          "--binout", Arg.String (fun s -> binOutName := s),
+              "<file> also save the processed file in the compact binary CIL format.\n\t\t\t\tA file ending in .cilb can be given back as an input later,\n\t\t\t\tskipping the parse (the cilly script uses this for --bincil)";
+          "--mergeCache", Arg.String (fun d -> mergeCacheDir := d),
+              "<dir> cache the binary ASTs of the inputs and the merged result in <dir>,\n\t\t\t\tkeyed by source digests, so a re-merge re-parses only changed files";
+          "--featureJobs", Arg.Int (fun n -> Fe.parallelJobs := n),
+              "<n> run function-parallel features with up to n worker processes";
+          "--fastprint", Arg.Unit (fun () ->
+                                     C.printerForMaincil := C.fastCilPrinter),
+              " print the output file with the direct-emission printer (faster, no pretty line breaking)";
+          "--groupedOutput", Arg.Set groupedOutput,
+              " emit types and declarations before all function and variable definitions.\n\t\t\t\tThe grouped form of a large merged file compiles faster downstream";
+          "--dumpJobs", Arg.Int (fun n -> dumpJobs := n),
+              "<n> print the output file with up to n forked workers, spliced in order.\n\t\t\t\tTakes precedence over --groupedOutput";
+          "--server", Arg.String (fun s -> serverSocket := s),
+              "<socket> run as a persistent server accepting file jobs on the given Unix domain socket";
+          "--compactIds", Arg.Set compactIds,
+              " renumber the variable ids and compinfo keys of the final (merged) file densely,\n\t\t\t\tso id-indexed tables in the features are sized by live ids only";
+          "--noGcTuning", Arg.Unit (fun () -> Cilgc.enabled := false),
+              " do not adjust the GC parameters per phase";
+          "--dedupWarnings", Arg.Unit (fun () -> E.dedupDiagnostics := true),
+              " print each distinct warning (same message, same location) once and report repeat\n\t\t\t\tcounts at exit";
+          "--perfCounters", Arg.Unit (fun () -> Stats.trackPerf := true),
+              " sample the hardware performance counters (cycles, instructions, cache and branch\n\t\t\t\tmisses) per timed phase; Linux only";
+          "--sampleStats", Arg.Unit Stats.startSampling,
+              " periodically sample the active timed phase and report per-phase tick counts,\n\t\t\t\tattributing time inside a phase without extra Stats.time wrappers";
           "--load", Arg.String ignore, "" (* ignore --load because they have been processed above already *)
         ]
         @ F.args @ featureArgs in
@@ -185,39 +357,105 @@ let theMain () =
     Arg.parse (Arg.align argDescr) Ciloptions.recordFile usageMsg;
     Cil.initCIL ();
 
+    (* in server mode the initialized state is now reused for a stream
+     * of jobs; runServer only returns on a fatal error *)
+    if !serverSocket <> "" then runServer !serverSocket;
+
     Ciloptions.fileNames := List.rev !Ciloptions.fileNames;
 
-    (* parse each of the files named on the command line, to CIL *)
-    let files = Util.list_map parseOneFile !Ciloptions.fileNames in
+    (* parsing, elaboration and merging allocate heavily; run them with
+     * GC parameters suited for a growing heap *)
+    Cilgc.beginAllocPhase ();
+
+    (* With --mergeCache and several inputs, see first whether the
+     * result of merging exactly these inputs is already cached *)
+    let mergedCacheFile =
+      match !Ciloptions.fileNames with
+        _ :: _ :: _ when !mergeCacheDir <> "" ->
+          let digests =
+            Util.list_map (fun fn -> Digest.file fn) !Ciloptions.fileNames in
+          let key = Digest.to_hex (Digest.string (String.concat "" digests)) in
+          Some (Filename.concat !mergeCacheDir ("merged-" ^ key ^ ".cilb"))
+      | _ -> None
+    in
 
-    (* if there's more than one source file, merge them together; *)
-    (* now we have just one CIL "file" to deal with *)
     let one =
-      match files with
-        [one] -> one
-      | [] -> E.s (E.error "No arguments for CIL")
+      match mergedCacheFile with
+        Some cf when Sys.file_exists cf ->
+          if !Cilutil.printStages then
+            ignore (E.log "Loading the cached merge of these inputs\n");
+          (* Renumbering makes the load safe no matter what ids were
+           * already handed out in this process *)
+          Stats.time "loadMerged" C.loadBinaryFileRenumber cf
       | _ ->
-          let merged =
-            Stats.time "merge" (Mergecil.merge files)
-              (if !outName = "" then "stdout" else !outName) in
-          if !E.hadErrors then
-            E.s (E.error "There were errors during merging");
-          (* See if we must save the merged file *)
-          (match !mergedChannel with
-            None -> ()
-          | Some mc -> begin
-              let oldpci = !C.print_CIL_Input in
-              C.print_CIL_Input := true;
-              Stats.time "printMerged"
-                (C.dumpFile !C.printerForMaincil mc.fchan mc.fname) merged;
-              C.print_CIL_Input := oldpci
-          end);
-          merged
+        (* if there's more than one source file, merge them together; *)
+        (* now we have just one CIL "file" to deal with *)
+        match !Ciloptions.fileNames with
+          [] -> E.s (E.error "No arguments for CIL")
+        | [fname] ->
+            if !mergeCacheDir <> "" then cachedParse fname
+            else parseOneFile fname
+        | fnames ->
+            (* Parsing and merging are pipelined: each translation unit
+             * is handed to the streaming merger as soon as it is parsed
+             * (or loaded from the cache) and becomes garbage before the
+             * next one is read, instead of parsing everything first and
+             * merging afterwards. The inner parse timers nest under the
+             * merge phase. *)
+            let sources =
+              if !mergeCacheDir <> "" then
+                Util.list_map (fun fn () -> cachedParse fn) fnames
+              else if !F.parallelJobs > 1
+                      && not (List.exists
+                                (fun fn -> Filename.check_suffix fn ".cilb")
+                                fnames) then
+                (* the workers hand back all the parsed units at once;
+                 * the per-file cleanup still runs here, just before
+                 * each unit is merged *)
+                let parsed =
+                  Stats.time "parse (parallel)" F.parse_parallel fnames in
+                Util.list_map
+                  (fun cil () ->
+                    if (not (Feature.enabled "epicenter")) then
+                      (Rmtmps.removeUnusedTemps cil);
+                    cil)
+                  parsed
+              else
+                Util.list_map (fun fn () -> parseOneFile fn) fnames in
+            let merged =
+              Stats.time "merge" (Mergecil.mergeSources sources)
+                (if !outName = "" then "stdout" else !outName) in
+            if !E.hadErrors then
+              E.s (E.error "There were errors during merging");
+            (* Remember the merged result for the next run with the same
+             * inputs *)
+            (match mergedCacheFile with
+              Some cf -> saveCached merged cf
+            | None -> ());
+            (* See if we must save the merged file *)
+            (match !mergedChannel with
+              None -> ()
+            | Some mc -> begin
+                let oldpci = !C.print_CIL_Input in
+                C.print_CIL_Input := true;
+                Stats.time "printMerged"
+                  (dumpFile !C.printerForMaincil mc.fchan mc.fname) merged;
+                C.print_CIL_Input := oldpci
+            end);
+            merged
     in
 
     if !E.hadErrors then
       E.s (E.error "Cabs2cil had some errors");
 
+    (* merging and the per-file pruning leave the surviving ids sparse;
+     * give the features a dense id space if asked to *)
+    if !compactIds then Stats.time "compactIds" C.compactFileIds one;
+
+    (* the AST is built; hand the features and the printer a compact
+     * heap and the default GC parameters *)
+    Cilgc.endAllocPhase ~compact:true ();
+
     (* process the CIL file (merged if necessary) *)
     processOneFile one
   end
@@ -227,8 +465,21 @@ let theMain () =
 let failed = ref false
 
 let cleanup () =
+  E.printDedupReport stderr;
   if !E.verboseFlag || !Cilutil.printStats then
     Stats.print stderr "Timings:\n";
+  (match !Cilutil.statsJsonFile with
+    Some fname ->
+      let chn = open_out fname in
+      Stats.printJson chn;
+      close_out chn
+  | None -> ());
+  (match !Cilutil.statsFoldedFile with
+    Some fname ->
+      let chn = open_out fname in
+      Stats.printFolded ~measure:!Cilutil.statsFoldedMeasure chn;
+      close_out chn
+  | None -> ());
   if !E.logChannel != stderr then
     close_out (! E.logChannel);
   (match ! outChannel with Some c -> close_out c.fchan | _ -> ())
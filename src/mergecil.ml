@@ -60,7 +60,7 @@ let mergeSynonyms = true
 
 
 (** Whether to use path compression *)
-let usePathCompression = false
+let usePathCompression = true
 
 (* Try to merge definitions of inline functions. They can appear in multiple
  * files and we would like them all to be the same. This can slow down the
@@ -110,8 +110,12 @@ type 'a node =
                                * and defined in a later file. If this pointer
                                * points to the node itself then this is the
                                * representative.  *)
-      mutable nmergedSyns: bool (* Whether we have merged the synonyms for
-                                 * the node of this name *)
+      mutable nmergedSyns: bool; (* Whether we have merged the synonyms for
+                                  * the node of this name *)
+      mutable nrank: int (* An upper bound on the height of the tree rooted
+                          * here, as in union-by-rank. Only meaningful for
+                          * representatives, and only used to break the ties
+                          * that the earliest-file rule leaves open *)
     }
 
 let d_nloc () (lo: (location * int) option) : P.doc =
@@ -125,7 +129,7 @@ let mkSelfNode (eq: (int * string, 'a node) H.t) (* The equivalence table *)
                (fidx: int) (name: string) (data: 'a)
                (l: (location * int) option) =
   let rec res = { nname = name; nfidx = fidx; ndata = data; nloc = l;
-              nrep  = res; nmergedSyns = false; } in
+              nrep  = res; nmergedSyns = false; nrank = 0; } in
   H.add eq (fidx, name) res; (* Add it to the proper table *)
   if mergeSynonyms && not (prefix "__anon" name) then
     H.add syn name res;
@@ -133,6 +137,16 @@ let mkSelfNode (eq: (int * string, 'a node) H.t) (* The equivalence table *)
 
 let debugFind = false
 
+(* Path compressions are journaled so that the undo function returned by
+ * union can revert the ones made while its undo was still possible.
+ * Reverting a compression never changes class membership, only the shape
+ * of the parent chains, so rolling back more compressions than strictly
+ * necessary is safe. The journal is cleared between input files (see
+ * {!merge}) to keep it from accumulating *)
+let undoJournal : (unit -> unit) list ref = ref []
+
+let clearUndoJournal () = undoJournal := []
+
 (* Find the representative with or without path compression *)
 let rec find (pathcomp: bool) (nd: 'a node) =
   if debugFind then
@@ -143,8 +157,11 @@ let rec find (pathcomp: bool) (nd: 'a node) =
     nd
   end else begin
     let res = find pathcomp nd.nrep in
-    if usePathCompression && pathcomp && nd.nrep != res then
-      nd.nrep <- res; (* Compress the paths *)
+    if usePathCompression && pathcomp && nd.nrep != res then begin
+      let oldrep = nd.nrep in
+      undoJournal := (fun () -> nd.nrep <- oldrep) :: !undoJournal;
+      nd.nrep <- res (* Compress the paths *)
+    end;
     res
   end
 
@@ -192,14 +209,30 @@ let union (nd1: 'a node) (nd2: 'a node) : 'a node * (unit -> unit) =
                * is harmless anyway, so is useless noise *)
               (* sm: re-enabling on claim it now will probably not happen *)
               ignore (warn "Merging two undefined elements in the same file: %s and %s" nd1.nname nd2.nname);
-              nd1, nd2
+              (* Nothing semantic forces a choice here; keep the trees
+               * shallow by putting the higher-ranked node on top *)
+              if nd1.nrank >= nd2.nrank then nd1, nd2 else nd2, nd1
         end
       else (* One is defined, the other is not. Choose the defined one *)
         if nd1.nloc != None then nd1, nd2 else nd2, nd1
     in
     let oldrep = norep.nrep in
+    let oldrank = rep.nrank in
+    let mark = !undoJournal in
+    if rep.nrank = norep.nrank then rep.nrank <- rep.nrank + 1;
     norep.nrep <- rep;
-    rep, (fun () -> norep.nrep <- oldrep)
+    rep, (fun () ->
+            (* Revert the path compressions made since this union *)
+            let rec rollback (l: (unit -> unit) list) =
+              if l != mark then
+                match l with
+                  f :: rest -> f (); rollback rest
+                | [] -> () (* the journal was cleared in between *)
+            in
+            rollback !undoJournal;
+            undoJournal := mark;
+            rep.nrank <- oldrank;
+            norep.nrep <- oldrep)
   end
 (*
 let union (nd1: 'a node) (nd2: 'a node) : 'a node * (unit -> unit) =
@@ -308,8 +341,11 @@ let tSyn: (string, typeinfo node) H.t = H.create 111
 let vEnv : (string, varinfo node) H.t = H.create 111
 
 
-(* A set of inline functions indexed by their printout ! *)
-let inlineBodies : (P.doc, varinfo node) H.t = H.create 111
+(* A set of inline functions indexed by the structural digest of their
+ * alpha-normalized body (see inlineBodyDigest). The table hashes and
+ * compares 16-byte strings, and nothing is ever printed to compare
+ * bodies. *)
+let inlineBodies : (string, varinfo node) H.t = H.create 111
 
 (** A number of alpha conversion tables. We ought to keep one table for each
  * name space. Unfortunately, because of the way the C lexer works, type
@@ -373,6 +409,9 @@ let originalVarNames: (string, string) H.t = H.create 113
 
 (* Initialize the module *)
 let init () =
+  clearUndoJournal ();
+  H.clear compDigests;
+
   H.clear sAlpha;
   H.clear eAlpha;
   H.clear vtAlpha;
@@ -437,9 +476,271 @@ type combineWhat =
   | CombineOther
 
 
+(* A cheap structural digest used to reject non-isomorphic types in O(1)
+ * before the deep comparison below runs. The digest must be invariant
+ * under every difference that combineTypes tolerates (attributes, array
+ * sizes, function arguments and results, typedef unrolling, enums
+ * merging with int, the renaming of nested tags), so unequal digests
+ * imply that the deep comparison would fail. Equal digests still pay for
+ * the deep comparison *)
+let digestMix (h: int) (v: int) : int = (h * 65599 + v) land max_int
+
+let rec digestType (t: typ) : int =
+  match t with
+    TVoid _ -> 1
+  | TInt (ik, _) -> digestMix 2 (H.hash ik)
+  | TFloat (fk, _) -> digestMix 3 (H.hash fk)
+  | TPtr (bt, _) -> digestMix 4 (digestType bt)
+  | TArray (bt, _, _) -> digestMix 5 (digestType bt)
+  | TFun _ -> 6 (* arguments and result tolerate combinable differences *)
+  | TNamed (ti, _) -> digestType ti.ttype (* combineTypes unrolls these *)
+  | TComp (ci, _) -> digestMix 7 (if ci.cstruct then 1 else 0)
+  | TEnum _ -> digestMix 2 (H.hash IInt) (* enums merge with int *)
+  | TBuiltin_va_list _ -> 8
+
+(* Digests of the defined compinfos, keyed by ckey. The memo stays valid
+ * across merging because the combined field types have the same digest
+ * as either input by construction *)
+let compDigests : (int, int) H.t = H.create 111
+
+let digestCompInfo (ci: compinfo) : int =
+  try H.find compDigests ci.ckey
+  with Not_found ->
+    let d =
+      List.fold_left
+        (fun acc fi ->
+          let acc = digestMix acc (digestType fi.ftype) in
+          let acc = digestMix acc (H.hash fi.fbitfield) in
+          digestMix acc (H.hash fi.fattr))
+        (digestMix (if ci.cstruct then 11 else 12) (List.length ci.cfields))
+        ci.cfields
+    in
+    H.add compDigests ci.ckey d;
+    d
+
+let digestEnumInfo (ei: enuminfo) : int =
+  List.fold_left
+    (fun acc (n, v, _) ->
+      let acc = digestMix acc (H.hash n) in
+      match constFold true v with
+        Const (CInt64 (i, _, _)) -> digestMix acc (H.hash i)
+      | _ -> digestMix acc 0)
+    (List.length ei.eitems) ei.eitems
+
+(* Compute the digest of an inline function directly over the AST,
+ * instead of printing the alpha-converted body and comparing the text.
+ * The function's own name is encoded by a fixed marker; with
+ * mergeInlinesWithAlphaConvert the formals and locals are encoded by
+ * declaration position, which is exactly what the temporary renaming
+ * achieved; named structures, enums and typedefs are encoded by name,
+ * as the printer shows them; goto targets by a label name, as the
+ * printer picks one; locations are never included. Strings are
+ * length-prefixed so concatenations cannot collide. *)
+let inlineBodyDigest (fdec: fundec) : string =
+  let b = Buffer.create 2048 in
+  let addC = Buffer.add_char b in
+  let addI (i: int) =
+    Buffer.add_string b (string_of_int i); Buffer.add_char b ' ' in
+  let addS (s: string) =
+    addI (String.length s); Buffer.add_string b s in
+  (* Constant constructors (ikind, binop, ...) are encoded by their
+   * generic hash, which is just the constructor tag *)
+  let addT x = addI (H.hash x) in
+  let localIdx : (int, int) H.t = H.create 53 in
+  let nextIdx = ref 0 in
+  let indexOne (v: varinfo) =
+    H.add localIdx v.vid !nextIdx; incr nextIdx in
+  if mergeInlinesWithAlphaConvert then begin
+    List.iter indexOne fdec.sformals;
+    List.iter indexOne fdec.slocals
+  end;
+  let dVar (v: varinfo) : unit =
+    if v.vid = fdec.svar.vid then addS "@@alphaname@@"
+    else
+      match (try Some (H.find localIdx v.vid) with Not_found -> None) with
+        Some i -> addC 'L'; addI i
+      | None -> addC 'G'; addS v.vname
+  in
+  let rec dTyp (t: typ) : unit =
+    match t with
+      TVoid a -> addC 'v'; dAttrs a
+    | TInt (ik, a) -> addC 'i'; addT ik; dAttrs a
+    | TFloat (fk, a) -> addC 'f'; addT fk; dAttrs a
+    | TPtr (t1, a) -> addC 'p'; dTyp t1; dAttrs a
+    | TArray (t1, eo, a) ->
+        addC 'a'; dTyp t1;
+        (match eo with None -> addC '-' | Some e -> dExp e);
+        dAttrs a
+    | TFun (rt, args, va, a) ->
+        addC 'F'; dTyp rt;
+        (match args with
+          None -> addC '-'
+        | Some args ->
+            (* the names of the arguments are alpha-convertible *)
+            List.iter (fun (_, at, aa) -> dTyp at; dAttrs aa) args);
+        addC (if va then '+' else '.');
+        dAttrs a
+    | TNamed (ti, a) -> addC 'n'; addS ti.tname; dAttrs a
+    | TComp (ci, a) ->
+        addC (if ci.cstruct then 's' else 'u'); addS ci.cname; dAttrs a
+    | TEnum (ei, a) -> addC 'e'; addS ei.ename; dAttrs a
+    | TBuiltin_va_list a -> addC 'b'; dAttrs a
+
+  and dAttrs (al: attributes) : unit =
+    List.iter
+      (fun (Attr (an, ap)) -> addC 'A'; addS an; List.iter dAttrparam ap)
+      al
+
+  and dAttrparam (ap: attrparam) : unit =
+    match ap with
+      AInt i -> addC '0'; addI i
+    | AStr s -> addC '1'; addS s
+    | ACons (s, l) -> addC '2'; addS s; List.iter dAttrparam l
+    | ASizeOf t -> addC '3'; dTyp t
+    | ASizeOfE a -> addC '4'; dAttrparam a
+    | AAlignOf t -> addC '5'; dTyp t
+    | AAlignOfE a -> addC '6'; dAttrparam a
+    | AUnOp (op, a) -> addC '7'; addT op; dAttrparam a
+    | ABinOp (op, a1, a2) -> addC '8'; addT op; dAttrparam a1; dAttrparam a2
+    | ADot (a, s) -> addC '9'; dAttrparam a; addS s
+    | AStar a -> addC '*'; dAttrparam a
+    | AAddrOf a -> addC '&'; dAttrparam a
+    | AIndex (a1, a2) -> addC '['; dAttrparam a1; dAttrparam a2
+    | AQuestion (a1, a2, a3) ->
+        addC '?'; dAttrparam a1; dAttrparam a2; dAttrparam a3
+
+  and dConst (c: constant) : unit =
+    match c with
+      CInt64 (v, ik, _) -> addC 'I'; addS (Int64.to_string v); addT ik
+    | CStr s -> addC 'S'; addS (cstringToString s)
+    | CWStr l -> addC 'W'; wstringIter (fun v -> addS (Int64.to_string v)) l
+    | CChr c -> addC 'C'; addC c
+    | CReal (f, fk, _) ->
+        addC 'R'; addS (Int64.to_string (Int64.bits_of_float f)); addT fk
+    | CEnum (_, n, ei) -> addC 'E'; addS n; addS ei.ename
+
+  and dExp (e: exp) : unit =
+    match e with
+      Const c -> dConst c
+    | Lval lv -> addC 'l'; dLval lv
+    | SizeOf t -> addC 'z'; dTyp t
+    | SizeOfE e1 -> addC 'Z'; dExp e1
+    | SizeOfStr s -> addC 'y'; addS (cstringToString s)
+    | AlignOf t -> addC 'g'; dTyp t
+    | AlignOfE e1 -> addC 'G'; dExp e1
+    | Real e1 -> addC 'r'; dExp e1
+    | Imag e1 -> addC 'j'; dExp e1
+    | UnOp (op, e1, t) -> addC 'U'; addT op; dExp e1; dTyp t
+    | BinOp (op, e1, e2, t) -> addC 'B'; addT op; dExp e1; dExp e2; dTyp t
+    | Question (e1, e2, e3, t) ->
+        addC 'Q'; dExp e1; dExp e2; dExp e3; dTyp t
+    | CastE (t, e1) -> addC 'c'; dTyp t; dExp e1
+    | AddrOf lv -> addC '@'; dLval lv
+    | AddrOfLabel sref -> addC 'P'; dStmtRef !sref
+    | StartOf lv -> addC 'o'; dLval lv
+
+  and dLval ((h, off): lval) : unit =
+    (match h with
+      Var v -> dVar v
+    | Mem e -> addC 'M'; dExp e);
+    dOffset off
+
+  and dOffset (off: offset) : unit =
+    match off with
+      NoOffset -> addC '.'
+    | Field (fi, o) -> addC 'd'; addS fi.fname; dOffset o
+    | Index (e, o) -> addC 'x'; dExp e; dOffset o
+
+  (* Encode a goto target by a label name, as the printer does. Labels
+   * are not alpha-converted by the merger, so the names participate in
+   * the comparison, as they did in the printout *)
+  and dStmtRef (s: stmt) : unit =
+    let rec pick = function
+        [] -> addC '-'
+      | Label (ln, _, _) :: _ -> addS ln
+      | _ :: rest -> pick rest
+    in
+    pick s.labels
+
+  and dInstr (i: instr) : unit =
+    match i with
+      Set (lv, e, _) -> addC '='; dLval lv; dExp e
+    | VarDecl (v, _) -> addC 'D'; dVar v
+    | Call (lvo, f, args, _) ->
+        addC 'k';
+        (match lvo with None -> addC '-' | Some lv -> dLval lv);
+        dExp f; List.iter dExp args
+    | Asm (a, tmpls, outs, ins, clobs, _) ->
+        addC 'm'; dAttrs a;
+        List.iter addS tmpls;
+        List.iter
+          (fun (no, c, lv) ->
+            (match no with None -> addC '-' | Some n1 -> addS n1);
+            addS c; dLval lv)
+          outs;
+        List.iter
+          (fun (no, c, e) ->
+            (match no with None -> addC '-' | Some n1 -> addS n1);
+            addS c; dExp e)
+          ins;
+        List.iter addS clobs
+
+  and dBlock (blk: block) : unit =
+    addC '{'; dAttrs blk.battrs;
+    List.iter dStmt blk.bstmts;
+    addC '}'
+
+  and dStmt (s: stmt) : unit =
+    List.iter
+      (fun lb ->
+        match lb with
+          Label (ln, _, real) ->
+            addC ':'; addS ln; addC (if real then '1' else '0')
+        | Case (e, _) -> addC 'K'; dExp e
+        | CaseRange (e1, e2, _) -> addC 'N'; dExp e1; dExp e2
+        | Default _ -> addC 'q')
+      s.labels;
+    match s.skind with
+      Instr il -> addC ';'; List.iter dInstr il
+    | Return (None, _) -> addC 'T'
+    | Return (Some e, _) -> addC 't'; dExp e
+    | Goto (sref, _) -> addC 'h'; dStmtRef !sref
+    | ComputedGoto (e, _) -> addC 'H'; dExp e
+    | Break _ -> addC 'w'
+    | Continue _ -> addC 'V'
+    | If (e, b1, b2, _) -> addC 'J'; dExp e; dBlock b1; dBlock b2
+      (* the case list of a Switch is derivable from the body *)
+    | Switch (e, blk, _, _) -> addC 'Y'; dExp e; dBlock blk
+    | Loop (blk, _, _, _) -> addC 'O'; dBlock blk
+    | Block blk -> dBlock blk
+    | TryFinally (b1, b2, _) -> addC 'X'; dBlock b1; dBlock b2
+    | TryExcept (b1, (il, e), b2, _) ->
+        addC 'x'; dBlock b1; List.iter dInstr il; dExp e; dBlock b2
+  in
+  (* The declaration: storage, inline flag, attributes and type, which
+   * covers the types of the formals; then the locals and the body *)
+  addT fdec.svar.vstorage;
+  addC (if fdec.svar.vinline then '1' else '0');
+  dAttrs fdec.svar.vattr;
+  dTyp fdec.svar.vtype;
+  if not mergeInlinesWithAlphaConvert then
+    List.iter (fun v -> addS v.vname) fdec.sformals;
+  List.iter
+    (fun v ->
+      if not mergeInlinesWithAlphaConvert then addS v.vname;
+      dTyp v.vtype; dAttrs v.vattr)
+    fdec.slocals;
+  Digest.string (Buffer.contents b)
+
 let rec combineTypes (what: combineWhat)
                      (oldfidx: int)  (oldt: typ)
                      (fidx: int) (t: typ)  : typ =
+  (* Physically shared types are trivially compatible. With type
+   * interning on this is the common case for scalar and pointer types.
+   * Since compinfos, enuminfos and typeinfos are never shared between
+   * files, such a type cannot contain named structures, so there are no
+   * equivalence nodes to union either. *)
+  if oldt == t then oldt else
   match oldt, t with
   | TVoid olda, TVoid a -> TVoid (addAttributes olda a)
   | TInt (oldik, olda), TInt (ik, a) ->
@@ -626,6 +927,11 @@ and matchCompInfo (oldfidx: int) (oldci: compinfo)
 	  oldci.cname ci.cname old_len len in
       raise (Failure msg)
     );
+    (* Reject quickly on the precomputed digests; only digest collisions
+     * pay for the field-by-field comparison below *)
+    if old_len = len && old_len <> 0
+       && digestCompInfo oldci <> digestCompInfo ci then
+      raise (Failure "(different structural digests)");
     (* We check that they are defined in the same way. While doing this there
      * might be recursion and we have to watch for going into an infinite
      * loop. So we add the assumption that they are equal *)
@@ -668,8 +974,12 @@ and matchCompInfo (oldfidx: int) (oldci: compinfo)
       (* We will reuse the old one. One of them is empty. If the old one is
        * empty, copy over the fields from the new one. Won't this result in
        * all sorts of undefined types??? *)
-      if old_len = 0 then
+      if old_len = 0 then begin
         oldci.cfields <- ci.cfields;
+        (* Its layout may already have been computed and cached while it
+         * was still empty *)
+        invalidateCompLayout oldci
+      end
     end;
     (* We get here when we succeeded checking that they are equal, or one of
      * them was empty *)
@@ -694,6 +1004,8 @@ and matchEnumInfo (oldfidx: int) (oldei: enuminfo)
       (* We do not have a mapping. They better be defined in the same way *)
       if List.length oldei.eitems <> List.length ei.eitems then
         raise (Failure "(different number of enumeration elements)");
+      if digestEnumInfo oldei <> digestEnumInfo ei then
+        raise (Failure "(different enumeration digests)");
       (* We check that they are defined in the same way. This is a fairly
       * conservative check. *)
       List.iter2
@@ -743,6 +1055,8 @@ and matchTypeInfo (oldfidx: int) (oldti: typeinfo)
     let fidx = tnode.nfidx in
     (* Check that they are the same *)
     (try
+      if digestType oldti.ttype <> digestType ti.ttype then
+        raise (Failure "(different type digests)");
       ignore (combineTypes CombineOther oldfidx oldti.ttype fidx ti.ttype);
     with Failure reason -> begin
       let msg =
@@ -1228,6 +1542,9 @@ begin
         | _, _ -> false
       in
       (equalLists xoil yoil)
+  | RepeatInit(xi, xn), RepeatInit(yi, yn) ->
+      (xn = yn) &&
+      (equalInits xi yi)
   | _, _ -> false
 end
 
@@ -1449,53 +1766,9 @@ let oneFilePass2 (f: file) =
           end;
           (* See if we can remove this inline function *)
           if fdec'.svar.vinline && mergeInlines then begin
-            let printout =
-              (* Temporarily turn of printing of lines *)
-              let oldprintln = !lineDirectiveStyle in
-              lineDirectiveStyle := None;
-              (* Temporarily set the name to all functions in the same way *)
-              let newname = fdec'.svar.vname in
-              fdec'.svar.vname <- "@@alphaname@@";
-              (* If we must do alpha conversion then temporarily set the
-               * names of the local variables and formals in a standard way *)
-              let nameId = ref 0 in
-              let oldNames : string list ref = ref [] in
-              let renameOne (v: varinfo) =
-                oldNames := v.vname :: !oldNames;
-                incr nameId;
-                v.vname <- "___alpha" ^ string_of_int !nameId
-              in
-              let undoRenameOne (v: varinfo) =
-                match !oldNames with
-                  n :: rest ->
-                    oldNames := rest;
-                    v.vname <- n
-                | _ -> E.s (bug "undoRenameOne")
-              in
-              (* Remember the original type *)
-              let origType = fdec'.svar.vtype in
-              if mergeInlinesWithAlphaConvert then begin
-                (* Rename the formals *)
-                List.iter renameOne fdec'.sformals;
-                (* Reflect in the type *)
-                setFormals fdec' fdec'.sformals;
-                (* Now do the locals *)
-                List.iter renameOne fdec'.slocals
-              end;
-              (* Now print it *)
-              let res = d_global () g' in
-              lineDirectiveStyle := oldprintln;
-              fdec'.svar.vname <- newname;
-              if mergeInlinesWithAlphaConvert then begin
-                (* Do the locals in reverse order *)
-                List.iter undoRenameOne (List.rev fdec'.slocals);
-                (* Do the formals in reverse order *)
-                List.iter undoRenameOne (List.rev fdec'.sformals);
-                (* Restore the type *)
-                fdec'.svar.vtype <- origType;
-              end;
-              res
-            in
+            (* The canonical form is computed directly on the AST; no
+             * temporary renaming and no printing (see inlineBodyDigest) *)
+            let printout = inlineBodyDigest fdec' in
             (* Make a node for this inline function using the original name. *)
             let inode =
               getNode vEq vSyn !currentFidx origname fdec'.svar
@@ -1735,25 +2008,48 @@ let oneFilePass2 (f: file) =
   end
 
 
+(* Force the synonyms to be equal. Safe to call repeatedly: nodes whose
+ * synonyms have already been merged are skipped via nmergedSyns *)
+let mergeAllSynonyms () =
+  doMergeSynonyms sSyn sEq matchCompInfo;
+  doMergeSynonyms eSyn eEq matchEnumInfo;
+  doMergeSynonyms tSyn tEq matchTypeInfo;
+  if mergeInlines then begin
+    (* Copy all the nodes from the iEq to vEq as well. This is needed
+     * because vEq will be used for variable renaming *)
+    H.iter (fun k n -> if not (H.mem vEq k) then H.add vEq k n) iEq;
+    doMergeSynonyms iSyn iEq matchInlines;
+  end
+
+(* Collect the accumulated globals into the result file *)
+let finishMerge (newname: string) : file =
+  (* Now reverse the result and return the resulting file *)
+  let rec revonto acc = function
+      [] -> acc
+    | x :: t -> revonto (x :: acc) t
+  in
+  let res =
+    { fileName = newname;
+      globals  = revonto (revonto [] !theFile) !theFileTypes;
+      globinit = None;
+      globinitcalled = false;
+      gindex = None;} in
+  init (); (* Make the GC happy *)
+  (* We have made many renaming changes and sometimes we have just guessed a
+   * name wrong. Make sure now that the local names are unique. *)
+  uniqueVarNames res;
+  res
+
 let merge (files: file list) (newname: string) : file =
   init ();
 
   (* Make the first pass over the files *)
   currentFidx := 0;
-  List.iter (fun f -> oneFilePass1 f; incr currentFidx) files;
+  List.iter (fun f -> clearUndoJournal (); oneFilePass1 f; incr currentFidx)
+    files;
 
   (* Now maybe try to force synonyms to be equal *)
-  if mergeSynonyms then begin
-    doMergeSynonyms sSyn sEq matchCompInfo;
-    doMergeSynonyms eSyn eEq matchEnumInfo;
-    doMergeSynonyms tSyn tEq matchTypeInfo;
-    if mergeInlines then begin
-      (* Copy all the nodes from the iEq to vEq as well. This is needed
-       * because vEq will be used for variable renaming *)
-      H.iter (fun k n -> H.add vEq k n) iEq;
-      doMergeSynonyms iSyn iEq matchInlines;
-    end
-  end;
+  if mergeSynonyms then mergeAllSynonyms ();
 
   (* Now maybe dump the graph *)
   if debugMerge then begin
@@ -1766,20 +2062,32 @@ let merge (files: file list) (newname: string) : file =
   (* Make the second pass over the files. This is when we start rewriting the
    * file *)
   currentFidx := 0;
-  List.iter (fun f -> oneFilePass2 f; incr currentFidx) files;
-
-  (* Now reverse the result and return the resulting file *)
-  let rec revonto acc = function
-      [] -> acc
-    | x :: t -> revonto (x :: acc) t
-  in
-  let res =
-    { fileName = newname;
-      globals  = revonto (revonto [] !theFile) !theFileTypes;
-      globinit = None;
-      globinitcalled = false;} in
-  init (); (* Make the GC happy *)
-  (* We have made many renaming changes and sometimes we have just guessed a
-   * name wrong. Make sure now that the local names are unique. *)
-  uniqueVarNames res;
-  res
+  List.iter (fun f -> clearUndoJournal (); oneFilePass2 f; incr currentFidx)
+    files;
+
+  finishMerge newname
+
+(* Streaming merge: the files are produced one at a time, each one is
+ * folded into the accumulated result with both passes and then released
+ * before the next one is read, so the peak memory is bounded by the
+ * output plus a single input. Because a file is gone once processed, the
+ * synonym merging that the batch merge does between its two global
+ * passes happens incrementally here, after the first pass of each file.
+ * Representatives still come from the earliest file, since only
+ * already-seen files can supply them. The sources are typically
+ * [fun () -> Cil.loadBinaryFile fname] thunks. *)
+let mergeSources (sources: (unit -> file) list) (newname: string) : file =
+  init ();
+  currentFidx := 0;
+  List.iter
+    (fun (getOne: unit -> file) ->
+      let f = getOne () in
+      clearUndoJournal ();
+      oneFilePass1 f;
+      if mergeSynonyms then mergeAllSynonyms ();
+      oneFilePass2 f;
+      (* f becomes garbage here, except for the declarations that the
+       * equivalence classes and the output keep alive *)
+      incr currentFidx)
+    sources;
+  finishMerge newname
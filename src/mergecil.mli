@@ -40,3 +40,9 @@ val ignore_merge_conflicts: bool ref
 
 (** Merge a number of CIL files *)
 val merge: Cil.file list -> string -> Cil.file
+
+(** Like {!Mergecil.merge} but the files are produced on demand, one at a
+ * time, and each one is released before the next one is read. Peak
+ * memory is bounded by the output plus a single input. Pass thunks such
+ * as [fun () -> Cil.loadBinaryFile fname]. *)
+val mergeSources: (unit -> Cil.file) list -> string -> Cil.file
@@ -7,16 +7,18 @@ let debugAlpha (prefix: string) = false
 let alphaSeparator = "___"
 let alphaSeparatorLen = String.length alphaSeparator
 
-(** For each prefix we remember the next integer suffix to use and the list 
- * of suffixes, each with some data assciated with the newAlphaName that 
- * created the suffix. *)
-type 'a alphaTableData = int * (string * 'a) list
-
-type 'a undoAlphaElement = 
-    AlphaChangedSuffix of 'a alphaTableData ref * 'a alphaTableData (* The 
-                                             * reference that was changed and 
+(** For each prefix we remember the next integer suffix to use and the list
+ * of suffixes, each with some data assciated with the newAlphaName that
+ * created the suffix. The suffixes are stored by their numeric value, with
+ * -1 standing for the name without any suffix, so that scanning the list
+ * compares integers and does not allocate any strings. *)
+type 'a alphaTableData = int * (int * 'a) list
+
+type 'a undoAlphaElement =
+    AlphaChangedSuffix of 'a alphaTableData ref * 'a alphaTableData (* The
+                                             * reference that was changed and
                                              * the old suffix *)
-  | AlphaAddedSuffix of string          (* We added this new entry to the 
+  | AlphaAddedSuffix of string          (* We added this new entry to the
                                          * table *)
 
 (* The number of decimal digits that can fit in a 31-bit signed int *)
@@ -27,7 +29,20 @@ let maxSuffix = (* "999999999" *)
     int_of_string maxSuffixStr
   with Failure _ ->
     E.s (E.bug "You appear to be using the Alpha module on a computer where int is represented with fewer than 31 bits.  Go to alpha.ml and change maxSuffixLength to a smaller number.")
-  
+
+
+(* Build prefix ^ alphaSeparator ^ string_of_int n with a single copy into
+ * the result. This is the only string created for a renamed name. *)
+let makeFullName (prefix: string) (n: int) : string =
+  let digits = string_of_int n in
+  let plen = String.length prefix in
+  let dlen = String.length digits in
+  let b = Bytes.create (plen + alphaSeparatorLen + dlen) in
+  String.blit prefix 0 b 0 plen;
+  String.blit alphaSeparator 0 b plen alphaSeparatorLen;
+  String.blit digits 0 b (plen + alphaSeparatorLen) dlen;
+  Bytes.unsafe_to_string b
+
 
 (* Create a new name based on a given name. The new name is formed
  * from a prefix (obtained from the given name by stripping a suffix
@@ -38,73 +53,72 @@ let maxSuffix = (* "999999999" *)
  * one when only the version without suffix has been used. *)
 let rec newAlphaName ~(alphaTable: (string, 'a alphaTableData ref) H.t)
                      ~(undolist: 'a undoAlphaElement list ref option)
-                     ~(lookupname: string) 
-                     ~(data: 'a) : string * 'a = 
-  alphaWorker ~alphaTable:alphaTable ~undolist:undolist 
+                     ~(lookupname: string)
+                     ~(data: 'a) : string * 'a =
+  alphaWorker ~alphaTable:alphaTable ~undolist:undolist
               ~lookupname:lookupname ~data:data true
-  
+
 
 (** Just register the name so that we will not use in the future *)
 and registerAlphaName ~(alphaTable: (string, 'a alphaTableData ref) H.t)
                       ~(undolist: 'a undoAlphaElement list ref option)
-                      ~(lookupname: string) 
-                      ~(data: 'a) : unit = 
-  ignore (alphaWorker ~alphaTable:alphaTable ~undolist:undolist 
+                      ~(lookupname: string)
+                      ~(data: 'a) : unit =
+  ignore (alphaWorker ~alphaTable:alphaTable ~undolist:undolist
                       ~lookupname:lookupname ~data:data false)
 
 
 and alphaWorker      ~(alphaTable: (string, 'a alphaTableData ref) H.t)
                      ~(undolist: 'a undoAlphaElement list ref option)
                      ~(lookupname: string) ~(data:'a)
-                     (make_new: bool) : string * 'a = 
-  let prefix, suffix, (numsuffix: int) = splitNameForAlpha ~lookupname in
+                     (make_new: bool) : string * 'a =
+  let prefix, (numsuffix: int) = splitNameForAlpha ~lookupname in
   if debugAlpha prefix then
-    ignore (E.log "Alpha worker: prefix=%s suffix=%s (%d) create=%b. " 
-              prefix suffix numsuffix make_new);
-  let newname, (olddata: 'a) = 
+    ignore (E.log "Alpha worker: prefix=%s numsuffix=%d create=%b. "
+              prefix numsuffix make_new);
+  let newname, (olddata: 'a) =
     try
       let rc = H.find alphaTable prefix in
-      let max, suffixes = !rc in 
+      let max, suffixes = !rc in
       (* We have seen this prefix *)
       if debugAlpha prefix then
         ignore (E.log " Old max %d. Old suffixes: @[%a@]" max
-                  (docList 
-                     (fun (s, l) -> dprintf "%s" (* d_loc l *) s)) suffixes);
+                  (docList
+                     (fun (n, l) -> dprintf "%d" (* d_loc l *) n)) suffixes);
       (* Save the undo info *)
-      (match undolist with 
+      (match undolist with
         Some l -> l := AlphaChangedSuffix (rc, !rc) :: !l
       | _ -> ());
 
-      let newmax, newsuffix, (olddata: 'a), newsuffixes = 
-        if numsuffix > max then begin 
+      let newmax, (olddata: 'a), newsuffixes, newname =
+        if numsuffix > max then begin
           (* Clearly we have not seen it *)
-          numsuffix, suffix, data,
-          (suffix, data) :: suffixes 
-        end else begin 
-          match List.filter (fun (n, _) -> n = suffix) suffixes with 
+          numsuffix, data, (numsuffix, data) :: suffixes, lookupname
+        end else begin
+          match List.filter (fun (n, _) -> n = numsuffix) suffixes with
             [] -> (* Not found *)
-              max, suffix, data, (suffix, data) :: suffixes
-          | [(_, l) ] -> 
+              max, data, (numsuffix, data) :: suffixes, lookupname
+          | [(_, l) ] ->
               (* We have seen this exact suffix before *)
               if make_new then begin
                 if max >= maxSuffix then
                   E.s (E.unimp ("Encountered a variable name containing ___ "
                     ^^"and many digits.  This could cause overflow "
                     ^^"in the Alpha renaming module."));
-                let newsuffix = alphaSeparator ^ (string_of_int (max + 1)) in
-                max + 1, newsuffix, l, (newsuffix, data) :: suffixes
+                max + 1, l, (max + 1, data) :: suffixes,
+                makeFullName prefix (max + 1)
               end else
-                max, suffix, data, suffixes
+                max, data, suffixes, lookupname
           |  _ -> E.s (E.bug "Alpha.alphaWorker")
         end
       in
       rc := (newmax, newsuffixes);
-      prefix ^ newsuffix, olddata
+      newname, olddata
     with Not_found -> begin (* First variable with this prefix *)
-      (match undolist with 
+      (match undolist with
         Some l -> l := AlphaAddedSuffix prefix :: !l
       | _ -> ());
-      H.add alphaTable prefix (ref (numsuffix, [ (suffix, data) ]));
+      H.add alphaTable prefix (ref (numsuffix, [ (numsuffix, data) ]));
       if debugAlpha prefix then ignore (E.log " First seen. ");
       lookupname, data  (* Return the original name *)
     end
@@ -113,62 +127,98 @@ and alphaWorker      ~(alphaTable: (string, 'a alphaTableData ref) H.t)
     ignore (E.log " Res=: %s \n" newname (* d_loc oldloc *));
   newname, olddata
 
-(* Strip the suffix. Return the prefix, the suffix (including the separator 
- * and the numeric value, possibly empty), and the 
- * numeric value of the suffix (possibly -1 if missing) *) 
-and splitNameForAlpha ~(lookupname: string) : (string * string * int) = 
+(* Strip the suffix. Return the prefix and the numeric value of the suffix
+ * (-1 if missing). The prefix is the only string this allocates; the
+ * separator is matched character by character and the digits are parsed in
+ * place. *)
+and splitNameForAlpha ~(lookupname: string) : (string * int) =
   let len = String.length lookupname in
-  (* Search backward for the numeric suffix. Return the first digit of the 
+  (* Search backward for the numeric suffix. Return the first digit of the
    * suffix. Returns len if no numeric suffix *)
-  let rec skipSuffix (i: int) = 
-    if i = -1 then -1 else 
+  let rec skipSuffix (i: int) =
+    if i = -1 then -1 else
     let c = Char.code (String.get lookupname i) - Char.code '0' in
-    if c >= 0 && c <= 9 then 
+    if c >= 0 && c <= 9 then
       skipSuffix (i - 1)
     else (i + 1)
   in
   let startSuffix = skipSuffix (len - 1) in
-
+  (* Check that the separator precedes the digits, without making a
+   * throwaway substring *)
+  let rec matchesSeparator (k: int) =
+    k >= alphaSeparatorLen ||
+    (String.get lookupname (startSuffix - alphaSeparatorLen + k)
+       = String.get alphaSeparator k
+     && matchesSeparator (k + 1))
+  in
   if startSuffix >= len (* No digits at all at the end *) ||
      (* If the suffix has length >= maxSuffixLength, treat it as no suffix
-        at all.  This ensures we only call int_of_string with values that
-        will fit in an int. *)
+        at all.  This ensures we only parse values that will fit in an
+        int. *)
      (len - startSuffix > maxSuffixLength) ||
-     startSuffix <= alphaSeparatorLen     (* Not enough room for a prefix and 
+     startSuffix <= alphaSeparatorLen     (* Not enough room for a prefix and
                                            * the separator before suffix *) ||
-     (* Suffix starts with a 0 and has more characters after that *) 
+     (* Suffix starts with a 0 and has more characters after that *)
      (startSuffix < len - 1 && String.get lookupname startSuffix = '0')  ||
-     alphaSeparator <> String.sub lookupname 
-                                 (startSuffix - alphaSeparatorLen)  
-                                 alphaSeparatorLen 
+     not (matchesSeparator 0)
   then
-    (lookupname, "", -1)  (* No valid suffix in the name *)
+    (lookupname, -1)  (* No valid suffix in the name *)
   else
-    (String.sub lookupname 0 (startSuffix - alphaSeparatorLen), 
-     String.sub lookupname (startSuffix - alphaSeparatorLen) 
-                           (len - startSuffix + alphaSeparatorLen),
-     int_of_string (String.sub lookupname startSuffix (len - startSuffix)))
-    
-
-let getAlphaPrefix ~(lookupname:string) : string = 
-  let p, _, _ = splitNameForAlpha ~lookupname:lookupname in
+    (* Parse the digits in place; skipSuffix validated them already and the
+     * length check above rules out overflow *)
+    let rec parseSuffix (i: int) (acc: int) =
+      if i >= len then acc
+      else parseSuffix (i + 1)
+             (acc * 10 + (Char.code (String.get lookupname i) - Char.code '0'))
+    in
+    (String.sub lookupname 0 (startSuffix - alphaSeparatorLen),
+     parseSuffix startSuffix 0)
+
+
+let getAlphaPrefix ~(lookupname:string) : string =
+  let p, _ = splitNameForAlpha ~lookupname:lookupname in
   p
-      
+
+(* Undo a single recorded change *)
+let undoOne ~(alphaTable: (string, 'a alphaTableData ref) H.t) = function
+    AlphaChangedSuffix (where, old) ->
+      where := old
+  | AlphaAddedSuffix name ->
+      if debugAlpha name then
+        ignore (E.log "Removing %s from alpha table\n" name);
+      H.remove alphaTable name
+
 (* Undoes the changes as specified by the undolist *)
-let undoAlphaChanges ~(alphaTable: (string, 'a alphaTableData ref) H.t) 
-                     ~(undolist: 'a undoAlphaElement list) = 
-  List.iter
-    (function 
-        AlphaChangedSuffix (where, old) -> 
-          where := old
-      | AlphaAddedSuffix name -> 
-          if debugAlpha name then 
-            ignore (E.log "Removing %s from alpha table\n" name);
-          H.remove alphaTable name)
-    undolist
-
-let docAlphaTable () (alphaTable: (string, 'a alphaTableData ref) H.t) = 
-  let acc : (string * (int * (string * 'a) list)) list ref = ref [] in
+let undoAlphaChanges ~(alphaTable: (string, 'a alphaTableData ref) H.t)
+                     ~(undolist: 'a undoAlphaElement list) =
+  List.iter (undoOne ~alphaTable:alphaTable) undolist
+
+(** A checkpoint into an undo stack: the suffix of the stack at the time
+ * the checkpoint was taken. The stack is an immutable list, so nested
+ * checkpoints share their suffixes and creating one costs nothing;
+ * rolling back replays only the entries recorded since the checkpoint
+ * and truncates the stack back to it. *)
+type 'a alphaCheckpoint = 'a undoAlphaElement list
+
+let checkpointAlpha ~(undolist: 'a undoAlphaElement list ref)
+    : 'a alphaCheckpoint =
+  !undolist
+
+let undoAlphaSince ~(alphaTable: (string, 'a alphaTableData ref) H.t)
+                   ~(undolist: 'a undoAlphaElement list ref)
+                   (cp: 'a alphaCheckpoint) : unit =
+  let rec loop l =
+    if l == cp then ()
+    else
+      match l with
+        [] -> E.s (E.bug "Alpha.undoAlphaSince: checkpoint is not a suffix of the undo stack")
+      | e :: rest -> undoOne ~alphaTable:alphaTable e; loop rest
+  in
+  loop !undolist;
+  undolist := cp
+
+let docAlphaTable () (alphaTable: (string, 'a alphaTableData ref) H.t) =
+  let acc : (string * (int * (int * 'a) list)) list ref = ref [] in
   H.iter (fun k d -> acc := (k, !d) :: !acc) alphaTable;
   docList ~sep:line (fun (k, (d, _)) -> dprintf "  %s -> %d" k d) () !acc
 
@@ -46,5 +46,25 @@ val docAlphaTable: unit ->
 val getAlphaPrefix: lookupname:string -> string
 
 (** Undo the changes to a table *)
-val undoAlphaChanges: alphaTable:(string, 'a alphaTableData ref) Hashtbl.t -> 
+val undoAlphaChanges: alphaTable:(string, 'a alphaTableData ref) Hashtbl.t ->
                       undolist:'a undoAlphaElement list -> unit
+
+(** A checkpoint into an undo stack. Creating a checkpoint is a constant-time
+ * operation: the undo stack is an immutable list, so the checkpoint simply
+ * shares the suffix of the stack at the time it was taken. Checkpoints can
+ * be nested freely as long as they are rolled back in reverse order of
+ * creation. *)
+type 'a alphaCheckpoint
+
+(** Take a checkpoint of the given undo stack *)
+val checkpointAlpha: undolist:'a undoAlphaElement list ref ->
+                     'a alphaCheckpoint
+
+(** Undo all the changes recorded in the undo stack since the given
+ * checkpoint was taken, and truncate the stack back to the checkpoint. Only
+ * the entries recorded since the checkpoint are replayed. It is an error if
+ * the checkpoint is not a suffix of the stack (e.g. if an enclosing
+ * checkpoint was rolled back first). *)
+val undoAlphaSince: alphaTable:(string, 'a alphaTableData ref) Hashtbl.t ->
+                    undolist:'a undoAlphaElement list ref ->
+                    'a alphaCheckpoint -> unit
@@ -200,24 +200,52 @@ let testAndSetTo bmp i tv =
 let setTo bmp i tv = ignore (testAndSetTo bmp i tv)
 
 
-                                        (* Iterate over all elements in a
-                                         * bitmap *)
+                                        (* Destructive union under its
+                                         * explicit name; see union above *)
+let union_into dst src = union dst src
+
+                                        (* Count the trailing zeros of a
+                                         * nonzero value that fits in 16
+                                         * bits *)
+let nrTrailingZeros (w: int) : int =
+  let n = ref 0 in
+  let w = ref w in
+  if !w land 0xFF = 0 then begin n := !n + 8; w := !w lsr 8 end;
+  if !w land 0xF = 0 then begin n := !n + 4; w := !w lsr 4 end;
+  if !w land 0x3 = 0 then begin n := !n + 2; w := !w lsr 2 end;
+  if !w land 0x1 = 0 then n := !n + 1;
+  !n
+
+                                        (* Iterate over the elements of a
+                                         * bitmap by extracting one trailing
+                                         * set bit at a time, instead of
+                                         * testing all bit positions *)
 let fold f bmp arg =
   let a = bmp.bitmap in
   let n = bmp.nrWords in
-  let rec allWords wrd bit arg =
-    if wrd >= n then arg else
-    let rec allBits msk bit left arg =
-      if left = 0 then
-        allWords (wrd + 1) bit arg
-      else
-        allBits (Int32.shift_right msk 1) (bit + 1) (left - 1)
-          (if Int32.logand msk Int32.one <> Int32.zero then f arg bit
-          else arg)
-    in
-    allBits a.(wrd) bit 32 arg
+  (* Visit the set bits of a 16-bit chunk whose lowest bit is bit number
+   * base. Clearing with w land (w - 1) drops the bit just visited. *)
+  let rec chunkBits base w arg =
+    if w = 0 then arg
+    else
+      let bit = base + nrTrailingZeros w in
+      chunkBits base (w land (w - 1)) (f arg bit)
+  in
+  let rec allWords wrd arg =
+    if wrd >= n then arg
+    else
+      let w = a.(wrd) in
+      if w = Int32.zero then allWords (wrd + 1) arg
+      else begin
+        (* Split the word into 16-bit chunks, so that the bit twiddling
+         * stays within the native int range even on 32-bit hosts *)
+        let base = wrd lsl 5 in
+        let lo = Int32.to_int (Int32.logand w 0xFFFFl) in
+        let hi = Int32.to_int (Int32.shift_right_logical w 16) in
+        allWords (wrd + 1) (chunkBits (base + 16) hi (chunkBits base lo arg))
+      end
   in
-  allWords 0 0 arg
+  allWords 0 arg
 
 
 let iter f t = fold (fun x y -> f y) t ()
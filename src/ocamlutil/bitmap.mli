@@ -30,6 +30,17 @@ val  testAndSetTo: t -> int -> bool -> bool  (** Set the value and return the ol
                                          * necessary  *)
 val  union  : t -> t -> bool
 
+                                        (** Same as {!union}, under a name
+                                         * that makes the in-place update
+                                         * and the change flag explicit:
+                                         * [union_into dst src] does
+                                         * dst += src and returns true if
+                                         * dst changed. Fixpoint loops can
+                                         * use the flag to detect
+                                         * stabilization without comparing
+                                         * whole bitmaps. *)
+val  union_into : t -> t -> bool
+
                                         (* union_except livein liveout def. 
                                          * Does liveIn += (liveout - def). 
                                          * Return true if the first set was 
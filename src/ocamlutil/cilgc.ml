@@ -0,0 +1,60 @@
+(* Phase-aware control of the OCaml garbage collector.
+
+   CIL runs with the default GC parameters, which are tuned for small
+   heaps: on multi-gigabyte ASTs the major collector repeatedly walks
+   the whole live heap during the phases that allocate heavily
+   (elaboration, merging). These hooks give the allocation-heavy phases
+   a larger minor heap and a lazier major collector, then restore the
+   defaults -- optionally after one compaction -- for the phases that
+   mostly read the heap (analysis, printing). *)
+
+(* set to false to leave the GC parameters alone *)
+let enabled = ref true
+
+(* the parameters in force before the first phase hook *)
+let saved : Gc.control option ref = ref None
+
+let save () =
+  match !saved with
+  | Some _ -> ()
+  | None -> saved := Some (Gc.get ())
+
+let restoreDefaults () =
+  match !saved with
+  | Some c -> Gc.set c
+  | None -> ()
+
+(* minor heap size is in words *)
+let kwords (n: int) : int = n * 1024
+
+(* Phases nest: the driver brackets the whole parse-and-merge stage
+   while the front end brackets each file's parse and elaboration. Only
+   the outermost bracket changes and restores the parameters *)
+let depth = ref 0
+
+(* A large minor heap cuts promotions of the short-lived cells the
+   elaborator and merger churn through, and a high space_overhead keeps
+   the major collector from rewalking the live heap while it is still
+   growing *)
+let beginAllocPhase () =
+  if !enabled then begin
+    if !depth = 0 then begin
+      save ();
+      Gc.set { (Gc.get ()) with
+               Gc.minor_heap_size = kwords 8192;
+               Gc.space_overhead = 400 }
+    end;
+    incr depth
+  end
+
+(* Restore the saved parameters; with ~compact:true also compact the
+   heap once, returning the fragmentation the allocation phase built up
+   before the read-mostly phases start *)
+let endAllocPhase ?(compact=false) () =
+  if !enabled then begin
+    if !depth > 0 then decr depth;
+    if !depth = 0 then begin
+      restoreDefaults ();
+      if compact then Gc.compact ()
+    end
+  end
@@ -0,0 +1,20 @@
+(** Phase-aware control of the OCaml garbage collector. The
+    allocation-heavy phases (elaboration, merging) run with a larger
+    minor heap and a lazier major collector; the defaults are restored,
+    optionally after one compaction, for the read-mostly phases
+    (analysis, printing). *)
+
+(** Set this to false to leave the GC parameters alone *)
+val enabled: bool ref
+
+(** Call when an allocation-heavy phase starts. Saves the current GC
+    parameters the first time it runs. Phases nest; only the outermost
+    one changes and restores the parameters *)
+val beginAllocPhase: unit -> unit
+
+(** Call when the allocation-heavy phases are done; [~compact:true]
+    also compacts the heap once *)
+val endAllocPhase: ?compact:bool -> unit -> unit
+
+(** Restore the GC parameters saved by the first {!beginAllocPhase} *)
+val restoreDefaults: unit -> unit
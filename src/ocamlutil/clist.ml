@@ -41,80 +41,83 @@ open Pretty
 (* We often need to concatenate sequences and using lists for this purpose is 
  * expensive. So we define a kind of "concatenable lists" that are easier to 
  * concatenate *)
-type 'a clist = 
-  | CList of 'a list             (* This is the only representation for empty 
+type 'a clist =
+  | CList of 'a list             (* This is the only representation for empty
                                   * *)
   | CConsL of 'a * 'a clist
-  | CConsR of 'a clist * 'a 
-  | CSeq  of 'a clist * 'a clist (* We concatenate only two of them at this 
-                                  * time. Neither is CEmpty. To be sure 
+  | CConsR of 'a clist * 'a
+  | CSeq  of int * 'a clist * 'a clist
+                                 (* We concatenate only two of them at this
+                                  * time. Neither is CEmpty. The int caches
+                                  * the total length, so that "length" does
+                                  * not have to traverse the tree. To be sure
                                   * always use append to make these  *)
 
 let rec listifyOnto (tail: 'a list) = function
     CList l -> l @ tail
   | CConsL (x, l) -> x :: listifyOnto tail l
   | CConsR (l, x) -> listifyOnto (x :: tail) l
-  | CSeq (l1, l2) -> listifyOnto (listifyOnto tail l2) l1
-        
+  | CSeq (_, l1, l2) -> listifyOnto (listifyOnto tail l2) l1
+
 let toList l = listifyOnto [] l
 let fromList l = CList l
-    
-    
+
+
 let single x = CList [x]
 let empty = CList []
-    
+
 let checkBeforeAppend  (l1: 'a clist) (l2: 'a clist) : bool =
   l1 != l2 || l1 = (CList [])
 
+let rec length (acc: int) = function
+    CList l -> acc + (List.length l)
+  | CConsL (x, l) -> length (acc + 1) l
+  | CConsR (l, _) -> length (acc + 1) l
+  | CSeq (n, _, _) -> acc + n    (* Cached at construction *)
+let length l = length 0 l  (* The external version *)
+
 let append l1 l2 =
   if l1 = CList [] then l2 else
   if l2 = CList [] then l1 else
   begin
-    if l1 == l2 then 
+    if l1 == l2 then
       raise (Failure "You should not use Clist.append to double a list");
-    CSeq (l1, l2)
+    CSeq (length l1 + length l2, l1, l2)
   end
 
-let rec length (acc: int) = function
-    CList l -> acc + (List.length l)
-  | CConsL (x, l) -> length (acc + 1) l
-  | CConsR (l, _) -> length (acc + 1) l
-  | CSeq (l1, l2) -> length (length acc l1) l2
-let length l = length 0 l  (* The external version *)
-    
-let map (f: 'a -> 'b) (l: 'a clist) : 'b clist = 
+let map (f: 'a -> 'b) (l: 'a clist) : 'b clist =
   let rec loop = function
       CList l -> CList (List.map f l)
     | CConsL (x, l) -> let x' = f x in CConsL (x', loop l)
     | CConsR (l, x) -> let l' = loop l in CConsR (l', f x)
-    | CSeq (l1, l2) -> let l1' = loop l1 in CSeq (l1', loop l2)
+    | CSeq (n, l1, l2) -> let l1' = loop l1 in CSeq (n, l1', loop l2)
   in
   loop l
-    
-  
-let fold_left (f: 'acc -> 'a -> 'acc) (start: 'acc) (l: 'a clist) = 
+
+
+let fold_left (f: 'acc -> 'a -> 'acc) (start: 'acc) (l: 'a clist) =
   let rec loop (start: 'acc) = function
       CList l -> List.fold_left f start l
     | CConsL (x, l) -> loop (f start x) l
     | CConsR (l, x) -> let res = loop start l in f res x
-    | CSeq (l1, l2) -> 
+    | CSeq (_, l1, l2) ->
         let res1 = loop start l1 in
         loop res1 l2
   in
   loop start l
-    
-let iter (f: 'a -> unit) (l: 'a clist) : unit = 
+
+let iter (f: 'a -> unit) (l: 'a clist) : unit =
   let rec loop = function
       CList l -> List.iter f l
     | CConsL (x, l) -> f x; loop l
     | CConsR (l, x) -> loop l; f x
-    | CSeq (l1, l2) -> loop l1; loop l2
+    | CSeq (_, l1, l2) -> loop l1; loop l2
   in
   loop l
-    
-        
+
+
 let rec rev (revelem: 'a -> 'a) = function
-    CList l -> 
+    CList l ->
       let rec revonto (tail: 'a list) = function
           [] -> tail
         | x :: rest -> revonto (revelem x :: tail) rest
@@ -123,7 +126,7 @@ let rec rev (revelem: 'a -> 'a) = function
 
   | CConsL (x, l) -> CConsR (rev revelem l, x)
   | CConsR (l, x) -> CConsL (x, rev revelem l)
-  | CSeq (l1, l2) -> CSeq (rev revelem l2, rev revelem l1)
+  | CSeq (n, l1, l2) -> CSeq (n, rev revelem l2, rev revelem l1)
 
 
 let docCList (sep: doc) (doone: 'a -> doc) () (dl: 'a clist) = 
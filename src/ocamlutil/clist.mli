@@ -49,10 +49,13 @@ type 'a clist =
                                      list. Try to use sparingly.  *)
   | CConsL of 'a * 'a clist      (** Do not use this a lot because scanning 
                                    * it is not tail recursive *)
-  | CConsR of 'a clist * 'a 
-  | CSeq of 'a clist * 'a clist (** We concatenate only two of them at this
-                                    time. Neither is the empty clist. To be
-                                    sure always use append to make these *)
+  | CConsR of 'a clist * 'a
+  | CSeq of int * 'a clist * 'a clist
+                                (** We concatenate only two of them at this
+                                    time. Neither is the empty clist. The
+                                    int caches the total length of the node.
+                                    To be sure always use append to make
+                                    these *)
 
 
 (** Convert a clist to an ordinary list *)
@@ -75,17 +78,22 @@ val append: 'a clist -> 'a clist -> 'a clist
  * are not identically the same (Except if they are both empty) *)
 val checkBeforeAppend: 'a clist -> 'a clist -> bool
 
-(** Find the length of a clist *)
-val length: 'a clist -> int   
+(** Find the length of a clist. Constant time on append nodes, which
+    cache their length *)
+val length: 'a clist -> int
 
 (** Map a function over a clist. Returns another clist *)
 val map: ('a -> 'b) -> 'a clist -> 'b clist 
 
 
-(** A version of fold_left that works on clists *)
+(** A version of fold_left that works on clists. This walks the tree
+    directly; prefer it to folding over [toList], which materializes the
+    whole list *)
 val fold_left: ('acc -> 'a -> 'acc) -> 'acc -> 'a clist -> 'acc
 
-(** A version of iter that works on clists *)
+(** A version of iter that works on clists. This walks the tree directly;
+    prefer it to iterating over [toList], which materializes the whole
+    list *)
 val iter: ('a -> unit) -> 'a clist -> unit
 
 (** Reverse a clist. The first function reverses an element.  *)
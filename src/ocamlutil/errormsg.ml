@@ -52,12 +52,34 @@ let hadErrors = ref false
 
 let logChannel : out_channel ref = ref stderr
 
-let errorContext = ref []
-let pushContext f = errorContext := f :: (!errorContext)
+(* The error context is a stack of printing functions, left unevaluated
+ * until a diagnostic is actually shown. It is pushed and popped around
+ * every declaration by the elaborator, so we keep it in a preallocated
+ * array with a depth counter: push and pop are O(1) and, once the array
+ * has reached its high-water mark, allocate nothing on the (usual)
+ * error-free path. *)
+let noContext : unit -> Pretty.doc = fun () -> Pretty.nil
+let errorContext : (unit -> Pretty.doc) array ref = ref (Array.make 64 noContext)
+let errorContextDepth = ref 0
+
+let pushContext f =
+  let st = !errorContext in
+  let n = Array.length st in
+  if !errorContextDepth >= n then begin
+    let st' = Array.make (2 * n) noContext in
+    Array.blit st 0 st' 0 n;
+    errorContext := st'
+  end;
+  !errorContext.(!errorContextDepth) <- f;
+  incr errorContextDepth
+
 let popContext () =
-  match !errorContext with
-    _ :: t -> errorContext := t
-  | [] -> s (fprintf !logChannel "Bug: cannot pop error context")
+  if !errorContextDepth > 0 then begin
+    decr errorContextDepth;
+    (* Drop the reference so that the closure can be collected *)
+    !errorContext.(!errorContextDepth) <- noContext
+  end else
+    s (fprintf !logChannel "Bug: cannot pop error context")
 
 
 let withContext ctx f x =
@@ -76,18 +98,19 @@ let withContext ctx f x =
                                          * errorContext as it was when it was
                                          * pushed *)
 let showContext () =
-  let rec loop = function
-      [] -> ()
-    | f :: rest -> (errorContext := rest; (* Just in case f raises an error *)
-                    ignore (fprintf !logChannel "  Context : %t@!" f);
-                    loop rest)
+  let old = !errorContextDepth in
+  let rec loop i =
+    if i >= 0 then begin
+      errorContextDepth := i;           (* Just in case f raises an error *)
+      ignore (fprintf !logChannel "  Context : %t@!" (!errorContext).(i));
+      loop (i - 1)
+    end
   in
-  let old = !errorContext in
   try
-    loop old;
-    errorContext := old
+    loop (old - 1);
+    errorContextDepth := old
   with e -> begin
-    errorContext := old;
+    errorContextDepth := old;
     raise e
   end
 
@@ -132,24 +155,104 @@ let unimp (fmt : ('a,unit,doc,unit) format4) : 'a =
   in
   Pretty.gprintf f fmt
 
+(* Consume the arguments of a suppressed diagnostic without building its
+ * doc. cabs2cil emits optional warnings liberally, so with -w off the
+ * formatting cost matters; this costs only the flag test. *)
+let dropFormat (fmt : ('a,unit,doc,unit) format4) : 'a =
+  Printf.ikfprintf (fun () -> ()) () fmt
+
+(* In a merged whole-program run the same warning can be emitted once
+ * per including translation unit: tens of thousands of identical lines.
+ * With this flag set, a diagnostic keyed by (digest of its format
+ * string, header location) is printed the first time only; repeats just
+ * bump a counter, without even formatting the message, and are summed
+ * up by printDedupReport at exit. *)
+let dedupDiagnostics = ref false
+
+type dedupInfo = { dFmt: string;     (* The message template *)
+                   dLoc: string;     (* The header location, "" if none *)
+                   mutable dCount: int } (* Suppressed repeats *)
+
+let seenDiagnostics : (string * string, dedupInfo) Hashtbl.t =
+  Hashtbl.create 117
+
+(* Record an occurrence of a diagnostic with the given format string and
+ * header location. Returns true if it is a repeat that the caller
+ * should suppress; the check costs a digest of the static format
+ * string and one table lookup, not a doc render. *)
+let isDuplicate (fmtstr: string) (loc: string) : bool =
+  !dedupDiagnostics &&
+  begin
+    let key = (Digest.string fmtstr, loc) in
+    try
+      let di = Hashtbl.find seenDiagnostics key in
+      di.dCount <- di.dCount + 1;
+      true
+    with Not_found ->
+      Hashtbl.add seenDiagnostics key
+        { dFmt = fmtstr; dLoc = loc; dCount = 0 };
+      false
+  end
+
+let printDedupReport (chn: out_channel) : unit =
+  let repeated =
+    Hashtbl.fold
+      (fun _ di acc -> if di.dCount > 0 then di :: acc else acc)
+      seenDiagnostics [] in
+  match repeated with
+    [] -> ()
+  | _ ->
+      let repeated =
+        List.sort (fun d1 d2 -> compare d2.dCount d1.dCount) repeated in
+      Printf.fprintf chn
+        "Repeated diagnostics (each printed once above):\n";
+      List.iter
+        (fun di ->
+          Printf.fprintf chn "  %s%s : %d more time%s\n"
+            (if di.dLoc = "" then "" else di.dLoc ^ ": ")
+            di.dFmt di.dCount (if di.dCount = 1 then "" else "s"))
+        repeated;
+      flush chn
+
 let warn (fmt : ('a,unit,doc,unit) format4) : 'a =
-  let f d =
-    if !colorFlag then output_string !logChannel yellowEscStr;
-    contextMessage "Warning" d;
-    if !colorFlag then output_string !logChannel resetEscStr;
-    flush !logChannel
-  in
-  Pretty.gprintf f fmt
+  if isDuplicate (string_of_format fmt) "" then
+    dropFormat fmt
+  else
+    let f d =
+      if !colorFlag then output_string !logChannel yellowEscStr;
+      contextMessage "Warning" d;
+      if !colorFlag then output_string !logChannel resetEscStr;
+      flush !logChannel
+    in
+    Pretty.gprintf f fmt
+
+(* Count the diagnostics that were suppressed, keyed by their format
+ * string, which is the closest thing a message has to a category. The
+ * table stays small because the keys are the static message templates. *)
+let suppressedCounts : (string, int) Hashtbl.t = Hashtbl.create 17
+
+let suppressedDiagnostics () : (string * int) list =
+  let l = Hashtbl.fold (fun k n acc -> (k, n) :: acc) suppressedCounts [] in
+  List.sort (fun (_, n1) (_, n2) -> compare n2 n1) l
 
 let warnOpt (fmt : ('a,unit,doc,unit) format4) : 'a =
-    let f d =
-      if !warnFlag then begin
+  if !warnFlag then begin
+    if isDuplicate (string_of_format fmt) "" then
+      dropFormat fmt
+    else
+      let f d =
         if !colorFlag then output_string !logChannel yellowEscStr;
         contextMessage "Warning" d;
         if !colorFlag then output_string !logChannel resetEscStr;
-      end;
-      flush !logChannel in
-    Pretty.gprintf f fmt
+        flush !logChannel in
+      Pretty.gprintf f fmt
+  end
+  else begin
+    let key = string_of_format fmt in
+    let prev = try Hashtbl.find suppressedCounts key with Not_found -> 0 in
+    Hashtbl.replace suppressedCounts key (prev + 1);
+    dropFormat fmt
+  end
 
 
 let log (fmt : ('a,unit,doc,unit) format4) : 'a =
@@ -161,8 +264,7 @@ let logg (fmt : ('a,unit,doc,unit) format4) : 'a =
   Pretty.gprintf f fmt
 
 let null (fmt : ('a,unit,doc,unit) format4) : 'a =
-  let f d = () in
-  Pretty.gprintf f fmt
+  dropFormat fmt
 
 
 let theLexbuf = ref (Lexing.from_string "")
@@ -231,6 +333,26 @@ let cleanFileName str =
 
 let readingFromStdin = ref false
 
+(* If true (the default) the input is read into memory in one go and
+ * lexed from there, instead of through the small refill buffer of
+ * Lexing.from_channel. Preprocessed files are routinely many megabytes
+ * and the refill copies show up in profiles. *)
+let lexWholeFiles = ref true
+
+let readWholeChannel (ic: in_channel) : string =
+  let chunk = 65536 in
+  let buf = Buffer.create chunk in
+  let bytes = Bytes.create chunk in
+  let rec loop () =
+    let n = input ic bytes 0 chunk in
+    if n > 0 then begin
+      Buffer.add_subbytes buf bytes 0 n;
+      loop ()
+    end
+  in
+  loop ();
+  Buffer.contents buf
+
 let startParsing ?(useBasename=true) (fname: string) =
   (* We only support one open file at a time *)
   if !current != dummyinfo then begin
@@ -246,12 +368,20 @@ let startParsing ?(useBasename=true) (fname: string) =
         end
     with e -> s (error "Cannot find input file %s (exception %s"
                     fname (Printexc.to_string e)) in
-  let lexbuf = Lexing.from_channel inchan in
+  let lexbuf, inchan' =
+    if !lexWholeFiles then begin
+      (* Slurp the whole input and lex it from memory. We can close the
+       * channel right away. *)
+      let str = readWholeChannel inchan in
+      if inchan != stdin then close_in inchan;
+      Lexing.from_string str, None
+    end else
+      Lexing.from_channel inchan, Some inchan in
   let i =
     { linenum = 1; linestart = 0;
       fileName =
         cleanFileName (if useBasename then Filename.basename fname else fname);
-      lexbuf = lexbuf; inchan = Some inchan;
+      lexbuf = lexbuf; inchan = inchan';
       hfile = ""; hline = 0;
       num_errors = 0 } in
 
@@ -350,9 +480,14 @@ type location =
 let d_loc () l =
   text (l.file ^ ":" ^ string_of_int l.line)
 
+(* These are applied once per message; compile the formats ahead of time *)
+let d_hloc_fmt = Pretty.compileFormat "%s:%d%a"
+let d_hloc_hfmt = Pretty.compileFormat " (%s:%d)"
+
 let d_hloc () (l: location) =
-  dprintf "%s:%d%a" l.file l.line
-    insert (if l.hline > 0 then dprintf " (%s:%d)" l.hfile l.hline else nil)
+  Pretty.dprintfc d_hloc_fmt l.file l.line
+    insert
+    (if l.hline > 0 then Pretty.dprintfc d_hloc_hfmt l.hfile l.hline else nil)
 
 let locUnknown = { file = ""; hfile = ""; line = -1; hline = -1 }
 
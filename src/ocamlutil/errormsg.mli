@@ -89,10 +89,35 @@ val hadErrors: bool ref
  * exception. Return type is unit. *)
 val warn:    ('a,unit,Pretty.doc,unit) format4 -> 'a
 
-(** Like {!Errormsg.warn} but optional. Printed only if the 
- * {!Errormsg.warnFlag} is set *)
+(** Like {!Errormsg.warn} but optional. Printed only if the
+ * {!Errormsg.warnFlag} is set. When the flag is not set the message is
+ * not even formatted; only a suppression counter is bumped *)
 val warnOpt: ('a,unit,Pretty.doc,unit) format4 -> 'a
 
+(** The diagnostics suppressed so far because {!Errormsg.warnFlag} was
+ * not set, keyed by their format string and sorted by decreasing count *)
+val suppressedDiagnostics: unit -> (string * int) list
+
+(** When set, each diagnostic keyed by (digest of its format string,
+ * header location) is printed the first time only; repeats are counted
+ * and not even formatted. Print the counts with
+ * {!Errormsg.printDedupReport} at exit. Useful in merged whole-program
+ * runs, where the same warning is otherwise emitted once per including
+ * translation unit. (default: false) *)
+val dedupDiagnostics: bool ref
+
+(** Record an occurrence of a diagnostic with the given format string
+ * and header location ("" if there is none). Returns true if it is a
+ * repeat the caller should suppress. Always false unless
+ * {!Errormsg.dedupDiagnostics} is set. Used by the location-aware
+ * warning wrappers in Cil. *)
+val isDuplicate: string -> string -> bool
+
+(** Print the diagnostics suppressed as duplicates, with their repeat
+ * counts, sorted by decreasing count. Prints nothing if there were
+ * none. *)
+val printDedupReport: out_channel -> unit
+
 (** Print something to [logChannel] *)
 val log:           ('a,unit,Pretty.doc,unit) format4 -> 'a
 
@@ -108,7 +133,10 @@ val logg:          ('a,unit,Pretty.doc,unit) format4 -> 'a
 (** Do not actually print (i.e. print to /dev/null) *)
 val null : ('a,unit,Pretty.doc,unit) format4 -> 'a
 
-(** Registers a context printing function *)
+(** Registers a context printing function. The function is kept
+    unevaluated on a preallocated stack; push and pop are O(1) and do not
+    allocate once the stack has reached its high-water mark, so this is
+    cheap to do around every scope on error-free runs. *)
 val pushContext  : (unit -> Pretty.doc) -> unit
 
 (** Removes the last registered context printing function *)
@@ -159,6 +187,11 @@ val locUnknown: location
 (** Records whether the stdin is open for reading the goal **)
 val readingFromStdin: bool ref
 
+(** If true (the default) the input is read into memory in one go and lexed
+ * from there, instead of through the refill buffer of a channel-based
+ * lexbuf. Set to false to get the old channel-based behavior. *)
+val lexWholeFiles: bool ref
+
 
 (* Call this function to start parsing. useBasename is by default "true", 
  * meaning that the error information maintains only the basename. If the 
@@ -17,24 +17,18 @@ type 'a t = {
     mutable gaData: 'a LA.t;
   } 
 
-let growTheArray (ga: 'a t) (len: int) 
-                 (toidx: int) (why: string) : unit = 
+let growTheArray (ga: 'a t) (len: int)
+                 (toidx: int) (why: string) : unit =
   if toidx >= len then begin
-    (* Grow the array by 50% *)
-    let newlen = toidx + 1 + len  / 2 in
 (*
     ignore (E.log "growing an array to idx=%d (%s)\n" toidx why);
 *)
-    let data' = begin match ga.gaFill with
-      Elem x ->
-	let data'' = LA.create newlen x in
-	LA.blit ga.gaData 0 data'' 0 len;
-	data''
-    | Susp f -> LA.init newlen
-	  (fun i -> if i < len then LA.get ga.gaData i else f i)
-    end
-    in
-    ga.gaData <- data'
+    (* The storage is chunked, so growing allocates fresh chunks without
+     * copying the existing elements; there is no need to over-allocate
+     * for amortization *)
+    match ga.gaFill with
+      Elem x -> LA.grow ga.gaData (toidx + 1) (fun _ -> x)
+    | Susp f -> LA.grow ga.gaData (toidx + 1) f
   end
 
 let max_init_index (ga: 'a t) : int =
@@ -88,8 +82,49 @@ let clear (ga: 'a t) : unit =
     ga.gaMaxInitIndex <- -1
   end
 
-let copy (ga: 'a t) : 'a t = 
-  { ga with gaData = LA.copy ga.gaData } 
+(** Copy [len] elements from [src] starting at [srcidx] into [dst]
+ * starting at [dstidx]. Both arrays grow as needed; the copy itself is
+ * done with [Array.blit] on the underlying storage rather than per
+ * element. *)
+let blit (src: 'a t) (srcidx: int)
+         (dst: 'a t) (dstidx: int) (len: int) : unit =
+  if len < 0 || srcidx < 0 || dstidx < 0 then
+    raise (Invalid_argument "GrowArray.blit");
+  if len > 0 then begin
+    let slen = LA.length src.gaData in
+    if srcidx + len > slen then growTheArray src slen (srcidx + len - 1) "blit";
+    let dlen = LA.length dst.gaData in
+    if dstidx + len > dlen then growTheArray dst dlen (dstidx + len - 1) "blit";
+    LA.blit src.gaData srcidx dst.gaData dstidx len;
+    if dstidx + len - 1 > max_init_index dst then
+      dst.gaMaxInitIndex <- dstidx + len - 1
+  end
+
+(** Return a fresh array holding the initialized elements of [a] followed
+ * by the initialized elements of [b]. The result uses the fill of [a]. *)
+let append (a: 'a t) (b: 'a t) : 'a t =
+  let na = max_init_index a + 1 in
+  let nb = max_init_index b + 1 in
+  let r = make (na + nb) a.gaFill in
+  blit a 0 r 0 na;
+  blit b 0 r na nb;
+  r
+
+(** Set the elements with indices [idx] through [idx + len - 1] to [x],
+ * growing the array as needed *)
+let fill (ga: 'a t) (idx: int) (len: int) (x: 'a) : unit =
+  if len < 0 || idx < 0 then
+    raise (Invalid_argument "GrowArray.fill");
+  if len > 0 then begin
+    let l = LA.length ga.gaData in
+    if idx + len > l then growTheArray ga l (idx + len - 1) "fill";
+    LA.fill ga.gaData idx len x;
+    if idx + len - 1 > max_init_index ga then
+      ga.gaMaxInitIndex <- idx + len - 1
+  end
+
+let copy (ga: 'a t) : 'a t =
+  { ga with gaData = LA.copy ga.gaData }
 
 let deep_copy (ga: 'a t) (copy: 'a -> 'a): 'a t = 
   { ga with gaData = LA.map copy ga.gaData } 
@@ -114,6 +149,16 @@ let iteri  (f: int -> 'a -> unit) (ga: 'a t) =
     f i (LA.get ga.gaData i)
   done
 
+(** Iterate over the elements with indices [lo] through [hi] inclusive,
+ * growing the array to cover the range first *)
+let iter_range (f: int -> 'a -> unit) (ga: 'a t) (lo: int) (hi: int) =
+  if hi >= lo then begin
+    ignore (getg ga hi); (* grow the array to cover the range *)
+    for i = lo to hi do
+      f i (LA.get ga.gaData i)
+    done
+  end
+
 (** Iterate over the elements of 2 arrays *)
 let iter2  (f: int -> 'a -> 'b -> unit) (ga1: 'a t) (ga2: 'b t) = 
   let len1 = max_init_index ga1 in
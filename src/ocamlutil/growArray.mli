@@ -76,6 +76,25 @@ val clear: 'a t -> unit
    max_init_index to -1.  Suspension thunks will be rerun to regenerate the 
    initial values of the array. *)
 
+val blit : 'a t -> int -> 'a t -> int -> int -> unit
+(** [GrowArray.blit src srcidx dst dstidx len] copies [len] elements of
+   [src] starting at [srcidx] into [dst] starting at [dstidx]. Both
+   arrays grow as needed to cover their range; the copy is done with
+   [Array.blit] on the underlying storage, not element by element.
+
+   Raise [Invalid_argument] if [len], [srcidx] or [dstidx] is negative. *)
+
+val append : 'a t -> 'a t -> 'a t
+(** [GrowArray.append a b] returns a fresh array containing the
+   initialized elements of [a] followed by the initialized elements of
+   [b]. The result uses the fill of [a]. *)
+
+val fill : 'a t -> int -> int -> 'a -> unit
+(** [GrowArray.fill a idx len x] sets the elements of [a] with indices
+   [idx] through [idx + len - 1] to [x], growing the array as needed.
+
+   Raise [Invalid_argument] if [idx] or [len] is negative. *)
+
 val copy : 'a t -> 'a t
 (** [GrowArray.copy a] returns a copy of [a], that is, a fresh array
    containing the same elements as [a]. *)
@@ -94,6 +113,11 @@ val iteri : (int -> 'a -> unit) -> 'a t -> unit
    function is applied to the index of the element as first argument,
    and the element itself as second argument. *)
 
+val iter_range : (int -> 'a -> unit) -> 'a t -> int -> int -> unit
+(** [GrowArray.iter_range f a lo hi] applies [f] to the index and value
+   of the elements with indices [lo] through [hi] inclusive, growing the
+   array to cover the range first. *)
+
 val iter2 : (int -> 'a -> 'b -> unit) -> 'a t -> 'b t -> unit
 (** Same as {!GrowArray.iteri}, but the function is applied to two arrays.
   [iter2 f a b]  is equivalent to
@@ -0,0 +1,171 @@
+(* See copyright notice at the end of the file *)
+
+(* An array-backed binary max-heap with an index map from the callers'
+ * integer keys to heap positions, so that the priority of an element
+ * that is already queued can be changed in O(log n) rather than by
+ * queueing a duplicate.  Grew out of the fixed-size heap that used to
+ * live in ext/partial; the partial evaluator's block scheduling and
+ * the sparse constant propagator share it now. *)
+
+type 'a t = {
+  (* slot 0 is a sentinel with infinite priority, so the sift-up loop
+   * needs no bounds check *)
+  mutable prios : int array ;
+  mutable keys  : int array ;
+  mutable data  : 'a option array ;
+  mutable size  : int ;         (* current number of elements *)
+          pos   : int Inthash.t ; (* key -> position in the arrays *)
+}
+
+let create size =
+  let size = max size 1 in
+  {
+    prios = Array.make (size+1) max_int ;
+    keys  = Array.make (size+1) (-1) ;
+    data  = Array.make (size+1) None ;
+    size  = 0 ;
+    pos   = Inthash.create size ;
+  }
+
+let clear heap =
+  heap.size <- 0 ;
+  Inthash.clear heap.pos
+
+let length heap = heap.size
+
+let is_empty heap = (heap.size = 0)
+
+let mem heap key = Inthash.mem heap.pos key
+
+(* place (prio,key,elt) at position i, keeping the index map in sync *)
+let put heap i prio key elt = begin
+  heap.prios.(i) <- prio ;
+  heap.keys.(i) <- key ;
+  heap.data.(i) <- elt ;
+  Inthash.replace heap.pos key i
+end
+
+let move heap i j = put heap i heap.prios.(j) heap.keys.(j) heap.data.(j)
+
+let grow heap = begin
+  let capacity = Array.length heap.prios - 1 in
+  let prios = Array.make (2*capacity+1) max_int in
+  let keys = Array.make (2*capacity+1) (-1) in
+  let data = Array.make (2*capacity+1) None in
+  Array.blit heap.prios 1 prios 1 heap.size ;
+  Array.blit heap.keys 1 keys 1 heap.size ;
+  Array.blit heap.data 1 data 1 heap.size ;
+  heap.prios <- prios ;
+  heap.keys <- keys ;
+  heap.data <- data
+end
+
+let sift_up heap start prio key elt = begin
+  let i = ref start in
+  while heap.prios.(!i / 2) < prio do
+    move heap !i (!i / 2) ;
+    i := (!i / 2)
+  done ;
+  put heap !i prio key elt
+end
+
+let sift_down heap start prio key elt = begin
+  let i = ref start in
+  let break = ref false in
+  while (!i * 2 <= heap.size) && not !break do
+    let child = ref (!i * 2) in
+
+    (* find larger child *)
+    if (!child <> heap.size &&
+        heap.prios.(!child+1) > heap.prios.(!child)) then begin
+        incr child
+    end ;
+
+    (* percolate one level *)
+    if (prio < heap.prios.(!child)) then begin
+      move heap !i !child ;
+      i := !child
+    end else begin
+      break := true
+    end
+  done ;
+  put heap !i prio key elt
+end
+
+let insert heap key prio elt = begin
+  try
+    (* already queued: adjust its priority in place *)
+    let i = Inthash.find heap.pos key in
+    let old = heap.prios.(i) in
+      if prio > old then sift_up heap i prio key (Some elt)
+      else if prio < old then sift_down heap i prio key (Some elt)
+      else heap.data.(i) <- Some elt
+  with Not_found -> begin
+    if heap.size + 1 >= Array.length heap.prios then grow heap ;
+    heap.size <- heap.size + 1 ;
+    sift_up heap heap.size prio key (Some elt)
+  end
+end
+
+let examine_max heap =
+  if is_empty heap then begin
+    raise (Invalid_argument "Heap.examine_max")
+  end ;
+  match heap.data.(1) with
+    Some(elt) -> heap.prios.(1),elt
+  | None -> failwith "Heap.examine_max"
+
+let extract_max heap = begin
+  if is_empty heap then begin
+    raise (Invalid_argument "Heap.extract_max")
+  end ;
+  let max_prio = heap.prios.(1) in
+  let max_elt = heap.data.(1) in
+  Inthash.remove heap.pos heap.keys.(1) ;
+  let last = heap.size in
+  heap.size <- heap.size - 1 ;
+  if heap.size > 0 then
+    sift_down heap 1 heap.prios.(last) heap.keys.(last) heap.data.(last) ;
+  heap.data.(last) <- None ;
+  match max_elt with
+    Some(elt) -> max_prio,elt
+  | None -> failwith "Heap.extract_max"
+  end
+
+
+(*
+ *
+ * Copyright (c) 2001-2002,
+ *  George C. Necula    <necula@cs.berkeley.edu>
+ *  Scott McPeak        <smcpeak@cs.berkeley.edu>
+ *  Wes Weimer          <weimer@cs.berkeley.edu>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the distribution.
+ *
+ * 3. The names of the contributors may not be used to endorse or promote
+ * products derived from this software without specific prior written
+ * permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+ * IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER
+ * OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ *)
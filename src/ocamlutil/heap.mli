@@ -0,0 +1,26 @@
+(* A priority queue (max-heap): priorities are integers, data values
+   are whatever you like.  Every element carries an integer key chosen
+   by the caller (for example a statement id); the heap keeps an index
+   from keys to positions, so re-inserting a queued key adjusts its
+   priority in place -- decrease-key and increase-key in O(log n) --
+   instead of queueing a duplicate.  The array grows on demand. *)
+
+type 'a t
+
+val create : int -> 'a t
+val clear : 'a t -> unit
+val length : 'a t -> int
+val is_empty : 'a t -> bool
+
+(* [insert h key prio elt] adds [elt] under [key] with priority
+   [prio]; if [key] is already queued, its priority and element are
+   replaced and the heap is rearranged accordingly *)
+val insert : 'a t -> int -> int -> 'a -> unit
+
+(* is an element with this key currently queued? *)
+val mem : 'a t -> int -> bool
+
+(* the highest-priority binding, without (resp. with) removing it.
+   Raise [Invalid_argument] if the heap is empty *)
+val examine_max : 'a t -> int * 'a
+val extract_max : 'a t -> int * 'a
@@ -1,191 +1,339 @@
-(** A hash table specialized on integer keys *)
-type 'a t =
-  { mutable size: int;                        (* number of elements *)
-    mutable data: 'a bucketlist array } (* the buckets *)
+(** A hash table specialized on integer keys. The implementation uses open
+ * addressing with linear probing into flat key/value arrays, so lookups
+ * touch consecutive memory instead of chasing bucket-list cells.
+ * Capacities are powers of two and the probe step is a masked increment.
+ * Multiple bindings per key keep the Hashtbl semantics: [add] shadows,
+ * [remove] unshadows. Newer bindings of a key always sit later in its
+ * probe run, and we take care to preserve that invariant when reusing
+ * tombstones and when resizing. *)
+
+(* The per-slot states *)
+let sEmpty = '\000'            (* never occupied; terminates probe runs *)
+let sFull = '\001'             (* holds a binding *)
+let sDeleted = '\002'          (* tombstone: keep probing past it *)
 
-and 'a bucketlist =
-    Empty
-  | Cons of int * 'a * 'a bucketlist
+type 'a t =
+  { mutable size: int;         (* number of live bindings *)
+    mutable occupied: int;     (* live bindings plus tombstones *)
+    mutable mask: int;         (* capacity - 1; capacity is a power of 2 *)
+    mutable state: Bytes.t;
+    mutable keys: int array;
+    mutable vals: 'a option array;   (* Some v exactly when the slot is full *)
+    mutable dupes: bool        (* may some key be bound more than once? *)
+  }
 
 let hash key = key land 0x3fffffff
 
+(* The smallest power of two that accomodates n slots *)
+let roundCapacity (n: int) : int =
+  let rec round c =
+    if c >= n || c lsl 1 >= Sys.max_array_length then c else round (c lsl 1)
+  in
+  round 8
+
 let create initial_size =
-  let s = min (max 1 initial_size) Sys.max_array_length in
-  { size = 0; data = Array.make s Empty }
+  let cap = roundCapacity initial_size in
+  { size = 0; occupied = 0; mask = cap - 1;
+    state = Bytes.make cap sEmpty;
+    keys = Array.make cap 0;
+    vals = Array.make cap None;
+    dupes = false }
 
 let clear h =
-  for i = 0 to Array.length h.data - 1 do
-    h.data.(i) <- Empty
-  done;
-  h.size <- 0
+  Bytes.fill h.state 0 (Bytes.length h.state) sEmpty;
+  Array.fill h.vals 0 (Array.length h.vals) None; (* release the values *)
+  h.size <- 0;
+  h.occupied <- 0;
+  h.dupes <- false
 
 let copy h =
-  { size = h.size;
-    data = Array.copy h.data }
+  { h with
+    state = Bytes.copy h.state;
+    keys = Array.copy h.keys;
+    vals = Array.copy h.vals }
 
 let copy_into src dest =
   dest.size <- src.size;
-  dest.data <- Array.copy src.data
+  dest.occupied <- src.occupied;
+  dest.mask <- src.mask;
+  dest.state <- Bytes.copy src.state;
+  dest.keys <- Array.copy src.keys;
+  dest.vals <- Array.copy src.vals;
+  dest.dupes <- src.dupes
 
 let length h = h.size
 
-let resize tbl =
-  let odata = tbl.data in
-  let osize = Array.length odata in
-  let nsize = min (2 * osize + 1) Sys.max_array_length in
-  if nsize <> osize then begin
-    let ndata = Array.make nsize Empty in
-    let rec insert_bucket = function
-        Empty -> ()
-      | Cons(key, data, rest) ->
-          insert_bucket rest; (* preserve original order of elements *)
-          let nidx = (hash key) mod nsize in
-          ndata.(nidx) <- Cons(key, data, ndata.(nidx)) in
-    for i = 0 to osize - 1 do
-      insert_bucket odata.(i)
-    done;
-    tbl.data <- ndata;
-  end
+(* Insert into freshly built arrays, which contain no tombstones *)
+let insertClean (state: Bytes.t) (keys: int array) (vals: 'a option array)
+                (mask: int) (key: int) (v: 'a option) : unit =
+  let i = ref (hash key land mask) in
+  while Bytes.unsafe_get state !i = sFull do
+    i := (!i + 1) land mask
+  done;
+  Bytes.unsafe_set state !i sFull;
+  keys.(!i) <- key;
+  vals.(!i) <- v
+
+(* Rebuild the arrays at the given capacity (a power of two able to
+ * hold the live bindings), dropping any tombstones *)
+let rebuild h ncap =
+  let ocap = h.mask + 1 in
+  let nmask = ncap - 1 in
+  let nstate = Bytes.make ncap sEmpty in
+  let nkeys = Array.make ncap 0 in
+  let nvals = Array.make ncap None in
+  (* Reinsert each probe run from its start, so that older bindings of a
+   * key keep preceding newer ones. Starting the scan just past an empty
+   * slot guarantees that we never enter a run in the middle, even when
+   * it wraps around. *)
+  let start =
+    let rec findEmpty i =
+      if i > h.mask then 0
+      else if Bytes.get h.state i = sEmpty then i
+      else findEmpty (i + 1)
+    in
+    findEmpty 0
+  in
+  for j = 1 to ocap do
+    let idx = (start + j) land h.mask in
+    if Bytes.get h.state idx = sFull then
+      insertClean nstate nkeys nvals nmask h.keys.(idx) h.vals.(idx)
+  done;
+  h.state <- nstate;
+  h.keys <- nkeys;
+  h.vals <- nvals;
+  h.mask <- nmask;
+  h.occupied <- h.size
+
+let resize h =
+  let ocap = h.mask + 1 in
+  if ocap lsl 1 < Sys.max_array_length then
+    rebuild h (ocap lsl 1)
+
+(* Keep the load factor, tombstones included, under 3/4 *)
+let maybeGrow h =
+  if 4 * (h.occupied + 1) > 3 * (h.mask + 1) then resize h
 
 let add h key info =
-  let i = (hash key) mod (Array.length h.data) in
-  let bucket = Cons(key, info, h.data.(i)) in
-  h.data.(i) <- bucket;
-  h.size <- succ h.size;
-  if h.size > Array.length h.data lsl 1 then resize h
+  maybeGrow h;
+  let mask = h.mask in
+  let state = h.state and keys = h.keys in
+  let i = ref (hash key land mask) in
+  let tomb = ref (-1) in   (* first tombstone of the run *)
+  let seen = ref false in  (* does the run already bind this key? *)
+  while Bytes.unsafe_get state !i <> sEmpty do
+    if Bytes.unsafe_get state !i = sFull then begin
+      if Array.unsafe_get keys !i = key then seen := true
+    end else
+      if !tomb < 0 then tomb := !i;
+    i := (!i + 1) land mask
+  done;
+  (* If the key is already bound we must append at the end of the run to
+   * stay the newest binding; otherwise the first tombstone will do *)
+  let slot = if !seen || !tomb < 0 then !i else !tomb in
+  if !seen then h.dupes <- true;
+  if Bytes.get h.state slot = sEmpty then h.occupied <- h.occupied + 1;
+  Bytes.set h.state slot sFull;
+  h.keys.(slot) <- key;
+  h.vals.(slot) <- Some info;
+  h.size <- succ h.size
 
 let remove h key =
-  let rec remove_bucket = function
-      Empty ->
-        Empty
-    | Cons(k, i, next) ->
-        if k = key
-        then begin h.size <- pred h.size; next end
-        else Cons(k, i, remove_bucket next) in
-  let i = (hash key) mod (Array.length h.data) in
-  h.data.(i) <- remove_bucket h.data.(i)
+  let mask = h.mask in
+  let state = h.state and keys = h.keys in
+  let rec probe i last =
+    if Bytes.unsafe_get state i = sEmpty then last
+    else begin
+      let last' =
+        if Bytes.unsafe_get state i = sFull
+            && Array.unsafe_get keys i = key then i
+        else last
+      in
+      if last' >= 0 && not h.dupes then last'
+      else probe ((i + 1) land mask) last'
+    end
+  in
+  (* The newest binding is the last one in the run *)
+  let slot = probe (hash key land mask) (-1) in
+  if slot >= 0 then begin
+    Bytes.set h.state slot sDeleted;
+    h.vals.(slot) <- None;
+    h.size <- pred h.size
+  end
 
 let remove_all h key =
-  let rec remove_bucket = function
-      Empty ->
-        Empty
-    | Cons(k, i, next) ->
-        if k = key
-        then begin h.size <- pred h.size;
-	  remove_bucket next end
-        else Cons(k, i, remove_bucket next) in
-  let i = (hash key) mod (Array.length h.data) in
-  h.data.(i) <- remove_bucket h.data.(i)
-
-let rec find_rec key = function
-    Empty ->
-      raise Not_found
-  | Cons(k, d, rest) ->
-      if key = k then d else find_rec key rest
+  let mask = h.mask in
+  let rec probe i =
+    if Bytes.unsafe_get h.state i <> sEmpty then begin
+      if Bytes.unsafe_get h.state i = sFull && h.keys.(i) = key then begin
+        Bytes.unsafe_set h.state i sDeleted;
+        h.vals.(i) <- None;
+        h.size <- pred h.size
+      end;
+      probe ((i + 1) land mask)
+    end
+  in
+  probe (hash key land mask)
 
 let find h key =
-  match h.data.((hash key) mod (Array.length h.data)) with
-    Empty -> raise Not_found
-  | Cons(k1, d1, rest1) ->
-      if key = k1 then d1 else
-      match rest1 with
-        Empty -> raise Not_found
-      | Cons(k2, d2, rest2) ->
-          if key = k2 then d2 else
-          match rest2 with
-            Empty -> raise Not_found
-          | Cons(k3, d3, rest3) ->
-              if key = k3 then d3 else find_rec key rest3
+  let mask = h.mask in
+  let state = h.state and keys = h.keys and vals = h.vals in
+  let rec probe i (last: 'a option) =
+    if Bytes.unsafe_get state i = sEmpty then begin
+      match last with
+        Some v -> v
+      | None -> raise Not_found
+    end
+    else if Bytes.unsafe_get state i = sFull
+        && Array.unsafe_get keys i = key then begin
+      if h.dupes then
+        (* Keep probing: a newer binding may follow *)
+        probe ((i + 1) land mask) (Array.unsafe_get vals i)
+      else
+        match Array.unsafe_get vals i with
+          Some v -> v
+        | None -> raise Not_found (* cannot happen: the slot is full *)
+    end
+    else probe ((i + 1) land mask) last
+  in
+  probe (hash key land mask) None
 
 let find_all h key =
-  let rec find_in_bucket = function
-    Empty ->
-      []
-  | Cons(k, d, rest) ->
-      if k = key then d :: find_in_bucket rest else find_in_bucket rest in
-  find_in_bucket h.data.((hash key) mod (Array.length h.data))
+  let mask = h.mask in
+  let state = h.state and keys = h.keys and vals = h.vals in
+  (* The probe run lists bindings oldest first; consing returns them
+   * newest first, as Hashtbl.find_all does *)
+  let rec probe i acc =
+    if Bytes.unsafe_get state i = sEmpty then acc
+    else begin
+      let acc =
+        if Bytes.unsafe_get state i = sFull
+            && Array.unsafe_get keys i = key then
+          match Array.unsafe_get vals i with
+            Some v -> v :: acc
+          | None -> acc
+        else acc
+      in
+      probe ((i + 1) land mask) acc
+    end
+  in
+  probe (hash key land mask) []
 
 let tryfind h key =
   try Some(find h key)
   with Not_found -> None
 
 let replace h key info =
-  let rec replace_bucket = function
-      Empty ->
-        raise Not_found
-    | Cons(k, i, next) ->
-        if k = key
-        then Cons(k, info, next)
-        else Cons(k, i, replace_bucket next) in
-  let i = (hash key) mod (Array.length h.data) in
-  let l = h.data.(i) in
-  try
-    h.data.(i) <- replace_bucket l
-  with Not_found ->
-    h.data.(i) <- Cons(key, info, l);
-    h.size <- succ h.size;
-    if h.size > Array.length h.data lsl 1 then resize h
+  let mask = h.mask in
+  let state = h.state and keys = h.keys in
+  let rec probe i last =
+    if Bytes.unsafe_get state i = sEmpty then last
+    else begin
+      let last' =
+        if Bytes.unsafe_get state i = sFull
+            && Array.unsafe_get keys i = key then i
+        else last
+      in
+      if last' >= 0 && not h.dupes then last'
+      else probe ((i + 1) land mask) last'
+    end
+  in
+  (* Replace the newest binding, or add one if the key is unbound *)
+  let slot = probe (hash key land mask) (-1) in
+  if slot >= 0 then
+    h.vals.(slot) <- Some info
+  else
+    add h key info
 
 let mem h key =
-  let rec mem_in_bucket = function
-  | Empty ->
-      false
-  | Cons(k, d, rest) ->
-      k = key || mem_in_bucket rest in
-  mem_in_bucket h.data.((hash key) mod (Array.length h.data))
+  let mask = h.mask in
+  let state = h.state and keys = h.keys in
+  let rec probe i =
+    if Bytes.unsafe_get state i = sEmpty then false
+    else
+      (Bytes.unsafe_get state i = sFull && Array.unsafe_get keys i = key)
+      || probe ((i + 1) land mask)
+  in
+  probe (hash key land mask)
 
 let iter (f: int -> 'a -> unit) (h: 'a t) : unit =
-  let rec do_bucket = function
-      Empty ->
-        ()
-    | Cons(k, d, rest) ->
-        f k d; do_bucket rest in
-  let d = h.data in
-  for i = 0 to Array.length d - 1 do
-    do_bucket d.(i)
+  let state = h.state and keys = h.keys and vals = h.vals in
+  for i = 0 to h.mask do
+    if Bytes.unsafe_get state i = sFull then
+      match Array.unsafe_get vals i with
+        Some v -> f keys.(i) v
+      | None -> ()
   done
 
 let fold (f: int -> 'a -> 'b -> 'b) (h: 'a t) (init: 'b) =
-  let rec do_bucket b accu =
-    match b with
-      Empty ->
-        accu
-    | Cons(k, d, rest) ->
-        do_bucket rest (f k d accu) in
-  let d = h.data in
+  let state = h.state and keys = h.keys and vals = h.vals in
   let accu = ref init in
-  for i = 0 to Array.length d - 1 do
-    accu := do_bucket d.(i) !accu
+  for i = 0 to h.mask do
+    if Bytes.unsafe_get state i = sFull then
+      match Array.unsafe_get vals i with
+        Some v -> accu := f keys.(i) v !accu
+      | None -> ()
   done;
   !accu
 
 
+(* Keep only the bindings the predicate accepts. The rejected slots
+ * become tombstones; call compact afterwards if most bindings went
+ * away and the table is long-lived *)
+let retain (f: int -> 'a -> bool) (h: 'a t) : unit =
+  let state = h.state and keys = h.keys and vals = h.vals in
+  for i = 0 to h.mask do
+    if Bytes.unsafe_get state i = sFull then
+      match Array.unsafe_get vals i with
+        Some v ->
+          if not (f keys.(i) v) then begin
+            Bytes.unsafe_set state i sDeleted;
+            vals.(i) <- None;
+            h.size <- pred h.size
+          end
+      | None -> ()
+  done
+
+(* Shrink the arrays to the smallest capacity that keeps the load
+ * factor under 3/4 for the live bindings, dropping the tombstones *)
+let compact (h: 'a t) : unit =
+  let rec capFor c =
+    if 4 * (h.size + 1) <= 3 * c || c lsl 1 >= Sys.max_array_length then c
+    else capFor (c lsl 1)
+  in
+  let ncap = capFor 8 in
+  if ncap <> h.mask + 1 || h.occupied > h.size then rebuild h ncap
+
+(* A pool of reusable tables, for passes that build and drop a table
+ * per function. Tables come back from the pool already cleared and
+ * sized for the expected population, so the per-function arrays are
+ * allocated once instead of once per function *)
+type 'a pool =
+  { pcap: int;                  (* capacity of the tables we hand out *)
+    mutable pfree: 'a t list }
+
+let mkPool (expected: int) : 'a pool =
+  { pcap = roundCapacity expected; pfree = [] }
+
+let getTable (p: 'a pool) : 'a t =
+  match p.pfree with
+    t :: rest -> p.pfree <- rest; t
+  | [] -> create p.pcap
+
+let putTable (p: 'a pool) (t: 'a t) : unit =
+  (* Do not let one oversized function pin a huge table in the pool *)
+  if t.mask + 1 > 8 * p.pcap then ()
+  else begin
+    clear t;
+    p.pfree <- t :: p.pfree
+  end
+
 let memoize (h: 'a t) (key: int) (f: int -> 'a) : 'a =
-  let i = (hash key) mod (Array.length h.data) in
-  let rec find_rec key = function
-      Empty -> addit ()
-    | Cons(k, d, rest) ->
-        if key = k then d else find_rec key rest
-  and find_in_bucket key = function
-      Empty -> addit ()
-    | Cons(k1, d1, rest1) ->
-        if key = k1 then d1 else
-        match rest1 with
-          Empty -> addit ()
-        | Cons(k2, d2, rest2) ->
-            if key = k2 then d2 else
-            match rest2 with
-              Empty -> addit ()
-            | Cons(k3, d3, rest3) ->
-                if key = k3 then d3 else find_rec key rest3
-  and addit () =
+  try find h key
+  with Not_found ->
     let it = f key in
-    h.data.(i) <- Cons(key, it, h.data.(i));
-    h.size <- succ h.size;
-    if h.size > Array.length h.data lsl 1 then resize h;
+    add h key it;
     it
-  in
-  find_in_bucket key h.data.(i)
 
 
 let tolist (h: 'a t) : (int * 'a) list =
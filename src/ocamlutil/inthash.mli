@@ -23,6 +23,24 @@ val tryfind: 'a t -> int -> 'a option
 val iter: (int -> 'a -> unit) -> 'a t -> unit
 val fold: (int -> 'a -> 'b -> 'b) -> 'a t -> 'b -> 'b
 
+(* Keep only the bindings the predicate accepts. Cheaper than removing
+   the rejected keys one by one; call compact afterwards if most
+   bindings went away and the table is long-lived. *)
+val retain: (int -> 'a -> bool) -> 'a t -> unit
+
+(* Shrink the table to the smallest capacity that holds its current
+   bindings, releasing the capacity left behind by removals. *)
+val compact: 'a t -> unit
+
+(* A pool of reusable tables for passes that build and drop a table per
+   function: getTable returns a cleared table sized for the population
+   the pool was created for, and putTable gives it back. Tables that
+   grew far beyond the expected size are dropped instead of pooled. *)
+type 'a pool
+val mkPool: int -> 'a pool
+val getTable: 'a pool -> 'a t
+val putTable: 'a pool -> 'a t -> unit
+
 val memoize: 'a t -> int -> (int -> 'a) -> 'a
 
 val tolist: 'a t -> (int * 'a) list
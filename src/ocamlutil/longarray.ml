@@ -1,91 +1,120 @@
 (* The Longarray module is designed to work around the maximum array size
  * imposed by OCaml's built-in Array module.  Longarray provides the
  * same interface as Array (well, a portion of it) and is implemented as
- * a list of arrays.  For arrays shorter than the maximum length, the
- * only cost is an additional level of indirection. *)
+ * a table of fixed-size chunks.  Growing an array never copies the
+ * elements: fresh chunks are allocated and, rarely, the small table of
+ * chunk pointers is doubled.  Indexing costs one extra indirection. *)
 
 open Pretty
 
-module E = Errormsg
+let chunkBits = 12
+let chunkSize = 1 lsl chunkBits         (* 4096 elements per chunk *)
+let chunkMask = chunkSize - 1
 
-type 'a t = 'a array list
+type 'a t = {
+  mutable chunks: 'a array array;
+          (* The chunk table. The first nrChunks entries are arrays of
+           * exactly chunkSize elements; the remaining entries are empty
+           * arrays. *)
+  mutable nrChunks: int;
+}
 
-let split_len (len: int) : int * int =
-  if len <= Sys.max_array_length then
-    len, 0
-  else
-    Sys.max_array_length, len - Sys.max_array_length
+(* How many chunks are needed for len elements *)
+let chunksFor (len: int) : int = (len + chunkMask) lsr chunkBits
 
-let split_idx (idx: int) : int option =
-  if idx < Sys.max_array_length then
-    None
-  else
-    Some (idx - Sys.max_array_length)
-
-let rec create (len: int) (init: 'a) : 'a t =
-  let len1, len2 = split_len len in
-  (Array.make len1 init) :: (if len2 > 0 then create len2 init else [])
-
-let rec init (len: int) (fn: int -> 'a) : 'a t =
-  let len1, len2 = split_len len in
-  let fn2 i = fn (i + len1) in
-  (Array.init len1 fn) :: (if len2 > 0 then init len2 fn2 else [])
-
-let rec blit (src: 'a t) (srcidx: int)
-             (dst: 'a t) (dstidx: int) (len: int) : unit =
-  if srcidx != 0 || dstidx != 0 then
-    E.s (E.unimp "Longarray.blit with nonzero src/dst indices");
-  try
-    let len1, len2 = split_len len in
-    Array.blit (List.hd src) 0 (List.hd dst) 0 len1;
-    if len2 > 0 then
-      blit (List.tl src) 0 (List.tl dst) 0 len2
-  with Failure _ ->
-    raise (Invalid_argument "Longarray.blit")
-
-let rec fill (a: 'a t) (idx: int) (len: int) (elt: 'a) : unit =
-  try
-    match split_idx idx with
-    | None ->
-        let end1, end2 = split_len (idx + len) in
-        Array.fill (List.hd a) idx (end1 - idx) elt;
-        if end2 > 0 then
-          fill (List.tl a) 0 end2 elt
-    | Some idx' ->
-        fill (List.tl a) idx' len elt
-  with Failure _ ->
-    raise (Invalid_argument "Longarray.fill")
-
-let rec length (a: 'a t) : int =
-  match a with
-  | hd :: tl -> Array.length hd + length tl
-  | [] -> 0
-
-let rec get (a: 'a t) (i: int) : 'a =
-  try
-    match split_idx i with
-    | None -> Array.get (List.hd a) i
-    | Some i' -> get (List.tl a) i'
-  with Failure _ ->
-    raise (Invalid_argument "(get) index out of bounds")
-
-let rec set (a: 'a t) (i: int) (elt: 'a) : unit =
-  try
-    match split_idx i with
-    | None -> Array.set (List.hd a) i elt
-    | Some i' -> set (List.tl a) i' elt
-  with Failure _ ->
-    raise (Invalid_argument "(set) index out of bounds")
-
-let rec copy (a: 'a t) : 'a t =
-  match a with
-  | hd :: tl -> Array.copy hd :: copy tl
-  | [] -> []
-
-let rec map (fn: 'a -> 'b) (a: 'a t) : 'b t =
-  match a with
-  | hd :: tl -> Array.map fn hd :: map fn tl
-  | [] -> []
+let makeChunk (fn: int -> 'a) (base: int) : 'a array =
+  Array.init chunkSize (fun j -> fn (base + j))
+
+let create (len: int) (init: 'a) : 'a t =
+  let nr = chunksFor len in
+  { chunks = Array.init nr (fun _ -> Array.make chunkSize init);
+    nrChunks = nr }
+
+let init (len: int) (fn: int -> 'a) : 'a t =
+  let nr = chunksFor len in
+  { chunks = Array.init nr (fun i -> makeChunk fn (i lsl chunkBits));
+    nrChunks = nr }
+
+let length (a: 'a t) : int =
+  a.nrChunks lsl chunkBits
+
+(* Extend to at least newlen elements, initializing the fresh slots with
+ * fn. The existing chunks are not touched, much less copied; only the
+ * table of chunk pointers may be reallocated. *)
+let grow (a: 'a t) (newlen: int) (fn: int -> 'a) : unit =
+  let nr = chunksFor newlen in
+  if nr > a.nrChunks then begin
+    if nr > Array.length a.chunks then begin
+      (* Double the pointer table; this copies pointers, not elements *)
+      let ncap = max nr (2 * Array.length a.chunks) in
+      let nchunks = Array.make ncap [||] in
+      Array.blit a.chunks 0 nchunks 0 a.nrChunks;
+      a.chunks <- nchunks
+    end;
+    for i = a.nrChunks to nr - 1 do
+      a.chunks.(i) <- makeChunk fn (i lsl chunkBits)
+    done;
+    a.nrChunks <- nr
+  end
+
+let get (a: 'a t) (i: int) : 'a =
+  if i < 0 || i lsr chunkBits >= a.nrChunks then
+    raise (Invalid_argument "(get) index out of bounds");
+  Array.unsafe_get (Array.unsafe_get a.chunks (i lsr chunkBits))
+    (i land chunkMask)
+
+let set (a: 'a t) (i: int) (elt: 'a) : unit =
+  if i < 0 || i lsr chunkBits >= a.nrChunks then
+    raise (Invalid_argument "(set) index out of bounds");
+  Array.unsafe_set (Array.unsafe_get a.chunks (i lsr chunkBits))
+    (i land chunkMask) elt
+
+let blit (src: 'a t) (srcidx: int)
+         (dst: 'a t) (dstidx: int) (len: int) : unit =
+  if len < 0 || srcidx < 0 || srcidx + len > length src
+     || dstidx < 0 || dstidx + len > length dst then
+    raise (Invalid_argument "Longarray.blit");
+  if src == dst && dstidx > srcidx && srcidx + len > dstidx then
+    (* An overlapping move towards higher indices: copy backwards, so
+     * that no element is overwritten before it has been read *)
+    for i = len - 1 downto 0 do
+      set dst (dstidx + i) (get src (srcidx + i))
+    done
+  else begin
+    (* Copy the longest stretch that stays within one chunk on both
+     * sides at a time *)
+    let rec doChunks (si: int) (di: int) (left: int) : unit =
+      if left > 0 then begin
+        let soff = si land chunkMask in
+        let doff = di land chunkMask in
+        let n = min left (min (chunkSize - soff) (chunkSize - doff)) in
+        Array.blit src.chunks.(si lsr chunkBits) soff
+                   dst.chunks.(di lsr chunkBits) doff n;
+        doChunks (si + n) (di + n) (left - n)
+      end
+    in
+    doChunks srcidx dstidx len
+  end
+
+let fill (a: 'a t) (idx: int) (len: int) (elt: 'a) : unit =
+  if idx < 0 || len < 0 || idx + len > length a then
+    raise (Invalid_argument "Longarray.fill");
+  let rec doChunks (i: int) (left: int) : unit =
+    if left > 0 then begin
+      let off = i land chunkMask in
+      let n = min left (chunkSize - off) in
+      Array.fill a.chunks.(i lsr chunkBits) off n elt;
+      doChunks (i + n) (left - n)
+    end
+  in
+  doChunks idx len
+
+let copy (a: 'a t) : 'a t =
+  { a with chunks = Array.map Array.copy a.chunks }
+
+let map (fn: 'a -> 'b) (a: 'a t) : 'b t =
+  { chunks = Array.map (Array.map fn) a.chunks;
+    nrChunks = a.nrChunks }
 
 let docArray ?(sep = chr ',') (doit: int -> 'a -> doc)
              () (elements: 'a t) =
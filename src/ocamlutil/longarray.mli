@@ -1,13 +1,22 @@
 (* The Longarray module is designed to work around the maximum array size
  * imposed by OCaml's built-in Array module.  Longarray provides the
  * same interface as Array (well, a portion of it) and is implemented as
- * a list of arrays.  For arrays shorter than the maximum length, the
- * only cost is an additional level of indirection. *)
+ * a table of fixed-size chunks, so it can also grow in place: fresh
+ * chunks are allocated without copying the existing elements.  The only
+ * cost is an additional level of indirection. *)
 
 type 'a t
 
 val create : int -> 'a -> 'a t
 val init : int -> (int -> 'a) -> 'a t
+
+(* [grow a newlen fn] extends [a] to at least [newlen] elements, filling
+ * the fresh slots with [fn].  The existing elements are not copied. *)
+val grow : 'a t -> int -> (int -> 'a) -> unit
+
+(* [blit src srcidx dst dstidx len] copies a chunk-sized stretch at a
+ * time; overlapping ranges within the same array behave as with
+ * [Array.blit]. *)
 val blit : 'a t -> int -> 'a t -> int -> int -> unit
 val fill : 'a t -> int -> int -> 'a -> unit
 val length : 'a t -> int
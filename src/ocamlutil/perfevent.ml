@@ -0,0 +1,37 @@
+(* Access to the Linux perf_event hardware counters. See perfevent.mli *)
+
+type sample = {
+    cycles: int64;
+    instructions: int64;
+    cacheMisses: int64;
+    branchMisses: int64;
+  }
+
+(* The stubs are in perfstubs.c. perf_read returns the four counters in
+ * the order of the fields of "sample" *)
+external perf_start : unit -> bool = "cil_perf_start"
+external perf_read : unit -> int64 array = "cil_perf_read"
+external perf_stop : unit -> unit = "cil_perf_stop"
+
+let active = ref false
+
+let start () : bool =
+  if not !active then active := perf_start ();
+  !active
+
+let stop () : unit =
+  if !active then begin
+    perf_stop ();
+    active := false
+  end
+
+let zeroSample =
+  { cycles = 0L; instructions = 0L; cacheMisses = 0L; branchMisses = 0L }
+
+let sample () : sample =
+  if !active then
+    let a = perf_read () in
+    { cycles = a.(0); instructions = a.(1);
+      cacheMisses = a.(2); branchMisses = a.(3) }
+  else
+    zeroSample
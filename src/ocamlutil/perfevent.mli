@@ -0,0 +1,25 @@
+(** Access to the Linux perf_event hardware counters: cycles,
+    instructions, last-level-cache misses and branch misses for the
+    current process, user space only. On systems without perf_event
+    support, or when the counters cannot be opened (e.g. a restrictive
+    perf_event_paranoid setting), {!Perfevent.start} returns false and
+    samples read as zero. *)
+
+(** One reading of all the counters *)
+type sample = {
+    cycles: int64;
+    instructions: int64;
+    cacheMisses: int64;
+    branchMisses: int64;
+  }
+
+(** Open the counters, if not open already. Returns whether they are
+    available; when this returns false everything else is a no-op. *)
+val start: unit -> bool
+
+(** Close the counters *)
+val stop: unit -> unit
+
+(** Read the current counter values. Cheap: one read(2) per counter and
+    no process switch. Returns all zeros if the counters are not open. *)
+val sample: unit -> sample
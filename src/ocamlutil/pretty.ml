@@ -48,6 +48,12 @@ type algo = George | Aman | Gap
 let  algo = George
 let fastMode       = ref false
 
+(** Documents with at least this many nodes are formatted in fast mode,
+  * without searching for the best line breaks. The optimal-gain search is
+  * quadratic in the worst case and its benefit is invisible on large
+  * machine-generated output. Set to 0 to never degrade automatically. *)
+let fastModeThreshold = ref 100000
+
 
 (** Whether to print indentation or not (for faster printing and smaller
   * output) *)
@@ -97,6 +103,18 @@ let rec breakString (acc: doc) (str: string) : doc =
 
 let nil           = Nil
 let text s        = breakString nil s
+
+(* Strings such as keywords, operators and punctuation are printed over
+ * and over; interning their docs means each is allocated once instead of
+ * at every occurrence. The table grows by one entry per distinct string
+ * passed to "atom", so only use it for strings from a bounded set. *)
+let atoms: (string, doc) Hashtbl.t = Hashtbl.create 137
+let atom (s: string) : doc =
+  try Hashtbl.find atoms s
+  with Not_found ->
+    let d = text s in
+    Hashtbl.add atoms s d;
+    d
 let num  i        = text (string_of_int i)
 let num64 i       = text (Int64.to_string i)
 let real f        = text (string_of_float f)
@@ -406,74 +424,89 @@ let shallowAlign () =
   not useAlignDepth || !alignDepth <= !printDepth
 
 
-(* Pass the current absolute column and compute the new column *)
-let rec scan (abscol: int) (d: doc) : int =
-  match d with
-    Nil -> abscol
-  | Concat (d1, d2) -> scan (scan abscol d1) d2
-  | Text s when shallowAlign () ->
-      let sl = String.length s in
-      if debug then
-        dbgprintf "Done string: %s from %d to %d\n" s abscol (abscol + sl);
-      movingRight (abscol + sl)
-  | CText (d, s) ->
-      let abscol' = scan abscol d in
-      if shallowAlign () then begin
-        let sl = String.length s in
-        if debug then
-          dbgprintf "Done string: %s from %d to %d\n" s abscol' (abscol' + sl);
-        movingRight (abscol' + sl)
-      end else
-        abscol'
+(* Work items for the iterative traversals below. The trees are
+ * processed in DFS order with an explicit work list, so the native
+ * stack stays constant no matter how deeply a document nests and no
+ * continuation closures are allocated along the way *)
+type workItem =
+    WDoc of doc
+  | WText of string        (* the trailing string of a CText, due after
+                            * its sub-document *)
 
-  | Align ->
-      pushAlign abscol;
-      if enterAlign () then
-        movingRight (abscol + 3) (* "..." *)
-      else
-        abscol
-
-  | Unalign -> exitAlign (); popAlign (); abscol
-
-  | Line when shallowAlign () -> (* A forced line break *)
-      if !activeMarkups != [] then
-        failwith "Line breaks inside markup sections";
-      newline ()
-
-  | LeftFlush when shallowAlign ()  -> (* Keep cursor left-flushed *) 0
-
-  | Break when shallowAlign () -> (* An optional line break. Always a space
-                                   * followed by an optional line break *)
-      if !activeMarkups != [] then
-        failwith "Line breaks inside markup sections";
-      let takenref = ref false in
-      breaks := takenref :: !breaks;
-      let topalign = List.hd !aligns in (* aligns is never empty *)
-      if !breakAllMode then begin
-        takenref := true;
-        newline ()
-      end else begin
-        (* If there was a previous break there it stays not taken, forever.
-         * So we overwrite it. *)
-        topalign.isTaken <- takenref;
-        topalign.gainBreak <- 1 + abscol - !topAlignAbsCol;
-        if debug then
-          dbgprintf "Registering a break at %d with gain %d\n"
-            (1 + abscol) topalign.gainBreak;
-        movingRight (1 + abscol)
-      end
+(* Pass the current absolute column and compute the new column *)
+let scan (abscol: int) (d: doc) : int =
+  let doText abscol s =
+    let sl = String.length s in
+    if debug then
+      dbgprintf "Done string: %s from %d to %d\n" s abscol (abscol + sl);
+    movingRight (abscol + sl)
+  in
+  let rec loop (abscol: int) (todo: workItem list) : int =
+    match todo with
+      [] -> abscol
+    | WText s :: rest ->
+        if shallowAlign () then loop (doText abscol s) rest
+        else loop abscol rest
+    | WDoc d :: rest ->
+        match d with
+          Nil -> loop abscol rest
+        | Concat (d1, d2) -> loop abscol (WDoc d1 :: WDoc d2 :: rest)
+        | Text s when shallowAlign () -> loop (doText abscol s) rest
+        | CText (d, s) -> loop abscol (WDoc d :: WText s :: rest)
+
+        | Align ->
+            pushAlign abscol;
+            if enterAlign () then
+              loop (movingRight (abscol + 3)) rest (* "..." *)
+            else
+              loop abscol rest
+
+        | Unalign -> exitAlign (); popAlign (); loop abscol rest
+
+        | Line when shallowAlign () -> (* A forced line break *)
+            if !activeMarkups != [] then
+              failwith "Line breaks inside markup sections";
+            loop (newline ()) rest
+
+        | LeftFlush when shallowAlign ()  -> (* Keep cursor left-flushed *)
+            loop 0 rest
+
+        | Break when shallowAlign () -> (* An optional line break. Always a
+                                         * space followed by an optional
+                                         * line break *)
+            if !activeMarkups != [] then
+              failwith "Line breaks inside markup sections";
+            let takenref = ref false in
+            breaks := takenref :: !breaks;
+            let topalign = List.hd !aligns in (* aligns is never empty *)
+            if !breakAllMode then begin
+              takenref := true;
+              loop (newline ()) rest
+            end else begin
+              (* If there was a previous break there it stays not taken,
+               * forever. So we overwrite it. *)
+              topalign.isTaken <- takenref;
+              topalign.gainBreak <- 1 + abscol - !topAlignAbsCol;
+              if debug then
+                dbgprintf "Registering a break at %d with gain %d\n"
+                  (1 + abscol) topalign.gainBreak;
+              loop (movingRight (1 + abscol)) rest
+            end
 
-  | Mark -> activeMarkups := abscol :: !activeMarkups;
-            abscol
+        | Mark ->
+            activeMarkups := abscol :: !activeMarkups;
+            loop abscol rest
 
-  | Unmark -> begin
-      match !activeMarkups with
-        old :: rest -> activeMarkups := rest;
-                       old
-      | [] -> failwith "Too many unmark"
-  end
+        | Unmark -> begin
+            match !activeMarkups with
+              old :: mrest -> activeMarkups := mrest;
+                              loop old rest
+            | [] -> failwith "Too many unmark"
+          end
 
-  | _ -> (* Align level is too deep *) abscol
+        | _ -> (* Align level is too deep *) loop abscol rest
+  in
+  loop abscol [WDoc d]
 
 
 (** Keep a running counter of the newlines we are taking. You can read and
@@ -510,85 +543,109 @@ let emitDoc
           x);
     wantIndent := false
   in
-  (* A continuation passing style loop *)
-  let rec loopCont (abscol: int) (d: doc) (cont: int -> unit) : unit
-      (* the new column *) =
-    match d with
-      Nil -> cont abscol
-    | Concat (d1, d2) ->
-        loopCont abscol d1 (fun abscol' -> loopCont abscol' d2 cont)
-
-    | Text s when shallowAlign () ->
-        let sl = String.length s in
-	indentIfNeeded ();
-        emitString s 1;
-        cont (abscol + sl)
-
-    | CText (d, s) ->
-        loopCont abscol d
-          (fun abscol' ->
-            if shallowAlign () then
-              let sl = String.length s in
-	      indentIfNeeded ();
-              emitString s 1;
-              cont (abscol' + sl)
-            else
-              cont abscol')
-
-    | Align ->
-        aligns := abscol :: !aligns;
-        if enterAlign () then begin
-          indentIfNeeded ();
-          emitString "..." 1;
-          cont (abscol + 3)
-        end else
-          cont abscol
-
-    | Unalign -> begin
-        match !aligns with
-          [] -> failwith "Unmatched unalign"
-        | _ :: rest ->
-            exitAlign ();
-            aligns := rest; cont abscol
-    end
-    | Line when shallowAlign ()  -> cont (newline ())
-    | LeftFlush when shallowAlign () -> wantIndent := false;  cont (0)
-    | Break when shallowAlign () -> begin
-        match !breaks with
-          [] -> failwith "Break without a takenref"
-        | istaken :: rest ->
-            breaks := rest; (* Consume the break *)
-            if !istaken then cont (newline ())
-            else begin
-	      indentIfNeeded ();
-              emitString " " 1;
-              cont (abscol + 1)
-            end
-    end
-
-    | Mark ->
-        activeMarkups := abscol :: !activeMarkups;
-        cont abscol
-
-    | Unmark -> begin
-        match !activeMarkups with
-          old :: rest -> activeMarkups := rest;
-                         cont old
-        | [] -> failwith "Unmark without a mark"
-    end
-
-    | _ -> (* Align is too deep *)
-        cont abscol
+  (* DFS over the tree with an explicit work list; the strings are
+   * written as soon as they are reached *)
+  let doText abscol s =
+    let sl = String.length s in
+    indentIfNeeded ();
+    emitString s 1;
+    abscol + sl
+  in
+  let rec loop (abscol: int) (todo: workItem list) : unit =
+    match todo with
+      [] -> ()
+    | WText s :: rest ->
+        if shallowAlign () then loop (doText abscol s) rest
+        else loop abscol rest
+    | WDoc d :: rest ->
+        match d with
+          Nil -> loop abscol rest
+        | Concat (d1, d2) -> loop abscol (WDoc d1 :: WDoc d2 :: rest)
+
+        | Text s when shallowAlign () -> loop (doText abscol s) rest
+
+        | CText (d, s) -> loop abscol (WDoc d :: WText s :: rest)
+
+        | Align ->
+            aligns := abscol :: !aligns;
+            if enterAlign () then begin
+              indentIfNeeded ();
+              emitString "..." 1;
+              loop (abscol + 3) rest
+            end else
+              loop abscol rest
+
+        | Unalign -> begin
+            match !aligns with
+              [] -> failwith "Unmatched unalign"
+            | _ :: arest ->
+                exitAlign ();
+                aligns := arest; loop abscol rest
+          end
+        | Line when shallowAlign ()  -> loop (newline ()) rest
+        | LeftFlush when shallowAlign () -> wantIndent := false; loop 0 rest
+        | Break when shallowAlign () -> begin
+            match !breaks with
+              [] -> failwith "Break without a takenref"
+            | istaken :: brest ->
+                breaks := brest; (* Consume the break *)
+                if !istaken then loop (newline ()) rest
+                else begin
+	          indentIfNeeded ();
+                  emitString " " 1;
+                  loop (abscol + 1) rest
+                end
+          end
+
+        | Mark ->
+            activeMarkups := abscol :: !activeMarkups;
+            loop abscol rest
+
+        | Unmark -> begin
+            match !activeMarkups with
+              old :: mrest -> activeMarkups := mrest;
+                              loop old rest
+            | [] -> failwith "Unmark without a mark"
+          end
+
+        | _ -> (* Align is too deep *)
+            loop abscol rest
   in
 
-  loopCont 0 d (fun x -> ())
+  loop 0 [WDoc d]
+
+
+(* See if a document has at least [limit] nodes. Stops traversing as soon
+ * as the limit is reached, so the check stays cheap even on huge docs. *)
+let exceedsSize (limit: int) (d: doc) : bool =
+  let rec loop (n: int) (ds: doc list) : bool =
+    if n >= limit then true
+    else
+      match ds with
+        [] -> false
+      | Nil :: rest -> loop n rest
+      | Concat (d1, d2) :: rest -> loop n (d1 :: d2 :: rest)
+      | CText (d, _) :: rest -> loop (n + 1) (d :: rest)
+      | (Text _ | Break | Line | LeftFlush
+        | Align | Unalign | Mark | Unmark) :: rest -> loop (n + 1) rest
+  in
+  loop 0 [d]
 
+(* Degrade to fast layout for the duration of one printing call if the
+ * document is above the threshold. Returns the saved fastMode. *)
+let autoFastMode (doc: doc) : bool =
+  let old = !fastMode in
+  if not old && !fastModeThreshold > 0
+     && exceedsSize !fastModeThreshold doc then
+    fastMode := true;
+  old
 
 (* Print a document on a channel *)
 let fprint (chn: out_channel) ~(width: int) doc =
   let doc = if !flattenBeforePrint then flatten Nil doc else doc in
   (* Save some parameters, to allow for nested calls of these routines. *)
   maxCol := width;
+  let old_fastMode = autoFastMode doc in
   let old_breaks = !breaks in
   breaks := [];
   let old_alignDepth = !alignDepth in
@@ -604,31 +661,38 @@ let fprint (chn: out_channel) ~(width: int) doc =
               done) doc);
   activeMarkups := old_activeMarkups;
   alignDepth := old_alignDepth;
-  breaks := old_breaks (* We must do this especially if we don't do emit
+  breaks := old_breaks; (* We must do this especially if we don't do emit
                         * (which consumes breaks) because otherwise we waste
                         * memory *)
+  fastMode := old_fastMode
 
-(* Print the document to a string *)
-let sprint ~(width : int)  doc : string =
+(* Print a document into a buffer *)
+let bprint (buf: Buffer.t) ~(width: int) doc =
   let doc = if !flattenBeforePrint then flatten Nil doc else doc in
   maxCol := width;
+  let old_fastMode = autoFastMode doc in
   let old_breaks = !breaks in
   breaks := [];
-  let old_activeMarkups = !activeMarkups in
-  activeMarkups := [];
   let old_alignDepth = !alignDepth in
   alignDepth := 0;
+  let old_activeMarkups = !activeMarkups in
+  activeMarkups := [];
   ignore (scan 0 doc);
   breaks := List.rev !breaks;
-  let buf = Buffer.create 1024 in
-  let rec add_n_strings str num =
-    if num <= 0 then ()
-    else begin Buffer.add_string buf str; add_n_strings str (num - 1) end
-  in
-  emitDoc add_n_strings doc;
-  breaks  := old_breaks;
+  ignore (emitDoc
+            (fun s nrcopies ->
+              for _ = 1 to nrcopies do
+                Buffer.add_string buf s
+              done) doc);
   activeMarkups := old_activeMarkups;
   alignDepth := old_alignDepth;
+  breaks := old_breaks;
+  fastMode := old_fastMode
+
+(* Print the document to a string *)
+let sprint ~(width : int)  doc : string =
+  let buf = Buffer.create 1024 in
+  bprint buf ~width doc;
   Buffer.contents buf
 
 
@@ -824,6 +888,224 @@ let gprintf (finish : doc -> 'b)
   in
   collect Nil 0
 
+(******************************************************************************)
+(* Compiled formats. gprintf re-scans the format string on every call; for
+ * formats that are applied millions of times we parse them once into a
+ * sequence of instructions and only replay the instructions per call. The
+ * alignment-depth bookkeeping stays at replay time because it depends on
+ * the current printDepth. *)
+
+type fmtInstr =
+    FLit of string           (* literal text, with no newlines *)
+  | FStr of int              (* %s; the padding, or 0 for none *)
+  | FChr                     (* %c *)
+  | FInt of string           (* %d,%i,%o,%x,%X,%u with their full spec *)
+  | FInt64 of string         (* %Ld etc.; the spec for Int64.format *)
+  | FInt32 of string         (* %ld etc. *)
+  | FNativeint of string     (* %nd etc. *)
+  | FFloat of string         (* %f,%e,%E,%g,%G with their full spec *)
+  | FBool                    (* %b or %B *)
+  | FDoc                     (* %a *)
+  | FThunk                   (* %t *)
+  | FAlign | FUnalign | FLine | FBreak | FLeftflush | FMark | FUnmark
+
+(* The type parameter is phantom: it records the type of the arguments the
+ * format consumes, exactly as in the original format string *)
+type 'a compiledFormat =
+    { cInstrs: fmtInstr array;
+      cFormat: string          (* for error messages only *) }
+
+let compileFormat (format : ('a, unit, doc, doc) format4) : 'a compiledFormat =
+  let format = string_of_format format in
+  let flen = String.length format in
+  let fget = String.unsafe_get format in
+  let instrs : fmtInstr list ref = ref [] in
+  let emit (ins: fmtInstr) = instrs := ins :: !instrs in
+  (* The scanning below mirrors gprintf exactly, including its treatment
+   * of "@<" and "@>" *)
+  let rec literal i =
+    let rec skipChars j =
+      if j >= flen ||
+      (match fget j with
+        '%' -> true
+      | '@' -> true
+      | '\n' -> true
+      | _ -> false) then begin
+        emit (FLit (String.sub format i (j - i)));
+        collect j
+      end else
+        skipChars (succ j)
+    in
+    skipChars (succ i)
+  and collect (i: int) =
+    if i < flen then begin
+      let c = fget i in
+      if c = '%' then begin
+        let j = skip_args (succ i) in
+        match fget j with
+          '%' -> literal j
+        | ',' -> collect (succ j)
+        | 's' ->
+            let p =
+              if j <= i+1 then 0
+              else begin
+                try
+                  int_of_string (String.sub format (i+1) (j-i-1))
+                with _ ->
+                  invalid_arg "fprintf: bad %s format"
+              end
+            in
+            emit (FStr p);
+            collect (succ j)
+        | 'c' ->
+            emit FChr;
+            collect (succ j)
+        | 'd' | 'i' | 'o' | 'x' | 'X' | 'u' ->
+            emit (FInt (String.sub format i (j-i+1)));
+            collect (succ j)
+        | ('L' | 'l' | 'n') as m ->
+	    if j != i + 1 then
+              invalid_arg ("dprintf: unimplemented format "
+			   ^ (String.sub format i (j-i+1)));
+	    let j' = succ j in (* eat the d,i,x etc. *)
+            let spec = "%" ^ String.make 1 (fget j') in
+            emit (match m with
+                    'L' -> FInt64 spec
+                  | 'l' -> FInt32 spec
+                  | _ -> FNativeint spec);
+            collect (succ j')
+        | 'f' | 'e' | 'E' | 'g' | 'G' ->
+            emit (FFloat (String.sub format i (j-i+1)));
+            collect (succ j)
+        | 'b' | 'B' ->
+            emit FBool;
+            collect (succ j)
+        | 'a' ->
+            emit FDoc;
+            collect (succ j)
+        | 't' ->
+            emit FThunk;
+            collect (succ j)
+        | c ->
+            invalid_arg ("dprintf: unknown format %s" ^ String.make 1 c)
+      end else if c = '@' then begin
+        if i + 1 < flen then begin
+          match fget (succ i) with
+            '[' -> emit FAlign; collect (i + 2)
+          | ']' -> emit FUnalign; collect (i + 2)
+          | '!' -> emit FLine; collect (i + 2)
+          | '?' -> emit FBreak; collect (i + 2)
+          | '<' -> emit FMark; collect (i + 1)
+          | '>' -> emit FUnmark; collect (i + 1)
+	  | '^' -> emit FLeftflush; collect (i + 2)
+          | '@' -> emit (FLit "@"); collect (i + 2)
+          | c ->
+              invalid_arg ("dprintf: unknown format @" ^ String.make 1 c)
+        end else
+          invalid_arg "dprintf: incomplete format @"
+      end else if c = '\n' then begin
+        emit FLine;
+        collect (i + 1)
+      end else
+        literal i
+    end
+  and skip_args j =
+    match String.unsafe_get format j with
+      '0' .. '9' | ' ' | '.' | '-' -> skip_args (succ j)
+    | _ -> j
+  in
+  collect 0;
+  { cInstrs = Array.of_list (List.rev !instrs); cFormat = format }
+
+let dprintfc (cf: 'a compiledFormat) : 'a =
+  let instrs = cf.cInstrs in
+  let ninstrs = Array.length instrs in
+  (* Record the starting align depth *)
+  let startAlignDepth = !alignDepth in
+  let dconcat (acc: doc) (another: doc) =
+    if !alignDepth > !printDepth then acc else acc ++ another in
+  let dctext1 (acc: doc) (str: string) =
+    if !alignDepth > !printDepth then acc else
+    CText(acc, str)
+  in
+  let rec collect (acc: doc) (i: int) =
+    if i >= ninstrs then begin
+      if !alignDepth <> startAlignDepth then
+        prerr_string ("Unmatched align/unalign in " ^ cf.cFormat ^ "\n");
+      Obj.magic acc
+    end else begin
+      match instrs.(i) with
+        FLit s -> collect (dctext1 acc s) (succ i)
+      | FStr 0 ->
+          Obj.magic (fun s -> collect (breakString acc s) (succ i))
+      | FStr p ->
+          Obj.magic (fun s ->
+            let sl = String.length s in
+            let str =
+              if p > 0 && sl < p then
+                (String.make (p - sl) ' ') ^ s
+              else if p < 0 && sl < -p then
+                s ^ (String.make (-p - sl) ' ')
+              else
+                s
+            in
+            collect (breakString acc str) (succ i))
+      | FChr ->
+          Obj.magic (fun c ->
+            collect (dctext1 acc (String.make 1 c)) (succ i))
+      | FInt spec ->
+          Obj.magic (fun n ->
+            collect (dctext1 acc (format_int spec n)) (succ i))
+      | FInt64 spec ->
+          Obj.magic (fun n ->
+            collect (dctext1 acc (Int64.format spec n)) (succ i))
+      | FInt32 spec ->
+          Obj.magic (fun n ->
+            collect (dctext1 acc (Int32.format spec n)) (succ i))
+      | FNativeint spec ->
+          Obj.magic (fun n ->
+            collect (dctext1 acc (Nativeint.format spec n)) (succ i))
+      | FFloat spec ->
+          Obj.magic (fun f ->
+            collect (dctext1 acc (format_float spec f)) (succ i))
+      | FBool ->
+          Obj.magic (fun b ->
+            collect (dctext1 acc (string_of_bool b)) (succ i))
+      | FDoc ->
+          Obj.magic (fun pprinter arg ->
+            collect (dconcat acc (pprinter () arg)) (succ i))
+      | FThunk ->
+          Obj.magic (fun pprinter ->
+            collect (dconcat acc (pprinter ())) (succ i))
+      | FAlign ->
+          let newacc =
+            if !alignDepth > !printDepth then
+              acc
+            else if !alignDepth = !printDepth then
+              CText(acc, "...")
+            else
+              acc ++ align
+          in
+          incr alignDepth;
+          collect newacc (succ i)
+      | FUnalign ->
+          decr alignDepth;
+          let newacc =
+            if !alignDepth >= !printDepth then
+              acc
+            else
+              acc ++ unalign
+          in
+          collect newacc (succ i)
+      | FLine -> collect (dconcat acc line) (succ i)
+      | FBreak -> collect (dconcat acc break) (succ i)
+      | FLeftflush -> collect (dconcat acc leftflush) (succ i)
+      | FMark -> collect (dconcat acc mark) (succ i)
+      | FUnmark -> collect (dconcat acc unmark) (succ i)
+    end
+  in
+  collect Nil 0
+
 let withPrintDepth dp thunk =
   let opd = !printDepth in
   printDepth := dp;
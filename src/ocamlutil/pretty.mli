@@ -79,6 +79,13 @@ val concat       : doc -> doc -> doc
 (** A document that prints the given string *)
 val text         : string -> doc
 
+(** Like {!Pretty.text}, but memoized: the same string yields the same
+    document, allocated once. Use this for strings that are printed many
+    times, such as keywords, operators and punctuation. The table keeps
+    every string it has seen, so do not pass strings drawn from an
+    unbounded set. *)
+val atom         : string -> doc
+
 
 (** A document that prints an integer in decimal form *)
 val num          : int    -> doc
@@ -262,12 +269,32 @@ val dprintf: ('a, unit, doc, doc) format4 -> 'a
  * the result of gprintf. *)
 val gprintf: (doc -> 'b) -> ('a, unit, doc, 'b) format4 -> 'a
 
+(** A format parsed once, for use with {!Pretty.dprintfc}. The type
+ * parameter records the type of the arguments that the format consumes,
+ * exactly as for {!Pretty.dprintf} *)
+type 'a compiledFormat
+
+(** Compile a {!Pretty.dprintf}-style format. The scanning of the format
+ * string and the decoding of widths and conversions happen once, here;
+ * the result can be applied any number of times *)
+val compileFormat: ('a, unit, doc, doc) format4 -> 'a compiledFormat
+
+(** Like {!Pretty.dprintf}, but replays a format compiled with
+ * {!Pretty.compileFormat}. Printers on hot paths should hoist the
+ * compilation to the top level and use this instead of re-parsing the
+ * format on every call *)
+val dprintfc: 'a compiledFormat -> 'a
+
 (** Format the document to the given width and emit it to the given channel *)
 val fprint: out_channel -> width:int -> doc -> unit
 
 (** Format the document to the given width and emit it as a string *)
 val sprint: width:int -> doc -> string
 
+(** Format the document to the given width and emit it into the given
+    buffer, without materializing an intermediate string *)
+val bprint: Buffer.t -> width:int -> doc -> unit
+
 (** Like {!Pretty.dprintf} followed by {!Pretty.fprint} *)
 val fprintf: out_channel -> ('a, unit, doc) format -> 'a  
 
@@ -302,7 +329,13 @@ val printIndent  : bool ref  (** If false then does not indent *)
 (** If set to [true] then optional breaks are taken only when the document 
     has exceeded the given width. This means that the printout will looked 
     more ragged but it will be faster *)
-val fastMode  : bool ref 
+val fastMode  : bool ref
+
+(** Documents with at least this many nodes are formatted as if
+    {!Pretty.fastMode} were set, for that printing call only. The search
+    for optimal line breaks does not pay off on large machine-generated
+    output. Set to 0 to never degrade automatically *)
+val fastModeThreshold : int ref
 
 val flushOften   : bool ref  (** If true the it flushes after every print *)
 
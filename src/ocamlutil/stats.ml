@@ -13,12 +13,36 @@ let countCalls = ref false
 type t = { name : string;
            mutable time : float; (* In seconds *)
 	   mutable ncalls : int;
+           mutable minorWords : float; (* Words allocated in the minor heap
+                                        * while this timer was running *)
+           mutable majorWords : float; (* Words allocated in or promoted to
+                                        * the major heap *)
+           mutable minorGCs : int;     (* Minor collections *)
+           mutable majorGCs : int;     (* Major collection cycles *)
+           mutable cycles : int64;     (* Hardware counters, deltas over
+                                        * the phase; all zero unless
+                                        * trackPerf is set *)
+           mutable instrs : int64;
+           mutable cacheMisses : int64;
+           mutable branchMisses : int64;
+           mutable ticks : int;        (* Profiler samples that landed
+                                        * while this phase was the
+                                        * innermost one on the stack *)
            mutable sub  : t list}
 
                                         (* Create the top level *)
 let top = { name = "TOTAL";
             time = 0.0;
 	    ncalls = 0;
+            minorWords = 0.0;
+            majorWords = 0.0;
+            minorGCs = 0;
+            majorGCs = 0;
+            cycles = 0L;
+            instrs = 0L;
+            cacheMisses = 0L;
+            branchMisses = 0L;
+            ticks = 0;
             sub  = []; }
 
                                         (* The stack of current path through
@@ -29,16 +53,133 @@ let current : t list ref = ref [top]
 exception NoPerfCount
 let reset (mode: timerModeEnum) : unit =
   top.sub <- [];
+  top.ticks <- 0;
   timerMode := mode
 
+(* Whether to also sample the hardware performance counters (cycles,
+ * instructions, cache misses, branch misses) at phase entry and exit.
+ * The counters are opened lazily on the first timed phase, so the flag
+ * can be set from a command-line option after the initial reset *)
+let trackPerf = ref false
 
+let perfTried = ref false
+let perfActive = ref false
+let perfOn () : bool =
+  !trackPerf &&
+  begin
+    if not !perfTried then begin
+      perfTried := true;
+      perfActive := Perfevent.start ();
+      if not !perfActive then
+        ignore (Errormsg.warn
+                  "Cannot open the hardware performance counters; timing without them")
+    end;
+    !perfActive
+  end
+
+
+(* Sampling profiler. A periodic signal in virtual time (so only time
+ * spent executing is counted) attributes one tick to the innermost
+ * phase on the timer stack. The handler only follows the current-stack
+ * pointer and bumps an integer field, so sampling costs nothing between
+ * samples and gives statement-level attribution inside a phase without
+ * wrapping inner loops in Stats.time. Ticks that land outside every
+ * timed phase accumulate on the TOTAL node *)
+let samplingOn = ref false
+let sampleInterval = ref 0.001          (* Seconds of virtual time *)
+
+let sampleTick (_: int) : unit =
+  match !current with
+    h :: _ -> h.ticks <- h.ticks + 1
+  | [] -> ()
+
+let startSampling () : unit =
+  if not !samplingOn then begin
+    samplingOn := true;
+    Sys.set_signal Sys.sigvtalrm (Sys.Signal_handle sampleTick);
+    ignore (Unix.setitimer Unix.ITIMER_VIRTUAL
+              { Unix.it_interval = !sampleInterval;
+                Unix.it_value = !sampleInterval })
+  end
+
+let stopSampling () : unit =
+  if !samplingOn then begin
+    samplingOn := false;
+    ignore (Unix.setitimer Unix.ITIMER_VIRTUAL
+              { Unix.it_interval = 0.0; Unix.it_value = 0.0 });
+    Sys.set_signal Sys.sigvtalrm Sys.Signal_default
+  end
+
+                                        (* Total up the children into the
+                                         * top node, for reporting *)
+let sumTotals () : unit =
+  top.time <- List.fold_left (fun sum f -> sum +. f.time) 0.0 top.sub;
+  top.minorWords <-
+    List.fold_left (fun sum f -> sum +. f.minorWords) 0.0 top.sub;
+  top.majorWords <-
+    List.fold_left (fun sum f -> sum +. f.majorWords) 0.0 top.sub;
+  top.minorGCs <- List.fold_left (fun sum f -> sum + f.minorGCs) 0 top.sub;
+  top.majorGCs <- List.fold_left (fun sum f -> sum + f.majorGCs) 0 top.sub;
+  top.cycles <-
+    List.fold_left (fun sum f -> Int64.add sum f.cycles) 0L top.sub;
+  top.instrs <-
+    List.fold_left (fun sum f -> Int64.add sum f.instrs) 0L top.sub;
+  top.cacheMisses <-
+    List.fold_left (fun sum f -> Int64.add sum f.cacheMisses) 0L top.sub;
+  top.branchMisses <-
+    List.fold_left (fun sum f -> Int64.add sum f.branchMisses) 0L top.sub
+
+(* Named event counters (cache hits and misses, mostly). They are
+ * registered once, bumped from hot paths with a plain field update,
+ * and reported alongside the timings *)
+type counter = { cname: string;
+                 mutable cval: int }
+
+let counters : counter list ref = ref []
+
+let newCounter (name: string) : counter =
+  let c = { cname = name; cval = 0 } in
+  counters := c :: !counters;
+  c
+
+let incr (c: counter) : unit =
+  c.cval <- c.cval + 1
+
+let printM (w: float) : string =
+  let coeff = float_of_int (Sys.word_size / 8) in
+  Printf.sprintf "%.2fMB" (w *. coeff /. 1000000.0)
+
+(* Abbreviate a large event count for the one-line-per-phase report *)
+let printCnt (c: int64) : string =
+  let f = Int64.to_float c in
+  if f >= 1.0e9 then Printf.sprintf "%.2fG" (f /. 1.0e9)
+  else if f >= 1.0e6 then Printf.sprintf "%.2fM" (f /. 1.0e6)
+  else if f >= 1.0e3 then Printf.sprintf "%.2fK" (f /. 1.0e3)
+  else Int64.to_string c
 
 let print chn msg =
   (* Total up *)
-  top.time <- List.fold_left (fun sum f -> sum +. f.time) 0.0 top.sub;
+  sumTotals ();
+  let totalTicks =
+    let rec count n =
+      List.fold_left (fun acc s -> acc + count s) n.ticks n.sub in
+    count top
+  in
   let rec prTree ind node =
 	(Printf.fprintf chn "%s%-25s      %6.3f s"
         (String.make ind ' ') node.name node.time);
+    if node.minorWords > 0.0 || node.majorWords > 0.0 then
+      Printf.fprintf chn "  minor=%s major=%s gc=%d/%d"
+        (printM node.minorWords) (printM node.majorWords)
+        node.minorGCs node.majorGCs;
+    if node.cycles <> 0L || node.instrs <> 0L then
+      Printf.fprintf chn "  cyc=%s ins=%s llcm=%s brm=%s"
+        (printCnt node.cycles) (printCnt node.instrs)
+        (printCnt node.cacheMisses) (printCnt node.branchMisses);
+    if node.ticks > 0 then
+      Printf.fprintf chn "  smp=%d (%.1f%%)"
+        node.ticks
+        (100.0 *. float_of_int node.ticks /. float_of_int totalTicks);
     begin
       if node.ncalls <= 0 then
 	output_string chn "\n"
@@ -52,11 +193,11 @@ let print chn msg =
   Printf.fprintf chn "%s" msg;
   List.iter (prTree 0) [ top ];
   Printf.fprintf chn "Timing used\n";
+  if totalTicks > 0 then
+    Printf.fprintf chn
+      "Sampling: %d ticks at %gms of virtual time; smp counts are self samples\n"
+      totalTicks (!sampleInterval *. 1000.0);
   let gc = Gc.quick_stat () in
-  let printM (w: float) : string =
-    let coeff = float_of_int (Sys.word_size / 8) in
-    Printf.sprintf "%.2fMB" (w *. coeff /. 1000000.0)
-  in
   Printf.fprintf chn
     "Memory statistics: total=%s, max=%s, minor=%s, major=%s, promoted=%s\n    minor collections=%d  major collections=%d compactions=%d\n"
     (printM (gc.Gc.minor_words +. gc.Gc.major_words
@@ -68,10 +209,118 @@ let print chn msg =
     gc.Gc.minor_collections
     gc.Gc.major_collections
     gc.Gc.compactions;
-
+  (match List.rev !counters with
+    [] -> ()
+  | cs ->
+      Printf.fprintf chn "Counters:\n";
+      List.iter
+        (fun c -> Printf.fprintf chn "  %-25s %d\n" c.cname c.cval)
+        cs);
   ()
 
+(* Quote a string for JSON. Timer labels are plain words, so the escapes
+ * are almost never needed *)
+let jsonString (s: string) : string =
+  let b = Buffer.create (String.length s + 2) in
+  Buffer.add_char b '"';
+  String.iter
+    (fun c ->
+      match c with
+        '"' -> Buffer.add_string b "\\\""
+      | '\\' -> Buffer.add_string b "\\\\"
+      | c when Char.code c < 32 ->
+          Buffer.add_string b (Printf.sprintf "\\u%04x" (Char.code c))
+      | c -> Buffer.add_char b c)
+    s;
+  Buffer.add_char b '"';
+  Buffer.contents b
+
+(* Dump the same hierarchy that print shows, as a JSON tree, so that the
+ * per-phase times and allocation figures can be consumed by scripts *)
+let printJson (chn: out_channel) : unit =
+  sumTotals ();
+  let rec prNode node =
+    Printf.fprintf chn
+      "{\"name\":%s,\"time\":%.6f,\"ncalls\":%d,\"minor_words\":%.0f,\"major_words\":%.0f,\"minor_collections\":%d,\"major_collections\":%d,\"cycles\":%Ld,\"instructions\":%Ld,\"cache_misses\":%Ld,\"branch_misses\":%Ld,\"ticks\":%d,\"sub\":["
+      (jsonString node.name) node.time node.ncalls
+      node.minorWords node.majorWords node.minorGCs node.majorGCs
+      node.cycles node.instrs node.cacheMisses node.branchMisses
+      node.ticks;
+    let rec prSubs = function
+        [] -> ()
+      | [s] -> prNode s
+      | s :: rest -> prNode s; output_string chn ","; prSubs rest
+    in
+    prSubs (List.rev node.sub);
+    output_string chn "]}"
+  in
+  (* Wrap the timer tree so the counters can sit beside it *)
+  output_string chn "{\"timers\":";
+  prNode top;
+  output_string chn ",\"counters\":{";
+  let rec prCounters = function
+      [] -> ()
+    | [c] -> Printf.fprintf chn "%s:%d" (jsonString c.cname) c.cval
+    | c :: rest ->
+        Printf.fprintf chn "%s:%d," (jsonString c.cname) c.cval;
+        prCounters rest
+  in
+  prCounters (List.rev !counters);
+  output_string chn "}}\n"
+
+
 
+(* A timer label as a flamegraph frame: the folded format separates
+ * frames with semicolons and the value with the last space, so neither
+ * may appear inside a frame name *)
+let foldedFrame (s: string) : string =
+  if String.contains s ' ' || String.contains s ';' then begin
+    let b = Bytes.of_string s in
+    for i = 0 to Bytes.length b - 1 do
+      match Bytes.get b i with
+        ' ' -> Bytes.set b i '_'
+      | ';' -> Bytes.set b i ':'
+      | _ -> ()
+    done;
+    Bytes.to_string b
+  end else
+    s
+
+(* Write the same hierarchy that print shows in the folded-stack format
+ * that flamegraph tools consume: one line per path, frames joined by
+ * semicolons, then the self value of that path (the cumulative value
+ * of a frame is recovered by the tools as the sum over its suffixes).
+ * The measure selects what the value is: "time" (microseconds),
+ * "minor" or "major" (words allocated), or "ticks" (profiler samples),
+ * so allocation and sampling flame graphs come from the same tree as
+ * time ones *)
+let printFolded ?(measure: string = "time") (chn: out_channel) : unit =
+  sumTotals ();
+  let value (n: t) : float =
+    match measure with
+      "minor" -> n.minorWords
+    | "major" -> n.majorWords
+    | _ -> n.time *. 1.0e6
+  in
+  let rec prNode (path: string) (n: t) : unit =
+    let path =
+      if path = "" then foldedFrame n.name
+      else path ^ ";" ^ foldedFrame n.name in
+    let self =
+      if measure = "ticks" then
+        (* Ticks are attributed to the innermost phase, so the field is
+         * already a self value *)
+        float_of_int n.ticks
+      else
+        let inChildren =
+          List.fold_left (fun acc s -> acc +. value s) 0.0 n.sub in
+        value n -. inChildren
+    in
+    if self >= 0.5 then
+      Printf.fprintf chn "%s %.0f\n" path self;
+    List.iter (prNode path) (List.rev n.sub)
+  in
+  prNode "" top
 
 (* Get the current time, in seconds *)
 let get_current_time () : float =
@@ -85,7 +334,12 @@ let repeattime limit str f arg =
         h :: _ when h.name = str -> h
       | _ :: rest -> loop rest
       | [] ->
-          let nw = {name = str; time = 0.0; ncalls = 0; sub = []} in
+          let nw = {name = str; time = 0.0; ncalls = 0;
+                    minorWords = 0.0; majorWords = 0.0;
+                    minorGCs = 0; majorGCs = 0;
+                    cycles = 0L; instrs = 0L;
+                    cacheMisses = 0L; branchMisses = 0L;
+                    ticks = 0; sub = []} in
           curr.sub <- nw :: curr.sub;
           nw
     in
@@ -93,12 +347,44 @@ let repeattime limit str f arg =
   in
   let oldcurrent = !current in
   current := stat :: oldcurrent;
+  (* quick_stat does not walk the heap; it only reads counters *)
+  let startGc = Gc.quick_stat () in
+  let startPerf =
+    if perfOn () then Some (Perfevent.sample ()) else None in
   let start = get_current_time () in
   let rec repeatf count =
     let finish diff =
       (* count each call to repeattime once *)
       if !countCalls then stat.ncalls <- stat.ncalls + 1;
       stat.time <- stat.time +. (diff /. float(count));
+      let endGc = Gc.quick_stat () in
+      let cnt = float count in
+      stat.minorWords <- stat.minorWords +.
+        (endGc.Gc.minor_words -. startGc.Gc.minor_words) /. cnt;
+      stat.majorWords <- stat.majorWords +.
+        (endGc.Gc.major_words -. startGc.Gc.major_words) /. cnt;
+      stat.minorGCs <- stat.minorGCs +
+        (endGc.Gc.minor_collections - startGc.Gc.minor_collections);
+      stat.majorGCs <- stat.majorGCs +
+        (endGc.Gc.major_collections - startGc.Gc.major_collections);
+      (match startPerf with
+        None -> ()
+      | Some s0 ->
+          let s1 = Perfevent.sample () in
+          let cnt64 = Int64.of_int count in
+          let add field d0 d1 =
+            Int64.add field (Int64.div (Int64.sub d1 d0) cnt64) in
+          stat.cycles <-
+            add stat.cycles s0.Perfevent.cycles s1.Perfevent.cycles;
+          stat.instrs <-
+            add stat.instrs s0.Perfevent.instructions
+                            s1.Perfevent.instructions;
+          stat.cacheMisses <-
+            add stat.cacheMisses s0.Perfevent.cacheMisses
+                                 s1.Perfevent.cacheMisses;
+          stat.branchMisses <-
+            add stat.branchMisses s0.Perfevent.branchMisses
+                                  s1.Perfevent.branchMisses);
       current := oldcurrent;                (* Pop the current stat *)
       ()
     in
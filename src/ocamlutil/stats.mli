@@ -45,6 +45,34 @@ val reset: timerModeEnum -> unit
     (default: false) *)
 val countCalls: bool ref
 
+(** When set, also sample the hardware performance counters (cycles,
+    instructions, last-level-cache misses, branch misses; see
+    {!Perfevent}) at phase entry and exit and report the per-phase
+    deltas in the timing tree. The counters are opened lazily on the
+    first timed phase, so the flag may be set after {!Stats.reset}. If
+    they cannot be opened (non-Linux system, or a restrictive
+    perf_event_paranoid setting) a warning is printed once and timing
+    continues without them. (default: false) *)
+val trackPerf: bool ref
+
+(** Start the sampling profiler: a periodic signal in virtual time
+    attributes one tick to the innermost phase on the timer stack, every
+    {!Stats.sampleInterval} seconds. The handler only bumps an integer
+    on the current phase, so sampling adds nothing to the code between
+    samples and attributes time inside a phase without wrapping inner
+    loops in {!Stats.time}. Tick counts appear as [smp] self counts in
+    {!Stats.print}, as ["ticks"] in {!Stats.printJson} and as the
+    ["ticks"] measure of {!Stats.printFolded}. Uses [SIGVTALRM], so do
+    not combine with other users of the virtual interval timer *)
+val startSampling: unit -> unit
+
+(** Stop the sampling profiler; the accumulated ticks are kept *)
+val stopSampling: unit -> unit
+
+(** Sampling period in seconds of virtual time, read when
+    {!Stats.startSampling} arms the timer (default: 0.001) *)
+val sampleInterval: float ref
+
 (** Time a function and associate the time with the given string. If some
     timing information is already associated with that string, then accumulate
     the times. If this function is invoked within another timed function then
@@ -56,9 +84,37 @@ val time : string -> ('a -> 'b) -> 'a -> 'b
     then divided by the number of times the function was run. *)
 val repeattime : float -> string -> ('a -> 'b) -> 'a -> 'b
 
-(** Print the current stats preceeded by a message *)
+(** Print the current stats preceeded by a message. Phases that allocated
+    show their minor and major heap allocation and the number of
+    minor/major collections that ran while they were on the timer stack,
+    from [Gc.quick_stat] deltas. With {!Stats.trackPerf}, phases also
+    show their hardware counter deltas. *)
 val print : out_channel -> string -> unit
 
+(** Print the same hierarchy of timings and allocation figures as a JSON
+    document, for consumption by scripts: an object with the timer tree
+    under "timers" and the registered counters under "counters" *)
+val printJson : out_channel -> unit
+
+(** Print the timing hierarchy in folded-stack format, one line per
+    path with its self value, so standard flamegraph tooling can render
+    it (and diff it across runs). The measure selects the value:
+    ["time"] (the default; microseconds), ["minor"] or ["major"] (words
+    allocated), or ["ticks"] (profiler samples), so allocation and
+    sampling flame graphs come from the same tree as time ones. *)
+val printFolded : ?measure:string -> out_channel -> unit
+
+(** A named event counter, reported by {!Stats.print} and
+    {!Stats.printJson}. Mostly used for cache hit/miss accounting. *)
+type counter
+
+(** Register a counter, starting at zero. Counters are reported in
+    registration order. *)
+val newCounter : string -> counter
+
+(** Bump a counter by one; cheap enough for hot paths *)
+val incr : counter -> unit
+
 (** Return the cumulative time of all calls to {!Stats.time} and
   {!Stats.repeattime} with the given label. *)
 val lookupTime: string -> float
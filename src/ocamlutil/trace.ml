@@ -48,9 +48,18 @@ open Pretty;;
 let traceSubsystems : string list ref = ref [];;
 
 
+(* for each subsystem that some caller wants to test cheaply, a shared
+ * ref holding whether that subsystem is currently traced.  the refs are
+ * kept up to date by traceAddSys, so a hot call site can hoist the ref
+ * out of its loop and pay one load and one branch when disabled *)
+let activeRefs : (string, bool ref) Hashtbl.t = Hashtbl.create 13;;
+
+
 let traceAddSys (subsys : string) : unit =
   (* (ignore (printf "traceAddSys %s\n" subsys)); *)
-  traceSubsystems := subsys :: !traceSubsystems
+  traceSubsystems := subsys :: !traceSubsystems;
+  (try (Hashtbl.find activeRefs subsys) := true
+   with Not_found -> ())
 ;;
 
 
@@ -60,6 +69,15 @@ let traceActive (subsys : string) : bool =
 ;;
 
 
+let active (subsys : string) : bool ref =
+  try (Hashtbl.find activeRefs subsys)
+  with Not_found ->
+    let r = ref (traceActive subsys) in
+    (Hashtbl.add activeRefs subsys r);
+    r
+;;
+
+
 let rec parseString (str : string) (delim : char) : string list =
 begin
   if (not (String.contains str delim)) then
@@ -156,6 +174,24 @@ let traceu (sys : string) (d : Pretty.doc) : unit =
 ;;
 
 
+(* lazy flavors: the doc is only built when the subsystem is traced, so
+ * a disabled call does not allocate the formatted arguments *)
+let traceLazy (subsys : string) (mkd : unit -> Pretty.doc) : unit =
+  if !(active subsys) then
+    (trace subsys (mkd ()))
+;;
+
+let traceiLazy (subsys : string) (mkd : unit -> Pretty.doc) : unit =
+  if !(active subsys) then
+    (tracei subsys (mkd ()))
+;;
+
+let traceuLazy (subsys : string) (mkd : unit -> Pretty.doc) : unit =
+  if !(active subsys) then
+    (traceu subsys (mkd ()))
+;;
+
+
 
 
 (* -------------------------- trash --------------------- *)
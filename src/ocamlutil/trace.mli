@@ -60,7 +60,13 @@ val traceAddSys : string -> unit
 
 (* query whether a particular subsystem is being traced *)
 val traceActive : string -> bool
-   
+
+(* a shared ref holding whether the subsystem is traced, kept up to
+ * date by 'traceAddSys'.  hot call sites should hoist this ref out of
+ * their loop: testing it costs one load and one branch, instead of the
+ * list scan done by 'traceActive' *)
+val active : string -> bool ref
+
 (* add several systems, separated by commas *)
 val traceAddMulti : string -> unit
 
@@ -104,3 +110,11 @@ val trace : string -> Pretty.doc -> unit
  *)
 val tracei : string -> Pretty.doc -> unit
 val traceu : string -> Pretty.doc -> unit
+
+
+(* lazy flavors of the above: the thunk is only run (and hence the doc
+ * only built) when the subsystem is actually traced, so a disabled call
+ * does not allocate the formatted arguments *)
+val traceLazy : string -> (unit -> Pretty.doc) -> unit
+val traceiLazy : string -> (unit -> Pretty.doc) -> unit
+val traceuLazy : string -> (unit -> Pretty.doc) -> unit
@@ -50,6 +50,28 @@ let memoize (h: ('a, 'b) Hashtbl.t)
     res
   end
 
+(* Like memoize, but the table is cleared when it reaches bound
+ * entries, so caches keyed by structural values (type signatures, AST
+ * fragments) cannot grow without bound in long-running processes. The
+ * two counters record cache hits and misses for the Stats reports *)
+let memoizeBounded (h: ('a, 'b) Hashtbl.t)
+                   (bound: int)
+                   (hit: Stats.counter)
+                   (miss: Stats.counter)
+                   (arg: 'a)
+                   (f: 'a -> 'b) : 'b =
+  try
+    let res = Hashtbl.find h arg in
+    Stats.incr hit;
+    res
+  with Not_found -> begin
+    Stats.incr miss;
+    let res = f arg in
+    if Hashtbl.length h >= bound then Hashtbl.clear h;
+    Hashtbl.add h arg res;
+    res
+  end
+
 let valOf : 'a option -> 'a = function
     None -> raise (Failure "Util.valOf")
   | Some x -> x
@@ -59,4 +81,4 @@ let list_map_opt f = function
   | Some l -> Some (list_map f l)
 
 let equals x1 x2 : bool =
-  (compare x1 x2) = 0
+  x1 == x2 || (compare x1 x2) = 0
@@ -8,6 +8,15 @@ val memoize: ('a, 'b) Hashtbl.t ->
             'a ->
             ('a -> 'b) -> 'b
 
+(** Like [memoize], but the table is cleared when it reaches the given
+   number of entries, so caches keyed by structural values cannot grow
+   without bound in long-running processes. The two counters record
+   cache hits and misses for the Stats reports. *)
+val memoizeBounded: ('a, 'b) Hashtbl.t -> int ->
+                    Stats.counter -> Stats.counter ->
+                    'a ->
+                    ('a -> 'b) -> 'b
+
 
 (** Get the value of an option.  Raises Failure if None *)
 val valOf : 'a option -> 'a
@@ -44,13 +44,19 @@ open Cil
 module H = Hashtbl
 module E = Errormsg
 module U = Util
+module B = Bitmap
 
 (* Set on the command-line: *)
 let keepUnused = ref false
 let rmUnusedInlines = ref false
+let linkerRootsFile : string option ref = ref None
 
 
-let trace = Trace.trace "rmtmps"
+(* Tracing is almost always off, and this pass visits every global, so
+ * guard on the cached flag before formatting anything *)
+let traceActive = Trace.active "rmtmps"
+let trace (mkdoc: unit -> Pretty.doc) : unit =
+  if !traceActive then Trace.trace "rmtmps" (mkdoc ())
 
 
 
@@ -58,44 +64,45 @@ let trace = Trace.trace "rmtmps"
  *
  *  Clearing of "referenced" bits
  *
+ *  This is folded into the set-up pass of markReachable below, so that
+ *  one walk over the globals clears the stale marks, builds the name
+ *  map and collects the roots.
+ *
  *)
 
 
-let clearReferencedBits file =
-  let considerGlobal global =
+let clearReferencedBitsOfGlobal global =
     match global with
     | GType (info, _) ->
-	trace (dprintf "clearing mark: %a\n" d_shortglobal global);
+	trace (fun () -> dprintf "clearing mark: %a\n" d_shortglobal global);
 	info.treferenced <- false
 
     | GEnumTag (info, _)
     | GEnumTagDecl (info, _) ->
-	trace (dprintf "clearing mark: %a\n" d_shortglobal global);
+	trace (fun () -> dprintf "clearing mark: %a\n" d_shortglobal global);
 	info.ereferenced <- false
 
     | GCompTag (info, _)
     | GCompTagDecl (info, _) ->
-	trace (dprintf "clearing mark: %a\n" d_shortglobal global);
+	trace (fun () -> dprintf "clearing mark: %a\n" d_shortglobal global);
 	info.creferenced <- false
 
-    | GVar ({vname = name; _} as info, _, _)
-    | GVarDecl ({vname = name; _} as info, _) ->
-	trace (dprintf "clearing mark: %a\n" d_shortglobal global);
+    | GVar (info, _, _)
+    | GVarDecl (info, _) ->
+	trace (fun () -> dprintf "clearing mark: %a\n" d_shortglobal global);
 	info.vreferenced <- false
 
     | GFun ({svar = info; _} as func, _) ->
-	trace (dprintf "clearing mark: %a\n" d_shortglobal global);
+	trace (fun () -> dprintf "clearing mark: %a\n" d_shortglobal global);
 	info.vreferenced <- false;
 	let clearMark local =
-	  trace (dprintf "clearing mark: local %s\n" local.vname);
+	  trace (fun () -> dprintf "clearing mark: local %s\n" local.vname);
 	  local.vreferenced <- false
 	in
 	List.iter clearMark func.slocals
 
     | _ ->
 	()
-  in
-  iterGlobals file considerGlobal
 
 
 (***********************************************************************
@@ -257,7 +264,7 @@ let amputateFunctionBodies keptGlobals file =
   let considerGlobal = function
     | GFun ({svar = {vname = name; _} as info; _}, location)
       when not (H.mem keptGlobals name) ->
-	trace (dprintf "slicing: reducing to prototype: function %s\n" name);
+	trace (fun () -> dprintf "slicing: reducing to prototype: function %s\n" name);
 	GVarDecl (info, location)
     | other ->
 	other
@@ -293,6 +300,71 @@ let isPragmaRoot keepers = function
 
 
 
+(***********************************************************************
+ *
+ *  Root collection from an external symbol list
+ *
+ *)
+
+
+(* In whole-program mode the linker knows exactly which symbols the final
+ * binary needs, and that set is usually much smaller than what the
+ * export-based heuristics below keep.  We accept a file containing one
+ * symbol per line: the last whitespace-separated word on each line is
+ * taken as the symbol name, so plain symbol lists, "nm" output such as
+ * "0804aa00 T main" and similar map formats all work.  Blank lines and
+ * lines starting with '#' are ignored.
+ *)
+
+let readLinkerRoots (filename: string) : (string, unit) H.t =
+  let roots : (string, unit) H.t = H.create 137 in
+  let chn =
+    try open_in filename
+    with Sys_error msg ->
+      E.s (error "Cannot open list of linker roots: %s" msg)
+  in
+  let isSpace c = c = ' ' || c = '\t' || c = '\r' in
+  let lastWord (line: string) : string =
+    let rec findEnd i =
+      if i < 0 || not (isSpace (String.get line i)) then i else findEnd (i - 1)
+    in
+    let e = findEnd (String.length line - 1) in
+    if e < 0 then ""
+    else
+      let rec findStart i =
+        if i < 0 || isSpace (String.get line i) then i + 1
+        else findStart (i - 1)
+      in
+      let s = findStart e in
+      String.sub line s (e - s + 1)
+  in
+  (try
+    while true do
+      let line = input_line chn in
+      if String.length line > 0 && String.get line 0 <> '#' then
+        let name = lastWord line in
+        if name <> "" then
+          H.replace roots name ()
+    done
+  with End_of_file -> ());
+  close_in chn;
+  roots
+
+
+let isLinkerRoot (roots: (string, unit) H.t) global =
+  let result = match global with
+  | GVar ({vname = name; _}, _, _)
+  | GVarDecl ({vname = name; _}, _)
+  | GFun ({svar = {vname = name; _}; _}, _) ->
+      H.mem roots name
+  | _ ->
+      false
+  in
+  trace (fun () -> dprintf "linker root -> %b for %a@!" result d_shortglobal global);
+  result
+
+
+
 (***********************************************************************
  *
  *  Common root collecting utilities
@@ -301,12 +373,12 @@ let isPragmaRoot keepers = function
 
 
 let traceRoot reason global =
-  trace (dprintf "root (%s): %a@!" reason d_shortglobal global);
+  trace (fun () -> dprintf "root (%s): %a@!" reason d_shortglobal global);
   true
 
 
 let traceNonRoot reason global =
-  trace (dprintf "non-root (%s): %a@!" reason d_shortglobal global);
+  trace (fun () -> dprintf "non-root (%s): %a@!" reason d_shortglobal global);
   false
 
 
@@ -361,7 +433,7 @@ let isExportedRoot global =
   | _ ->
       false, "neither function nor variable"
   in
-  trace (dprintf "isExportedRoot %a -> %b, %s@!"
+  trace (fun () -> dprintf "isExportedRoot %a -> %b, %s@!"
            d_shortglobal global result reason);
   result
 
@@ -389,7 +461,7 @@ let isCompleteProgramRoot global =
   | _ ->
       false
   in
-  trace (dprintf "complete program root -> %b for %a@!" result d_shortglobal global);
+  trace (fun () -> dprintf "complete program root -> %b for %a@!" result d_shortglobal global);
   result
 
 
@@ -400,9 +472,13 @@ let isCompleteProgramRoot global =
  *)
 
 
-(* This visitor recursively marks all reachable types and variables as used. *)
+(* This visitor marks all types and variables reachable from one global as
+ * used. References to other globals are not followed here; they are handed
+ * to 'schedule', and markReachable below drains an explicit worklist. This
+ * keeps the traversal iterative and scans each global once, instead of
+ * recursing through shared subgraphs. *)
 class markReachableVisitor
-    ((globalMap: (string, Cil.global) H.t),
+    ((schedule: varinfo -> unit),
      (currentFunc: fundec option ref)) = object (self)
   inherit nopCilVisitor
 
@@ -448,24 +524,18 @@ class markReachableVisitor
     if not v.vreferenced then
       begin
 	let name = v.vname in
-	if v.vglob then
-	  trace (dprintf "marking transitive use: global %s\n" name)
-	else
-	  trace (dprintf "marking transitive use: local %s\n" name);
-
         (* If this is a global, we need to keep everything used in its
-	 * definition and declarations. *)
+	 * definition and declarations; put it on the worklist *)
 	if v.vglob then
 	  begin
-	    trace (dprintf "descending: global %s\n" name);
-	    let descend global =
-	      ignore (visitCilGlobal (self :> cilVisitor) global)
-	    in
-	    let globals = Hashtbl.find_all globalMap name in
-	    List.iter descend globals
+	    trace (fun () -> dprintf "marking transitive use: global %s\n" name);
+	    schedule v
 	  end
 	else
-	  v.vreferenced <- true;
+	  begin
+	    trace (fun () -> dprintf "marking transitive use: local %s\n" name);
+	    v.vreferenced <- true
+	  end
       end;
     SkipChildren
 
@@ -488,7 +558,7 @@ class markReachableVisitor
 	  let old = e.ereferenced in
 	  if not old then
 	    begin
-	      trace (dprintf "marking transitive use: enum %s\n" e.ename);
+	      trace (fun () -> dprintf "marking transitive use: enum %s\n" e.ename);
 	      e.ereferenced <- true;
 	      visitAttrs attrs;
 	      visitAttrs e.eattr
@@ -499,7 +569,7 @@ class markReachableVisitor
 	  let old = c.creferenced in
           if not old then
             begin
-	      trace (dprintf "marking transitive use: compound %s\n" c.cname);
+	      trace (fun () -> dprintf "marking transitive use: compound %s\n" c.cname);
 	      c.creferenced <- true;
 
               (* to recurse, we must ask explicitly *)
@@ -514,7 +584,7 @@ class markReachableVisitor
 	  let old = ti.treferenced in
           if not old then
 	    begin
-	      trace (dprintf "marking transitive use: typedef %s\n" ti.tname);
+	      trace (fun () -> dprintf "marking transitive use: typedef %s\n" ti.tname);
 	      ti.treferenced <- true;
 
 	      (* recurse deeper into the type referred-to by the typedef *)
@@ -536,37 +606,73 @@ end
 
 
 let markReachable file isRoot =
-  (* build a mapping from global names back to their definitions &
-   * declarations *)
+  (* One set-up pass over the globals does three jobs at once: clear the
+   * stale "referenced" bits, build a mapping from global names back to
+   * their definitions & declarations, and collect the roots. The roots
+   * are only traversed after the pass completes, so every mark that
+   * marking sets is guaranteed to come after the corresponding clear *)
   let globalMap = Hashtbl.create 137 in
+  let roots = ref [] in
   let considerGlobal global =
-    match global with
+    clearReferencedBitsOfGlobal global;
+    (match global with
     | GFun ({svar = info; _}, _)
     | GVar (info, _, _)
     | GVarDecl (info, _) ->
 	Hashtbl.add globalMap info.vname global
     | _ ->
-	()
+	());
+    if isRoot global then
+      roots := global :: !roots
+    else
+      trace (fun () -> dprintf "skipping non-root global: %a\n" d_shortglobal global)
   in
   iterGlobals file considerGlobal;
 
   let currentFunc = ref None in
 
-  (* mark everything reachable from the global roots *)
-  let visitor = new markReachableVisitor (globalMap, currentFunc) in
-  let visitIfRoot global =
-    if isRoot global then
-      begin
-	trace (dprintf "traversing root global: %a\n" d_shortglobal global);
-        (match global with
-          GFun(fd, _) -> currentFunc := Some fd
-        | _ -> currentFunc := None);
-	ignore (visitCilGlobal visitor global)
-      end
-    else
-      trace (dprintf "skipping non-root global: %a\n" d_shortglobal global)
+  (* The explicit worklist of global variables whose definitions and
+   * declarations still have to be scanned. The bitset over vids keeps a
+   * variable from entering the worklist twice *)
+  let worklist : varinfo list ref = ref [] in
+  let scheduled = B.make 1024 in
+  let schedule (v: varinfo) : unit =
+    if not (B.testAndSetTo scheduled v.vid true) then
+      worklist := v :: !worklist
+  in
+
+  let visitor = new markReachableVisitor (schedule, currentFunc) in
+  let visitGlobal global =
+    (match global with
+      GFun(fd, _) -> currentFunc := Some fd
+    | _ -> currentFunc := None);
+    ignore (visitCilGlobal visitor global)
+  in
+
+  (* Each global comes off the worklist at most once; this is the only
+   * place where its references are scanned *)
+  let rec drain () =
+    match !worklist with
+      [] -> ()
+    | v :: rest ->
+	worklist := rest;
+	trace (fun () -> dprintf "descending: global %s\n" v.vname);
+	List.iter visitGlobal (Hashtbl.find_all globalMap v.vname);
+	drain ()
+  in
+
+  (* seed the worklist with the global roots; roots that have no varinfo
+   * (e.g. pragma-kept types) are scanned directly *)
+  let visitRoot global =
+    trace (fun () -> dprintf "traversing root global: %a\n" d_shortglobal global);
+    (match global with
+      GFun ({svar = v; _}, _)
+    | GVar (v, _, _)
+    | GVarDecl (v, _) -> schedule v
+    | _ -> visitGlobal global);
+    drain ()
   in
-  iterGlobals file visitIfRoot
+  List.iter visitRoot (List.rev !roots)
 
 
 (**********************************************************************
@@ -755,7 +861,7 @@ let removeUnmarked file =
     | GVar ({vreferenced = false; _}, _, _)
     | GVarDecl ({vreferenced = false; _}, _)
     | GFun ({svar = {vreferenced = false; _}; _}, _) ->
-	trace (dprintf "removing global: %a\n" d_shortglobal global);
+	trace (fun () -> dprintf "removing global: %a\n" d_shortglobal global);
 	false
 
     (* retained functions may wish to discard some unused locals *)
@@ -765,7 +871,7 @@ let removeUnmarked file =
 	    begin
 	      (* along the way, record the interesting locals that were removed *)
 	      let name = local.vname in
-	      trace (dprintf "removing local: %s\n" name);
+	      trace (fun () -> dprintf "removing local: %s\n" name);
 	      if not (Str.string_match uninteresting name 0) then
 		removedLocals := (func.svar.vname ^ "::" ^ name) :: !removedLocals;
 	    end;
@@ -785,10 +891,11 @@ let removeUnmarked file =
 
     (* all other globals are retained *)
     | _ ->
-	trace (dprintf "keeping global: %a\n" d_shortglobal global);
+	trace (fun () -> dprintf "keeping global: %a\n" d_shortglobal global);
 	true
   in
   file.globals <- List.filter filterGlobal file.globals;
+  invalidateGlobalIndex file;
   !removedLocals
 
 
@@ -822,13 +929,27 @@ let removeUnusedTemps ?(isRoot : rootsFilter = isDefaultRoot) file =
 	amputateFunctionBodies keepers.defines file;
 
       (* build up the root set *)
-      let isRoot global =
-	isPragmaRoot keepers global ||
-	isRoot global
+      let isRoot =
+	match !linkerRootsFile with
+	  Some fname ->
+	    (* the externally supplied symbol list replaces the heuristic
+	     * roots: exactly the listed symbols (plus pragma roots) are
+	     * kept, and the bodies of unlisted functions are dropped up
+	     * front so the reachability marking never scans them *)
+	    let roots = readLinkerRoots fname in
+	    H.iter (fun name () -> H.replace roots name ()) keepers.defines;
+	    amputateFunctionBodies roots file;
+	    (fun global ->
+	      isPragmaRoot keepers global ||
+	      isLinkerRoot roots global)
+	| None ->
+	    (fun global ->
+	      isPragmaRoot keepers global ||
+	      isRoot global)
       in
 
-      (* mark everything reachable from the global roots *)
-      clearReferencedBits file;
+      (* mark everything reachable from the global roots; this also
+       * clears the stale "referenced" bits first *)
       markReachable file isRoot;
 
       (* take out the trash *)
@@ -77,6 +77,20 @@ val isCompleteProgramRoot : rootsFilter
 (* process a complete Cil file *)
 val removeUnusedTemps: ?isRoot:rootsFilter -> Cil.file -> unit
 
+(* reduce the bodies of all functions whose names are not in the given
+ * table to mere declarations; the result still compiles to object
+ * code, but contains only the retained bodies *)
+val amputateFunctionBodies: (string, 'a) Hashtbl.t -> Cil.file -> unit
+
 
 val keepUnused: bool ref (* Set this to true to turn off this module *)
 val rmUnusedInlines: bool ref (* Delete unused inline funcs in gcc mode? *)
+
+(* When set, the named file supplies the root set instead of the isRoot
+ * filter: each line's last whitespace-separated word is a symbol name
+ * (plain lists and "nm" output both work), exactly those symbols (plus
+ * pragma-induced roots) are treated as roots, and the bodies of
+ * unlisted functions are dropped before the reachability marking.
+ * Useful in whole-program mode when the linker's view of the needed
+ * symbols is available. *)
+val linkerRootsFile: string option ref
@@ -0,0 +1,484 @@
+(** Static single assignment form for CIL functions. See the interface for
+ * a description of the conversion. *)
+open Cil
+module E = Errormsg
+module IH = Inthash
+module D = Dominators
+
+let debug = false
+
+(** A phi node, conceptually placed at the start of a statement. The
+ * versions of the variable that arrive along the incoming CFG edges are
+ * merged into a fresh version. *)
+type phi = {
+    phiOrig: varinfo;       (** the variable before the conversion *)
+    mutable phiLhs: varinfo; (** the version defined by this phi *)
+    mutable phiArgs: (int * varinfo) list;
+        (** for each predecessor (by statement id), the arriving version *)
+  }
+
+type ssaForm = {
+    ssaFundec: fundec;
+    ssaPhis: phi list IH.t;
+        (** the phis at the start of each statement, by statement id *)
+    ssaOrig: varinfo IH.t;
+        (** maps the id of each fresh version back to the original
+         * variable. The original variables themselves also serve as the
+         * initial version and are not in this table. *)
+    ssaDefStmt: stmt IH.t;
+        (** maps the id of each fresh version to the statement that
+         * defines it (for a phi, the statement carrying the phi) *)
+  }
+
+(* We convert only the scalar locals and formals whose address is not
+ * taken and that do not appear in inline assembly *)
+let isScalarType (t: typ) = isArithmeticType t || isPointerType t
+
+class asmVarCollectorClass (acc: unit IH.t) = object
+  inherit nopCilVisitor
+  method! vinst (i: instr) =
+    (match i with
+      Asm _ ->
+        let vis = object
+          inherit nopCilVisitor
+          method! vvrbl vi = IH.replace acc vi.vid (); DoChildren
+        end in
+        ignore (visitCilInstr vis i)
+    | _ -> ());
+    SkipChildren
+end
+
+(* The variables defined by an instruction, in the sense of SSA: direct
+ * whole-variable writes. Writes through Mem or with an offset do not count
+ * (the candidates are scalars, so those cannot target them anyway). *)
+let instrDefs (i: instr) : varinfo list =
+  match i with
+    Set ((Var vi, NoOffset), _, _) -> [ vi ]
+  | Call (Some (Var vi, NoOffset), _, _, _) -> [ vi ]
+  | _ -> []
+
+let getPhis (phis: phi list IH.t) (s: stmt) : phi list =
+  match IH.tryfind phis s.sid with None -> [] | Some l -> l
+
+(* The worklist of the renaming walk over the dominator tree. We keep it
+ * explicit because the dominator tree of straight-line code is a path and
+ * very large functions would overflow the OCaml stack. *)
+type renameTask =
+    RenameStmt of stmt
+  | PopVersions of varinfo list (* original variables to pop, in order *)
+
+let convertToSsa (f: fundec) : ssaForm =
+  prepareCFG f;
+  computeCFGInfo f false;
+  (* The renaming needs an entry statement without predecessors; give the
+   * function one if a goto targets its first statement *)
+  (match f.sbody.bstmts with
+    s :: _ when s.preds <> [] ->
+      f.sbody.bstmts <- mkEmptyStmt () :: f.sbody.bstmts;
+      computeCFGInfo f false
+  | _ -> ());
+  let idomData, tree = D.computeDomTree ~doCFG:false f in
+
+  (* Select the candidate variables *)
+  let inAsm: unit IH.t = IH.create 8 in
+  ignore (visitCilBlock (new asmVarCollectorClass inAsm) f.sbody);
+  let candidates: unit IH.t = IH.create 64 in
+  List.iter
+    (fun vi ->
+      if not vi.vaddrof && isScalarType vi.vtype
+          && not (IH.mem inAsm vi.vid) then
+        IH.add candidates vi.vid ())
+    (f.sformals @ f.slocals);
+  let isCand (vi: varinfo) = IH.mem candidates vi.vid in
+
+  (* Collect the definition sites of each candidate *)
+  let defSites: stmt list IH.t = IH.create 64 in
+  List.iter
+    (fun s ->
+      match s.skind with
+        Instr il ->
+          List.iter
+            (fun i ->
+              List.iter
+                (fun vi ->
+                  if isCand vi then
+                    let old =
+                      match IH.tryfind defSites vi.vid with
+                        None -> [] | Some l -> l in
+                    match old with
+                      s' :: _ when s' == s -> ()
+                    | _ -> IH.replace defSites vi.vid (s :: old))
+                (instrDefs i))
+            il
+      | _ -> ())
+    f.sallstmts;
+
+  (* Place the phis at the iterated dominance frontier of the def sites *)
+  let df = D.computeDomFrontier idomData tree in
+  let getDF (s: stmt) =
+    match IH.tryfind df s.sid with None -> [] | Some l -> l in
+  let phis: phi list IH.t = IH.create 64 in
+  IH.iter
+    (fun vid sites ->
+      let vi =
+        match sites with
+          s :: _ ->
+            (* Recover the varinfo from any def site *)
+            let rec findIt = function
+                [] -> E.s (E.bug "Ssa: cannot find the variable %d" vid)
+              | i :: rest ->
+                  (match
+                     List.filter (fun v -> v.vid = vid) (instrDefs i)
+                   with
+                     v :: _ -> v
+                   | [] -> findIt rest)
+            in
+            (match s.skind with
+              Instr il -> findIt il
+            | _ -> E.s (E.bug "Ssa: def site of %d is not an Instr" vid))
+        | [] -> E.s (E.bug "Ssa: candidate %d has no def sites" vid)
+      in
+      let placed: unit IH.t = IH.create 8 in
+      let onWorklist: unit IH.t = IH.create 8 in
+      List.iter (fun s -> IH.replace onWorklist s.sid ()) sites;
+      let worklist = ref sites in
+      while !worklist <> [] do
+        match !worklist with
+          [] -> ()
+        | x :: rest ->
+            worklist := rest;
+            List.iter
+              (fun y ->
+                if not (IH.mem placed y.sid) then begin
+                  IH.add placed y.sid ();
+                  let p = { phiOrig = vi; phiLhs = vi; phiArgs = [] } in
+                  IH.replace phis y.sid (p :: getPhis phis y);
+                  if not (IH.mem onWorklist y.sid) then begin
+                    IH.add onWorklist y.sid ();
+                    worklist := y :: !worklist
+                  end
+                end)
+              (getDF x)
+      done)
+    defSites;
+
+  (* Rename the uses and definitions by walking the dominator tree. Each
+   * candidate has a stack of versions; the stack starts with the original
+   * variable, which thus serves as the entry version (the value of a
+   * formal, or an uninitialized local). *)
+  let ssaOrig: varinfo IH.t = IH.create 64 in
+  let ssaDefStmt: stmt IH.t = IH.create 64 in
+  let stacks: varinfo list ref IH.t = IH.create 64 in
+  IH.iter (fun vid _ -> IH.add stacks vid (ref [])) candidates;
+  List.iter
+    (fun vi ->
+      match IH.tryfind stacks vi.vid with
+        Some r -> r := [ vi ]
+      | None -> ())
+    (f.sformals @ f.slocals);
+  let top (vi: varinfo) : varinfo =
+    match IH.tryfind stacks vi.vid with
+      Some { contents = v :: _ } -> v
+    | _ -> E.s (E.bug "Ssa: empty version stack for %s" vi.vname)
+  in
+  let renameUses = object
+    inherit nopCilVisitor
+    method! vvrbl vi =
+      if isCand vi then begin
+        let v = top vi in
+        if v != vi then ChangeTo v else SkipChildren
+      end else
+        SkipChildren
+  end in
+  let fixE (e: exp) : exp = visitCilExpr renameUses e in
+  let fixL (lv: lval) : lval = visitCilLval renameUses lv in
+  let work = ref [] in
+  (match f.sbody.bstmts with
+    [] -> ()
+  | start :: _ -> work := [ RenameStmt start ]);
+  while !work <> [] do
+    match !work with
+      [] -> ()
+    | PopVersions vis :: rest ->
+        work := rest;
+        List.iter
+          (fun vi ->
+            match IH.tryfind stacks vi.vid with
+              Some ({ contents = _ :: tl } as r) -> r := tl
+            | _ -> E.s (E.bug "Ssa: unbalanced version stack for %s"
+                          vi.vname))
+          vis
+    | RenameStmt s :: rest ->
+        work := rest;
+        let pushed = ref [] in
+        let newVersion (vi: varinfo) : varinfo =
+          let v = makeTempVar f ~name:(vi.vname ^ "_") vi.vtype in
+          IH.add ssaOrig v.vid vi;
+          IH.add ssaDefStmt v.vid s;
+          (match IH.tryfind stacks vi.vid with
+            Some r -> r := v :: !r
+          | None -> E.s (E.bug "Ssa: no version stack for %s" vi.vname));
+          pushed := vi :: !pushed;
+          v
+        in
+        (* The phis define new versions before anything else in s *)
+        List.iter (fun p -> p.phiLhs <- newVersion p.phiOrig)
+          (getPhis phis s);
+        (* Rename inside the statement itself; uses before definitions *)
+        s.skind <-
+          (match s.skind with
+            Instr il ->
+              Instr
+                (Util.list_map
+                   (fun i ->
+                     match i with
+                       Set (lv, e, l) ->
+                         let e' = fixE e in
+                         let lv' =
+                           match lv with
+                             (Var vi, NoOffset) when isCand vi ->
+                               (Var (newVersion vi), NoOffset)
+                           | _ -> fixL lv
+                         in
+                         Set (lv', e', l)
+                     | Call (lvo, fn, args, l) ->
+                         let fn' = fixE fn in
+                         let args' = Util.list_map fixE args in
+                         let lvo' =
+                           match lvo with
+                             Some (Var vi, NoOffset) when isCand vi ->
+                               Some (Var (newVersion vi), NoOffset)
+                           | Some lv -> Some (fixL lv)
+                           | None -> None
+                         in
+                         Call (lvo', fn', args', l)
+                     | _ ->
+                         (* Asm does not mention candidates and VarDecl
+                          * keeps the original variable *)
+                         i)
+                   il)
+          | Return (Some e, l) -> Return (Some (fixE e), l)
+          | If (e, b1, b2, l) -> If (fixE e, b1, b2, l)
+          | Switch (e, b, cases, l) -> Switch (fixE e, b, cases, l)
+          | ComputedGoto (e, l) -> ComputedGoto (fixE e, l)
+          | sk -> sk);
+        (* Feed the phis of the successors with the current versions *)
+        List.iter
+          (fun succ ->
+            List.iter
+              (fun p -> p.phiArgs <- (s.sid, top p.phiOrig) :: p.phiArgs)
+              (getPhis phis succ))
+          s.succs;
+        (* Pop our versions after the dominated statements are done *)
+        work := PopVersions !pushed :: !work;
+        List.iter
+          (fun child -> work := RenameStmt child :: !work)
+          (D.children tree s)
+  done;
+
+  if debug then
+    IH.iter
+      (fun sid ps ->
+        List.iter
+          (fun p ->
+            ignore (E.log "Ssa: phi at %d: %s <- %a\n" sid p.phiLhs.vname
+                      (Pretty.docList
+                         (fun (psid, v) ->
+                           Pretty.dprintf "%s from %d" v.vname psid))
+                      p.phiArgs))
+          ps)
+      phis;
+
+  { ssaFundec = f; ssaPhis = phis;
+    ssaOrig = ssaOrig; ssaDefStmt = ssaDefStmt }
+
+
+(* Insert the given copies on the CFG edge from p to s. The insertion
+ * point depends on the kind of p: the copies must execute after the
+ * effects of p but only on the way to s. *)
+let insertOnEdge (p: stmt) (s: stmt) (copies: instr list) : unit =
+  let copyStmt () = mkStmt (Instr copies) in
+  let intoBlockHead (b: block) =
+    b.bstmts <- copyStmt () :: b.bstmts in
+  match p.skind with
+    Instr il ->
+      (* A single fall-through successor *)
+      p.skind <- Instr (il @ copies)
+  | Goto _ ->
+      (* The copies must run before the jump *)
+      p.skind <- Block (mkBlock [ copyStmt (); mkStmt p.skind ])
+  | Block b | Loop (b, _, _, _) ->
+      (* A single successor: the head of the body, or the fall-through
+       * continuation when the body is empty. Gotos into the body still
+       * target s directly and thus skip the copies. *)
+      if b.bstmts <> [] && List.hd b.bstmts == s then
+        intoBlockHead b
+      else
+        b.bstmts <- b.bstmts @ [ copyStmt () ]
+  | If (_, b1, b2, _) ->
+      (* Find the branch whose edge leads to s. A branch block is entered
+       * only from this If, so inserting at its head affects just this
+       * edge; an empty branch falls through to s after the copies. *)
+      if b1.bstmts <> [] && List.hd b1.bstmts == s then
+        intoBlockHead b1
+      else if b2.bstmts <> [] && List.hd b2.bstmts == s then
+        intoBlockHead b2
+      else begin
+        let found = ref false in
+        if b1.bstmts = [] then begin intoBlockHead b1; found := true end;
+        if b2.bstmts = [] then begin intoBlockHead b2; found := true end;
+        if not !found then
+          E.s (E.bug "Ssa: cannot find the edge %d -> %d" p.sid s.sid)
+      end
+  | Switch (e, b, cases, l) ->
+      (* Retarget the case labels of s to a fresh statement that runs the
+       * copies and jumps to s. The case labels of s all belong to this
+       * switch, since cases bind to the innermost enclosing switch. *)
+      let isCase = function
+          Case _ | CaseRange _ | Default _ -> true
+        | Label _ -> false
+      in
+      let t = mkStmt (Block (mkBlock [ copyStmt ();
+                                       mkStmt (Goto (ref s, l)) ])) in
+      t.labels <- List.filter isCase s.labels;
+      s.labels <- List.filter (fun lb -> not (isCase lb)) s.labels;
+      (* The new statement is only reachable through its labels *)
+      b.bstmts <- t :: b.bstmts;
+      p.skind <-
+        Switch (e, b, Util.list_map (fun c -> if c == s then t else c) cases,
+                l)
+  | ComputedGoto _ ->
+      E.s (E.unimp "Ssa: phi at the target of a computed goto")
+  | _ ->
+      E.s (E.bug "Ssa: statement %d has no successors but precedes %d"
+             p.sid s.sid)
+
+let convertFromSsa (ssa: ssaForm) : unit =
+  let f = ssa.ssaFundec in
+  let stmtOfSid: stmt IH.t = IH.create 64 in
+  List.iter (fun s -> IH.replace stmtOfSid s.sid s) f.sallstmts;
+  IH.iter
+    (fun sid ps ->
+      let s =
+        try IH.find stmtOfSid sid
+        with Not_found -> E.s (E.bug "Ssa: unknown statement %d" sid) in
+      let loc = get_stmtLoc s.skind in
+      List.iter
+        (fun p ->
+          (* The copies realizing the phis of s, for the edge from p *)
+          let copies =
+            List.fold_left
+              (fun acc ph ->
+                match
+                  (try Some (List.assoc p.sid ph.phiArgs)
+                   with Not_found -> None)
+                with
+                  Some src when src.vid <> ph.phiLhs.vid ->
+                    (ph.phiLhs, src) :: acc
+                | Some _ -> acc
+                | None ->
+                    E.s (E.bug
+                           "Ssa: no argument for predecessor %d of phi at %d"
+                           p.sid sid))
+              [] ps
+          in
+          if copies <> [] then begin
+            (* The phis of a statement are simultaneous. If a copy reads a
+             * variable that another copy writes, we go through fresh
+             * temporaries: all the reads first, then all the writes. *)
+            let dests: unit IH.t = IH.create 8 in
+            List.iter (fun (d, _) -> IH.add dests d.vid ()) copies;
+            let overlapping =
+              List.exists (fun (_, src) -> IH.mem dests src.vid) copies in
+            let instrs =
+              if not overlapping then
+                Util.list_map
+                  (fun (d, src) ->
+                    Set ((Var d, NoOffset), Lval (Var src, NoOffset), loc))
+                  copies
+              else begin
+                let withTemps =
+                  Util.list_map
+                    (fun (d, src) ->
+                      (d, src, makeTempVar f src.vtype))
+                    copies
+                in
+                Util.list_map
+                  (fun (_, src, t) ->
+                    Set ((Var t, NoOffset), Lval (Var src, NoOffset), loc))
+                  withTemps
+                @ Util.list_map
+                    (fun (d, _, t) ->
+                      Set ((Var d, NoOffset), Lval (Var t, NoOffset), loc))
+                    withTemps
+              end
+            in
+            insertOnEdge p s instrs
+          end)
+        s.preds)
+    ssa.ssaPhis;
+  IH.clear ssa.ssaPhis
+
+(* Collect the statements that use each version. Definitions do not count
+ * as uses; the use of a phi argument is attributed to the corresponding
+ * predecessor statement. *)
+let computeUseChains (ssa: ssaForm) : stmt list IH.t =
+  let f = ssa.ssaFundec in
+  let chains: stmt list IH.t = IH.create 64 in
+  let stmtOfSid: stmt IH.t = IH.create 64 in
+  List.iter (fun s -> IH.replace stmtOfSid s.sid s) f.sallstmts;
+  let addUse (vi: varinfo) (s: stmt) =
+    let old = match IH.tryfind chains vi.vid with
+        None -> [] | Some l -> l in
+    match old with
+      s' :: _ when s' == s -> ()
+    | _ -> IH.replace chains vi.vid (s :: old)
+  in
+  let isVersion (vi: varinfo) =
+    IH.mem ssa.ssaOrig vi.vid || (not vi.vglob && not vi.vaddrof) in
+  let usesIn (s: stmt) = object
+    inherit nopCilVisitor
+    method! vvrbl vi =
+      if isVersion vi then addUse vi s;
+      SkipChildren
+  end in
+  let scanE (s: stmt) (e: exp) = ignore (visitCilExpr (usesIn s) e) in
+  let scanL (s: stmt) (lv: lval) = ignore (visitCilLval (usesIn s) lv) in
+  List.iter
+    (fun s ->
+      match s.skind with
+        Instr il ->
+          List.iter
+            (fun i ->
+              match i with
+                Set (lv, e, _) ->
+                  scanE s e;
+                  (match lv with
+                    (Var _, NoOffset) -> () (* a definition, not a use *)
+                  | _ -> scanL s lv)
+              | Call (lvo, fn, args, _) ->
+                  scanE s fn;
+                  List.iter (scanE s) args;
+                  (match lvo with
+                    Some (Var _, NoOffset) | None -> ()
+                  | Some lv -> scanL s lv)
+              | Asm _ | VarDecl _ -> ())
+            il
+      | Return (Some e, _) | If (e, _, _, _)
+      | Switch (e, _, _, _) | ComputedGoto (e, _) -> scanE s e
+      | _ -> ())
+    f.sallstmts;
+  (* The phi arguments are uses at the predecessor *)
+  IH.iter
+    (fun _ ps ->
+      List.iter
+        (fun p ->
+          List.iter
+            (fun (psid, v) ->
+              match IH.tryfind stmtOfSid psid with
+                Some ps' -> addUse v ps'
+              | None -> ())
+            p.phiArgs)
+        ps)
+    ssa.ssaPhis;
+  chains
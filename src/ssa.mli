@@ -0,0 +1,59 @@
+(** Static single assignment form for CIL functions.
+
+    {!Ssa.convertToSsa} renames the scalar locals and formals of a function
+    so that every variable has a single definition point: each definition
+    introduces a fresh version of the variable (a new local), and phi nodes
+    merge the versions that arrive at control-flow joins. The phis are
+    placed with the iterated dominance frontier of the definition sites
+    (see {!Dominators.computeDomFrontier}) and the renaming walks the
+    dominator tree over the CFG. Because CIL statements cannot carry phi
+    nodes, the phis live in a side table indexed by statement id.
+
+    Only the locals and formals with scalar (arithmetic or pointer) type
+    are converted, and only if their address is not taken and they do not
+    appear in inline assembly. The original variable serves as the initial
+    version, so the value of a formal, or of a local before its first
+    assignment, keeps its original name.
+
+    {!Ssa.convertFromSsa} leaves SSA form by materializing the phis as
+    copies on the incoming CFG edges (splitting the edge where necessary,
+    e.g. for switch cases). The versions remain distinct locals, so the
+    result is correct regardless of the transformations performed while in
+    SSA form. Both conversions leave the CFG information stale; run
+    {!Cil.computeCFGInfo} again before relying on it. *)
+
+(** A phi node, conceptually placed at the start of a statement *)
+type phi = {
+    phiOrig: Cil.varinfo;       (** the variable before the conversion *)
+    mutable phiLhs: Cil.varinfo; (** the version defined by this phi *)
+    mutable phiArgs: (int * Cil.varinfo) list;
+        (** for each predecessor (by statement id), the arriving version *)
+  }
+
+type ssaForm = {
+    ssaFundec: Cil.fundec;
+    ssaPhis: phi list Inthash.t;
+        (** the phis at the start of each statement, by statement id *)
+    ssaOrig: Cil.varinfo Inthash.t;
+        (** maps the id of each fresh version back to the original
+         * variable. The originals themselves serve as the initial version
+         * and are not in this table. *)
+    ssaDefStmt: Cil.stmt Inthash.t;
+        (** maps the id of each fresh version to the statement defining it
+         * (for a phi, the statement carrying the phi) *)
+  }
+
+(** Convert a function to SSA form. Computes the CFG of the function
+ * (with {!Cil.prepareCFG} and {!Cil.computeCFGInfo}) as a side effect. *)
+val convertToSsa: Cil.fundec -> ssaForm
+
+(** Leave SSA form by turning the phis into copies on the incoming CFG
+ * edges. The phi table of the argument is cleared. *)
+val convertFromSsa: ssaForm -> unit
+
+(** Compute, for each variable version, the statements that use it: the
+ * sparse def-use information that makes optimizations on SSA form cheap.
+ * A use through a phi is attributed to the corresponding predecessor
+ * statement; definitions are not uses (the single definition point is in
+ * [ssaDefStmt]). Unconverted scalar locals are included as well. *)
+val computeUseChains: ssaForm -> Cil.stmt list Inthash.t
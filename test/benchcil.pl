@@ -0,0 +1,146 @@
+#!/usr/bin/perl
+# benchcil.pl - benchmark CIL's phases over the test corpora
+#
+# Preprocesses each C file, runs the CIL binary on the result with
+# --statsJson, and aggregates the per-phase times and allocation
+# (collected by Stats.time) into one JSON report that can be compared
+# across CIL versions. With --baseline the report is compared against a
+# previous run and the script exits nonzero if any phase regressed by
+# more than the tolerance, so phase-level regressions show up in CI
+# instead of only in hand-run `time` totals.
+#
+# Usage: ./benchcil.pl [options] [dirs-or-files...]
+#   --cil <path>        the CIL binary (default: ../_build/default/src/main.exe)
+#   --cc <path>         the preprocessor to use (default: $CC or gcc)
+#   --out <file>        where to write the report (default: bench-results.json)
+#   --baseline <file>   a previous report to compare against
+#   --tolerance <pct>   allowed slowdown per phase with --baseline (default 10)
+#
+# Directories are scanned for *.c files; the default corpora are
+# small1, small2, llvm and llvm/cfrac.d. Files that do not preprocess
+# or that CIL rejects are skipped and counted.
+
+use strict;
+use warnings;
+use File::Basename;
+use File::Temp qw(tempdir);
+use Getopt::Long;
+use JSON::PP;
+
+my $scriptdir = dirname($0);
+my $cil = "$scriptdir/../_build/default/src/main.exe";
+my $cc = $ENV{'CC'} || "gcc";
+my $out = "bench-results.json";
+my $baseline;
+my $tolerance = 10;
+
+GetOptions("cil=s" => \$cil,
+           "cc=s" => \$cc,
+           "out=s" => \$out,
+           "baseline=s" => \$baseline,
+           "tolerance=f" => \$tolerance)
+    or die "benchcil.pl: bad arguments\n";
+
+die "benchcil.pl: cannot run CIL binary $cil\n" unless -x $cil;
+
+my @corpora = @ARGV;
+@corpora = map { "$scriptdir/$_" } ("small1", "small2", "llvm", "llvm/cfrac.d")
+    unless @corpora;
+
+my @files;
+foreach my $c (@corpora) {
+    if (-d $c) {
+        push @files, sort glob("$c/*.c");
+    } elsif (-f $c) {
+        push @files, $c;
+    } else {
+        warn "benchcil.pl: no such file or directory: $c\n";
+    }
+}
+die "benchcil.pl: nothing to benchmark\n" unless @files;
+
+my $tmpdir = tempdir(CLEANUP => 1);
+my %phases;        # slash-joined phase path -> accumulated counters
+my $totaltime = 0;
+my ($nfiles, $nskipped) = (0, 0);
+
+# accumulate one run's stats tree into %phases
+sub addnode {
+    my ($node, $path) = @_;
+    my $name = $path eq "" ? "" : ($path eq "/" ? $node->{'name'}
+                                   : "$path/$node->{'name'}");
+    if ($name ne "") {
+        my $p = ($phases{$name} ||= { 'time' => 0, 'ncalls' => 0,
+                                      'minor_words' => 0,
+                                      'major_words' => 0 });
+        $p->{'time'} += $node->{'time'};
+        $p->{'ncalls'} += $node->{'ncalls'};
+        $p->{'minor_words'} += $node->{'minor_words'};
+        $p->{'major_words'} += $node->{'major_words'};
+    }
+    foreach my $s (@{$node->{'sub'}}) {
+        addnode($s, $name eq "" ? "/" : $name);
+    }
+}
+
+foreach my $file (@files) {
+    my $ifile = "$tmpdir/bench.i";
+    my $jfile = "$tmpdir/bench.json";
+    my $dir = dirname($file);
+    if (system("$cc -E -I$dir -o $ifile $file 2>/dev/null") != 0) {
+        $nskipped++;
+        next;
+    }
+    if (system("$cil $ifile --out /dev/null --statsJson $jfile " .
+               ">/dev/null 2>&1") != 0 || ! -s $jfile) {
+        $nskipped++;
+        next;
+    }
+    open(my $jh, '<', $jfile) or do { $nskipped++; next; };
+    local $/;
+    my $run = eval { decode_json(<$jh>) };
+    close($jh);
+    if (!defined $run) { $nskipped++; next; }
+    $totaltime += $run->{'time'};
+    addnode($run, "");
+    $nfiles++;
+}
+
+my $report = { 'cil' => $cil,
+               'files' => $nfiles,
+               'skipped' => $nskipped,
+               'total_time' => $totaltime,
+               'phases' => \%phases };
+
+open(my $oh, '>', $out) or die "benchcil.pl: cannot write $out\n";
+print $oh JSON::PP->new->canonical->pretty->encode($report);
+close($oh);
+
+printf "benchmarked %d files (%d skipped), total %.3fs, report in %s\n",
+    $nfiles, $nskipped, $totaltime, $out;
+foreach my $name (sort { $phases{$b}->{'time'} <=> $phases{$a}->{'time'} }
+                  keys %phases) {
+    printf "  %-32s %8.3fs  %12.0f minor words\n",
+        $name, $phases{$name}->{'time'}, $phases{$name}->{'minor_words'};
+}
+
+exit 0 unless defined $baseline;
+
+# compare phase times against the baseline report
+open(my $bh, '<', $baseline) or die "benchcil.pl: cannot read $baseline\n";
+my $base = do { local $/; decode_json(<$bh>) };
+close($bh);
+
+my $failed = 0;
+print "comparison against $baseline (tolerance $tolerance%):\n";
+foreach my $name (sort keys %phases) {
+    my $old = $base->{'phases'}->{$name};
+    next unless defined $old && $old->{'time'} >= 0.05;
+    my $pct = 100 * ($phases{$name}->{'time'} - $old->{'time'})
+        / $old->{'time'};
+    printf "  %-32s %8.3fs -> %8.3fs  %+6.1f%%%s\n",
+        $name, $old->{'time'}, $phases{$name}->{'time'}, $pct,
+        $pct > $tolerance ? "  REGRESSION" : "";
+    $failed = 1 if $pct > $tolerance;
+}
+exit($failed);
@@ -0,0 +1,217 @@
+#!/usr/bin/perl
+# benchfeature.pl - measure what a transforming feature costs at runtime
+#
+# Builds each benchmark program twice -- once straight through CIL and
+# once with a transforming feature enabled (--do<feature>) -- compiles
+# both outputs with the same compiler and flags, runs both, and reports
+# the runtime and code-size deltas per feature in one JSON report.
+# Useful for putting numbers on instrumentation passes such as sfi,
+# logcalls and logwrites, and for catching overhead regressions in
+# transformation passes when compared across CIL versions.
+#
+# Usage: ./benchfeature.pl --feature <name> [--feature <name>]...
+#                          [options] [programs...]
+#   --cil <path>      the CIL binary (default: ../_build/default/src/main.exe)
+#   --cc <path>       compiler for the CIL output (default: $CC or gcc)
+#   --cflags <flags>  flags for the final compile (default: -O2)
+#   --extra <flags>   extra link flags for the instrumented variants,
+#                     e.g. the feature's runtime library
+#   --out <file>      where to write the report (default: feature-bench.json)
+#   --runs <n>        timed runs per binary; the best is kept (default 3)
+#   --args <p=a>      command line arguments for program p
+#
+# A program is either a single .c file or a directory whose *.c files
+# are linked into one binary (like llvm/cfrac.d). The defaults are the
+# llvm test programs and cfrac. Programs that fail to build or to run
+# in the plain variant are skipped and counted; a feature variant that
+# fails is reported as failed for that program.
+
+use strict;
+use warnings;
+use File::Basename;
+use File::Temp qw(tempdir);
+use Getopt::Long;
+use JSON::PP;
+use Time::HiRes qw(gettimeofday tv_interval);
+
+my $scriptdir = dirname($0);
+my $cil = "$scriptdir/../_build/default/src/main.exe";
+my $cc = $ENV{'CC'} || "gcc";
+my $cflags = "-O2";
+my $extra = "";
+my $out = "feature-bench.json";
+my $runs = 3;
+my @features;
+# the same input that cfrac.d's Makefile uses
+my %progargs = ('cfrac' => '23551');
+
+GetOptions("cil=s" => \$cil,
+           "cc=s" => \$cc,
+           "cflags=s" => \$cflags,
+           "extra=s" => \$extra,
+           "out=s" => \$out,
+           "runs=i" => \$runs,
+           "feature=s" => \@features,
+           "args=s" => sub { my (undef, $v) = @_;
+                             my ($p, $a) = split(/=/, $v, 2);
+                             $progargs{$p} = $a; })
+    or die "benchfeature.pl: bad arguments\n";
+
+die "benchfeature.pl: at least one --feature is required\n" unless @features;
+die "benchfeature.pl: cannot run CIL binary $cil\n" unless -x $cil;
+
+my @progs = @ARGV;
+@progs = (sort(glob("$scriptdir/llvm/test*.c")), "$scriptdir/llvm/cfrac.d")
+    unless @progs;
+
+my $tmpdir = tempdir(CLEANUP => 1);
+
+# the text segment size, if the size(1) tool is around
+sub textsize {
+    my ($bin) = @_;
+    my $szout = `size $bin 2>/dev/null`;
+    return $1 + 0 if defined $szout && $szout =~ /\n\s*(\d+)\s+\d+\s+\d+/;
+    return undef;
+}
+
+# preprocess, push through CIL (with the feature when given), compile
+# and link one variant; returns { bin, size, text } or undef
+sub buildvariant {
+    my ($name, $sources, $incdir, $feature) = @_;
+    my $dir = "$tmpdir/$name-" . (defined $feature ? $feature : "base");
+    mkdir $dir;
+    my $flag = defined $feature ? "--do$feature" : "";
+    my @cilout;
+    foreach my $src (@$sources) {
+        my $b = basename($src, ".c");
+        my $ifile = "$dir/$b.i";
+        my $cfile = "$dir/$b.cil.c";
+        # -DNOMEMOPT is what cfrac.d builds with; harmless elsewhere
+        return undef
+            if system("$cc -E -DNOMEMOPT -I$incdir -o $ifile $src " .
+                      "2>/dev/null") != 0;
+        return undef
+            if system("$cil $flag --out $cfile $ifile >/dev/null 2>&1") != 0
+               || ! -s $cfile;
+        push @cilout, $cfile;
+    }
+    my $bin = "$dir/a.out";
+    my $link = defined $feature ? $extra : "";
+    return undef
+        if system("$cc $cflags -o $bin @cilout -lm $link 2>/dev/null") != 0;
+    return { 'bin' => $bin,
+             'size' => -s $bin,
+             'text' => textsize($bin) };
+}
+
+# run the binary $runs times; the best wall time, or undef on failure
+sub timerun {
+    my ($bin, $args) = @_;
+    my $best;
+    for (1 .. $runs) {
+        my $t0 = [gettimeofday];
+        return undef if system("$bin $args >/dev/null 2>&1") != 0;
+        my $dt = tv_interval($t0);
+        $best = $dt if !defined $best || $dt < $best;
+    }
+    return $best;
+}
+
+my %programs;
+my ($nprogs, $nskipped) = (0, 0);
+
+foreach my $p (@progs) {
+    my ($name, @sources, $incdir);
+    if (-d $p) {
+        $name = basename($p);
+        $name =~ s/\.d$//;
+        @sources = sort glob("$p/*.c");
+        $incdir = $p;
+    } elsif (-f $p) {
+        $name = basename($p, ".c");
+        @sources = ($p);
+        $incdir = dirname($p);
+    } else {
+        warn "benchfeature.pl: no such file or directory: $p\n";
+        next;
+    }
+    my $args = defined $progargs{$name} ? $progargs{$name} : "";
+
+    my $base = buildvariant($name, \@sources, $incdir, undef);
+    my $basetime = defined $base ? timerun($base->{'bin'}, $args) : undef;
+    if (!defined $basetime) {
+        $nskipped++;
+        next;
+    }
+    my $entry = { 'base' => { 'time' => $basetime,
+                              'size' => $base->{'size'},
+                              'text' => $base->{'text'} },
+                  'features' => {} };
+    foreach my $f (@features) {
+        my $inst = buildvariant($name, \@sources, $incdir, $f);
+        my $insttime = defined $inst ? timerun($inst->{'bin'}, $args) : undef;
+        if (!defined $insttime) {
+            $entry->{'features'}->{$f} = { 'failed' => JSON::PP::true };
+            next;
+        }
+        my $r = { 'time' => $insttime,
+                  'size' => $inst->{'size'},
+                  'text' => $inst->{'text'},
+                  'time_delta_pct' =>
+                      $basetime > 0
+                          ? 100 * ($insttime - $basetime) / $basetime : 0,
+                  'size_delta_pct' =>
+                      100 * ($inst->{'size'} - $base->{'size'})
+                          / $base->{'size'} };
+        $r->{'text_delta_pct'} =
+            100 * ($inst->{'text'} - $base->{'text'}) / $base->{'text'}
+            if defined $inst->{'text'} && defined $base->{'text'}
+               && $base->{'text'} > 0;
+        $entry->{'features'}->{$f} = $r;
+    }
+    $programs{$name} = $entry;
+    $nprogs++;
+}
+
+die "benchfeature.pl: no program could be benchmarked\n" unless $nprogs;
+
+my $report = { 'cil' => $cil,
+               'cc' => $cc,
+               'cflags' => $cflags,
+               'runs' => $runs,
+               'features' => \@features,
+               'programs' => \%programs,
+               'skipped' => $nskipped };
+
+open(my $oh, '>', $out) or die "benchfeature.pl: cannot write $out\n";
+print $oh JSON::PP->new->canonical->pretty->encode($report);
+close($oh);
+
+printf "benchmarked %d programs (%d skipped), report in %s\n",
+    $nprogs, $nskipped, $out;
+foreach my $f (@features) {
+    # the geometric mean of the runtime ratios, over the programs where
+    # the instrumented build worked
+    my ($logsum, $n, $nfailed) = (0, 0, 0);
+    printf "feature %s:\n", $f;
+    foreach my $name (sort keys %programs) {
+        my $r = $programs{$name}->{'features'}->{$f};
+        if (exists $r->{'failed'}) {
+            printf "  %-20s FAILED\n", $name;
+            $nfailed++;
+            next;
+        }
+        printf "  %-20s time %+6.1f%%  size %+6.1f%%\n",
+            $name, $r->{'time_delta_pct'}, $r->{'size_delta_pct'};
+        my $base = $programs{$name}->{'base'}->{'time'};
+        if ($base > 0 && $r->{'time'} > 0) {
+            $logsum += log($r->{'time'} / $base);
+            $n++;
+        }
+    }
+    printf "  %-20s time %+6.1f%%  (%d programs, %d failed)\n",
+        "geometric mean", 100 * (exp($logsum / $n) - 1), $n, $nfailed
+        if $n > 0;
+}
+
+exit 0;